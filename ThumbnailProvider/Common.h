@@ -11,6 +11,13 @@
 STDAPI_(ULONG) DllAddRef();
 STDAPI_(ULONG) DllRelease();
 
+// Per user settings, DWORD values under HKEY_CURRENT_USER.
+#define szSettingsKey L"Software\\VTF Shell Extensions"
+#define szSettingLowResThumbnails L"LowResThumbnails"	// 0 disables the embedded low-res image for small thumbnails.
+#define szSettingShadeNormalMaps L"ShadeNormalMaps"	// 0 shows normal maps as their colors instead of lit.
+#define szSettingThumbnailCache L"ThumbnailCache"			// 1 keeps generated thumbnails in %LOCALAPPDATA%\VTF Shell Extensions\thumbcache.bin.
+#define szSettingThumbnailCacheSize L"ThumbnailCacheSizeMB"	// Size of that file, 64 MB by default.
+
 // {202C4699-A5D9-40EF-ACEC-F1A7455F935C}
 #define szCLSID_VTFThumbnailProvider L"{202C4699-A5D9-40EF-ACEC-F1A7455F935C}"
 static inline constexpr const GUID CLSID_VTFThumbnailProvider = { 0x202c4699, 0xa5d9, 0x40ef, { 0xac, 0xec, 0xf1, 0xa7, 0x45, 0x5f, 0x93, 0x5c } };
\ No newline at end of file
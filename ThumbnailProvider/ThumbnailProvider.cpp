@@ -1,13 +1,166 @@
 #include "Common.h"
 #include "ThumbnailProvider.h"
+#include "readers.h"
+#include "texturecache.h"
+#include "thumbnail.h"
+#include "thumbnailcache.h"
+#include "threadpool.h"
 #include "gdiplus.h"
+#include <mutex>
+#include <string>
 
 using namespace Gdiplus;
+
+namespace IO
+{
+	namespace Readers
+	{
+		// Reads straight from the shell supplied stream so only the needed byte ranges are fetched.
+		class CStreamReader : public IReader
+		{
+		private:
+			IStream* pStream;
+			vlBool bOpened;
+
+		public:
+			CStreamReader( IStream* pStream )
+			{
+				this->pStream = pStream;
+				this->bOpened = vlFalse;
+			}
+
+		public:
+			virtual vlBool Opened() const
+			{
+				return this->bOpened;
+			}
+
+			virtual vlBool Open()
+			{
+				if ( this->pStream == nullptr )
+					return vlFalse;
+
+				LARGE_INTEGER zero = {};
+				this->bOpened = SUCCEEDED( this->pStream->Seek( zero, STREAM_SEEK_SET, nullptr ) );
+				return this->bOpened;
+			}
+			virtual vlVoid Close()
+			{
+				this->bOpened = vlFalse;
+			}
+
+			virtual vlUInt64 GetStreamSize() const
+			{
+				STATSTG stat;
+				if ( !this->bOpened || this->pStream->Stat( &stat, STATFLAG_NONAME ) != S_OK )
+					return 0;
+
+				return stat.cbSize.QuadPart;
+			}
+			virtual vlUInt64 GetStreamPointer() const
+			{
+				LARGE_INTEGER zero = {};
+				ULARGE_INTEGER pos;
+				if ( !this->bOpened || FAILED( this->pStream->Seek( zero, STREAM_SEEK_CUR, &pos ) ) )
+					return 0;
+
+				return pos.QuadPart;
+			}
+
+			virtual vlUInt64 Seek( vlInt64 lOffset, vlUInt uiMode )
+			{
+				if ( !this->bOpened )
+					return 0;
+
+				LARGE_INTEGER offset;
+				offset.QuadPart = lOffset;
+				ULARGE_INTEGER pos;
+				const DWORD origin = uiMode == 0 ? STREAM_SEEK_SET : uiMode == 1 ? STREAM_SEEK_CUR : STREAM_SEEK_END;
+				if ( FAILED( this->pStream->Seek( offset, origin, &pos ) ) )
+					return 0;
+
+				return pos.QuadPart;
+			}
+
+			virtual vlBool Read( vlChar& cChar )
+			{
+				return this->Read( &cChar, 1 ) == 1;
+			}
+			virtual vlUInt Read( vlVoid* vData, vlUInt uiBytes )
+			{
+				ULONG len = 0;
+				if ( !this->bOpened || FAILED( this->pStream->Read( vData, uiBytes, &len ) ) )
+					return 0;
+
+				return len;
+			}
+
+			virtual const vlVoid* Map( vlUInt64 uiOffset, vlUInt64 uiBytes )
+			{
+				return nullptr;
+			}
+		};
+	}
+}
+
+static DWORD GetSettingValue( LPCWSTR lpszValue, DWORD dwDefault )
+{
+	DWORD dwValue = 0;
+	DWORD cbData = sizeof( dwValue );
+	DWORD dwType = 0;
+	if ( SHGetValue( HKEY_CURRENT_USER, szSettingsKey, lpszValue, &dwType, &dwValue, &cbData ) != ERROR_SUCCESS || dwType != REG_DWORD )
+		return dwDefault;
+
+	return dwValue;
+}
+
+static bool GetSettingEnabled( LPCWSTR lpszValue, bool bDefault )
+{
+	return GetSettingValue( lpszValue, bDefault ? 1 : 0 ) != 0;
+}
+
+// One pack file shared by every provider in the process, opened on first use when the setting is on.
+static CThumbnailCache* GetThumbnailCache()
+{
+	static CThumbnailCache cache;
+	static std::once_flag once;
+	std::call_once( once, []
+	{
+		if ( !GetSettingEnabled( szSettingThumbnailCache, false ) )
+			return;
+
+		PWSTR pszLocalAppData = nullptr;
+		if ( FAILED( SHGetKnownFolderPath( FOLDERID_LocalAppData, 0, nullptr, &pszLocalAppData ) ) )
+			return;
+
+		std::wstring path = pszLocalAppData;
+		CoTaskMemFree( pszLocalAppData );
+
+		path += L"\\VTF Shell Extensions";
+		CreateDirectoryW( path.c_str(), nullptr );
+		path += L"\\thumbcache.bin";
+
+		const DWORD dwSizeMB = GetSettingValue( szSettingThumbnailCacheSize, THUMBNAIL_CACHE_DEFAULT_SIZE >> 20 );
+		cache.Open( path.c_str(), static_cast<std::uint64_t>( dwSizeMB ) << 20 );
+	} );
+
+	return cache.IsOpen() ? &cache : nullptr;
+}
+
+// Explorer asks for the same file at several sizes with a new provider each time, this outlives them.
+static CTextureCache& GetTextureCache()
+{
+	static CTextureCache cache;
+	return cache;
+}
+
 CThumbnailProvider::CThumbnailProvider()
 {
 	DllAddRef();
 	m_cRef = 1;
 	m_pSite = nullptr;
+	m_pStream = nullptr;
+	m_bHasIdentity = false;
 }
 
 CThumbnailProvider::~CThumbnailProvider()
@@ -17,6 +170,11 @@ CThumbnailProvider::~CThumbnailProvider()
 		m_pSite->Release();
 		m_pSite = nullptr;
 	}
+	if ( m_pStream )
+	{
+		m_pStream->Release();
+		m_pStream = nullptr;
+	}
 	DllRelease();
 }
 
@@ -54,22 +212,21 @@ STDMETHODIMP CThumbnailProvider::Initialize( IStream* pstm, DWORD grfMode )
 	if ( grfMode & STGM_READWRITE )
 		return STG_E_ACCESSDENIED;
 
-	STATSTG stat;
-	if ( pstm->Stat( &stat, STATFLAG_NONAME ) != S_OK )
-		return S_FALSE;
-
-	ULONG len;
-	const vlUInt size = static_cast<vlUInt>( stat.cbSize.QuadPart );
-	byte* data = new byte[size];
-	if ( pstm->Read( data, size, &len ) != S_OK )
+	// Only the header and resources are read here, GetThumbnail fetches the one mip it needs.
+	m_bHasIdentity = CTextureCache::GetStreamIdentity( pstm, m_identity );
+	if ( !m_bHasIdentity || !GetTextureCache().FindHeader( m_identity, m_texture ) )
 	{
-		delete[] data;
-		return S_FALSE;
+		IO::Readers::CStreamReader reader( pstm );
+		if ( !m_texture.Load( &reader, VTF_LOAD_NO_IMAGE_DATA ) )
+			return S_FALSE;
+
+		if ( m_bHasIdentity )
+			GetTextureCache().InsertHeader( m_identity, m_texture );
 	}
 
-	const bool succsess = m_texture.Load( data, size );
-	delete[] data;
-	return succsess ? S_OK : S_FALSE;
+	m_pStream = pstm;
+	m_pStream->AddRef();
+	return S_OK;
 }
 
 STDMETHODIMP CThumbnailProvider::GetThumbnail( UINT cx, HBITMAP* phbmp, WTS_ALPHATYPE* pdwAlpha )
@@ -80,15 +237,26 @@ STDMETHODIMP CThumbnailProvider::GetThumbnail( UINT cx, HBITMAP* phbmp, WTS_ALPH
 	GdiplusStartupInput input;
 	if ( GdiplusStartup( &token, &input, nullptr ) == Ok )
 	{
-		vlUInt32 compressedSize = 0;
-		if ( vlUInt size; auto res = static_cast<byte*>( m_texture.GetResourceData( VTF_RSRC_AUX_COMPRESSION_INFO, size ) ) )
+		SThumbnailOptions options;
+		options.bLowRes = GetSettingEnabled( szSettingLowResThumbnails, true );
+		options.bShadeNormalMaps = GetSettingEnabled( szSettingShadeNormalMaps, true );
+		options.pCache = GetThumbnailCache();
+		options.pTextureCache = &GetTextureCache();
+		options.pIdentity = m_bHasIdentity ? &m_identity : nullptr;
+
+		// Workers only start if the mip is large enough for Convert to split it.
+		CThreadPool threadPool;
+		IO::Readers::CStreamReader reader( m_pStream );
+		CThumbnail thumbnail;
+		if ( !thumbnail.Create( m_texture, &reader, cx, options, &threadPool ) )
 		{
-			compressedSize = size > sizeof( AuxCompressionInfoHeader_t ) && reinterpret_cast<AuxCompressionInfoHeader_t*>( res )->m_CompressionLevel != 0 ? reinterpret_cast<AuxCompressionInfoEntry_t*>( res + m_texture.GetAuxInfoOffset( 0, 0, 0 ) )->m_CompressedSize : 0;
+			GdiplusShutdown( token );
+			return E_FAIL;
 		}
-		const vlUInt w = m_texture.GetWidth(), h = m_texture.GetHeight();
-		byte* pConverted = new byte[CVTFFile::ComputeImageSize( w, h, 1, IMAGE_FORMAT_BGRA8888 )];
-		CVTFFile::Convert( m_texture.GetData(), pConverted, w, h, m_texture.GetFormat(), IMAGE_FORMAT_BGRA8888, compressedSize );
-		Bitmap* pBitmap = new Bitmap( w, h, w * 4, PixelFormat32bppARGB, pConverted ); // delete?
+
+		const vlUInt w = thumbnail.GetWidth();
+		const vlUInt h = thumbnail.GetHeight();
+		Bitmap* pBitmap = new Bitmap( w, h, w * 4, PixelFormat32bppARGB, thumbnail.GetData() ); // delete?
 		if ( pBitmap )
 		{
 			Graphics xGraphics( pBitmap );
@@ -97,7 +265,6 @@ STDMETHODIMP CThumbnailProvider::GetThumbnail( UINT cx, HBITMAP* phbmp, WTS_ALPH
 			*pdwAlpha = WTSAT_ARGB;
 		}
 		delete pBitmap;
-		delete[] pConverted;
 	}
 	GdiplusShutdown( token );
 	if ( *phbmp != nullptr )
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "texturecache.h"
 #include "vtffile.h"
 
 class CThumbnailProvider : public IThumbnailProvider, IObjectWithSite, IInitializeWithStream
@@ -28,5 +29,8 @@ private:
 	volatile LONG m_cRef;
 
 	IUnknown* m_pSite;
+	IStream* m_pStream;
 	CVTFFile m_texture;
+	STextureIdentity m_identity;
+	bool m_bHasIdentity;
 };
\ No newline at end of file
@@ -0,0 +1,3 @@
+﻿// The one translation unit holding the bcdec decoders, everything else includes bcdec.h for the declarations.
+#define BCDEC_IMPLEMENTATION
+#include "bcdec.h"
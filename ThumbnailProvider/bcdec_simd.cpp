@@ -0,0 +1,1087 @@
+﻿#include "bcdec_simd.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined( _M_X64 ) || defined( _M_IX86 ) || defined( __x86_64__ ) || defined( __i386__ )
+#define BCDECODE_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define BCDECODE_TARGET_SSE2
+#define BCDECODE_TARGET_AVX2
+#else
+#define BCDECODE_TARGET_SSE2 __attribute__( ( target( "sse2" ) ) )
+#define BCDECODE_TARGET_AVX2 __attribute__( ( target( "avx2" ) ) )
+#endif
+#endif
+
+static inline vlUInt32 LoadUInt32( const vlByte *lpSource )
+{
+	vlUInt32 uiValue;
+	memcpy( &uiValue, lpSource, sizeof( uiValue ) );
+	return uiValue;
+}
+
+static inline unsigned long long LoadUInt64( const vlByte *lpSource )
+{
+	unsigned long long uiValue;
+	memcpy( &uiValue, lpSource, sizeof( uiValue ) );
+	return uiValue;
+}
+
+//
+// Palettes are built exactly like bcdec__color_block and bcdec__smooth_alpha_block, so every
+// level is bit-exact with bcdec. Swapping red and blue in the palette gives BGRA for free.
+//
+
+template<vlBool bBGRA>
+static inline vlUInt32 PackColor( vlUInt r, vlUInt g, vlUInt b )
+{
+	return bBGRA ? 0xFF000000 | ( r << 16 ) | ( g << 8 ) | b : 0xFF000000 | ( b << 16 ) | ( g << 8 ) | r;
+}
+
+template<vlBool bBGRA>
+static inline vlVoid DecodeColorPalette( const vlByte *lpBlock, vlUInt32 *lpPalette, vlBool bOpaqueOnly )
+{
+	const vlUInt c0 = lpBlock[0] | ( lpBlock[1] << 8 );
+	const vlUInt c1 = lpBlock[2] | ( lpBlock[3] << 8 );
+
+	const vlUInt r0 = ( ( ( c0 >> 11 ) & 0x1F ) * 527 + 23 ) >> 6;
+	const vlUInt g0 = ( ( ( c0 >> 5 ) & 0x3F ) * 259 + 33 ) >> 6;
+	const vlUInt b0 = ( ( c0 & 0x1F ) * 527 + 23 ) >> 6;
+	const vlUInt r1 = ( ( ( c1 >> 11 ) & 0x1F ) * 527 + 23 ) >> 6;
+	const vlUInt g1 = ( ( ( c1 >> 5 ) & 0x3F ) * 259 + 33 ) >> 6;
+	const vlUInt b1 = ( ( c1 & 0x1F ) * 527 + 23 ) >> 6;
+
+	lpPalette[0] = PackColor<bBGRA>( r0, g0, b0 );
+	lpPalette[1] = PackColor<bBGRA>( r1, g1, b1 );
+
+	if ( c0 > c1 || bOpaqueOnly )
+	{
+		lpPalette[2] = PackColor<bBGRA>( ( 2 * r0 + r1 + 1 ) / 3, ( 2 * g0 + g1 + 1 ) / 3, ( 2 * b0 + b1 + 1 ) / 3 );
+		lpPalette[3] = PackColor<bBGRA>( ( r0 + 2 * r1 + 1 ) / 3, ( g0 + 2 * g1 + 1 ) / 3, ( b0 + 2 * b1 + 1 ) / 3 );
+	}
+	else
+	{
+		lpPalette[2] = PackColor<bBGRA>( ( r0 + r1 + 1 ) >> 1, ( g0 + g1 + 1 ) >> 1, ( b0 + b1 + 1 ) >> 1 );
+		lpPalette[3] = 0x00000000;
+	}
+}
+
+static inline vlVoid DecodeAlphaPalette( const vlByte *lpBlock, vlByte *lpPalette )
+{
+	const vlUInt a0 = lpBlock[0];
+	const vlUInt a1 = lpBlock[1];
+
+	lpPalette[0] = ( vlByte )a0;
+	lpPalette[1] = ( vlByte )a1;
+
+	if ( a0 > a1 )
+	{
+		for ( vlUInt i = 1; i < 7; i++ )
+			lpPalette[i + 1] = ( vlByte )( ( ( 7 - i ) * a0 + i * a1 + 1 ) / 7 );
+	}
+	else
+	{
+		for ( vlUInt i = 1; i < 5; i++ )
+			lpPalette[i + 1] = ( vlByte )( ( ( 5 - i ) * a0 + i * a1 + 1 ) / 5 );
+		lpPalette[6] = 0x00;
+		lpPalette[7] = 0xFF;
+	}
+}
+
+//
+// Scalar
+//
+
+static inline vlVoid StoreUInt32( vlByte *lpDest, vlUInt32 uiValue )
+{
+	memcpy( lpDest, &uiValue, sizeof( uiValue ) );
+}
+
+static inline vlVoid WriteColorBlockScalar( const vlUInt32 *lpPalette, vlUInt32 uiIndices, const vlByte *lpAlpha, vlByte *lpDest, vlUInt uiPitch )
+{
+	for ( vlUInt i = 0; i < 16; i++, uiIndices >>= 2 )
+	{
+		vlUInt32 uiColor = lpPalette[uiIndices & 0x03];
+		if ( lpAlpha )
+			uiColor = ( uiColor & 0x00FFFFFF ) | ( ( vlUInt32 )lpAlpha[i] << 24 );
+
+		StoreUInt32( lpDest + ( i / 4 ) * uiPitch + ( i % 4 ) * 4, uiColor );
+	}
+}
+
+template<vlBool bBGRA>
+static vlVoid DecodeBC1RowScalar( const vlByte *lpSource, vlByte *lpDest, vlUInt uiBlocks, vlUInt uiPitch )
+{
+	for ( vlUInt i = 0; i < uiBlocks; i++, lpSource += 8, lpDest += 16 )
+	{
+		vlUInt32 uiPalette[4];
+		DecodeColorPalette<bBGRA>( lpSource, uiPalette, vlFalse );
+		WriteColorBlockScalar( uiPalette, LoadUInt32( lpSource + 4 ), 0, lpDest, uiPitch );
+	}
+}
+
+template<vlBool bBGRA>
+static vlVoid DecodeBC2RowScalar( const vlByte *lpSource, vlByte *lpDest, vlUInt uiBlocks, vlUInt uiPitch )
+{
+	for ( vlUInt i = 0; i < uiBlocks; i++, lpSource += 16, lpDest += 16 )
+	{
+		vlUInt32 uiPalette[4];
+		DecodeColorPalette<bBGRA>( lpSource + 8, uiPalette, vlTrue );
+
+		vlByte ucAlpha[16];
+		for ( vlUInt j = 0; j < 8; j++ )
+		{
+			ucAlpha[j * 2 + 0] = ( lpSource[j] & 0x0F ) * 17;
+			ucAlpha[j * 2 + 1] = ( lpSource[j] >> 4 ) * 17;
+		}
+
+		WriteColorBlockScalar( uiPalette, LoadUInt32( lpSource + 12 ), ucAlpha, lpDest, uiPitch );
+	}
+}
+
+template<vlBool bBGRA>
+static vlVoid DecodeBC3RowScalar( const vlByte *lpSource, vlByte *lpDest, vlUInt uiBlocks, vlUInt uiPitch )
+{
+	for ( vlUInt i = 0; i < uiBlocks; i++, lpSource += 16, lpDest += 16 )
+	{
+		vlUInt32 uiPalette[4];
+		DecodeColorPalette<bBGRA>( lpSource + 8, uiPalette, vlTrue );
+
+		vlByte ucAlphaPalette[8];
+		DecodeAlphaPalette( lpSource, ucAlphaPalette );
+
+		vlByte ucAlpha[16];
+		unsigned long long uiAlphaIndices = LoadUInt64( lpSource ) >> 16;
+		for ( vlUInt j = 0; j < 16; j++, uiAlphaIndices >>= 3 )
+			ucAlpha[j] = ucAlphaPalette[uiAlphaIndices & 0x07];
+
+		WriteColorBlockScalar( uiPalette, LoadUInt32( lpSource + 12 ), ucAlpha, lpDest, uiPitch );
+	}
+}
+
+#ifdef BCDECODE_X86
+//
+// SSE2, one block per iteration. Palette entries are picked per lane with compare masks on the two index bits.
+//
+
+BCDECODE_TARGET_SSE2 static inline __m128i SelectSSE2( __m128i Mask, __m128i A, __m128i B )
+{
+	return _mm_or_si128( _mm_and_si128( Mask, A ), _mm_andnot_si128( Mask, B ) );
+}
+
+//! Writes the color block with indices uiIndices, OR'ing Alpha[row] into each row.
+BCDECODE_TARGET_SSE2 static inline vlVoid WriteColorBlockSSE2( __m128i Palette, vlUInt32 uiIndices, const __m128i *lpAlpha, vlByte *lpDest, vlUInt uiPitch )
+{
+	const __m128i Bit0 = _mm_setr_epi32( 1 << 0, 1 << 2, 1 << 4, 1 << 6 );
+	const __m128i Bit1 = _mm_setr_epi32( 2 << 0, 2 << 2, 2 << 4, 2 << 6 );
+	const __m128i Color0 = _mm_shuffle_epi32( Palette, 0x00 );
+	const __m128i Color1 = _mm_shuffle_epi32( Palette, 0x55 );
+	const __m128i Color2 = _mm_shuffle_epi32( Palette, 0xAA );
+	const __m128i Color3 = _mm_shuffle_epi32( Palette, 0xFF );
+
+	__m128i Indices = _mm_set1_epi32( ( vlInt )uiIndices );
+	for ( vlUInt y = 0; y < 4; y++ )
+	{
+		const __m128i Mask0 = _mm_cmpeq_epi32( _mm_and_si128( Indices, Bit0 ), Bit0 );
+		const __m128i Mask1 = _mm_cmpeq_epi32( _mm_and_si128( Indices, Bit1 ), Bit1 );
+		__m128i Row = SelectSSE2( Mask1, SelectSSE2( Mask0, Color3, Color2 ), SelectSSE2( Mask0, Color1, Color0 ) );
+		if ( lpAlpha )
+			Row = _mm_or_si128( Row, lpAlpha[y] );
+
+		_mm_storeu_si128( ( __m128i * )( lpDest + y * uiPitch ), Row );
+		Indices = _mm_srli_epi32( Indices, 8 );
+	}
+}
+
+//! Spreads 16 alpha bytes into four rows of alpha << 24.
+BCDECODE_TARGET_SSE2 static inline vlVoid ExpandAlphaSSE2( __m128i Alpha, __m128i *lpRows )
+{
+	const __m128i Zero = _mm_setzero_si128();
+	const __m128i Low = _mm_unpacklo_epi8( Zero, Alpha );
+	const __m128i High = _mm_unpackhi_epi8( Zero, Alpha );
+
+	lpRows[0] = _mm_unpacklo_epi16( Zero, Low );
+	lpRows[1] = _mm_unpackhi_epi16( Zero, Low );
+	lpRows[2] = _mm_unpacklo_epi16( Zero, High );
+	lpRows[3] = _mm_unpackhi_epi16( Zero, High );
+}
+
+template<vlBool bBGRA>
+BCDECODE_TARGET_SSE2 static inline vlVoid DecodeBC2BlockSSE2( const vlByte *lpSource, vlByte *lpDest, vlUInt uiPitch )
+{
+	alignas( 16 ) vlUInt32 uiPalette[4];
+	DecodeColorPalette<bBGRA>( lpSource + 8, uiPalette, vlTrue );
+
+	// 4 bit alpha, low nibble first, scaled by 17.
+	const __m128i NibbleMask = _mm_set1_epi8( 0x0F );
+	const __m128i Packed = _mm_loadl_epi64( ( const __m128i * )lpSource );
+	const __m128i Nibbles = _mm_unpacklo_epi8( _mm_and_si128( Packed, NibbleMask ), _mm_and_si128( _mm_srli_epi16( Packed, 4 ), NibbleMask ) );
+
+	__m128i Alpha[4];
+	ExpandAlphaSSE2( _mm_or_si128( Nibbles, _mm_slli_epi16( Nibbles, 4 ) ), Alpha );
+
+	const __m128i Palette = _mm_and_si128( _mm_load_si128( ( const __m128i * )uiPalette ), _mm_set1_epi32( 0x00FFFFFF ) );
+	WriteColorBlockSSE2( Palette, LoadUInt32( lpSource + 12 ), Alpha, lpDest, uiPitch );
+}
+
+template<vlBool bBGRA>
+BCDECODE_TARGET_SSE2 static inline vlVoid DecodeBC3BlockSSE2( const vlByte *lpSource, vlByte *lpDest, vlUInt uiPitch )
+{
+	alignas( 16 ) vlUInt32 uiPalette[4];
+	DecodeColorPalette<bBGRA>( lpSource + 8, uiPalette, vlTrue );
+
+	vlByte ucAlphaPalette[8];
+	DecodeAlphaPalette( lpSource, ucAlphaPalette );
+
+	alignas( 16 ) vlByte ucAlpha[16];
+	unsigned long long uiAlphaIndices = LoadUInt64( lpSource ) >> 16;
+	for ( vlUInt i = 0; i < 16; i++, uiAlphaIndices >>= 3 )
+		ucAlpha[i] = ucAlphaPalette[uiAlphaIndices & 0x07];
+
+	__m128i Alpha[4];
+	ExpandAlphaSSE2( _mm_load_si128( ( const __m128i * )ucAlpha ), Alpha );
+
+	const __m128i Palette = _mm_and_si128( _mm_load_si128( ( const __m128i * )uiPalette ), _mm_set1_epi32( 0x00FFFFFF ) );
+	WriteColorBlockSSE2( Palette, LoadUInt32( lpSource + 12 ), Alpha, lpDest, uiPitch );
+}
+
+template<vlBool bBGRA>
+BCDECODE_TARGET_SSE2 static vlVoid DecodeBC1RowSSE2( const vlByte *lpSource, vlByte *lpDest, vlUInt uiBlocks, vlUInt uiPitch )
+{
+	for ( vlUInt i = 0; i < uiBlocks; i++, lpSource += 8, lpDest += 16 )
+	{
+		alignas( 16 ) vlUInt32 uiPalette[4];
+		DecodeColorPalette<bBGRA>( lpSource, uiPalette, vlFalse );
+		WriteColorBlockSSE2( _mm_load_si128( ( const __m128i * )uiPalette ), LoadUInt32( lpSource + 4 ), 0, lpDest, uiPitch );
+	}
+}
+
+template<vlBool bBGRA>
+BCDECODE_TARGET_SSE2 static vlVoid DecodeBC2RowSSE2( const vlByte *lpSource, vlByte *lpDest, vlUInt uiBlocks, vlUInt uiPitch )
+{
+	for ( vlUInt i = 0; i < uiBlocks; i++, lpSource += 16, lpDest += 16 )
+		DecodeBC2BlockSSE2<bBGRA>( lpSource, lpDest, uiPitch );
+}
+
+template<vlBool bBGRA>
+BCDECODE_TARGET_SSE2 static vlVoid DecodeBC3RowSSE2( const vlByte *lpSource, vlByte *lpDest, vlUInt uiBlocks, vlUInt uiPitch )
+{
+	for ( vlUInt i = 0; i < uiBlocks; i++, lpSource += 16, lpDest += 16 )
+		DecodeBC3BlockSSE2<bBGRA>( lpSource, lpDest, uiPitch );
+}
+
+//
+// AVX2, two blocks per iteration. Block A fills lanes 0-3 and block B lanes 4-7, so each
+// row of the pair is one contiguous 32 byte store and the lookups are a single permute.
+//
+
+BCDECODE_TARGET_AVX2 static inline __m256i PairIndicesAVX2( vlUInt32 uiA, vlUInt32 uiB )
+{
+	return _mm256_inserti128_si256( _mm256_castsi128_si256( _mm_set1_epi32( ( vlInt )uiA ) ), _mm_set1_epi32( ( vlInt )uiB ), 1 );
+}
+
+//! Writes the color blocks of a pair, OR'ing Alpha[row] into each row when given.
+BCDECODE_TARGET_AVX2 static inline vlVoid WriteColorPairAVX2( const vlUInt32 *lpPaletteA, const vlUInt32 *lpPaletteB, vlUInt32 uiIndicesA, vlUInt32 uiIndicesB, const __m256i *lpAlpha, vlByte *lpDest, vlUInt uiPitch )
+{
+	const __m256i Shifts = _mm256_setr_epi32( 0, 2, 4, 6, 0, 2, 4, 6 );
+	const __m256i Offsets = _mm256_setr_epi32( 0, 0, 0, 0, 4, 4, 4, 4 );
+	const __m256i Mask = _mm256_set1_epi32( 0x03 );
+	const __m256i Palette = _mm256_inserti128_si256( _mm256_castsi128_si256( _mm_load_si128( ( const __m128i * )lpPaletteA ) ), _mm_load_si128( ( const __m128i * )lpPaletteB ), 1 );
+
+	__m256i Indices = PairIndicesAVX2( uiIndicesA, uiIndicesB );
+	for ( vlUInt y = 0; y < 4; y++ )
+	{
+		const __m256i Lanes = _mm256_add_epi32( _mm256_and_si256( _mm256_srlv_epi32( Indices, Shifts ), Mask ), Offsets );
+		__m256i Row = _mm256_permutevar8x32_epi32( Palette, Lanes );
+		if ( lpAlpha )
+			Row = _mm256_or_si256( Row, lpAlpha[y] );
+
+		_mm256_storeu_si256( ( __m256i * )( lpDest + y * uiPitch ), Row );
+		Indices = _mm256_srli_epi32( Indices, 8 );
+	}
+}
+
+template<vlBool bBGRA>
+BCDECODE_TARGET_AVX2 static vlVoid DecodeBC1RowAVX2( const vlByte *lpSource, vlByte *lpDest, vlUInt uiBlocks, vlUInt uiPitch )
+{
+	vlUInt i = 0;
+	for ( ; i + 2 <= uiBlocks; i += 2, lpSource += 16, lpDest += 32 )
+	{
+		alignas( 16 ) vlUInt32 uiPalette[2][4];
+		DecodeColorPalette<bBGRA>( lpSource, uiPalette[0], vlFalse );
+		DecodeColorPalette<bBGRA>( lpSource + 8, uiPalette[1], vlFalse );
+		WriteColorPairAVX2( uiPalette[0], uiPalette[1], LoadUInt32( lpSource + 4 ), LoadUInt32( lpSource + 12 ), 0, lpDest, uiPitch );
+	}
+
+	if ( i < uiBlocks )
+		DecodeBC1RowSSE2<bBGRA>( lpSource, lpDest, 1, uiPitch );
+}
+
+template<vlBool bBGRA>
+BCDECODE_TARGET_AVX2 static vlVoid DecodeBC2RowAVX2( const vlByte *lpSource, vlByte *lpDest, vlUInt uiBlocks, vlUInt uiPitch )
+{
+	const __m256i Shifts = _mm256_setr_epi32( 0, 4, 8, 12, 0, 4, 8, 12 );
+	const __m256i NibbleMask = _mm256_set1_epi32( 0x0F );
+
+	vlUInt i = 0;
+	for ( ; i + 2 <= uiBlocks; i += 2, lpSource += 32, lpDest += 32 )
+	{
+		alignas( 16 ) vlUInt32 uiPalette[2][4];
+		DecodeColorPalette<bBGRA>( lpSource + 8, uiPalette[0], vlTrue );
+		DecodeColorPalette<bBGRA>( lpSource + 24, uiPalette[1], vlTrue );
+		for ( vlUInt j = 0; j < 4; j++ )
+		{
+			uiPalette[0][j] &= 0x00FFFFFF;
+			uiPalette[1][j] &= 0x00FFFFFF;
+		}
+
+		// Each row is 16 bits of 4 bit alpha, scaled by 17.
+		__m256i Alpha[4];
+		for ( vlUInt y = 0; y < 4; y++ )
+		{
+			const __m256i Row = PairIndicesAVX2( LoadUInt32( lpSource + y * 2 ) & 0xFFFF, LoadUInt32( lpSource + 16 + y * 2 ) & 0xFFFF );
+			const __m256i Nibbles = _mm256_and_si256( _mm256_srlv_epi32( Row, Shifts ), NibbleMask );
+			Alpha[y] = _mm256_slli_epi32( _mm256_or_si256( Nibbles, _mm256_slli_epi32( Nibbles, 4 ) ), 24 );
+		}
+
+		WriteColorPairAVX2( uiPalette[0], uiPalette[1], LoadUInt32( lpSource + 12 ), LoadUInt32( lpSource + 28 ), Alpha, lpDest, uiPitch );
+	}
+
+	if ( i < uiBlocks )
+		DecodeBC2BlockSSE2<bBGRA>( lpSource, lpDest, uiPitch );
+}
+
+template<vlBool bBGRA>
+BCDECODE_TARGET_AVX2 static vlVoid DecodeBC3RowAVX2( const vlByte *lpSource, vlByte *lpDest, vlUInt uiBlocks, vlUInt uiPitch )
+{
+	const __m256i Shifts = _mm256_setr_epi32( 0, 3, 6, 9, 0, 3, 6, 9 );
+	const __m256i IndexMask = _mm256_set1_epi32( 0x07 );
+
+	vlUInt i = 0;
+	for ( ; i + 2 <= uiBlocks; i += 2, lpSource += 32, lpDest += 32 )
+	{
+		alignas( 16 ) vlUInt32 uiPalette[2][4];
+		DecodeColorPalette<bBGRA>( lpSource + 8, uiPalette[0], vlTrue );
+		DecodeColorPalette<bBGRA>( lpSource + 24, uiPalette[1], vlTrue );
+		for ( vlUInt j = 0; j < 4; j++ )
+		{
+			uiPalette[0][j] &= 0x00FFFFFF;
+			uiPalette[1][j] &= 0x00FFFFFF;
+		}
+
+		alignas( 8 ) vlByte ucAlphaPalette[2][8];
+		DecodeAlphaPalette( lpSource, ucAlphaPalette[0] );
+		DecodeAlphaPalette( lpSource + 16, ucAlphaPalette[1] );
+		const __m256i AlphaPaletteA = _mm256_slli_epi32( _mm256_cvtepu8_epi32( _mm_loadl_epi64( ( const __m128i * )ucAlphaPalette[0] ) ), 24 );
+		const __m256i AlphaPaletteB = _mm256_slli_epi32( _mm256_cvtepu8_epi32( _mm_loadl_epi64( ( const __m128i * )ucAlphaPalette[1] ) ), 24 );
+
+		// Each row is 12 bits of 3 bit indices; block B looks up its own palette and is blended into the upper lanes.
+		const unsigned long long uiIndicesA = LoadUInt64( lpSource ) >> 16;
+		const unsigned long long uiIndicesB = LoadUInt64( lpSource + 16 ) >> 16;
+		__m256i Alpha[4];
+		for ( vlUInt y = 0; y < 4; y++ )
+		{
+			const __m256i Row = PairIndicesAVX2( ( vlUInt32 )( uiIndicesA >> ( 12 * y ) ) & 0xFFF, ( vlUInt32 )( uiIndicesB >> ( 12 * y ) ) & 0xFFF );
+			const __m256i Lanes = _mm256_and_si256( _mm256_srlv_epi32( Row, Shifts ), IndexMask );
+			Alpha[y] = _mm256_blend_epi32( _mm256_permutevar8x32_epi32( AlphaPaletteA, Lanes ), _mm256_permutevar8x32_epi32( AlphaPaletteB, Lanes ), 0xF0 );
+		}
+
+		WriteColorPairAVX2( uiPalette[0], uiPalette[1], LoadUInt32( lpSource + 12 ), LoadUInt32( lpSource + 28 ), Alpha, lpDest, uiPitch );
+	}
+
+	if ( i < uiBlocks )
+		DecodeBC3BlockSSE2<bBGRA>( lpSource, lpDest, uiPitch );
+}
+#endif
+
+//
+// BC4 and BC5 (ATI1N and ATI2N). Channels use the DXT5 alpha palette like bcdec_bc4 and bcdec_bc5, so
+// every level is bit-exact with them. BC4 lands in red, BC5 in red and green with blue either 0 or the
+// Z of the unit normal the two channels describe. Alpha is opaque.
+//
+
+//! Z of the unit normal with x and y stored as unsigned bytes, stored the same way. The SIMD levels do the
+//! same float operations in the same order so they give the same bytes.
+static inline vlUInt ReconstructZ( vlUInt x, vlUInt y )
+{
+	const vlSingle fX = x * ( 2.0f / 255.0f ) - 1.0f;
+	const vlSingle fY = y * ( 2.0f / 255.0f ) - 1.0f;
+	const vlSingle fZ = std::sqrt( std::max( 1.0f - fX * fX - fY * fY, 0.0f ) );
+	return ( vlUInt )( fZ * 127.5f + 128.0f );
+}
+
+//! The 16 values of a BC4 block, row by row.
+static inline vlVoid DecodeBC4Values( const vlByte *lpBlock, vlByte *lpValues )
+{
+	vlByte ucPalette[8];
+	DecodeAlphaPalette( lpBlock, ucPalette );
+
+	unsigned long long uiIndices = LoadUInt64( lpBlock ) >> 16;
+	for ( vlUInt i = 0; i < 16; i++, uiIndices >>= 3 )
+		lpValues[i] = ucPalette[uiIndices & 0x07];
+}
+
+template<vlBool bBGRA>
+static vlVoid DecodeBC4RowScalar( const vlByte *lpSource, vlByte *lpDest, vlUInt uiBlocks, vlUInt uiPitch )
+{
+	for ( vlUInt i = 0; i < uiBlocks; i++, lpSource += 8, lpDest += 16 )
+	{
+		vlByte ucRed[16];
+		DecodeBC4Values( lpSource, ucRed );
+		for ( vlUInt j = 0; j < 16; j++ )
+			StoreUInt32( lpDest + ( j / 4 ) * uiPitch + ( j % 4 ) * 4, PackColor<bBGRA>( ucRed[j], 0, 0 ) );
+	}
+}
+
+template<vlBool bBGRA, vlBool bZ>
+static vlVoid DecodeBC5RowScalar( const vlByte *lpSource, vlByte *lpDest, vlUInt uiBlocks, vlUInt uiPitch )
+{
+	for ( vlUInt i = 0; i < uiBlocks; i++, lpSource += 16, lpDest += 16 )
+	{
+		vlByte ucRed[16], ucGreen[16];
+		DecodeBC4Values( lpSource, ucRed );
+		DecodeBC4Values( lpSource + 8, ucGreen );
+		for ( vlUInt j = 0; j < 16; j++ )
+			StoreUInt32( lpDest + ( j / 4 ) * uiPitch + ( j % 4 ) * 4, PackColor<bBGRA>( ucRed[j], ucGreen[j], bZ ? ReconstructZ( ucRed[j], ucGreen[j] ) : 0 ) );
+	}
+}
+
+#ifdef BCDECODE_X86
+//
+// SSE2, one block per iteration. Values are looked up like DXT5 alpha and then widened a row at a time
+// and shifted into place, so the pixels are written with four stores per block.
+//
+
+//! The 16 values of a BC4 block gathered in registers, a 16 byte load right after byte stores could not be forwarded.
+BCDECODE_TARGET_SSE2 static inline __m128i DecodeBC4ValuesSSE2( const vlByte *lpBlock )
+{
+	vlByte ucPalette[8];
+	DecodeAlphaPalette( lpBlock, ucPalette );
+
+	const unsigned long long uiIndices = LoadUInt64( lpBlock ) >> 16;
+	unsigned long long uiValues[2] = {};
+	for ( vlUInt i = 0; i < 16; i++ )
+		uiValues[i / 8] |= ( unsigned long long )ucPalette[( uiIndices >> ( i * 3 ) ) & 0x07] << ( ( i % 8 ) * 8 );
+
+	// _mm_set_epi64x rather than _mm_cvtsi64_si128, which only exists on x64.
+	return _mm_set_epi64x( ( long long )uiValues[1], ( long long )uiValues[0] );
+}
+
+//! Widens 16 values into four rows of 32 bit lanes.
+BCDECODE_TARGET_SSE2 static inline vlVoid ExpandValuesSSE2( __m128i Values, __m128i *lpRows )
+{
+	const __m128i Zero = _mm_setzero_si128();
+	const __m128i Low = _mm_unpacklo_epi8( Values, Zero );
+	const __m128i High = _mm_unpackhi_epi8( Values, Zero );
+
+	lpRows[0] = _mm_unpacklo_epi16( Low, Zero );
+	lpRows[1] = _mm_unpackhi_epi16( Low, Zero );
+	lpRows[2] = _mm_unpacklo_epi16( High, Zero );
+	lpRows[3] = _mm_unpackhi_epi16( High, Zero );
+}
+
+BCDECODE_TARGET_SSE2 static inline __m128i ReconstructZSSE2( __m128i X, __m128i Y )
+{
+	const __m128 Scale = _mm_set1_ps( 2.0f / 255.0f );
+	const __m128 One = _mm_set1_ps( 1.0f );
+	const __m128 fX = _mm_sub_ps( _mm_mul_ps( _mm_cvtepi32_ps( X ), Scale ), One );
+	const __m128 fY = _mm_sub_ps( _mm_mul_ps( _mm_cvtepi32_ps( Y ), Scale ), One );
+	const __m128 fZ = _mm_sqrt_ps( _mm_max_ps( _mm_sub_ps( _mm_sub_ps( One, _mm_mul_ps( fX, fX ) ), _mm_mul_ps( fY, fY ) ), _mm_setzero_ps() ) );
+	return _mm_cvttps_epi32( _mm_add_ps( _mm_mul_ps( fZ, _mm_set1_ps( 127.5f ) ), _mm_set1_ps( 128.0f ) ) );
+}
+
+template<vlBool bBGRA>
+BCDECODE_TARGET_SSE2 static inline vlVoid DecodeBC4BlockSSE2( const vlByte *lpSource, vlByte *lpDest, vlUInt uiPitch )
+{
+	__m128i Red[4];
+	ExpandValuesSSE2( DecodeBC4ValuesSSE2( lpSource ), Red );
+
+	const __m128i Alpha = _mm_set1_epi32( 0xFF000000 );
+	for ( vlUInt y = 0; y < 4; y++ )
+		_mm_storeu_si128( ( __m128i * )( lpDest + y * uiPitch ), _mm_or_si128( _mm_slli_epi32( Red[y], bBGRA ? 16 : 0 ), Alpha ) );
+}
+
+template<vlBool bBGRA, vlBool bZ>
+BCDECODE_TARGET_SSE2 static inline vlVoid DecodeBC5BlockSSE2( const vlByte *lpSource, vlByte *lpDest, vlUInt uiPitch )
+{
+	__m128i Red[4], Green[4];
+	ExpandValuesSSE2( DecodeBC4ValuesSSE2( lpSource ), Red );
+	ExpandValuesSSE2( DecodeBC4ValuesSSE2( lpSource + 8 ), Green );
+
+	const __m128i Alpha = _mm_set1_epi32( 0xFF000000 );
+	for ( vlUInt y = 0; y < 4; y++ )
+	{
+		__m128i Row = _mm_or_si128( _mm_or_si128( _mm_slli_epi32( Red[y], bBGRA ? 16 : 0 ), _mm_slli_epi32( Green[y], 8 ) ), Alpha );
+		if ( bZ )
+			Row = _mm_or_si128( Row, _mm_slli_epi32( ReconstructZSSE2( Red[y], Green[y] ), bBGRA ? 0 : 16 ) );
+
+		_mm_storeu_si128( ( __m128i * )( lpDest + y * uiPitch ), Row );
+	}
+}
+
+template<vlBool bBGRA>
+BCDECODE_TARGET_SSE2 static vlVoid DecodeBC4RowSSE2( const vlByte *lpSource, vlByte *lpDest, vlUInt uiBlocks, vlUInt uiPitch )
+{
+	for ( vlUInt i = 0; i < uiBlocks; i++, lpSource += 8, lpDest += 16 )
+		DecodeBC4BlockSSE2<bBGRA>( lpSource, lpDest, uiPitch );
+}
+
+template<vlBool bBGRA, vlBool bZ>
+BCDECODE_TARGET_SSE2 static vlVoid DecodeBC5RowSSE2( const vlByte *lpSource, vlByte *lpDest, vlUInt uiBlocks, vlUInt uiPitch )
+{
+	for ( vlUInt i = 0; i < uiBlocks; i++, lpSource += 16, lpDest += 16 )
+		DecodeBC5BlockSSE2<bBGRA, bZ>( lpSource, lpDest, uiPitch );
+}
+
+//
+// AVX2, two blocks per iteration laid out like the DXT kernels. The palettes are permuted directly
+// by the 3 bit indices, as for DXT5 alpha, so no value goes through memory.
+//
+
+BCDECODE_TARGET_AVX2 static inline __m256i LoadBC4PaletteAVX2( const vlByte *lpBlock )
+{
+	alignas( 8 ) vlByte ucPalette[8];
+	DecodeAlphaPalette( lpBlock, ucPalette );
+	return _mm256_cvtepu8_epi32( _mm_loadl_epi64( ( const __m128i * )ucPalette ) );
+}
+
+//! Row y of a pair of BC4 blocks as 32 bit lanes, block A in lanes 0-3 and block B in lanes 4-7.
+BCDECODE_TARGET_AVX2 static inline __m256i LookupBC4PairAVX2( __m256i PaletteA, __m256i PaletteB, unsigned long long uiIndicesA, unsigned long long uiIndicesB, vlUInt y )
+{
+	const __m256i Shifts = _mm256_setr_epi32( 0, 3, 6, 9, 0, 3, 6, 9 );
+	const __m256i Row = PairIndicesAVX2( ( vlUInt32 )( uiIndicesA >> ( 12 * y ) ) & 0xFFF, ( vlUInt32 )( uiIndicesB >> ( 12 * y ) ) & 0xFFF );
+	const __m256i Lanes = _mm256_and_si256( _mm256_srlv_epi32( Row, Shifts ), _mm256_set1_epi32( 0x07 ) );
+	return _mm256_blend_epi32( _mm256_permutevar8x32_epi32( PaletteA, Lanes ), _mm256_permutevar8x32_epi32( PaletteB, Lanes ), 0xF0 );
+}
+
+BCDECODE_TARGET_AVX2 static inline __m256i ReconstructZAVX2( __m256i X, __m256i Y )
+{
+	const __m256 Scale = _mm256_set1_ps( 2.0f / 255.0f );
+	const __m256 One = _mm256_set1_ps( 1.0f );
+	const __m256 fX = _mm256_sub_ps( _mm256_mul_ps( _mm256_cvtepi32_ps( X ), Scale ), One );
+	const __m256 fY = _mm256_sub_ps( _mm256_mul_ps( _mm256_cvtepi32_ps( Y ), Scale ), One );
+	const __m256 fZ = _mm256_sqrt_ps( _mm256_max_ps( _mm256_sub_ps( _mm256_sub_ps( One, _mm256_mul_ps( fX, fX ) ), _mm256_mul_ps( fY, fY ) ), _mm256_setzero_ps() ) );
+	return _mm256_cvttps_epi32( _mm256_add_ps( _mm256_mul_ps( fZ, _mm256_set1_ps( 127.5f ) ), _mm256_set1_ps( 128.0f ) ) );
+}
+
+template<vlBool bBGRA>
+BCDECODE_TARGET_AVX2 static vlVoid DecodeBC4RowAVX2( const vlByte *lpSource, vlByte *lpDest, vlUInt uiBlocks, vlUInt uiPitch )
+{
+	const __m256i Alpha = _mm256_set1_epi32( 0xFF000000 );
+
+	vlUInt i = 0;
+	for ( ; i + 2 <= uiBlocks; i += 2, lpSource += 16, lpDest += 32 )
+	{
+		const __m256i PaletteA = LoadBC4PaletteAVX2( lpSource );
+		const __m256i PaletteB = LoadBC4PaletteAVX2( lpSource + 8 );
+		const unsigned long long uiIndicesA = LoadUInt64( lpSource ) >> 16;
+		const unsigned long long uiIndicesB = LoadUInt64( lpSource + 8 ) >> 16;
+		for ( vlUInt y = 0; y < 4; y++ )
+		{
+			const __m256i Red = LookupBC4PairAVX2( PaletteA, PaletteB, uiIndicesA, uiIndicesB, y );
+			_mm256_storeu_si256( ( __m256i * )( lpDest + y * uiPitch ), _mm256_or_si256( _mm256_slli_epi32( Red, bBGRA ? 16 : 0 ), Alpha ) );
+		}
+	}
+
+	if ( i < uiBlocks )
+		DecodeBC4BlockSSE2<bBGRA>( lpSource, lpDest, uiPitch );
+}
+
+template<vlBool bBGRA, vlBool bZ>
+BCDECODE_TARGET_AVX2 static vlVoid DecodeBC5RowAVX2( const vlByte *lpSource, vlByte *lpDest, vlUInt uiBlocks, vlUInt uiPitch )
+{
+	const __m256i Alpha = _mm256_set1_epi32( 0xFF000000 );
+
+	vlUInt i = 0;
+	for ( ; i + 2 <= uiBlocks; i += 2, lpSource += 32, lpDest += 32 )
+	{
+		const __m256i RedPaletteA = LoadBC4PaletteAVX2( lpSource );
+		const __m256i GreenPaletteA = LoadBC4PaletteAVX2( lpSource + 8 );
+		const __m256i RedPaletteB = LoadBC4PaletteAVX2( lpSource + 16 );
+		const __m256i GreenPaletteB = LoadBC4PaletteAVX2( lpSource + 24 );
+		const unsigned long long uiRedA = LoadUInt64( lpSource ) >> 16;
+		const unsigned long long uiGreenA = LoadUInt64( lpSource + 8 ) >> 16;
+		const unsigned long long uiRedB = LoadUInt64( lpSource + 16 ) >> 16;
+		const unsigned long long uiGreenB = LoadUInt64( lpSource + 24 ) >> 16;
+		for ( vlUInt y = 0; y < 4; y++ )
+		{
+			const __m256i Red = LookupBC4PairAVX2( RedPaletteA, RedPaletteB, uiRedA, uiRedB, y );
+			const __m256i Green = LookupBC4PairAVX2( GreenPaletteA, GreenPaletteB, uiGreenA, uiGreenB, y );
+			__m256i Row = _mm256_or_si256( _mm256_or_si256( _mm256_slli_epi32( Red, bBGRA ? 16 : 0 ), _mm256_slli_epi32( Green, 8 ) ), Alpha );
+			if ( bZ )
+				Row = _mm256_or_si256( Row, _mm256_slli_epi32( ReconstructZAVX2( Red, Green ), bBGRA ? 0 : 16 ) );
+
+			_mm256_storeu_si256( ( __m256i * )( lpDest + y * uiPitch ), Row );
+		}
+	}
+
+	if ( i < uiBlocks )
+		DecodeBC5BlockSSE2<bBGRA, bZ>( lpSource, lpDest, uiPitch );
+}
+#endif
+
+//
+// BC7. Every mode has its own kernel with the block layout fixed at compile time, so header fields are
+// plain shifts of the two block halves instead of bcdec's bit at a time stream and the subset and anchor
+// lookups are single table reads. A kernel expands the block into an endpoint pair and a weight per texel,
+// already in output byte order with the rotation applied, and the levels only differ in how they
+// interpolate those. Endpoints are expanded and interpolated exactly like bcdec_bc7, so every level is
+// bit-exact with it; reserved modes decode to transparent black like there.
+//
+
+//! Subset of each texel, 2 bits per texel starting at the top left, for the 64 partitions of 2 and 3 subset modes.
+static const vlUInt32 uiBC7Partitions2[64] =
+{
+	0x50505050, 0x40404040, 0x54545454, 0x54505040, 0x50404000, 0x55545450, 0x55545040, 0x54504000,
+	0x50400000, 0x55555450, 0x55544000, 0x54400000, 0x55555440, 0x55550000, 0x55555500, 0x55000000,
+	0x55150100, 0x00004054, 0x15010000, 0x00405054, 0x00004050, 0x15050100, 0x05010000, 0x40505054,
+	0x00404050, 0x05010100, 0x14141414, 0x05141450, 0x01155440, 0x00555500, 0x15014054, 0x05414150,
+	0x44444444, 0x55005500, 0x11441144, 0x05055050, 0x05500550, 0x11114444, 0x41144114, 0x44111144,
+	0x15055054, 0x01055040, 0x05041050, 0x05455150, 0x14414114, 0x50050550, 0x41411414, 0x00141400,
+	0x00041504, 0x00105410, 0x10541000, 0x04150400, 0x50410514, 0x41051450, 0x05415014, 0x14054150,
+	0x41050514, 0x41505014, 0x40011554, 0x54150140, 0x50505500, 0x00555050, 0x15151010, 0x54540404
+};
+
+static const vlUInt32 uiBC7Partitions3[64] =
+{
+	0xAA685050, 0x6A5A5040, 0x5A5A4200, 0x5450A0A8, 0xA5A50000, 0xA0A05050, 0x5555A0A0, 0x5A5A5050,
+	0xAA550000, 0xAA555500, 0xAAAA5500, 0x90909090, 0x94949494, 0xA4A4A4A4, 0xA9A59450, 0x2A0A4250,
+	0xA5945040, 0x0A425054, 0xA5A5A500, 0x55A0A0A0, 0xA8A85454, 0x6A6A4040, 0xA4A45000, 0x1A1A0500,
+	0x0050A4A4, 0xAAA59090, 0x14696914, 0x69691400, 0xA08585A0, 0xAA821414, 0x50A4A450, 0x6A5A0200,
+	0xA9A58000, 0x5090A0A8, 0xA8A09050, 0x24242424, 0x00AA5500, 0x24924924, 0x24499224, 0x50A50A50,
+	0x500AA550, 0xAAAA4444, 0x66660000, 0xA5A0A5A0, 0x50A050A0, 0x69286928, 0x44AAAA44, 0x66666600,
+	0xAA444444, 0x54A854A8, 0x95809580, 0x96969600, 0xA85454A8, 0x80959580, 0xAA141414, 0x96960000,
+	0xAAAA1414, 0xA05050A0, 0xA0A5A5A0, 0x96000000, 0x40804080, 0xA9A8A9A8, 0xAAAAAA44, 0x2A4A5254
+};
+
+//! Anchor texel of subset 1 in the 2 subset partitions, subset 0 always anchors at texel 0.
+static const vlByte ucBC7Anchors2[64] =
+{
+	15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+	15,  2,  8,  2,  2,  8,  8, 15,  2,  8,  2,  2,  8,  8,  2,  2,
+	15, 15,  6,  8,  2,  8, 15, 15,  2,  8,  2,  2,  2, 15, 15,  6,
+	 6,  2,  6,  8, 15, 15,  2,  2, 15, 15, 15, 15, 15,  2,  2, 15
+};
+
+//! Anchor texels of subsets 1 and 2 in the 3 subset partitions.
+static const vlByte ucBC7Anchors3[64][2] =
+{
+	{  3, 15 }, {  3,  8 }, { 15,  8 }, { 15,  3 }, {  8, 15 }, {  3, 15 }, { 15,  3 }, { 15,  8 },
+	{  8, 15 }, {  8, 15 }, {  6, 15 }, {  6, 15 }, {  6, 15 }, {  5, 15 }, {  3, 15 }, {  3,  8 },
+	{  3, 15 }, {  3,  8 }, {  8, 15 }, { 15,  3 }, {  3, 15 }, {  3,  8 }, {  6, 15 }, { 10,  8 },
+	{  5,  3 }, {  8, 15 }, {  8,  6 }, {  6, 10 }, {  8, 15 }, {  5, 15 }, { 15, 10 }, { 15,  8 },
+	{  8, 15 }, { 15,  3 }, {  3, 15 }, {  5, 10 }, {  6, 10 }, { 10,  8 }, {  8,  9 }, { 15, 10 },
+	{ 15,  6 }, {  3, 15 }, { 15,  8 }, {  5, 15 }, { 15,  3 }, { 15,  6 }, { 15,  6 }, { 15,  8 },
+	{  3, 15 }, { 15,  3 }, {  5, 15 }, {  5, 15 }, {  5, 15 }, {  8, 15 }, {  5, 15 }, { 10, 15 },
+	{  5, 15 }, { 10, 15 }, {  8, 15 }, { 13, 15 }, { 15,  3 }, { 12, 15 }, {  3, 15 }, {  3,  8 }
+};
+
+static const vlByte ucBC7Weights2[4] = { 0, 21, 43, 64 };
+static const vlByte ucBC7Weights3[8] = { 0, 9, 18, 27, 37, 46, 55, 64 };
+static const vlByte ucBC7Weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+struct SBC7ModeInfo
+{
+	vlUInt uiSubsets;
+	vlUInt uiPartitionBits;
+	vlUInt uiRotationBits;
+	vlUInt uiSelectionBits;		//!< Index selection bit, swaps which index drives color and which alpha.
+	vlUInt uiColorBits;
+	vlUInt uiAlphaBits;			//!< 0 for opaque modes.
+	vlBool bEndpointPBits;		//!< One P-bit per endpoint.
+	vlBool bSubsetPBits;		//!< One P-bit per subset, shared by its endpoints.
+	vlUInt uiIndexBits;
+	vlUInt uiIndexBits2;		//!< Secondary index, 0 if the mode has none.
+};
+
+static constexpr SBC7ModeInfo BC7ModeInfo[8] =
+{
+	{ 3, 4, 0, 0, 4, 0, vlTrue,  vlFalse, 3, 0 },
+	{ 2, 6, 0, 0, 6, 0, vlFalse, vlTrue,  3, 0 },
+	{ 3, 6, 0, 0, 5, 0, vlFalse, vlFalse, 2, 0 },
+	{ 2, 6, 0, 0, 7, 0, vlTrue,  vlFalse, 2, 0 },
+	{ 1, 0, 2, 1, 5, 6, vlFalse, vlFalse, 2, 3 },
+	{ 1, 0, 2, 0, 7, 8, vlFalse, vlFalse, 2, 2 },
+	{ 1, 0, 0, 0, 7, 7, vlTrue,  vlFalse, 4, 0 },
+	{ 2, 6, 0, 0, 5, 5, vlTrue,  vlFalse, 2, 0 }
+};
+
+//! Per texel endpoints and weight of endpoint 1, one byte per output channel.
+struct alignas( 16 ) SBC7Texels
+{
+	vlUInt32 uiEndpoint0[16];
+	vlUInt32 uiEndpoint1[16];
+	vlUInt32 uiWeights[16];
+};
+
+//! uiCount bits, at most 64, of the block starting at bit uiOffset.
+static inline unsigned long long ExtractBits( unsigned long long uiLow, unsigned long long uiHigh, vlUInt uiOffset, vlUInt uiCount )
+{
+	unsigned long long uiBits;
+	if ( uiCount == 0 )
+		return 0;
+	else if ( uiOffset >= 64 )
+		uiBits = uiHigh >> ( uiOffset - 64 );
+	else if ( uiOffset == 0 )
+		uiBits = uiLow;
+	else
+		uiBits = ( uiLow >> uiOffset ) | ( uiHigh << ( 64 - uiOffset ) );
+
+	return uiCount < 64 ? uiBits & ( ( 1ull << uiCount ) - 1 ) : uiBits;
+}
+
+//! Anchor indices are stored with their top bit left out, putting it back as 0 makes every index the same width.
+//! Anchors must be inserted lowest first.
+static inline unsigned long long InsertAnchorBit( unsigned long long uiIndices, vlUInt uiAnchor, vlUInt uiIndexBits )
+{
+	const unsigned long long uiLowMask = ( 1ull << ( uiAnchor * uiIndexBits + uiIndexBits - 1 ) ) - 1;
+	return ( uiIndices & uiLowMask ) | ( ( uiIndices & ~uiLowMask ) << 1 );
+}
+
+static constexpr const vlByte *GetBC7Weights( vlUInt uiIndexBits )
+{
+	return uiIndexBits == 2 ? ucBC7Weights2 : uiIndexBits == 3 ? ucBC7Weights3 : ucBC7Weights4;
+}
+
+template<vlUInt uiMode, vlBool bBGRA>
+static inline vlVoid UnpackBC7Mode( const vlByte *lpSource, SBC7Texels &Texels )
+{
+	constexpr SBC7ModeInfo Info = BC7ModeInfo[uiMode];
+	constexpr vlUInt uiEndpoints = Info.uiSubsets * 2;
+	constexpr vlUInt uiPBit = Info.bEndpointPBits || Info.bSubsetPBits ? 1 : 0;
+	constexpr vlUInt uiColorPrecision = Info.uiColorBits + uiPBit;
+	constexpr vlUInt uiAlphaPrecision = Info.uiAlphaBits + uiPBit;
+	constexpr vlUInt uiIndexCount = 16 * Info.uiIndexBits - Info.uiSubsets;
+	constexpr vlUInt uiIndexCount2 = Info.uiIndexBits2 != 0 ? 16 * Info.uiIndexBits2 - 1 : 0;
+
+	const unsigned long long uiLow = LoadUInt64( lpSource );
+	const unsigned long long uiHigh = LoadUInt64( lpSource + 8 );
+
+	vlUInt uiOffset = uiMode + 1;
+	const vlUInt uiPartition = ( vlUInt )ExtractBits( uiLow, uiHigh, uiOffset, Info.uiPartitionBits );
+	uiOffset += Info.uiPartitionBits;
+	const vlUInt uiRotation = ( vlUInt )ExtractBits( uiLow, uiHigh, uiOffset, Info.uiRotationBits );
+	uiOffset += Info.uiRotationBits;
+	const vlBool bSelection = ExtractBits( uiLow, uiHigh, uiOffset, Info.uiSelectionBits ) != 0;
+	uiOffset += Info.uiSelectionBits;
+
+	// Endpoints are stored channel by channel, P-bits after all of them.
+	vlUInt uiEndpoint[uiEndpoints][4];
+	for ( vlUInt i = 0; i < 3; i++ )
+	{
+		for ( vlUInt j = 0; j < uiEndpoints; j++, uiOffset += Info.uiColorBits )
+			uiEndpoint[j][i] = ( vlUInt )ExtractBits( uiLow, uiHigh, uiOffset, Info.uiColorBits );
+	}
+	for ( vlUInt j = 0; j < uiEndpoints; j++, uiOffset += Info.uiAlphaBits )
+		uiEndpoint[j][3] = ( vlUInt )ExtractBits( uiLow, uiHigh, uiOffset, Info.uiAlphaBits );
+
+	vlUInt uiPBits[uiEndpoints] = {};
+	if ( Info.bEndpointPBits )
+	{
+		for ( vlUInt j = 0; j < uiEndpoints; j++, uiOffset++ )
+			uiPBits[j] = ( vlUInt )ExtractBits( uiLow, uiHigh, uiOffset, 1 );
+	}
+	else if ( Info.bSubsetPBits )
+	{
+		for ( vlUInt j = 0; j < uiEndpoints; j += 2, uiOffset++ )
+			uiPBits[j] = uiPBits[j + 1] = ( vlUInt )ExtractBits( uiLow, uiHigh, uiOffset, 1 );
+	}
+
+	// Byte each interpolated channel ends up in, the rotation swaps alpha with one color channel.
+	vlUInt uiChannel[4] = { 0, 1, 2, 3 };
+	if ( uiRotation != 0 )
+	{
+		uiChannel[3] = uiRotation - 1;
+		uiChannel[uiRotation - 1] = 3;
+	}
+
+	vlUInt uiShift[4];
+	for ( vlUInt i = 0; i < 4; i++ )
+		uiShift[i] = 8 * ( bBGRA && uiChannel[i] != 1 && uiChannel[i] != 3 ? 2 - uiChannel[i] : uiChannel[i] );
+
+	// Expand to 8 bits by replicating the top bits, alpha is opaque in modes without it.
+	vlUInt32 uiPacked[uiEndpoints];
+	for ( vlUInt j = 0; j < uiEndpoints; j++ )
+	{
+		vlUInt32 uiColor = 0;
+		for ( vlUInt i = 0; i < 3; i++ )
+		{
+			const vlUInt uiValue = ( ( uiEndpoint[j][i] << uiPBit ) | uiPBits[j] ) << ( 8 - uiColorPrecision );
+			uiColor |= ( uiValue | ( uiValue >> uiColorPrecision ) ) << uiShift[i];
+		}
+
+		if ( Info.uiAlphaBits != 0 )
+		{
+			const vlUInt uiValue = ( ( uiEndpoint[j][3] << uiPBit ) | uiPBits[j] ) << ( 8 - uiAlphaPrecision );
+			uiColor |= ( uiValue | ( uiValue >> uiAlphaPrecision ) ) << uiShift[3];
+		}
+		else
+		{
+			uiColor |= 0xFFu << uiShift[3];
+		}
+
+		uiPacked[j] = uiColor;
+	}
+
+	unsigned long long uiIndices = InsertAnchorBit( ExtractBits( uiLow, uiHigh, uiOffset, uiIndexCount ), 0, Info.uiIndexBits );
+	uiOffset += uiIndexCount;
+
+	vlUInt32 uiSubsets = 0;
+	if ( Info.uiSubsets == 2 )
+	{
+		uiSubsets = uiBC7Partitions2[uiPartition];
+		uiIndices = InsertAnchorBit( uiIndices, ucBC7Anchors2[uiPartition], Info.uiIndexBits );
+	}
+	else if ( Info.uiSubsets == 3 )
+	{
+		const vlUInt uiAnchor1 = ucBC7Anchors3[uiPartition][0];
+		const vlUInt uiAnchor2 = ucBC7Anchors3[uiPartition][1];
+		uiSubsets = uiBC7Partitions3[uiPartition];
+		uiIndices = InsertAnchorBit( uiIndices, uiAnchor1 < uiAnchor2 ? uiAnchor1 : uiAnchor2, Info.uiIndexBits );
+		uiIndices = InsertAnchorBit( uiIndices, uiAnchor1 < uiAnchor2 ? uiAnchor2 : uiAnchor1, Info.uiIndexBits );
+	}
+
+	const unsigned long long uiIndices2 = InsertAnchorBit( ExtractBits( uiLow, uiHigh, uiOffset, uiIndexCount2 ), 0, Info.uiIndexBits2 != 0 ? Info.uiIndexBits2 : 1 );
+
+	constexpr const vlByte *lpWeights = GetBC7Weights( Info.uiIndexBits );
+	constexpr const vlByte *lpWeights2 = GetBC7Weights( Info.uiIndexBits2 );
+	const vlUInt32 uiAlphaMask = 1u << uiShift[3];
+	const vlUInt32 uiColorMask = 0x01010101 & ~uiAlphaMask;
+	for ( vlUInt i = 0; i < 16; i++ )
+	{
+		const vlUInt uiSubset = ( uiSubsets >> ( 2 * i ) ) & 0x03;
+		Texels.uiEndpoint0[i] = uiPacked[uiSubset * 2];
+		Texels.uiEndpoint1[i] = uiPacked[uiSubset * 2 + 1];
+
+		const vlUInt32 uiWeight = lpWeights[( uiIndices >> ( Info.uiIndexBits * i ) ) & ( ( 1u << Info.uiIndexBits ) - 1 )];
+		if ( Info.uiIndexBits2 == 0 )
+		{
+			Texels.uiWeights[i] = uiWeight * 0x01010101;
+		}
+		else
+		{
+			// The index selection bit drives color with the secondary index and alpha with the primary one.
+			const vlUInt32 uiWeight2 = lpWeights2[( uiIndices2 >> ( Info.uiIndexBits2 * i ) ) & ( ( 1u << Info.uiIndexBits2 ) - 1 )];
+			Texels.uiWeights[i] = bSelection ? uiWeight2 * uiColorMask + uiWeight * uiAlphaMask : uiWeight * uiColorMask + uiWeight2 * uiAlphaMask;
+		}
+	}
+}
+
+//! Returns false for the reserved mode.
+template<vlBool bBGRA>
+static inline vlBool UnpackBC7Block( const vlByte *lpSource, SBC7Texels &Texels )
+{
+	// The mode is the number of zero bits before the first set one.
+	switch ( lpSource[0] & ( 0u - lpSource[0] ) & 0xFF )
+	{
+	case 0x01: UnpackBC7Mode<0, bBGRA>( lpSource, Texels ); return vlTrue;
+	case 0x02: UnpackBC7Mode<1, bBGRA>( lpSource, Texels ); return vlTrue;
+	case 0x04: UnpackBC7Mode<2, bBGRA>( lpSource, Texels ); return vlTrue;
+	case 0x08: UnpackBC7Mode<3, bBGRA>( lpSource, Texels ); return vlTrue;
+	case 0x10: UnpackBC7Mode<4, bBGRA>( lpSource, Texels ); return vlTrue;
+	case 0x20: UnpackBC7Mode<5, bBGRA>( lpSource, Texels ); return vlTrue;
+	case 0x40: UnpackBC7Mode<6, bBGRA>( lpSource, Texels ); return vlTrue;
+	case 0x80: UnpackBC7Mode<7, bBGRA>( lpSource, Texels ); return vlTrue;
+	default: return vlFalse;
+	}
+}
+
+static inline vlVoid ClearBlock( vlByte *lpDest, vlUInt uiPitch )
+{
+	for ( vlUInt y = 0; y < 4; y++ )
+		memset( lpDest + y * uiPitch, 0, 16 );
+}
+
+static inline vlVoid InterpolateBC7Scalar( const SBC7Texels &Texels, vlByte *lpDest, vlUInt uiPitch )
+{
+	for ( vlUInt i = 0; i < 16; i++ )
+	{
+		vlUInt32 uiColor = 0;
+		for ( vlUInt uiShift = 0; uiShift < 32; uiShift += 8 )
+		{
+			const vlUInt uiEndpoint0 = ( Texels.uiEndpoint0[i] >> uiShift ) & 0xFF;
+			const vlUInt uiEndpoint1 = ( Texels.uiEndpoint1[i] >> uiShift ) & 0xFF;
+			const vlUInt uiWeight = ( Texels.uiWeights[i] >> uiShift ) & 0xFF;
+			uiColor |= ( ( uiEndpoint0 * ( 64 - uiWeight ) + uiEndpoint1 * uiWeight + 32 ) >> 6 ) << uiShift;
+		}
+
+		StoreUInt32( lpDest + ( i / 4 ) * uiPitch + ( i % 4 ) * 4, uiColor );
+	}
+}
+
+template<vlBool bBGRA>
+static vlVoid DecodeBC7RowScalar( const vlByte *lpSource, vlByte *lpDest, vlUInt uiBlocks, vlUInt uiPitch )
+{
+	for ( vlUInt i = 0; i < uiBlocks; i++, lpSource += 16, lpDest += 16 )
+	{
+		SBC7Texels Texels;
+		if ( UnpackBC7Block<bBGRA>( lpSource, Texels ) )
+			InterpolateBC7Scalar( Texels, lpDest, uiPitch );
+		else
+			ClearBlock( lpDest, uiPitch );
+	}
+}
+
+#ifdef BCDECODE_X86
+//! ( e0 * ( 64 - w ) + e1 * w + 32 ) >> 6 on 16 bit lanes, the largest intermediate is 64 * 255 + 32.
+BCDECODE_TARGET_SSE2 static inline __m128i LerpBC7SSE2( __m128i Endpoint0, __m128i Endpoint1, __m128i Weights )
+{
+	const __m128i Sum = _mm_add_epi16( _mm_mullo_epi16( Endpoint0, _mm_sub_epi16( _mm_set1_epi16( 64 ), Weights ) ), _mm_mullo_epi16( Endpoint1, Weights ) );
+	return _mm_srli_epi16( _mm_add_epi16( Sum, _mm_set1_epi16( 32 ) ), 6 );
+}
+
+//! One row of four texels per iteration.
+BCDECODE_TARGET_SSE2 static inline vlVoid InterpolateBC7SSE2( const SBC7Texels &Texels, vlByte *lpDest, vlUInt uiPitch )
+{
+	const __m128i Zero = _mm_setzero_si128();
+	for ( vlUInt y = 0; y < 4; y++ )
+	{
+		const __m128i Endpoint0 = _mm_load_si128( ( const __m128i * )( Texels.uiEndpoint0 + y * 4 ) );
+		const __m128i Endpoint1 = _mm_load_si128( ( const __m128i * )( Texels.uiEndpoint1 + y * 4 ) );
+		const __m128i Weights = _mm_load_si128( ( const __m128i * )( Texels.uiWeights + y * 4 ) );
+
+		const __m128i Low = LerpBC7SSE2( _mm_unpacklo_epi8( Endpoint0, Zero ), _mm_unpacklo_epi8( Endpoint1, Zero ), _mm_unpacklo_epi8( Weights, Zero ) );
+		const __m128i High = LerpBC7SSE2( _mm_unpackhi_epi8( Endpoint0, Zero ), _mm_unpackhi_epi8( Endpoint1, Zero ), _mm_unpackhi_epi8( Weights, Zero ) );
+		_mm_storeu_si128( ( __m128i * )( lpDest + y * uiPitch ), _mm_packus_epi16( Low, High ) );
+	}
+}
+
+template<vlBool bBGRA>
+BCDECODE_TARGET_SSE2 static vlVoid DecodeBC7RowSSE2( const vlByte *lpSource, vlByte *lpDest, vlUInt uiBlocks, vlUInt uiPitch )
+{
+	for ( vlUInt i = 0; i < uiBlocks; i++, lpSource += 16, lpDest += 16 )
+	{
+		SBC7Texels Texels;
+		if ( UnpackBC7Block<bBGRA>( lpSource, Texels ) )
+			InterpolateBC7SSE2( Texels, lpDest, uiPitch );
+		else
+			ClearBlock( lpDest, uiPitch );
+	}
+}
+
+BCDECODE_TARGET_AVX2 static inline __m256i LerpBC7AVX2( __m256i Endpoint0, __m256i Endpoint1, __m256i Weights )
+{
+	const __m256i Sum = _mm256_add_epi16( _mm256_mullo_epi16( Endpoint0, _mm256_sub_epi16( _mm256_set1_epi16( 64 ), Weights ) ), _mm256_mullo_epi16( Endpoint1, Weights ) );
+	return _mm256_srli_epi16( _mm256_add_epi16( Sum, _mm256_set1_epi16( 32 ) ), 6 );
+}
+
+BCDECODE_TARGET_AVX2 static inline __m256i LoadBC7RowAVX2( const vlUInt32 *lpRow )
+{
+	return _mm256_cvtepu8_epi16( _mm_load_si128( ( const __m128i * )lpRow ) );
+}
+
+//! Two rows per iteration, each widened to a whole register. The texels are loaded a row at a time since they
+//! were just written with narrower stores, which a 32 byte load could not be forwarded from.
+BCDECODE_TARGET_AVX2 static inline vlVoid InterpolateBC7AVX2( const SBC7Texels &Texels, vlByte *lpDest, vlUInt uiPitch )
+{
+	for ( vlUInt y = 0; y < 4; y += 2 )
+	{
+		const __m256i Row0 = LerpBC7AVX2( LoadBC7RowAVX2( Texels.uiEndpoint0 + y * 4 ), LoadBC7RowAVX2( Texels.uiEndpoint1 + y * 4 ), LoadBC7RowAVX2( Texels.uiWeights + y * 4 ) );
+		const __m256i Row1 = LerpBC7AVX2( LoadBC7RowAVX2( Texels.uiEndpoint0 + y * 4 + 4 ), LoadBC7RowAVX2( Texels.uiEndpoint1 + y * 4 + 4 ), LoadBC7RowAVX2( Texels.uiWeights + y * 4 + 4 ) );
+
+		// Packing works within 128 bit lanes and leaves the halves of the two rows interleaved.
+		const __m256i Rows = _mm256_permute4x64_epi64( _mm256_packus_epi16( Row0, Row1 ), 0xD8 );
+		_mm_storeu_si128( ( __m128i * )( lpDest + y * uiPitch ), _mm256_castsi256_si128( Rows ) );
+		_mm_storeu_si128( ( __m128i * )( lpDest + ( y + 1 ) * uiPitch ), _mm256_extracti128_si256( Rows, 1 ) );
+	}
+
+	// The next block is unpacked by code without VEX encoding, the compiler does not clear the upper halves before
+	// calling it and the transition would otherwise cost more than the interpolation saves.
+	_mm256_zeroupper();
+}
+
+template<vlBool bBGRA>
+BCDECODE_TARGET_AVX2 static vlVoid DecodeBC7RowAVX2( const vlByte *lpSource, vlByte *lpDest, vlUInt uiBlocks, vlUInt uiPitch )
+{
+	for ( vlUInt i = 0; i < uiBlocks; i++, lpSource += 16, lpDest += 16 )
+	{
+		SBC7Texels Texels;
+		if ( UnpackBC7Block<bBGRA>( lpSource, Texels ) )
+			InterpolateBC7AVX2( Texels, lpDest, uiPitch );
+		else
+			ClearBlock( lpDest, uiPitch );
+	}
+}
+#endif
+
+static BCDecodeLevel DetectBCDecodeLevel()
+{
+#ifdef BCDECODE_X86
+#ifdef _MSC_VER
+	int iInfo[4];
+	__cpuid( iInfo, 0 );
+	const int iMaxLeaf = iInfo[0];
+
+	__cpuid( iInfo, 1 );
+	const vlBool bSSE2 = ( iInfo[3] & ( 1 << 26 ) ) != 0;
+	const vlBool bOSXSave = ( iInfo[2] & ( 1 << 27 ) ) != 0;
+	const vlBool bAVX = ( iInfo[2] & ( 1 << 28 ) ) != 0;
+
+	// AVX2 also needs the OS to save the upper halves of the ymm registers.
+	if ( iMaxLeaf >= 7 && bOSXSave && bAVX && ( _xgetbv( 0 ) & 0x06 ) == 0x06 )
+	{
+		__cpuidex( iInfo, 7, 0 );
+		if ( iInfo[1] & ( 1 << 5 ) )
+			return BCDECODE_AVX2;
+	}
+
+	if ( bSSE2 )
+		return BCDECODE_SSE2;
+#else
+	__builtin_cpu_init();
+	if ( __builtin_cpu_supports( "avx2" ) )
+		return BCDECODE_AVX2;
+
+	if ( __builtin_cpu_supports( "sse2" ) )
+		return BCDECODE_SSE2;
+#endif
+#endif
+	return BCDECODE_SCALAR;
+}
+
+BCDecodeLevel GetBCDecodeLevel()
+{
+	static const BCDecodeLevel Level = DetectBCDecodeLevel();
+	return Level;
+}
+
+static const SBCDecodeFunctions BCDecodeFunctions[BCDECODE_COUNT] =
+{
+#define BCDECODE_FUNCTIONS( Level ) \
+	{ \
+		{ DecodeBC1Row##Level<vlFalse>, DecodeBC1Row##Level<vlTrue> }, \
+		{ DecodeBC2Row##Level<vlFalse>, DecodeBC2Row##Level<vlTrue> }, \
+		{ DecodeBC3Row##Level<vlFalse>, DecodeBC3Row##Level<vlTrue> }, \
+		{ DecodeBC4Row##Level<vlFalse>, DecodeBC4Row##Level<vlTrue> }, \
+		{ DecodeBC5Row##Level<vlFalse, vlFalse>, DecodeBC5Row##Level<vlTrue, vlFalse> }, \
+		{ DecodeBC5Row##Level<vlFalse, vlTrue>, DecodeBC5Row##Level<vlTrue, vlTrue> }, \
+		{ DecodeBC7Row##Level<vlFalse>, DecodeBC7Row##Level<vlTrue> }, \
+	}
+
+	BCDECODE_FUNCTIONS( Scalar ),
+#ifdef BCDECODE_X86
+	BCDECODE_FUNCTIONS( SSE2 ),
+	BCDECODE_FUNCTIONS( AVX2 ),
+#else
+	BCDECODE_FUNCTIONS( Scalar ),
+	BCDECODE_FUNCTIONS( Scalar ),
+#endif
+
+#undef BCDECODE_FUNCTIONS
+};
+
+const SBCDecodeFunctions &GetBCDecodeFunctions()
+{
+	return BCDecodeFunctions[GetBCDecodeLevel()];
+}
+
+const SBCDecodeFunctions &GetBCDecodeFunctions( BCDecodeLevel Level )
+{
+	if ( Level < BCDECODE_SCALAR || Level > GetBCDecodeLevel() )
+		Level = GetBCDecodeLevel();
+
+	return BCDecodeFunctions[Level];
+}
@@ -0,0 +1,42 @@
+﻿#pragma once
+
+#include "vtffile.h"
+
+//! Decodes uiBlocks horizontally adjacent 4x4 blocks into four RGBA8888 or BGRA8888 rows, uiPitch bytes apart.
+typedef vlVoid ( *BCDecodeRowFunc )( const vlByte *lpSource, vlByte *lpDest, vlUInt uiBlocks, vlUInt uiPitch );
+
+typedef enum tagBCDecodeLevel
+{
+	BCDECODE_SCALAR = 0,
+	BCDECODE_SSE2,
+	BCDECODE_AVX2,
+	BCDECODE_COUNT
+} BCDecodeLevel;
+
+typedef enum tagBCDecodeOrder
+{
+	BCDECODE_RGBA = 0,
+	BCDECODE_BGRA,
+	BCDECODE_ORDER_COUNT
+} BCDecodeOrder;
+
+//! Decoders indexed by BCDecodeOrder.
+struct SBCDecodeFunctions
+{
+	BCDecodeRowFunc BC1[BCDECODE_ORDER_COUNT];		//!< DXT1, 8 bytes per block.
+	BCDecodeRowFunc BC2[BCDECODE_ORDER_COUNT];		//!< DXT3, 16 bytes per block.
+	BCDecodeRowFunc BC3[BCDECODE_ORDER_COUNT];		//!< DXT5, 16 bytes per block.
+	BCDecodeRowFunc BC4[BCDECODE_ORDER_COUNT];		//!< ATI1N, 8 bytes per block, decoded to red.
+	BCDecodeRowFunc BC5[BCDECODE_ORDER_COUNT];		//!< ATI2N, 16 bytes per block, decoded to red and green with blue 0.
+	BCDecodeRowFunc BC5Z[BCDECODE_ORDER_COUNT];		//!< ATI2N with blue reconstructed as the Z of the unit normal red and green hold.
+	BCDecodeRowFunc BC7[BCDECODE_ORDER_COUNT];		//!< BPTC, 16 bytes per block.
+};
+
+//! Best instruction set level supported by the running CPU.
+BCDecodeLevel GetBCDecodeLevel();
+
+//! Decoders for the running CPU.
+const SBCDecodeFunctions &GetBCDecodeFunctions();
+
+//! Decoders for a specific level, clamped to what the running CPU supports.
+const SBCDecodeFunctions &GetBCDecodeFunctions( BCDecodeLevel Level );
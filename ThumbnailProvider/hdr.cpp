@@ -0,0 +1,261 @@
+﻿#include "hdr.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined( _M_X64 ) || defined( _M_IX86 ) || defined( __x86_64__ ) || defined( __i386__ )
+#define HDR_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define HDR_TARGET_SSE2
+#define HDR_TARGET_F16C
+#else
+#define HDR_TARGET_SSE2 __attribute__( ( target( "sse2" ) ) )
+#define HDR_TARGET_F16C __attribute__( ( target( "avx,f16c" ) ) )
+#endif
+#endif
+
+vlSingle ComputeHDRWhite( vlSingle fLargest )
+{
+	const vlSingle fSteps = std::min( 255.0f, std::ceil( fLargest * ( 1.0f / HDR_MAX_WHITE ) * 255.0f ) );
+	return std::max( HDR_MIN_WHITE, static_cast<int>( fSteps ) * ( HDR_MAX_WHITE / 255.0f ) );
+}
+
+vlUInt ComputeHDRSampleStep( vlUInt uiWidth, vlUInt uiHeight, vlUInt uiMaxSamples )
+{
+	// The square root gets close, the loop corrects for the grid rounding up at the edges.
+	vlUInt uiStep = std::max( 1u, static_cast<vlUInt>( std::sqrt( static_cast<double>( uiWidth ) * uiHeight / std::max( uiMaxSamples, 1u ) ) ) );
+	while ( static_cast<vlUInt64>( ( uiWidth + uiStep - 1 ) / uiStep ) * ( ( uiHeight + uiStep - 1 ) / uiStep ) > uiMaxSamples )
+		uiStep++;
+
+	return uiStep;
+}
+
+//
+// Scalar. The half conversion is exact, every level gives the same floats, except that F16C quiets
+// signaling NaNs, and the same bytes.
+//
+
+static inline vlSingle HalfToFloat( vlUInt16 uiHalf )
+{
+	// Move exponent and mantissa into place and rebias; infinities and NaNs need the exponent pushed to the
+	// top, denormals are renormalized by subtracting the smallest normal.
+	const vlUInt32 uiShiftedExponent = 0x7C00 << 13;
+	vlUInt32 uiBits = ( uiHalf & 0x7FFF ) << 13;
+	const vlUInt32 uiExponent = uiBits & uiShiftedExponent;
+	uiBits += ( 127 - 15 ) << 23;
+
+	vlSingle fValue;
+	if ( uiExponent == uiShiftedExponent )
+	{
+		uiBits += ( 128 - 16 ) << 23;
+	}
+	else if ( uiExponent == 0 )
+	{
+		const vlUInt32 uiMagic = 113 << 23;
+		vlSingle fMagic;
+		uiBits += 1 << 23;
+		memcpy( &fValue, &uiBits, sizeof( fValue ) );
+		memcpy( &fMagic, &uiMagic, sizeof( fMagic ) );
+		fValue -= fMagic;
+		memcpy( &uiBits, &fValue, sizeof( uiBits ) );
+	}
+
+	uiBits |= ( vlUInt32 )( uiHalf & 0x8000 ) << 16;
+	memcpy( &fValue, &uiBits, sizeof( fValue ) );
+	return fValue;
+}
+
+static vlVoid HalfToFloatScalar( const vlUInt16 *lpSource, vlSingle *lpDest, size_t uiCount )
+{
+	for ( size_t i = 0; i < uiCount; i++ )
+		lpDest[i] = HalfToFloat( lpSource[i] );
+}
+
+//! Scaled, rounded and clamped the same way as the SSE2 kernel, including NaNs ending up as 0.
+static inline vlByte TonemapValue( vlSingle fValue, vlSingle fScale )
+{
+	const vlSingle fScaled = fValue * fScale + 0.5f;
+	return fScaled > 0.0f ? ( vlByte )std::min( fScaled, 255.0f ) : 0;
+}
+
+template<vlBool bBGRA>
+static vlVoid TonemapRowScalar( const vlSingle *lpSource, vlUInt uiChannels, vlByte *lpDest, vlUInt uiPixels, vlSingle fWhite )
+{
+	const vlSingle fScale = 255.0f / fWhite;
+	for ( vlUInt i = 0; i < uiPixels; i++, lpSource += uiChannels, lpDest += 4 )
+	{
+		lpDest[bBGRA ? 2 : 0] = TonemapValue( lpSource[0], fScale );
+		lpDest[1] = uiChannels >= 3 ? TonemapValue( lpSource[1], fScale ) : 0;
+		lpDest[bBGRA ? 0 : 2] = uiChannels >= 3 ? TonemapValue( lpSource[2], fScale ) : 0;
+		lpDest[3] = uiChannels == 4 ? TonemapValue( lpSource[3], 255.0f ) : 255;
+	}
+}
+
+#ifdef HDR_X86
+//
+// SSE2. Halves are widened and rebuilt with integer ops, the tonemap works on one pixel per register so
+// the channel count only changes the load stride.
+//
+
+//! Same steps as the scalar version. Denormal halves are renormalized with a subtraction of normal floats,
+//! multiplying by a power of two instead would feed denormals to the multiplier and stall on every one.
+HDR_TARGET_SSE2 static inline __m128 HalfToFloatSSE2( __m128i Halves )
+{
+	const __m128i ShiftedExponent = _mm_set1_epi32( 0x7C00 << 13 );
+	const __m128i ExponentMantissa = _mm_slli_epi32( _mm_and_si128( Halves, _mm_set1_epi32( 0x7FFF ) ), 13 );
+	const __m128i Exponent = _mm_and_si128( ExponentMantissa, ShiftedExponent );
+	const __m128i Rebiased = _mm_add_epi32( ExponentMantissa, _mm_set1_epi32( ( 127 - 15 ) << 23 ) );
+
+	const __m128i InfNaN = _mm_and_si128( _mm_cmpeq_epi32( Exponent, ShiftedExponent ), _mm_set1_epi32( ( 128 - 16 ) << 23 ) );
+	const __m128i Denormal = _mm_cmpeq_epi32( Exponent, _mm_setzero_si128() );
+	const __m128 Renormalized = _mm_sub_ps( _mm_castsi128_ps( _mm_add_epi32( Rebiased, _mm_set1_epi32( 1 << 23 ) ) ), _mm_castsi128_ps( _mm_set1_epi32( 113 << 23 ) ) );
+
+	const __m128i Value = _mm_or_si128( _mm_and_si128( Denormal, _mm_castps_si128( Renormalized ) ), _mm_andnot_si128( Denormal, _mm_add_epi32( Rebiased, InfNaN ) ) );
+	return _mm_castsi128_ps( _mm_or_si128( Value, _mm_slli_epi32( _mm_and_si128( Halves, _mm_set1_epi32( 0x8000 ) ), 16 ) ) );
+}
+
+HDR_TARGET_SSE2 static vlVoid HalfToFloatSSE2( const vlUInt16 *lpSource, vlSingle *lpDest, size_t uiCount )
+{
+	const __m128i Zero = _mm_setzero_si128();
+	size_t i = 0;
+	for ( ; i + 8 <= uiCount; i += 8 )
+	{
+		const __m128i Halves = _mm_loadu_si128( ( const __m128i * )( lpSource + i ) );
+		_mm_storeu_ps( lpDest + i, HalfToFloatSSE2( _mm_unpacklo_epi16( Halves, Zero ) ) );
+		_mm_storeu_ps( lpDest + i + 4, HalfToFloatSSE2( _mm_unpackhi_epi16( Halves, Zero ) ) );
+	}
+
+	HalfToFloatScalar( lpSource + i, lpDest + i, uiCount - i );
+}
+
+template<vlUInt uiChannels, vlBool bBGRA>
+HDR_TARGET_SSE2 static inline __m128i TonemapPixelSSE2( const vlSingle *lpSource, __m128 Mask, __m128 Scale, __m128 Bias )
+{
+	__m128 Pixel = _mm_loadu_ps( lpSource );
+	if ( uiChannels == 3 )
+		Pixel = _mm_and_ps( Pixel, Mask );
+	if ( bBGRA )
+		Pixel = _mm_shuffle_ps( Pixel, Pixel, _MM_SHUFFLE( 3, 0, 1, 2 ) );
+
+	// max returns its second operand when either is NaN.
+	const __m128 Scaled = _mm_add_ps( _mm_mul_ps( Pixel, Scale ), Bias );
+	return _mm_cvttps_epi32( _mm_min_ps( _mm_max_ps( Scaled, _mm_setzero_ps() ), _mm_set1_ps( 255.0f ) ) );
+}
+
+template<vlUInt uiChannels, vlBool bBGRA>
+HDR_TARGET_SSE2 static vlVoid TonemapRowSSE2( const vlSingle *lpSource, vlByte *lpDest, vlUInt uiPixels, vlSingle fWhite )
+{
+	// 3 channel pixels load the next pixel's red as alpha, masked off and replaced by the bias.
+	const vlSingle fScale = 255.0f / fWhite;
+	const __m128 Mask = _mm_castsi128_ps( _mm_setr_epi32( -1, -1, -1, 0 ) );
+	const __m128 Scale = _mm_setr_ps( fScale, fScale, fScale, uiChannels == 4 ? 255.0f : 0.0f );
+	const __m128 Bias = _mm_setr_ps( 0.5f, 0.5f, 0.5f, uiChannels == 4 ? 0.5f : 255.5f );
+
+	// So the last load stays inside the row.
+	const vlUInt uiVectorPixels = uiChannels == 4 || uiPixels == 0 ? uiPixels : uiPixels - 1;
+
+	vlUInt i = 0;
+	for ( ; i + 4 <= uiVectorPixels; i += 4 )
+	{
+		const vlSingle *lpPixels = lpSource + ( size_t )i * uiChannels;
+		const __m128i Low = _mm_packs_epi32( TonemapPixelSSE2<uiChannels, bBGRA>( lpPixels, Mask, Scale, Bias ), TonemapPixelSSE2<uiChannels, bBGRA>( lpPixels + uiChannels, Mask, Scale, Bias ) );
+		const __m128i High = _mm_packs_epi32( TonemapPixelSSE2<uiChannels, bBGRA>( lpPixels + 2 * uiChannels, Mask, Scale, Bias ), TonemapPixelSSE2<uiChannels, bBGRA>( lpPixels + 3 * uiChannels, Mask, Scale, Bias ) );
+		_mm_storeu_si128( ( __m128i * )( lpDest + ( size_t )i * 4 ), _mm_packus_epi16( Low, High ) );
+	}
+
+	TonemapRowScalar<bBGRA>( lpSource + ( size_t )i * uiChannels, uiChannels, lpDest + ( size_t )i * 4, uiPixels - i, fWhite );
+}
+
+//! Single channel rows hold four pixels per register instead, each value lands in red of its own pixel.
+template<vlBool bBGRA>
+HDR_TARGET_SSE2 static vlVoid TonemapRedRowSSE2( const vlSingle *lpSource, vlByte *lpDest, vlUInt uiPixels, vlSingle fWhite )
+{
+	const __m128 Scale = _mm_set1_ps( 255.0f / fWhite );
+	const __m128i Alpha = _mm_set1_epi32( 0xFF000000 );
+
+	vlUInt i = 0;
+	for ( ; i + 4 <= uiPixels; i += 4 )
+	{
+		const __m128 Scaled = _mm_add_ps( _mm_mul_ps( _mm_loadu_ps( lpSource + i ), Scale ), _mm_set1_ps( 0.5f ) );
+		const __m128i Red = _mm_cvttps_epi32( _mm_min_ps( _mm_max_ps( Scaled, _mm_setzero_ps() ), _mm_set1_ps( 255.0f ) ) );
+		_mm_storeu_si128( ( __m128i * )( lpDest + ( size_t )i * 4 ), _mm_or_si128( bBGRA ? _mm_slli_epi32( Red, 16 ) : Red, Alpha ) );
+	}
+
+	TonemapRowScalar<bBGRA>( lpSource + i, 1, lpDest + ( size_t )i * 4, uiPixels - i, fWhite );
+}
+
+template<vlBool bBGRA>
+HDR_TARGET_SSE2 static vlVoid TonemapRowSSE2( const vlSingle *lpSource, vlUInt uiChannels, vlByte *lpDest, vlUInt uiPixels, vlSingle fWhite )
+{
+	if ( uiChannels == 4 )
+		TonemapRowSSE2<4, bBGRA>( lpSource, lpDest, uiPixels, fWhite );
+	else if ( uiChannels == 3 )
+		TonemapRowSSE2<3, bBGRA>( lpSource, lpDest, uiPixels, fWhite );
+	else
+		TonemapRedRowSSE2<bBGRA>( lpSource, lpDest, uiPixels, fWhite );
+}
+
+//
+// F16C, which every CPU with AVX2 has, converts eight halves per instruction.
+//
+
+HDR_TARGET_F16C static vlVoid HalfToFloatF16C( const vlUInt16 *lpSource, vlSingle *lpDest, size_t uiCount )
+{
+	size_t i = 0;
+	for ( ; i + 8 <= uiCount; i += 8 )
+		_mm256_storeu_ps( lpDest + i, _mm256_cvtph_ps( _mm_loadu_si128( ( const __m128i * )( lpSource + i ) ) ) );
+
+	// Leave the upper halves clean for the SSE2 code that usually follows.
+	_mm256_zeroupper();
+	HalfToFloatScalar( lpSource + i, lpDest + i, uiCount - i );
+}
+
+static vlBool HasF16C()
+{
+#ifdef _MSC_VER
+	int iInfo[4];
+	__cpuid( iInfo, 1 );
+	return ( iInfo[2] & ( 1 << 29 ) ) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports( "f16c" ) != 0;
+#endif
+}
+#endif
+
+static const SHDRFunctions HDRFunctions[BCDECODE_COUNT] =
+{
+	{ HalfToFloatScalar, { TonemapRowScalar<vlFalse>, TonemapRowScalar<vlTrue> } },
+#ifdef HDR_X86
+	{ HalfToFloatSSE2, { TonemapRowSSE2<vlFalse>, TonemapRowSSE2<vlTrue> } },
+	{ HalfToFloatF16C, { TonemapRowSSE2<vlFalse>, TonemapRowSSE2<vlTrue> } },
+#else
+	{ HalfToFloatScalar, { TonemapRowScalar<vlFalse>, TonemapRowScalar<vlTrue> } },
+	{ HalfToFloatScalar, { TonemapRowScalar<vlFalse>, TonemapRowScalar<vlTrue> } },
+#endif
+};
+
+static BCDecodeLevel GetHDRLevel()
+{
+	static const BCDecodeLevel Level =
+#ifdef HDR_X86
+		GetBCDecodeLevel() == BCDECODE_AVX2 && !HasF16C() ? BCDECODE_SSE2 :
+#endif
+		GetBCDecodeLevel();
+	return Level;
+}
+
+const SHDRFunctions &GetHDRFunctions()
+{
+	return HDRFunctions[GetHDRLevel()];
+}
+
+const SHDRFunctions &GetHDRFunctions( BCDecodeLevel Level )
+{
+	if ( Level < BCDECODE_SCALAR || Level > GetHDRLevel() )
+		Level = GetHDRLevel();
+
+	return HDRFunctions[Level];
+}
@@ -0,0 +1,38 @@
+﻿#pragma once
+
+#include "bcdec_simd.h"
+#include <cstddef>
+
+//
+// HDR to 8 bit. Images are scaled so their brightest sampled channel becomes white, that white point is
+// capped at HDR_MAX_WHITE so a few very bright texels do not turn the rest black and never goes below
+// HDR_MIN_WHITE so dark images are not blown up into noise.
+//
+
+#define HDR_MAX_WHITE 8.0f
+#define HDR_MIN_WHITE 0.1f
+
+//! Converts uiCount half floats to floats, denormals, infinities and NaNs included.
+typedef vlVoid ( *HalfToFloatFunc )( const vlUInt16 *lpSource, vlSingle *lpDest, size_t uiCount );
+
+//! Writes uiPixels pixels of uiChannels (1, 3 or 4) floats as RGBA8888 or BGRA8888, color scaled so fWhite is 255
+//! and alpha so 1 is. Values are clamped, NaNs become 0, a single channel is red and missing alpha is opaque.
+typedef vlVoid ( *TonemapRowFunc )( const vlSingle *lpSource, vlUInt uiChannels, vlByte *lpDest, vlUInt uiPixels, vlSingle fWhite );
+
+struct SHDRFunctions
+{
+	HalfToFloatFunc HalfToFloat;
+	TonemapRowFunc Tonemap[BCDECODE_ORDER_COUNT];		//!< Indexed by BCDecodeOrder.
+};
+
+//! White point for an image whose brightest sampled channel is fLargest, rounded up to a 255th of HDR_MAX_WHITE.
+vlSingle ComputeHDRWhite( vlSingle fLargest );
+
+//! Step between samples so a grid over uiWidth x uiHeight items takes at most uiMaxSamples of them.
+vlUInt ComputeHDRSampleStep( vlUInt uiWidth, vlUInt uiHeight, vlUInt uiMaxSamples );
+
+//! Functions for the running CPU, using the same levels as the block decoders.
+const SHDRFunctions &GetHDRFunctions();
+
+//! Functions for a specific level, clamped to what the running CPU supports.
+const SHDRFunctions &GetHDRFunctions( BCDecodeLevel Level );
@@ -0,0 +1,553 @@
+﻿#include "inflate.h"
+#include <atomic>
+#include <cstring>
+
+#undef next_in
+#include "zlib.h"
+
+static std::atomic<vlInt> InflateBackend( VTF_INFLATE_AUTO );
+
+vlVoid SetInflateBackend( VTFInflateBackend Backend )
+{
+	if ( Backend >= VTF_INFLATE_AUTO && Backend < VTF_INFLATE_COUNT )
+		InflateBackend = Backend;
+}
+
+VTFInflateBackend GetInflateBackend()
+{
+	return ( VTFInflateBackend )InflateBackend.load();
+}
+
+vlBool InflateZlib( const vlByte *lpSource, vlUInt uiSourceSize, vlByte *lpDest, vlUInt uiDestSize )
+{
+	z_stream zStream;
+	memset( &zStream, 0, sizeof( zStream ) );
+	if ( inflateInit( &zStream ) != Z_OK )
+		return vlFalse;
+
+	zStream.next_in = const_cast<vlByte *>( lpSource );
+	zStream.avail_in = uiSourceSize;
+	zStream.next_out = lpDest;
+	zStream.avail_out = uiDestSize;
+
+	const int zRet = inflate( &zStream, Z_FINISH );
+	const vlBool bResult = ( zRet == Z_STREAM_END || zRet == Z_OK ) && zStream.avail_out == 0;
+
+	inflateEnd( &zStream );
+	return bResult;
+}
+
+//
+// One-shot inflate in the style of libdeflate: the whole input and output are in memory, so there is
+// no state machine to suspend. Bits come from a 64 bit buffer that one refill per symbol keeps at 56 or
+// more, and codes decode through a primary table with subtables for the few long codewords.
+//
+
+#define INFLATE_LITLEN_TABLE_BITS	10
+#define INFLATE_DIST_TABLE_BITS		8
+#define INFLATE_CODELEN_TABLE_BITS	7
+
+#define INFLATE_LITLEN_SYMBOLS		288
+#define INFLATE_DIST_SYMBOLS		32
+#define INFLATE_CODELEN_SYMBOLS		19
+#define INFLATE_MAX_CODE_LENGTH		15
+
+// Worst case is every long codeword getting its own full size subtable.
+#define INFLATE_LITLEN_TABLE_SIZE	( ( 1 << INFLATE_LITLEN_TABLE_BITS ) + INFLATE_LITLEN_SYMBOLS * ( 1 << ( INFLATE_MAX_CODE_LENGTH - INFLATE_LITLEN_TABLE_BITS ) ) )
+#define INFLATE_DIST_TABLE_SIZE		( ( 1 << INFLATE_DIST_TABLE_BITS ) + INFLATE_DIST_SYMBOLS * ( 1 << ( INFLATE_MAX_CODE_LENGTH - INFLATE_DIST_TABLE_BITS ) ) )
+#define INFLATE_CODELEN_TABLE_SIZE	( 1 << INFLATE_CODELEN_TABLE_BITS )
+
+// Table entries are ( value << 16 ) | ( flags << 8 ) | codeword length; 0 marks an invalid codeword.
+// For lengths and distances the low flag bits hold the number of extra bits, for subtable pointers the subtable bits.
+#define INFLATE_ENTRY_LITERAL		0x80
+#define INFLATE_ENTRY_SUBTABLE		0x40
+#define INFLATE_ENTRY_END			0x20
+#define INFLATE_ENTRY_EXTRA_MASK	0x1F
+
+#define INFLATE_ENTRY( Value, Flags ) ( ( ( vlUInt32 )( Value ) << 16 ) | ( ( vlUInt32 )( Flags ) << 8 ) )
+
+static const vlUInt16 LengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const vlByte LengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const vlUInt16 DistBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const vlByte DistExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+static const vlByte CodeLengthOrder[INFLATE_CODELEN_SYMBOLS] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+static vlUInt32 LitLenEntry( vlUInt uiSymbol )
+{
+	if ( uiSymbol < 256 )
+		return INFLATE_ENTRY( uiSymbol, INFLATE_ENTRY_LITERAL );
+	if ( uiSymbol == 256 )
+		return INFLATE_ENTRY( 0, INFLATE_ENTRY_END );
+	if ( uiSymbol < 257 + 29 )
+		return INFLATE_ENTRY( LengthBase[uiSymbol - 257], LengthExtra[uiSymbol - 257] );
+	return 0;
+}
+
+static vlUInt32 DistEntry( vlUInt uiSymbol )
+{
+	return uiSymbol < 30 ? INFLATE_ENTRY( DistBase[uiSymbol], DistExtra[uiSymbol] ) : 0;
+}
+
+static vlUInt32 CodeLengthEntry( vlUInt uiSymbol )
+{
+	return INFLATE_ENTRY( uiSymbol, INFLATE_ENTRY_LITERAL );
+}
+
+//! Builds a decode table for canonical Huffman codes with the given lengths. Like zlib, the only incomplete
+//! codes accepted are a single codeword or none at all, and only when bAllowSingle is set.
+static vlBool BuildDecodeTable( vlUInt32 *lpTable, vlUInt uiTableBits, vlUInt uiTableSize, const vlByte *lpLengths, vlUInt uiSymbols, vlUInt32 ( *pfnEntry )( vlUInt ), vlBool bAllowSingle )
+{
+	vlUInt uiCount[INFLATE_MAX_CODE_LENGTH + 1] = {};
+	for ( vlUInt i = 0; i < uiSymbols; i++ )
+		uiCount[lpLengths[i]]++;
+	uiCount[0] = 0;
+
+	vlInt iLeft = 1;
+	for ( vlUInt uiLength = 1; uiLength <= INFLATE_MAX_CODE_LENGTH; uiLength++ )
+	{
+		iLeft = ( iLeft << 1 ) - ( vlInt )uiCount[uiLength];
+		if ( iLeft < 0 )
+			return vlFalse;
+	}
+
+	// Sort symbols by ( length, symbol ), which is canonical code order.
+	vlUInt uiOffset[INFLATE_MAX_CODE_LENGTH + 2] = {};
+	for ( vlUInt uiLength = 1; uiLength <= INFLATE_MAX_CODE_LENGTH; uiLength++ )
+		uiOffset[uiLength + 1] = uiOffset[uiLength] + uiCount[uiLength];
+
+	vlUInt16 uiSorted[INFLATE_LITLEN_SYMBOLS];
+	const vlUInt uiCodes = uiOffset[INFLATE_MAX_CODE_LENGTH + 1];
+	if ( iLeft > 0 && !( bAllowSingle && uiCodes <= 1 ) )
+		return vlFalse;
+
+	for ( vlUInt i = 0; i < uiSymbols; i++ )
+	{
+		if ( lpLengths[i] )
+			uiSorted[uiOffset[lpLengths[i]]++] = ( vlUInt16 )i;
+	}
+
+	// Codewords are read LSB first, so index the table by the bit reversed code.
+	vlUInt16 uiReversed[INFLATE_LITLEN_SYMBOLS];
+	vlUInt uiCode = 0, uiPrevLength = 0;
+	for ( vlUInt i = 0; i < uiCodes; i++ )
+	{
+		const vlUInt uiLength = lpLengths[uiSorted[i]];
+		uiCode <<= uiLength - uiPrevLength;
+		uiPrevLength = uiLength;
+
+		vlUInt uiReverse = 0;
+		for ( vlUInt j = 0; j < uiLength; j++ )
+			uiReverse |= ( ( uiCode >> j ) & 1 ) << ( uiLength - 1 - j );
+		uiReversed[i] = ( vlUInt16 )uiReverse;
+		uiCode++;
+	}
+
+	const vlUInt uiPrimarySize = 1u << uiTableBits;
+	memset( lpTable, 0, uiPrimarySize * sizeof( vlUInt32 ) );
+
+	vlUInt i = 0;
+	for ( ; i < uiCodes && lpLengths[uiSorted[i]] <= uiTableBits; i++ )
+	{
+		const vlUInt uiLength = lpLengths[uiSorted[i]];
+		const vlUInt32 uiEntry = pfnEntry( uiSorted[i] );
+		for ( vlUInt j = uiReversed[i]; j < uiPrimarySize; j += 1u << uiLength )
+			lpTable[j] = uiEntry ? uiEntry | uiLength : 0;
+	}
+
+	// Longer codes sharing their first uiTableBits bits are adjacent in canonical order, and the last one is the longest.
+	vlUInt uiUsed = uiPrimarySize;
+	while ( i < uiCodes )
+	{
+		const vlUInt uiPrefix = uiReversed[i] & ( uiPrimarySize - 1 );
+		vlUInt uiEnd = i + 1;
+		while ( uiEnd < uiCodes && ( uiReversed[uiEnd] & ( uiPrimarySize - 1 ) ) == uiPrefix )
+			uiEnd++;
+
+		const vlUInt uiSubBits = lpLengths[uiSorted[uiEnd - 1]] - uiTableBits;
+		const vlUInt uiSubSize = 1u << uiSubBits;
+		if ( uiUsed + uiSubSize > uiTableSize )
+			return vlFalse;
+
+		lpTable[uiPrefix] = INFLATE_ENTRY( uiUsed, INFLATE_ENTRY_SUBTABLE | uiSubBits ) | uiTableBits;
+		memset( lpTable + uiUsed, 0, uiSubSize * sizeof( vlUInt32 ) );
+
+		for ( ; i < uiEnd; i++ )
+		{
+			const vlUInt uiLength = lpLengths[uiSorted[i]] - uiTableBits;
+			const vlUInt32 uiEntry = pfnEntry( uiSorted[i] );
+			for ( vlUInt j = uiReversed[i] >> uiTableBits; j < uiSubSize; j += 1u << uiLength )
+				lpTable[uiUsed + j] = uiEntry ? uiEntry | uiLength : 0;
+		}
+
+		uiUsed += uiSubSize;
+	}
+
+	return vlTrue;
+}
+
+static inline unsigned long long LoadUInt64( const vlByte *lpSource )
+{
+	unsigned long long uiValue;
+	memcpy( &uiValue, lpSource, sizeof( uiValue ) );
+	return uiValue;
+}
+
+static inline vlVoid StoreUInt64( vlByte *lpDest, unsigned long long uiValue )
+{
+	memcpy( lpDest, &uiValue, sizeof( uiValue ) );
+}
+
+static vlUInt32 Adler32( const vlByte *lpData, vlUInt uiSize )
+{
+	vlUInt32 a = 1, b = 0;
+	while ( uiSize )
+	{
+		// 5552 is the most bytes that can be summed before b can overflow 32 bits.
+		vlUInt uiBlock = uiSize < 5552 ? uiSize : 5552;
+		uiSize -= uiBlock;
+
+		for ( ; uiBlock >= 8; uiBlock -= 8, lpData += 8 )
+		{
+			a += lpData[0]; b += a;
+			a += lpData[1]; b += a;
+			a += lpData[2]; b += a;
+			a += lpData[3]; b += a;
+			a += lpData[4]; b += a;
+			a += lpData[5]; b += a;
+			a += lpData[6]; b += a;
+			a += lpData[7]; b += a;
+		}
+
+		for ( ; uiBlock; uiBlock--, lpData++ )
+		{
+			a += *lpData;
+			b += a;
+		}
+
+		a %= 65521;
+		b %= 65521;
+	}
+
+	return ( b << 16 ) | a;
+}
+
+namespace
+{
+	struct SInflateTables
+	{
+		vlUInt32 LitLen[INFLATE_LITLEN_TABLE_SIZE];
+		vlUInt32 Dist[INFLATE_DIST_TABLE_SIZE];
+		vlUInt32 CodeLength[INFLATE_CODELEN_TABLE_SIZE];
+	};
+
+	class CBitReader
+	{
+	public:
+		CBitReader( const vlByte *lpSource, vlUInt uiSize ) : lpIn( lpSource ), lpInEnd( lpSource + uiSize ), uiBits( 0 ), uiBitCount( 0 ), uiOverread( 0 ) {}
+
+		//! Tops the buffer up to at least 56 bits; past the end of input zero bytes are shifted in and counted.
+		inline vlVoid Refill()
+		{
+			if ( this->lpInEnd - this->lpIn >= 8 )
+			{
+				this->uiBits |= LoadUInt64( this->lpIn ) << this->uiBitCount;
+				this->lpIn += ( 63 - this->uiBitCount ) >> 3;
+				this->uiBitCount |= 56;
+				return;
+			}
+
+			while ( this->uiBitCount <= 56 )
+			{
+				if ( this->lpIn < this->lpInEnd )
+					this->uiBits |= ( unsigned long long )*this->lpIn++ << this->uiBitCount;
+				else
+					this->uiOverread++;
+				this->uiBitCount += 8;
+			}
+		}
+
+		inline vlUInt Peek( vlUInt uiCount ) const
+		{
+			return ( vlUInt )( this->uiBits & ( ( 1ull << uiCount ) - 1 ) );
+		}
+
+		inline vlVoid Consume( vlUInt uiCount )
+		{
+			this->uiBits >>= uiCount;
+			this->uiBitCount -= uiCount;
+		}
+
+		inline vlUInt Read( vlUInt uiCount )
+		{
+			const vlUInt uiValue = this->Peek( uiCount );
+			this->Consume( uiCount );
+			return uiValue;
+		}
+
+		//! Drops the partial byte and hands the whole bytes still in the buffer back to the input.
+		vlBool AlignToByte()
+		{
+			this->Consume( this->uiBitCount & 7 );
+
+			vlUInt uiBytes = this->uiBitCount >> 3;
+			if ( uiBytes <= this->uiOverread )
+			{
+				this->uiOverread -= uiBytes;
+				uiBytes = 0;
+			}
+			else
+			{
+				uiBytes -= this->uiOverread;
+				this->uiOverread = 0;
+			}
+
+			this->lpIn -= uiBytes;
+			this->uiBits = 0;
+			this->uiBitCount = 0;
+			return this->uiOverread == 0;
+		}
+
+		const vlByte *lpIn;
+		const vlByte *lpInEnd;
+
+	private:
+		unsigned long long uiBits;
+		vlUInt uiBitCount;
+		vlUInt uiOverread;
+	};
+}
+
+//! Decodes one symbol; the caller has refilled the buffer.
+static inline vlUInt32 DecodeSymbol( CBitReader &Reader, const vlUInt32 *lpTable, vlUInt uiTableBits )
+{
+	vlUInt32 uiEntry = lpTable[Reader.Peek( uiTableBits )];
+	if ( ( uiEntry >> 8 ) & INFLATE_ENTRY_SUBTABLE )
+	{
+		Reader.Consume( uiTableBits );
+		uiEntry = lpTable[( uiEntry >> 16 ) + Reader.Peek( ( uiEntry >> 8 ) & INFLATE_ENTRY_EXTRA_MASK )];
+	}
+
+	Reader.Consume( uiEntry & 0xFF );
+	return uiEntry;
+}
+
+static vlBool ReadDynamicTables( CBitReader &Reader, SInflateTables &Tables )
+{
+	Reader.Refill();
+	const vlUInt uiLitLenCount = Reader.Read( 5 ) + 257;
+	const vlUInt uiDistCount = Reader.Read( 5 ) + 1;
+	const vlUInt uiCodeLengthCount = Reader.Read( 4 ) + 4;
+	if ( uiLitLenCount > 286 || uiDistCount > 30 )
+		return vlFalse;
+
+	// Up to 19 * 3 bits, one more than a refill guarantees.
+	vlByte uiCodeLengths[INFLATE_CODELEN_SYMBOLS] = {};
+	for ( vlUInt i = 0; i < uiCodeLengthCount; i++ )
+	{
+		if ( ( i & 15 ) == 0 )
+			Reader.Refill();
+		uiCodeLengths[CodeLengthOrder[i]] = ( vlByte )Reader.Read( 3 );
+	}
+
+	if ( !BuildDecodeTable( Tables.CodeLength, INFLATE_CODELEN_TABLE_BITS, INFLATE_CODELEN_TABLE_SIZE, uiCodeLengths, INFLATE_CODELEN_SYMBOLS, CodeLengthEntry, vlFalse ) )
+		return vlFalse;
+
+	vlByte uiLengths[INFLATE_LITLEN_SYMBOLS + INFLATE_DIST_SYMBOLS] = {};
+	const vlUInt uiTotal = uiLitLenCount + uiDistCount;
+	for ( vlUInt i = 0; i < uiTotal; )
+	{
+		Reader.Refill();
+		const vlUInt32 uiEntry = DecodeSymbol( Reader, Tables.CodeLength, INFLATE_CODELEN_TABLE_BITS );
+		if ( uiEntry == 0 )
+			return vlFalse;
+
+		const vlUInt uiSymbol = uiEntry >> 16;
+		if ( uiSymbol < 16 )
+		{
+			uiLengths[i++] = ( vlByte )uiSymbol;
+			continue;
+		}
+
+		vlByte uiRepeatLength = 0;
+		vlUInt uiRepeat;
+		if ( uiSymbol == 16 )
+		{
+			if ( i == 0 )
+				return vlFalse;
+			uiRepeatLength = uiLengths[i - 1];
+			uiRepeat = 3 + Reader.Read( 2 );
+		}
+		else if ( uiSymbol == 17 )
+		{
+			uiRepeat = 3 + Reader.Read( 3 );
+		}
+		else
+		{
+			uiRepeat = 11 + Reader.Read( 7 );
+		}
+
+		if ( i + uiRepeat > uiTotal )
+			return vlFalse;
+
+		memset( uiLengths + i, uiRepeatLength, uiRepeat );
+		i += uiRepeat;
+	}
+
+	if ( uiLengths[256] == 0 )
+		return vlFalse;
+
+	return BuildDecodeTable( Tables.LitLen, INFLATE_LITLEN_TABLE_BITS, INFLATE_LITLEN_TABLE_SIZE, uiLengths, uiLitLenCount, LitLenEntry, vlTrue ) &&
+		BuildDecodeTable( Tables.Dist, INFLATE_DIST_TABLE_BITS, INFLATE_DIST_TABLE_SIZE, uiLengths + uiLitLenCount, uiDistCount, DistEntry, vlTrue );
+}
+
+static vlVoid BuildFixedTables( SInflateTables &Tables )
+{
+	vlByte uiLengths[INFLATE_LITLEN_SYMBOLS + INFLATE_DIST_SYMBOLS];
+	memset( uiLengths, 8, 144 );
+	memset( uiLengths + 144, 9, 256 - 144 );
+	memset( uiLengths + 256, 7, 280 - 256 );
+	memset( uiLengths + 280, 8, INFLATE_LITLEN_SYMBOLS - 280 );
+	memset( uiLengths + INFLATE_LITLEN_SYMBOLS, 5, INFLATE_DIST_SYMBOLS );
+
+	BuildDecodeTable( Tables.LitLen, INFLATE_LITLEN_TABLE_BITS, INFLATE_LITLEN_TABLE_SIZE, uiLengths, INFLATE_LITLEN_SYMBOLS, LitLenEntry, vlTrue );
+	BuildDecodeTable( Tables.Dist, INFLATE_DIST_TABLE_BITS, INFLATE_DIST_TABLE_SIZE, uiLengths + INFLATE_LITLEN_SYMBOLS, INFLATE_DIST_SYMBOLS, DistEntry, vlTrue );
+}
+
+static vlBool InflateHuffmanBlock( CBitReader &Reader, const SInflateTables &Tables, vlByte *lpOutStart, vlByte *&lpOut, vlByte *lpOutEnd )
+{
+	vlByte *lpOutNext = lpOut;
+	for ( ;; )
+	{
+		// One refill covers the longest length (15 + 5 bits) plus distance (15 + 13 bits).
+		Reader.Refill();
+		const vlUInt32 uiEntry = DecodeSymbol( Reader, Tables.LitLen, INFLATE_LITLEN_TABLE_BITS );
+		const vlUInt uiFlags = ( uiEntry >> 8 ) & 0xFF;
+
+		if ( uiFlags & INFLATE_ENTRY_LITERAL )
+		{
+			if ( lpOutNext == lpOutEnd )
+				return vlFalse;
+			*lpOutNext++ = ( vlByte )( uiEntry >> 16 );
+			continue;
+		}
+
+		if ( uiFlags & INFLATE_ENTRY_END )
+			break;
+
+		if ( uiEntry == 0 )
+			return vlFalse;
+
+		const vlUInt uiLength = ( uiEntry >> 16 ) + Reader.Read( uiFlags & INFLATE_ENTRY_EXTRA_MASK );
+
+		const vlUInt32 uiDistEntry = DecodeSymbol( Reader, Tables.Dist, INFLATE_DIST_TABLE_BITS );
+		if ( uiDistEntry == 0 )
+			return vlFalse;
+
+		const vlUInt uiDist = ( uiDistEntry >> 16 ) + Reader.Read( ( uiDistEntry >> 8 ) & INFLATE_ENTRY_EXTRA_MASK );
+		if ( uiDist > ( vlUInt )( lpOutNext - lpOutStart ) || uiLength > ( vlUInt )( lpOutEnd - lpOutNext ) )
+			return vlFalse;
+
+		const vlByte *lpMatch = lpOutNext - uiDist;
+		vlByte *lpMatchEnd = lpOutNext + uiLength;
+		if ( uiDist >= 8 && lpOutEnd - lpMatchEnd >= 8 )
+		{
+			// Whole words may run up to 7 bytes past the match, those get overwritten later.
+			do
+			{
+				StoreUInt64( lpOutNext, LoadUInt64( lpMatch ) );
+				lpOutNext += 8;
+				lpMatch += 8;
+			} while ( lpOutNext < lpMatchEnd );
+			lpOutNext = lpMatchEnd;
+		}
+		else if ( uiDist == 1 )
+		{
+			memset( lpOutNext, *lpMatch, uiLength );
+			lpOutNext = lpMatchEnd;
+		}
+		else
+		{
+			while ( lpOutNext < lpMatchEnd )
+				*lpOutNext++ = *lpMatch++;
+		}
+	}
+
+	lpOut = lpOutNext;
+	return vlTrue;
+}
+
+vlBool InflateOneShot( const vlByte *lpSource, vlUInt uiSourceSize, vlByte *lpDest, vlUInt uiDestSize )
+{
+	// zlib header: deflate with a window of at most 32K, no preset dictionary.
+	if ( uiSourceSize < 2 + 4 )
+		return vlFalse;
+
+	const vlUInt uiCMF = lpSource[0], uiFLG = lpSource[1];
+	if ( ( uiCMF & 0x0F ) != 8 || ( uiCMF >> 4 ) > 7 || ( uiCMF * 256 + uiFLG ) % 31 != 0 || ( uiFLG & 0x20 ) )
+		return vlFalse;
+
+	SInflateTables *lpTables = new SInflateTables;
+	CBitReader Reader( lpSource + 2, uiSourceSize - 2 );
+
+	vlByte *lpOut = lpDest;
+	vlByte *lpOutEnd = lpDest + uiDestSize;
+	vlBool bResult = vlTrue;
+	vlBool bFinal = vlFalse;
+	vlInt iTables = -1;	// Block type the tables were last built for, fixed tables are reused across blocks.
+
+	while ( bResult && !bFinal )
+	{
+		Reader.Refill();
+		bFinal = ( vlBool )Reader.Read( 1 );
+		const vlUInt uiType = Reader.Read( 2 );
+
+		if ( uiType == 0 )
+		{
+			if ( !Reader.AlignToByte() || Reader.lpInEnd - Reader.lpIn < 4 )
+			{
+				bResult = vlFalse;
+				break;
+			}
+
+			const vlUInt uiLength = Reader.lpIn[0] | ( Reader.lpIn[1] << 8 );
+			const vlUInt uiNLength = Reader.lpIn[2] | ( Reader.lpIn[3] << 8 );
+			Reader.lpIn += 4;
+			if ( uiLength != ( ~uiNLength & 0xFFFF ) || uiLength > ( vlUInt )( Reader.lpInEnd - Reader.lpIn ) || uiLength > ( vlUInt )( lpOutEnd - lpOut ) )
+			{
+				bResult = vlFalse;
+				break;
+			}
+
+			memcpy( lpOut, Reader.lpIn, uiLength );
+			Reader.lpIn += uiLength;
+			lpOut += uiLength;
+		}
+		else if ( uiType == 1 )
+		{
+			if ( iTables != 1 )
+			{
+				BuildFixedTables( *lpTables );
+				iTables = 1;
+			}
+			bResult = InflateHuffmanBlock( Reader, *lpTables, lpDest, lpOut, lpOutEnd );
+		}
+		else if ( uiType == 2 )
+		{
+			iTables = 2;
+			bResult = ReadDynamicTables( Reader, *lpTables ) && InflateHuffmanBlock( Reader, *lpTables, lpDest, lpOut, lpOutEnd );
+		}
+		else
+		{
+			bResult = vlFalse;
+		}
+	}
+
+	delete lpTables;
+
+	// Adler-32 of the output follows the last block, most significant byte first.
+	if ( !bResult || lpOut != lpOutEnd || !Reader.AlignToByte() || Reader.lpInEnd - Reader.lpIn < 4 )
+		return vlFalse;
+
+	const vlUInt32 uiAdler = ( ( vlUInt32 )Reader.lpIn[0] << 24 ) | ( ( vlUInt32 )Reader.lpIn[1] << 16 ) | ( ( vlUInt32 )Reader.lpIn[2] << 8 ) | Reader.lpIn[3];
+	return uiAdler == Adler32( lpDest, uiDestSize );
+}
@@ -0,0 +1,26 @@
+﻿#pragma once
+
+#include "vtffile.h"
+
+typedef enum tagVTFInflateBackend
+{
+	VTF_INFLATE_AUTO = 0,	//!< One-shot for faces up to INFLATE_ONESHOT_MAX_SIZE, streamed zlib above that.
+	VTF_INFLATE_ZLIB,		//!< zlib, whole faces are streamed through the decoder.
+	VTF_INFLATE_ONESHOT,	//!< Built-in whole buffer decoder, needs the full face in memory.
+	VTF_INFLATE_COUNT
+} VTFInflateBackend;
+
+//! Largest decompressed face VTF_INFLATE_AUTO inflates in one go.
+#define INFLATE_ONESHOT_MAX_SIZE ( 4 * 1024 * 1024 )
+
+//! Inflates a zlib stream that must decode to exactly uiDestSize bytes.
+typedef vlBool ( *InflateFunc )( const vlByte *lpSource, vlUInt uiSourceSize, vlByte *lpDest, vlUInt uiDestSize );
+
+vlBool InflateZlib( const vlByte *lpSource, vlUInt uiSourceSize, vlByte *lpDest, vlUInt uiDestSize );
+
+//! Decodes the whole stream in one call with table driven Huffman decoding, checking the Adler-32 trailer like zlib.
+vlBool InflateOneShot( const vlByte *lpSource, vlUInt uiSourceSize, vlByte *lpDest, vlUInt uiDestSize );
+
+//! Process wide backend used by CVTFFile::Convert for aux compressed images.
+vlVoid SetInflateBackend( VTFInflateBackend Backend );
+VTFInflateBackend GetInflateBackend();
@@ -0,0 +1,200 @@
+﻿#include "normalmap.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined( _M_X64 ) || defined( _M_IX86 ) || defined( __x86_64__ ) || defined( __i386__ )
+#define NORMALMAP_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define NORMALMAP_TARGET_SSE2
+#define NORMALMAP_TARGET_AVX2
+#else
+#define NORMALMAP_TARGET_SSE2 __attribute__( ( target( "sse2" ) ) )
+#define NORMALMAP_TARGET_AVX2 __attribute__( ( target( "avx2" ) ) )
+#endif
+#endif
+
+// Direction towards the light, normalize( -1, -1, 2 ).
+#define LIGHT_X -0.40824829f
+#define LIGHT_Y -0.40824829f
+#define LIGHT_Z 0.81649658f
+
+// Source's bump basis; an SSBump texel weights these three directions and their sum is its normal.
+#define BASIS0_X 0.81649661f
+#define BASIS0_Y 0.0f
+#define BASIS1_X -0.40824831f
+#define BASIS1_Y 0.70710677f
+#define BASIS2_X -0.40824831f
+#define BASIS2_Y -0.70710677f
+#define BASIS_Z 0.57735026f
+
+//! Normals shorter than this, blank SSBump texels mostly, get the ambient gray.
+#define NORMALMAP_MIN_LENGTH 1e-6f
+
+#define SHADE_SCALE ( ( 1.0f - NORMALMAP_AMBIENT ) * 255.0f )
+#define SHADE_BIAS ( NORMALMAP_AMBIENT * 255.0f + 0.5f )
+
+//
+// Scalar. Every level does the same operations in the same order and sqrt and division are exact,
+// so all of them give the same bytes.
+//
+
+static inline vlByte Shade( vlSingle fX, vlSingle fY, vlSingle fZ )
+{
+	// Normalizing after the dot product saves scaling all three components.
+	const vlSingle fDot = ( fX * LIGHT_X + fY * LIGHT_Y ) + fZ * LIGHT_Z;
+	const vlSingle fLength = std::sqrt( ( fX * fX + fY * fY ) + fZ * fZ );
+	const vlSingle fLight = fDot / std::max( fLength, NORMALMAP_MIN_LENGTH );
+	return ( vlByte )std::min( std::max( fLight, 0.0f ) * SHADE_SCALE + SHADE_BIAS, 255.0f );
+}
+
+template<vlBool bBGRA, vlBool bSSBump>
+static vlVoid ShadeRowScalar( vlByte *lpPixels, size_t uiPixels )
+{
+	for ( size_t i = 0; i < uiPixels; i++, lpPixels += 4 )
+	{
+		const vlSingle fRed = lpPixels[bBGRA ? 2 : 0];
+		const vlSingle fGreen = lpPixels[1];
+		const vlSingle fBlue = lpPixels[bBGRA ? 0 : 2];
+
+		vlByte uiGray;
+		if ( bSSBump )
+		{
+			// The length is divided out, so the weights can stay in 0 to 255.
+			uiGray = Shade( ( fRed * BASIS0_X + fGreen * BASIS1_X ) + fBlue * BASIS2_X, ( fRed * BASIS0_Y + fGreen * BASIS1_Y ) + fBlue * BASIS2_Y, ( fRed + fGreen + fBlue ) * BASIS_Z );
+		}
+		else
+		{
+			uiGray = Shade( fRed * ( 2.0f / 255.0f ) - 1.0f, fGreen * ( 2.0f / 255.0f ) - 1.0f, fBlue * ( 2.0f / 255.0f ) - 1.0f );
+		}
+
+		lpPixels[0] = lpPixels[1] = lpPixels[2] = uiGray;
+		lpPixels[3] = 255;
+	}
+}
+
+#ifdef NORMALMAP_X86
+//
+// SSE2, four pixels per register with each channel widened to its own float vector.
+//
+
+NORMALMAP_TARGET_SSE2 static inline __m128i ShadeSSE2( __m128 X, __m128 Y, __m128 Z )
+{
+	const __m128 Dot = _mm_add_ps( _mm_add_ps( _mm_mul_ps( X, _mm_set1_ps( LIGHT_X ) ), _mm_mul_ps( Y, _mm_set1_ps( LIGHT_Y ) ) ), _mm_mul_ps( Z, _mm_set1_ps( LIGHT_Z ) ) );
+	const __m128 Length = _mm_sqrt_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( X, X ), _mm_mul_ps( Y, Y ) ), _mm_mul_ps( Z, Z ) ) );
+	const __m128 Light = _mm_max_ps( _mm_div_ps( Dot, _mm_max_ps( Length, _mm_set1_ps( NORMALMAP_MIN_LENGTH ) ) ), _mm_setzero_ps() );
+	const __m128i Gray = _mm_cvttps_epi32( _mm_min_ps( _mm_add_ps( _mm_mul_ps( Light, _mm_set1_ps( SHADE_SCALE ) ), _mm_set1_ps( SHADE_BIAS ) ), _mm_set1_ps( 255.0f ) ) );
+	return _mm_or_si128( _mm_or_si128( Gray, _mm_slli_epi32( Gray, 8 ) ), _mm_or_si128( _mm_slli_epi32( Gray, 16 ), _mm_set1_epi32( 0xFF000000 ) ) );
+}
+
+template<vlBool bBGRA, vlBool bSSBump>
+NORMALMAP_TARGET_SSE2 static vlVoid ShadeRowSSE2( vlByte *lpPixels, size_t uiPixels )
+{
+	const __m128i Mask = _mm_set1_epi32( 0xFF );
+
+	size_t i = 0;
+	for ( ; i + 4 <= uiPixels; i += 4 )
+	{
+		const __m128i Pixels = _mm_loadu_si128( ( const __m128i * )( lpPixels + i * 4 ) );
+		const __m128 Red = _mm_cvtepi32_ps( _mm_and_si128( bBGRA ? _mm_srli_epi32( Pixels, 16 ) : Pixels, Mask ) );
+		const __m128 Green = _mm_cvtepi32_ps( _mm_and_si128( _mm_srli_epi32( Pixels, 8 ), Mask ) );
+		const __m128 Blue = _mm_cvtepi32_ps( _mm_and_si128( bBGRA ? Pixels : _mm_srli_epi32( Pixels, 16 ), Mask ) );
+
+		__m128i Gray;
+		if ( bSSBump )
+		{
+			const __m128 X = _mm_add_ps( _mm_add_ps( _mm_mul_ps( Red, _mm_set1_ps( BASIS0_X ) ), _mm_mul_ps( Green, _mm_set1_ps( BASIS1_X ) ) ), _mm_mul_ps( Blue, _mm_set1_ps( BASIS2_X ) ) );
+			const __m128 Y = _mm_add_ps( _mm_add_ps( _mm_mul_ps( Red, _mm_set1_ps( BASIS0_Y ) ), _mm_mul_ps( Green, _mm_set1_ps( BASIS1_Y ) ) ), _mm_mul_ps( Blue, _mm_set1_ps( BASIS2_Y ) ) );
+			const __m128 Z = _mm_mul_ps( _mm_add_ps( _mm_add_ps( Red, Green ), Blue ), _mm_set1_ps( BASIS_Z ) );
+			Gray = ShadeSSE2( X, Y, Z );
+		}
+		else
+		{
+			const __m128 Scale = _mm_set1_ps( 2.0f / 255.0f );
+			const __m128 One = _mm_set1_ps( 1.0f );
+			Gray = ShadeSSE2( _mm_sub_ps( _mm_mul_ps( Red, Scale ), One ), _mm_sub_ps( _mm_mul_ps( Green, Scale ), One ), _mm_sub_ps( _mm_mul_ps( Blue, Scale ), One ) );
+		}
+
+		_mm_storeu_si128( ( __m128i * )( lpPixels + i * 4 ), Gray );
+	}
+
+	ShadeRowScalar<bBGRA, bSSBump>( lpPixels + i * 4, uiPixels - i );
+}
+
+//
+// AVX2, the same steps on eight pixels. Only avx2 is enabled, so nothing gets fused into FMAs that would
+// round differently from the other levels.
+//
+
+NORMALMAP_TARGET_AVX2 static inline __m256i ShadeAVX2( __m256 X, __m256 Y, __m256 Z )
+{
+	const __m256 Dot = _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( X, _mm256_set1_ps( LIGHT_X ) ), _mm256_mul_ps( Y, _mm256_set1_ps( LIGHT_Y ) ) ), _mm256_mul_ps( Z, _mm256_set1_ps( LIGHT_Z ) ) );
+	const __m256 Length = _mm256_sqrt_ps( _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( X, X ), _mm256_mul_ps( Y, Y ) ), _mm256_mul_ps( Z, Z ) ) );
+	const __m256 Light = _mm256_max_ps( _mm256_div_ps( Dot, _mm256_max_ps( Length, _mm256_set1_ps( NORMALMAP_MIN_LENGTH ) ) ), _mm256_setzero_ps() );
+	const __m256i Gray = _mm256_cvttps_epi32( _mm256_min_ps( _mm256_add_ps( _mm256_mul_ps( Light, _mm256_set1_ps( SHADE_SCALE ) ), _mm256_set1_ps( SHADE_BIAS ) ), _mm256_set1_ps( 255.0f ) ) );
+	return _mm256_or_si256( _mm256_or_si256( Gray, _mm256_slli_epi32( Gray, 8 ) ), _mm256_or_si256( _mm256_slli_epi32( Gray, 16 ), _mm256_set1_epi32( 0xFF000000 ) ) );
+}
+
+template<vlBool bBGRA, vlBool bSSBump>
+NORMALMAP_TARGET_AVX2 static vlVoid ShadeRowAVX2( vlByte *lpPixels, size_t uiPixels )
+{
+	const __m256i Mask = _mm256_set1_epi32( 0xFF );
+
+	size_t i = 0;
+	for ( ; i + 8 <= uiPixels; i += 8 )
+	{
+		const __m256i Pixels = _mm256_loadu_si256( ( const __m256i * )( lpPixels + i * 4 ) );
+		const __m256 Red = _mm256_cvtepi32_ps( _mm256_and_si256( bBGRA ? _mm256_srli_epi32( Pixels, 16 ) : Pixels, Mask ) );
+		const __m256 Green = _mm256_cvtepi32_ps( _mm256_and_si256( _mm256_srli_epi32( Pixels, 8 ), Mask ) );
+		const __m256 Blue = _mm256_cvtepi32_ps( _mm256_and_si256( bBGRA ? Pixels : _mm256_srli_epi32( Pixels, 16 ), Mask ) );
+
+		__m256i Gray;
+		if ( bSSBump )
+		{
+			const __m256 X = _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( Red, _mm256_set1_ps( BASIS0_X ) ), _mm256_mul_ps( Green, _mm256_set1_ps( BASIS1_X ) ) ), _mm256_mul_ps( Blue, _mm256_set1_ps( BASIS2_X ) ) );
+			const __m256 Y = _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( Red, _mm256_set1_ps( BASIS0_Y ) ), _mm256_mul_ps( Green, _mm256_set1_ps( BASIS1_Y ) ) ), _mm256_mul_ps( Blue, _mm256_set1_ps( BASIS2_Y ) ) );
+			const __m256 Z = _mm256_mul_ps( _mm256_add_ps( _mm256_add_ps( Red, Green ), Blue ), _mm256_set1_ps( BASIS_Z ) );
+			Gray = ShadeAVX2( X, Y, Z );
+		}
+		else
+		{
+			const __m256 Scale = _mm256_set1_ps( 2.0f / 255.0f );
+			const __m256 One = _mm256_set1_ps( 1.0f );
+			Gray = ShadeAVX2( _mm256_sub_ps( _mm256_mul_ps( Red, Scale ), One ), _mm256_sub_ps( _mm256_mul_ps( Green, Scale ), One ), _mm256_sub_ps( _mm256_mul_ps( Blue, Scale ), One ) );
+		}
+
+		_mm256_storeu_si256( ( __m256i * )( lpPixels + i * 4 ), Gray );
+	}
+
+	// Leave the upper halves clean for the SSE2 code that usually follows.
+	_mm256_zeroupper();
+	ShadeRowSSE2<bBGRA, bSSBump>( lpPixels + i * 4, uiPixels - i );
+}
+#endif
+
+#define NORMALMAP_FUNCTIONS( Suffix ) { { ShadeRow##Suffix<vlFalse, vlFalse>, ShadeRow##Suffix<vlTrue, vlFalse> }, { ShadeRow##Suffix<vlFalse, vlTrue>, ShadeRow##Suffix<vlTrue, vlTrue> } }
+
+static const SNormalMapFunctions NormalMapFunctions[BCDECODE_COUNT] =
+{
+	NORMALMAP_FUNCTIONS( Scalar ),
+#ifdef NORMALMAP_X86
+	NORMALMAP_FUNCTIONS( SSE2 ),
+	NORMALMAP_FUNCTIONS( AVX2 ),
+#else
+	NORMALMAP_FUNCTIONS( Scalar ),
+	NORMALMAP_FUNCTIONS( Scalar ),
+#endif
+};
+
+const SNormalMapFunctions &GetNormalMapFunctions()
+{
+	return NormalMapFunctions[GetBCDecodeLevel()];
+}
+
+const SNormalMapFunctions &GetNormalMapFunctions( BCDecodeLevel Level )
+{
+	if ( Level < BCDECODE_SCALAR || Level > GetBCDecodeLevel() )
+		Level = GetBCDecodeLevel();
+
+	return NormalMapFunctions[Level];
+}
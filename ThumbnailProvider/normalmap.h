@@ -0,0 +1,28 @@
+﻿#pragma once
+
+#include "bcdec_simd.h"
+#include <cstddef>
+
+//
+// Normal map previews. A tangent space normal map shown as colors says little about the surface, so its
+// thumbnail is shaded instead: every texel becomes the gray of a lit surface with that normal, the light
+// coming from the top left with green pointing down the image as Source's normal maps have it.
+//
+
+//! Gray of a texel facing away from the light, so such areas keep some of their shape.
+#define NORMALMAP_AMBIENT 0.25f
+
+//! Replaces uiPixels RGBA8888 or BGRA8888 pixels in place by their shading, gray in color and opaque.
+typedef vlVoid ( *ShadeRowFunc )( vlByte *lpPixels, size_t uiPixels );
+
+struct SNormalMapFunctions
+{
+	ShadeRowFunc Normal[BCDECODE_ORDER_COUNT];		//!< Red, green and blue hold X, Y and Z mapped from [-1, 1]. Indexed by BCDecodeOrder.
+	ShadeRowFunc SSBump[BCDECODE_ORDER_COUNT];		//!< Red, green and blue weight the three directions of Source's bump basis.
+};
+
+//! Functions for the running CPU, using the same levels as the block decoders.
+const SNormalMapFunctions &GetNormalMapFunctions();
+
+//! Functions for a specific level, clamped to what the running CPU supports.
+const SNormalMapFunctions &GetNormalMapFunctions( BCDecodeLevel Level );
@@ -0,0 +1,94 @@
+﻿#include "readers.h"
+#include <cstdint>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace IO::Readers;
+
+CMappedFileReader::CMappedFileReader( const vlChar *cFileName ) : CMemoryReader( 0, 0 )
+{
+	this->hFile = 0;
+	this->hMapping = 0;
+
+#ifdef _WIN32
+	HANDLE hFile = CreateFileA( cFileName, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0 );
+	if ( hFile == INVALID_HANDLE_VALUE )
+	{
+		return;
+	}
+
+	LARGE_INTEGER liSize;
+	if ( !GetFileSizeEx( hFile, &liSize ) || liSize.QuadPart == 0 || ( unsigned long long )liSize.QuadPart > SIZE_MAX )
+	{
+		CloseHandle( hFile );
+		return;
+	}
+
+	HANDLE hMapping = CreateFileMappingA( hFile, 0, PAGE_READONLY, 0, 0, 0 );
+	if ( hMapping == 0 )
+	{
+		CloseHandle( hFile );
+		return;
+	}
+
+	const vlVoid *vData = MapViewOfFile( hMapping, FILE_MAP_READ, 0, 0, 0 );
+	if ( vData == 0 )
+	{
+		CloseHandle( hMapping );
+		CloseHandle( hFile );
+		return;
+	}
+
+	this->hFile = hFile;
+	this->hMapping = hMapping;
+	this->vData = vData;
+	this->uiBufferSize = ( vlUInt64 )liSize.QuadPart;
+#else
+	int iFile = open( cFileName, O_RDONLY );
+	if ( iFile < 0 )
+	{
+		return;
+	}
+
+	struct stat Stat;
+	if ( fstat( iFile, &Stat ) != 0 || Stat.st_size == 0 || ( unsigned long long )Stat.st_size > SIZE_MAX )
+	{
+		close( iFile );
+		return;
+	}
+
+	vlVoid *vData = mmap( 0, ( size_t )Stat.st_size, PROT_READ, MAP_PRIVATE, iFile, 0 );
+	close( iFile );
+
+	if ( vData == MAP_FAILED )
+	{
+		return;
+	}
+
+	this->vData = vData;
+	this->uiBufferSize = ( vlUInt64 )Stat.st_size;
+#endif
+}
+
+CMappedFileReader::~CMappedFileReader()
+{
+	if ( this->vData == 0 )
+	{
+		return;
+	}
+
+#ifdef _WIN32
+	UnmapViewOfFile( this->vData );
+	CloseHandle( this->hMapping );
+	CloseHandle( this->hFile );
+#else
+	munmap( const_cast<vlVoid *>( this->vData ), ( size_t )this->uiBufferSize );
+#endif
+}
@@ -0,0 +1,380 @@
+﻿#pragma once
+
+#include "vtffile.h"
+#include <cstdio>
+#include <cstring>
+#ifndef _MSC_VER
+#include <sys/types.h>
+#endif
+
+namespace IO
+{
+	namespace Readers
+	{
+		class IReader
+		{
+		public:
+			virtual ~IReader() {}
+
+			virtual vlBool Opened() const = 0;
+
+			virtual vlBool Open() = 0;
+			virtual vlVoid Close() = 0;
+
+			virtual vlUInt64 GetStreamSize() const = 0;
+			virtual vlUInt64 GetStreamPointer() const = 0;
+
+			virtual vlUInt64 Seek( vlInt64 lOffset, vlUInt uiMode ) = 0;
+
+			virtual vlBool Read( vlChar &cChar ) = 0;
+			//! Reads at most uiBytes, larger ranges are read in several calls.
+			virtual vlUInt Read( vlVoid *vData, vlUInt uiBytes ) = 0;
+
+			//! Direct pointer to uiBytes at uiOffset that stays valid after Close, or 0 if the reader cannot provide one.
+			virtual const vlVoid *Map( vlUInt64 uiOffset, vlUInt64 uiBytes ) = 0;
+		};
+		class CMemoryReader : public IReader
+		{
+		protected:
+			vlBool bOpened;
+
+			const vlVoid *vData;
+			vlUInt64 uiBufferSize;
+
+			vlUInt64 uiPointer;
+
+		public:
+			CMemoryReader( const vlVoid *vData, vlUInt64 uiBufferSize )
+			{
+				this->bOpened = vlFalse;
+
+				this->vData = vData;
+				this->uiBufferSize = uiBufferSize;
+			}
+			~CMemoryReader()
+			{
+			}
+
+		public:
+			virtual vlBool Opened() const
+			{
+				return this->bOpened;
+			}
+
+			virtual vlBool Open()
+			{
+				if ( vData == 0 )
+				{
+					return vlFalse;
+				}
+
+				this->uiPointer = 0;
+
+				this->bOpened = vlTrue;
+
+				return vlTrue;
+			}
+			virtual vlVoid Close()
+			{
+				this->bOpened = vlFalse;
+			}
+
+			virtual vlUInt64 GetStreamSize() const
+			{
+				if ( !this->bOpened )
+				{
+					return 0;
+				}
+
+				return this->uiBufferSize;
+			}
+			virtual vlUInt64 GetStreamPointer() const
+			{
+				if ( !this->bOpened )
+				{
+					return 0;
+				}
+
+				return this->uiPointer;
+			}
+
+			virtual vlUInt64 Seek( vlInt64 lOffset, vlUInt uiMode )
+			{
+				if ( !this->bOpened )
+				{
+					return 0;
+				}
+
+				switch ( uiMode )
+				{
+				case 0:
+					this->uiPointer = 0;
+					break;
+				case 1:
+
+					break;
+				case ( vlUInt )-1:
+					this->uiPointer = this->uiBufferSize;
+					break;
+				}
+
+				vlInt64 lPointer = ( vlInt64 )this->uiPointer + lOffset;
+
+				if ( lPointer < 0 )
+				{
+					lPointer = 0;
+				}
+
+				if ( lPointer >( vlInt64 )this->uiBufferSize )
+				{
+					lPointer = ( vlInt64 )this->uiBufferSize;
+				}
+
+				this->uiPointer = ( vlUInt64 )lPointer;
+
+				return this->uiPointer;
+			}
+
+			vlBool Read( vlChar &cChar )
+			{
+				if ( !this->bOpened )
+				{
+					return vlFalse;
+				}
+
+				if ( this->uiPointer == this->uiBufferSize )
+				{
+					return vlFalse;
+				}
+				else
+				{
+					cChar = *( ( vlChar * )this->vData + this->uiPointer++ );
+
+					return vlTrue;
+				}
+			}
+
+			virtual vlUInt Read( vlVoid *vData, vlUInt uiBytes )
+			{
+				if ( !this->bOpened )
+				{
+					return 0;
+				}
+
+				if ( this->uiPointer == this->uiBufferSize )
+				{
+					return 0;
+				}
+				else if ( uiBytes > this->uiBufferSize - this->uiPointer )
+				{
+					uiBytes = ( vlUInt )( this->uiBufferSize - this->uiPointer );
+
+					memcpy( vData, ( vlByte * )this->vData + this->uiPointer, uiBytes );
+
+					this->uiPointer = this->uiBufferSize;
+
+					return uiBytes;
+				}
+				else
+				{
+					memcpy( vData, ( vlByte * )this->vData + this->uiPointer, uiBytes );
+
+					this->uiPointer += uiBytes;
+
+					return uiBytes;
+				}
+			}
+
+			virtual const vlVoid *Map( vlUInt64 uiOffset, vlUInt64 uiBytes )
+			{
+				if ( !this->bOpened )
+				{
+					return 0;
+				}
+
+				if ( uiOffset > this->uiBufferSize || uiBytes > this->uiBufferSize - uiOffset )
+				{
+					return 0;
+				}
+
+				return ( const vlByte * )this->vData + uiOffset;
+			}
+		};
+
+		class CFileReader : public IReader
+		{
+		private:
+			FILE *hFile;
+			vlChar *cFileName;
+			vlUInt64 uiFileSize;	//!< Taken at Open, every Seek clamps to it.
+
+			// ftell and fseek take a long, which is 32-bit on Windows.
+			static vlInt64 Tell( FILE *hFile )
+			{
+#ifdef _MSC_VER
+				return _ftelli64( hFile );
+#else
+				return ftello( hFile );
+#endif
+			}
+			static vlBool SeekTo( FILE *hFile, vlInt64 lOffset, int iOrigin )
+			{
+#ifdef _MSC_VER
+				return _fseeki64( hFile, lOffset, iOrigin ) == 0;
+#else
+				return fseeko( hFile, ( off_t )lOffset, iOrigin ) == 0;
+#endif
+			}
+
+		public:
+			CFileReader( const vlChar *cFileName )
+			{
+				this->hFile = 0;
+				this->uiFileSize = 0;
+
+				size_t uiLength = strlen( cFileName ) + 1;
+				this->cFileName = new vlChar[uiLength];
+				memcpy( this->cFileName, cFileName, uiLength );
+			}
+			~CFileReader()
+			{
+				this->Close();
+
+				delete[]this->cFileName;
+			}
+
+		public:
+			virtual vlBool Opened() const
+			{
+				return this->hFile != 0;
+			}
+
+			virtual vlBool Open()
+			{
+				this->Close();
+
+#ifdef _MSC_VER
+				if ( fopen_s( &this->hFile, this->cFileName, "rb" ) != 0 )
+				{
+					this->hFile = 0;
+				}
+#else
+				this->hFile = fopen( this->cFileName, "rb" );
+#endif
+
+				if ( this->hFile != 0 )
+				{
+					const vlInt64 lSize = SeekTo( this->hFile, 0, SEEK_END ) ? Tell( this->hFile ) : -1;
+					if ( lSize < 0 || !SeekTo( this->hFile, 0, SEEK_SET ) )
+					{
+						this->Close();
+						return vlFalse;
+					}
+					this->uiFileSize = ( vlUInt64 )lSize;
+				}
+
+				return this->hFile != 0;
+			}
+			virtual vlVoid Close()
+			{
+				if ( this->hFile != 0 )
+				{
+					fclose( this->hFile );
+					this->hFile = 0;
+				}
+				this->uiFileSize = 0;
+			}
+
+			virtual vlUInt64 GetStreamSize() const
+			{
+				return this->uiFileSize;
+			}
+			virtual vlUInt64 GetStreamPointer() const
+			{
+				if ( this->hFile == 0 )
+				{
+					return 0;
+				}
+
+				vlInt64 lPointer = Tell( this->hFile );
+
+				return lPointer < 0 ? 0 : ( vlUInt64 )lPointer;
+			}
+
+			virtual vlUInt64 Seek( vlInt64 lOffset, vlUInt uiMode )
+			{
+				if ( this->hFile == 0 )
+				{
+					return 0;
+				}
+
+				vlInt64 lPointer;
+				switch ( uiMode )
+				{
+				case 0:
+					lPointer = 0;
+					break;
+				case 1:
+					lPointer = ( vlInt64 )this->GetStreamPointer();
+					break;
+				default:
+					lPointer = ( vlInt64 )this->uiFileSize;
+					break;
+				}
+
+				lPointer += lOffset;
+
+				if ( lPointer < 0 )
+				{
+					lPointer = 0;
+				}
+
+				if ( lPointer > ( vlInt64 )this->uiFileSize )
+				{
+					lPointer = ( vlInt64 )this->uiFileSize;
+				}
+
+				SeekTo( this->hFile, lPointer, SEEK_SET );
+
+				return ( vlUInt64 )lPointer;
+			}
+
+			virtual vlBool Read( vlChar &cChar )
+			{
+				if ( this->hFile == 0 )
+				{
+					return vlFalse;
+				}
+
+				return fread( &cChar, 1, 1, this->hFile ) == 1;
+			}
+
+			virtual vlUInt Read( vlVoid *vData, vlUInt uiBytes )
+			{
+				if ( this->hFile == 0 )
+				{
+					return 0;
+				}
+
+				return ( vlUInt )fread( vData, 1, uiBytes, this->hFile );
+			}
+
+			virtual const vlVoid *Map( vlUInt64, vlUInt64 )
+			{
+				return 0;
+			}
+		};
+
+		//! Memory maps a whole file, so CVTFFile can borrow its image data without copying it.
+		class CMappedFileReader : public CMemoryReader
+		{
+		private:
+			vlVoid *hFile;
+			vlVoid *hMapping;
+
+		public:
+			CMappedFileReader( const vlChar *cFileName );
+			~CMappedFileReader();
+		};
+	}
+}
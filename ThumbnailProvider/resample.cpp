@@ -0,0 +1,550 @@
+﻿#include "resample.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined( _M_X64 ) || defined( _M_IX86 ) || defined( __x86_64__ ) || defined( __i386__ )
+#define RESAMPLE_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define RESAMPLE_TARGET_SSE2
+#define RESAMPLE_TARGET_AVX2
+#else
+#define RESAMPLE_TARGET_SSE2 __attribute__( ( target( "sse2" ) ) )
+#define RESAMPLE_TARGET_AVX2 __attribute__( ( target( "avx2" ) ) )
+#endif
+#endif
+
+//
+// Separable resampling: every source row is premultiplied to floats once and filtered horizontally
+// into a ring of uiTaps rows, then each output row sums its rows of the ring and divides alpha back out.
+// All levels add the same products in the same order without fused multiply-adds, so they are bit-exact.
+//
+
+static const double ResampleSupport[RESAMPLE_FILTER_COUNT] = { 0.5, 1.0, 3.0 };
+
+static double ResampleKernel( ResampleFilter Filter, double x )
+{
+	switch ( Filter )
+	{
+	case RESAMPLE_BOX:
+		return x > -0.5 && x <= 0.5 ? 1.0 : 0.0;
+	case RESAMPLE_BILINEAR:
+		x = fabs( x );
+		return x < 1.0 ? 1.0 - x : 0.0;
+	case RESAMPLE_LANCZOS3:
+		if ( x == 0.0 )
+			return 1.0;
+		if ( x <= -3.0 || x >= 3.0 )
+			return 0.0;
+		x *= 3.14159265358979323846;
+		return 3.0 * sin( x ) * sin( x / 3.0 ) / ( x * x );
+	default:
+		return 0.0;
+	}
+}
+
+namespace
+{
+	//! Source range and weights of every output pixel along one axis.
+	struct SResampleAxis
+	{
+		SResampleAxis() : uiTaps( 0 ), lpStart( 0 ), lpWeights( 0 ) {}
+		~SResampleAxis()
+		{
+			delete[] this->lpStart;
+			delete[] this->lpWeights;
+		}
+
+		vlUInt uiTaps;		//!< Weights per output pixel, the widest footprint.
+		vlUInt *lpStart;	//!< First source pixel, moved left near the far edge so all uiTaps stay in range.
+		float *lpWeights;	//!< uiTaps weights per output pixel, zero where the footprint is narrower.
+	};
+}
+
+static vlVoid BuildResampleAxis( SResampleAxis &Axis, vlUInt uiSource, vlUInt uiDest, ResampleFilter Filter )
+{
+	const double dScale = ( double )uiSource / uiDest;
+	const double dFilterScale = std::max( dScale, 1.0 );
+	const double dSupport = ResampleSupport[Filter] * dFilterScale;
+
+	// Footprints are clamped to the image, so none is wider than the source.
+	Axis.uiTaps = std::min( ( vlUInt )ceil( dSupport * 2.0 ) + 1, uiSource );
+	Axis.lpStart = new vlUInt[uiDest];
+	Axis.lpWeights = new float[uiDest * Axis.uiTaps];
+
+	double *lpWeights = new double[Axis.uiTaps];
+	for ( vlUInt i = 0; i < uiDest; i++ )
+	{
+		const double dCenter = ( i + 0.5 ) * dScale;
+		const vlInt iMin = std::max( ( vlInt )floor( dCenter - dSupport + 0.5 ), 0 );
+		const vlInt iMax = std::min( ( vlInt )floor( dCenter + dSupport + 0.5 ), ( vlInt )uiSource );
+		const vlUInt uiStart = std::min( ( vlUInt )iMin, uiSource - Axis.uiTaps );
+
+		double dTotal = 0.0;
+		for ( vlUInt j = 0; j < Axis.uiTaps; j++ )
+		{
+			const vlInt x = ( vlInt )( uiStart + j );
+			lpWeights[j] = x >= iMin && x < iMax ? ResampleKernel( Filter, ( x + 0.5 - dCenter ) / dFilterScale ) : 0.0;
+			dTotal += lpWeights[j];
+		}
+
+		// A box narrower than a texel can fall between centers, take the nearest texel then.
+		if ( dTotal == 0.0 )
+		{
+			const vlUInt uiNearest = std::min( ( vlUInt )dCenter, uiSource - 1 );
+			lpWeights[uiNearest - uiStart] = dTotal = 1.0;
+		}
+
+		Axis.lpStart[i] = uiStart;
+		for ( vlUInt j = 0; j < Axis.uiTaps; j++ )
+			Axis.lpWeights[i * Axis.uiTaps + j] = ( float )( lpWeights[j] / dTotal );
+	}
+	delete[] lpWeights;
+}
+
+//! Converts a row to floats with the colors multiplied by alpha / 255.
+typedef vlVoid ( *PremultiplyRowFunc )( const vlByte *lpSource, float *lpDest, vlUInt uiWidth );
+//! Filters a premultiplied row horizontally.
+typedef vlVoid ( *FilterRowFunc )( const float *lpSource, float *lpDest, const SResampleAxis &Axis, vlUInt uiWidth );
+//! Sums uiTaps weighted rows and writes them as straight alpha bytes.
+typedef vlVoid ( *ResolveRowFunc )( const float *const *lpRows, const float *lpWeights, vlUInt uiTaps, vlByte *lpDest, vlUInt uiWidth );
+
+struct SResampleFunctions
+{
+	PremultiplyRowFunc PremultiplyRow;
+	FilterRowFunc FilterRow;
+	ResolveRowFunc ResolveRow;
+};
+
+//
+// Scalar
+//
+
+static inline vlVoid PremultiplyPixel( const vlByte *lpSource, float *lpDest )
+{
+	const float fAlpha = lpSource[3] * ( 1.0f / 255.0f );
+	lpDest[0] = lpSource[0] * fAlpha;
+	lpDest[1] = lpSource[1] * fAlpha;
+	lpDest[2] = lpSource[2] * fAlpha;
+	lpDest[3] = lpSource[3];
+}
+
+static inline vlVoid FilterPixel( const float *lpSource, const float *lpWeights, vlUInt uiTaps, float *lpDest )
+{
+	float fSum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	for ( vlUInt k = 0; k < uiTaps; k++, lpSource += 4 )
+	{
+		for ( vlUInt c = 0; c < 4; c++ )
+			fSum[c] = fSum[c] + lpWeights[k] * lpSource[c];
+	}
+	memcpy( lpDest, fSum, sizeof( fSum ) );
+}
+
+static inline vlByte ResolveChannel( float fValue )
+{
+	return ( vlByte )( vlInt )( std::min( std::max( fValue, 0.0f ), 255.0f ) + 0.5f );
+}
+
+static inline vlVoid ResolvePixel( const float *const *lpRows, const float *lpWeights, vlUInt uiTaps, vlUInt uiOffset, vlByte *lpDest )
+{
+	float fSum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	for ( vlUInt k = 0; k < uiTaps; k++ )
+	{
+		for ( vlUInt c = 0; c < 4; c++ )
+			fSum[c] = fSum[c] + lpWeights[k] * lpRows[k][uiOffset + c];
+	}
+
+	const float fAlpha = std::min( std::max( fSum[3], 0.0f ), 255.0f );
+	const float fScale = fAlpha > 0.0f ? 255.0f / fAlpha : 0.0f;
+	lpDest[0] = ResolveChannel( fSum[0] * fScale );
+	lpDest[1] = ResolveChannel( fSum[1] * fScale );
+	lpDest[2] = ResolveChannel( fSum[2] * fScale );
+	lpDest[3] = ResolveChannel( fAlpha );
+}
+
+static vlVoid PremultiplyRowScalar( const vlByte *lpSource, float *lpDest, vlUInt uiWidth )
+{
+	for ( vlUInt x = 0; x < uiWidth; x++ )
+		PremultiplyPixel( lpSource + x * 4, lpDest + x * 4 );
+}
+
+static vlVoid FilterRowScalar( const float *lpSource, float *lpDest, const SResampleAxis &Axis, vlUInt uiWidth )
+{
+	for ( vlUInt x = 0; x < uiWidth; x++ )
+		FilterPixel( lpSource + Axis.lpStart[x] * 4, Axis.lpWeights + x * Axis.uiTaps, Axis.uiTaps, lpDest + x * 4 );
+}
+
+static vlVoid ResolveRowScalar( const float *const *lpRows, const float *lpWeights, vlUInt uiTaps, vlByte *lpDest, vlUInt uiWidth )
+{
+	for ( vlUInt x = 0; x < uiWidth; x++ )
+		ResolvePixel( lpRows, lpWeights, uiTaps, x * 4, lpDest + x * 4 );
+}
+
+#ifdef RESAMPLE_X86
+//
+// SSE2, one pixel per register
+//
+
+RESAMPLE_TARGET_SSE2 static inline __m128 PremultiplySSE2( __m128 Pixel )
+{
+	const __m128 AlphaMask = _mm_castsi128_ps( _mm_set_epi32( -1, 0, 0, 0 ) );
+	const __m128 Alpha = _mm_mul_ps( _mm_shuffle_ps( Pixel, Pixel, 0xFF ), _mm_set1_ps( 1.0f / 255.0f ) );
+	return _mm_or_ps( _mm_and_ps( AlphaMask, Pixel ), _mm_andnot_ps( AlphaMask, _mm_mul_ps( Pixel, Alpha ) ) );
+}
+
+//! Divides alpha back out of a summed pixel, rounded to integers like ResolvePixel.
+RESAMPLE_TARGET_SSE2 static inline __m128i ResolveSSE2( __m128 Sum )
+{
+	const __m128 AlphaMask = _mm_castsi128_ps( _mm_set_epi32( -1, 0, 0, 0 ) );
+	const __m128 Zero = _mm_setzero_ps();
+	const __m128 Max = _mm_set1_ps( 255.0f );
+
+	const __m128 Alpha = _mm_min_ps( _mm_max_ps( _mm_shuffle_ps( Sum, Sum, 0xFF ), Zero ), Max );
+	const __m128 Scale = _mm_and_ps( _mm_cmpgt_ps( Alpha, Zero ), _mm_div_ps( Max, Alpha ) );
+	__m128 Color = _mm_or_ps( _mm_and_ps( AlphaMask, Alpha ), _mm_andnot_ps( AlphaMask, _mm_mul_ps( Sum, Scale ) ) );
+	Color = _mm_min_ps( _mm_max_ps( Color, Zero ), Max );
+	return _mm_cvttps_epi32( _mm_add_ps( Color, _mm_set1_ps( 0.5f ) ) );
+}
+
+RESAMPLE_TARGET_SSE2 static vlVoid PremultiplyRowSSE2( const vlByte *lpSource, float *lpDest, vlUInt uiWidth )
+{
+	const __m128i Zero = _mm_setzero_si128();
+
+	vlUInt x = 0;
+	for ( ; x + 4 <= uiWidth; x += 4 )
+	{
+		const __m128i Bytes = _mm_loadu_si128( reinterpret_cast<const __m128i *>( lpSource + x * 4 ) );
+		const __m128i Low = _mm_unpacklo_epi8( Bytes, Zero );
+		const __m128i High = _mm_unpackhi_epi8( Bytes, Zero );
+
+		_mm_storeu_ps( lpDest + x * 4 + 0, PremultiplySSE2( _mm_cvtepi32_ps( _mm_unpacklo_epi16( Low, Zero ) ) ) );
+		_mm_storeu_ps( lpDest + x * 4 + 4, PremultiplySSE2( _mm_cvtepi32_ps( _mm_unpackhi_epi16( Low, Zero ) ) ) );
+		_mm_storeu_ps( lpDest + x * 4 + 8, PremultiplySSE2( _mm_cvtepi32_ps( _mm_unpacklo_epi16( High, Zero ) ) ) );
+		_mm_storeu_ps( lpDest + x * 4 + 12, PremultiplySSE2( _mm_cvtepi32_ps( _mm_unpackhi_epi16( High, Zero ) ) ) );
+	}
+
+	for ( ; x < uiWidth; x++ )
+		PremultiplyPixel( lpSource + x * 4, lpDest + x * 4 );
+}
+
+RESAMPLE_TARGET_SSE2 static vlVoid FilterRowSSE2( const float *lpSource, float *lpDest, const SResampleAxis &Axis, vlUInt uiWidth )
+{
+	// Footprints get long when shrinking a lot, two independent sums hide the add latency.
+	vlUInt x = 0;
+	for ( ; x + 2 <= uiWidth; x += 2 )
+	{
+		const float *lpPixels[2], *lpWeights[2];
+		__m128 Sum[2];
+		for ( vlUInt i = 0; i < 2; i++ )
+		{
+			lpPixels[i] = lpSource + Axis.lpStart[x + i] * 4;
+			lpWeights[i] = Axis.lpWeights + ( x + i ) * Axis.uiTaps;
+			Sum[i] = _mm_setzero_ps();
+		}
+
+		for ( vlUInt k = 0; k < Axis.uiTaps; k++ )
+		{
+			for ( vlUInt i = 0; i < 2; i++ )
+				Sum[i] = _mm_add_ps( Sum[i], _mm_mul_ps( _mm_set1_ps( lpWeights[i][k] ), _mm_loadu_ps( lpPixels[i] + k * 4 ) ) );
+		}
+
+		for ( vlUInt i = 0; i < 2; i++ )
+			_mm_storeu_ps( lpDest + ( x + i ) * 4, Sum[i] );
+	}
+
+	for ( ; x < uiWidth; x++ )
+		FilterPixel( lpSource + Axis.lpStart[x] * 4, Axis.lpWeights + x * Axis.uiTaps, Axis.uiTaps, lpDest + x * 4 );
+}
+
+RESAMPLE_TARGET_SSE2 static vlVoid ResolveRowSSE2( const float *const *lpRows, const float *lpWeights, vlUInt uiTaps, vlByte *lpDest, vlUInt uiWidth )
+{
+	vlUInt x = 0;
+	for ( ; x + 4 <= uiWidth; x += 4 )
+	{
+		__m128 Sum[4] = { _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps() };
+		for ( vlUInt k = 0; k < uiTaps; k++ )
+		{
+			const __m128 Weight = _mm_set1_ps( lpWeights[k] );
+			const float *lpRow = lpRows[k] + x * 4;
+			for ( vlUInt i = 0; i < 4; i++ )
+				Sum[i] = _mm_add_ps( Sum[i], _mm_mul_ps( Weight, _mm_loadu_ps( lpRow + i * 4 ) ) );
+		}
+
+		const __m128i Low = _mm_packs_epi32( ResolveSSE2( Sum[0] ), ResolveSSE2( Sum[1] ) );
+		const __m128i High = _mm_packs_epi32( ResolveSSE2( Sum[2] ), ResolveSSE2( Sum[3] ) );
+		_mm_storeu_si128( reinterpret_cast<__m128i *>( lpDest + x * 4 ), _mm_packus_epi16( Low, High ) );
+	}
+
+	for ( ; x < uiWidth; x++ )
+		ResolvePixel( lpRows, lpWeights, uiTaps, x * 4, lpDest + x * 4 );
+}
+
+//
+// AVX2, two pixels per register
+//
+
+RESAMPLE_TARGET_AVX2 static inline __m256 PremultiplyAVX2( __m256 Pixels )
+{
+	const __m256 Alpha = _mm256_mul_ps( _mm256_permute_ps( Pixels, 0xFF ), _mm256_set1_ps( 1.0f / 255.0f ) );
+	return _mm256_blend_ps( _mm256_mul_ps( Pixels, Alpha ), Pixels, 0x88 );
+}
+
+RESAMPLE_TARGET_AVX2 static inline __m256i ResolveAVX2( __m256 Sum )
+{
+	const __m256 Zero = _mm256_setzero_ps();
+	const __m256 Max = _mm256_set1_ps( 255.0f );
+
+	const __m256 Alpha = _mm256_min_ps( _mm256_max_ps( _mm256_permute_ps( Sum, 0xFF ), Zero ), Max );
+	const __m256 Scale = _mm256_and_ps( _mm256_cmp_ps( Alpha, Zero, _CMP_GT_OQ ), _mm256_div_ps( Max, Alpha ) );
+	__m256 Color = _mm256_blend_ps( _mm256_mul_ps( Sum, Scale ), Alpha, 0x88 );
+	Color = _mm256_min_ps( _mm256_max_ps( Color, Zero ), Max );
+	return _mm256_cvttps_epi32( _mm256_add_ps( Color, _mm256_set1_ps( 0.5f ) ) );
+}
+
+RESAMPLE_TARGET_AVX2 static vlVoid PremultiplyRowAVX2( const vlByte *lpSource, float *lpDest, vlUInt uiWidth )
+{
+	vlUInt x = 0;
+	for ( ; x + 4 <= uiWidth; x += 4 )
+	{
+		const __m128i Bytes = _mm_loadu_si128( reinterpret_cast<const __m128i *>( lpSource + x * 4 ) );
+		_mm256_storeu_ps( lpDest + x * 4 + 0, PremultiplyAVX2( _mm256_cvtepi32_ps( _mm256_cvtepu8_epi32( Bytes ) ) ) );
+		_mm256_storeu_ps( lpDest + x * 4 + 8, PremultiplyAVX2( _mm256_cvtepi32_ps( _mm256_cvtepu8_epi32( _mm_unpackhi_epi64( Bytes, Bytes ) ) ) ) );
+	}
+
+	for ( ; x < uiWidth; x++ )
+		PremultiplyPixel( lpSource + x * 4, lpDest + x * 4 );
+}
+
+RESAMPLE_TARGET_AVX2 static inline __m256 LoadPairAVX2( const float *lpLow, const float *lpHigh )
+{
+	return _mm256_insertf128_ps( _mm256_castps128_ps256( _mm_loadu_ps( lpLow ) ), _mm_loadu_ps( lpHigh ), 1 );
+}
+
+RESAMPLE_TARGET_AVX2 static vlVoid FilterRowAVX2( const float *lpSource, float *lpDest, const SResampleAxis &Axis, vlUInt uiWidth )
+{
+	// Two output pixels per register keeps each one's sum in the same order as the scalar path,
+	// and two registers at a time hide the add latency.
+	vlUInt x = 0;
+	for ( ; x + 4 <= uiWidth; x += 4 )
+	{
+		const float *lpPixels[4], *lpWeights[4];
+		for ( vlUInt i = 0; i < 4; i++ )
+		{
+			lpPixels[i] = lpSource + Axis.lpStart[x + i] * 4;
+			lpWeights[i] = Axis.lpWeights + ( x + i ) * Axis.uiTaps;
+		}
+
+		__m256 SumA = _mm256_setzero_ps(), SumB = _mm256_setzero_ps();
+		for ( vlUInt k = 0; k < Axis.uiTaps; k++ )
+		{
+			const __m256 WeightA = _mm256_insertf128_ps( _mm256_set1_ps( lpWeights[0][k] ), _mm_set1_ps( lpWeights[1][k] ), 1 );
+			const __m256 WeightB = _mm256_insertf128_ps( _mm256_set1_ps( lpWeights[2][k] ), _mm_set1_ps( lpWeights[3][k] ), 1 );
+			SumA = _mm256_add_ps( SumA, _mm256_mul_ps( WeightA, LoadPairAVX2( lpPixels[0] + k * 4, lpPixels[1] + k * 4 ) ) );
+			SumB = _mm256_add_ps( SumB, _mm256_mul_ps( WeightB, LoadPairAVX2( lpPixels[2] + k * 4, lpPixels[3] + k * 4 ) ) );
+		}
+		_mm256_storeu_ps( lpDest + x * 4, SumA );
+		_mm256_storeu_ps( lpDest + x * 4 + 8, SumB );
+	}
+
+	for ( ; x < uiWidth; x++ )
+		FilterPixel( lpSource + Axis.lpStart[x] * 4, Axis.lpWeights + x * Axis.uiTaps, Axis.uiTaps, lpDest + x * 4 );
+}
+
+RESAMPLE_TARGET_AVX2 static vlVoid ResolveRowAVX2( const float *const *lpRows, const float *lpWeights, vlUInt uiTaps, vlByte *lpDest, vlUInt uiWidth )
+{
+	vlUInt x = 0;
+	for ( ; x + 4 <= uiWidth; x += 4 )
+	{
+		__m256 SumA = _mm256_setzero_ps(), SumB = _mm256_setzero_ps();
+		for ( vlUInt k = 0; k < uiTaps; k++ )
+		{
+			const __m256 Weight = _mm256_set1_ps( lpWeights[k] );
+			const float *lpRow = lpRows[k] + x * 4;
+			SumA = _mm256_add_ps( SumA, _mm256_mul_ps( Weight, _mm256_loadu_ps( lpRow ) ) );
+			SumB = _mm256_add_ps( SumB, _mm256_mul_ps( Weight, _mm256_loadu_ps( lpRow + 8 ) ) );
+		}
+
+		const __m256i A = ResolveAVX2( SumA ), B = ResolveAVX2( SumB );
+		const __m128i Low = _mm_packs_epi32( _mm256_castsi256_si128( A ), _mm256_extracti128_si256( A, 1 ) );
+		const __m128i High = _mm_packs_epi32( _mm256_castsi256_si128( B ), _mm256_extracti128_si256( B, 1 ) );
+		_mm_storeu_si128( reinterpret_cast<__m128i *>( lpDest + x * 4 ), _mm_packus_epi16( Low, High ) );
+	}
+
+	for ( ; x < uiWidth; x++ )
+		ResolvePixel( lpRows, lpWeights, uiTaps, x * 4, lpDest + x * 4 );
+}
+#endif
+
+static const SResampleFunctions ResampleFunctions[BCDECODE_COUNT] =
+{
+#define RESAMPLE_FUNCTIONS( Level ) { PremultiplyRow##Level, FilterRow##Level, ResolveRow##Level }
+
+	RESAMPLE_FUNCTIONS( Scalar ),
+#ifdef RESAMPLE_X86
+	RESAMPLE_FUNCTIONS( SSE2 ),
+	RESAMPLE_FUNCTIONS( AVX2 ),
+#else
+	RESAMPLE_FUNCTIONS( Scalar ),
+	RESAMPLE_FUNCTIONS( Scalar ),
+#endif
+
+#undef RESAMPLE_FUNCTIONS
+};
+
+vlVoid ComputeResampleSize( vlUInt uiWidth, vlUInt uiHeight, vlUInt uiSize, vlUInt &uiDestWidth, vlUInt &uiDestHeight )
+{
+	if ( uiWidth >= uiHeight )
+	{
+		uiDestWidth = uiSize;
+		uiDestHeight = uiWidth ? ( vlUInt )( ( ( unsigned long long )uiHeight * uiSize + uiWidth / 2 ) / uiWidth ) : 0;
+	}
+	else
+	{
+		uiDestHeight = uiSize;
+		uiDestWidth = ( vlUInt )( ( ( unsigned long long )uiWidth * uiSize + uiHeight / 2 ) / uiHeight );
+	}
+
+	uiDestWidth = std::max( uiDestWidth, 1u );
+	uiDestHeight = std::max( uiDestHeight, 1u );
+}
+
+vlBool Resample( const vlByte *lpSource, vlUInt uiSourceWidth, vlUInt uiSourceHeight, vlByte *lpDest, vlUInt uiDestWidth, vlUInt uiDestHeight, ResampleFilter Filter )
+{
+	return Resample( lpSource, uiSourceWidth, uiSourceHeight, lpDest, uiDestWidth, uiDestHeight, Filter, GetBCDecodeLevel() );
+}
+
+vlBool Resample( const vlByte *lpSource, vlUInt uiSourceWidth, vlUInt uiSourceHeight, vlByte *lpDest, vlUInt uiDestWidth, vlUInt uiDestHeight, ResampleFilter Filter, BCDecodeLevel Level )
+{
+	if ( lpSource == 0 )
+		return vlFalse;
+
+	CResampler Resampler;
+	return Resampler.Create( uiSourceWidth, uiSourceHeight, lpDest, uiDestWidth, uiDestHeight, Filter, Level ) && Resampler.AddRows( lpSource, uiSourceHeight );
+}
+
+//
+// CResampler
+//
+
+struct SResamplerState
+{
+	SResamplerState() : pFunctions( 0 ), uiSourceWidth( 0 ), uiSourceHeight( 0 ), uiDestWidth( 0 ), uiDestHeight( 0 ), lpDest( 0 ), bCopy( vlFalse ),
+		lpPremultiplied( 0 ), lpRing( 0 ), lpTapRows( 0 ), uiNextRow( 0 ), uiNextDestRow( 0 ) {}
+	~SResamplerState()
+	{
+		delete[] this->lpTapRows;
+		delete[] this->lpRing;
+		delete[] this->lpPremultiplied;
+	}
+
+	SResampleAxis Horizontal;
+	SResampleAxis Vertical;
+	const SResampleFunctions *pFunctions;
+	vlUInt uiSourceWidth;
+	vlUInt uiSourceHeight;
+	vlUInt uiDestWidth;
+	vlUInt uiDestHeight;
+	vlByte *lpDest;
+	vlBool bCopy;				//!< Same size, rows are copied as they come.
+	float *lpPremultiplied;
+	float *lpRing;				//!< uiTaps horizontally filtered rows.
+	const float **lpTapRows;
+	vlUInt uiNextRow;			//!< Source rows added so far.
+	vlUInt uiNextDestRow;		//!< Output rows written so far.
+};
+
+CResampler::CResampler()
+{
+	this->pState = 0;
+}
+
+CResampler::~CResampler()
+{
+	this->Destroy();
+}
+
+vlVoid CResampler::Destroy()
+{
+	delete this->pState;
+	this->pState = 0;
+}
+
+vlBool CResampler::Create( vlUInt uiSourceWidth, vlUInt uiSourceHeight, vlByte *lpDest, vlUInt uiDestWidth, vlUInt uiDestHeight, ResampleFilter Filter, BCDecodeLevel Level )
+{
+	this->Destroy();
+
+	if ( lpDest == 0 || uiSourceWidth == 0 || uiSourceHeight == 0 || uiDestWidth == 0 || uiDestHeight == 0 )
+		return vlFalse;
+
+	if ( Filter < RESAMPLE_BOX || Filter >= RESAMPLE_FILTER_COUNT )
+		return vlFalse;
+
+	if ( Level < BCDECODE_SCALAR || Level > GetBCDecodeLevel() )
+		Level = GetBCDecodeLevel();
+
+	SResamplerState *pState = new SResamplerState();
+	pState->pFunctions = &ResampleFunctions[Level];
+	pState->uiSourceWidth = uiSourceWidth;
+	pState->uiSourceHeight = uiSourceHeight;
+	pState->uiDestWidth = uiDestWidth;
+	pState->uiDestHeight = uiDestHeight;
+	pState->lpDest = lpDest;
+	pState->bCopy = uiSourceWidth == uiDestWidth && uiSourceHeight == uiDestHeight;
+
+	if ( !pState->bCopy )
+	{
+		BuildResampleAxis( pState->Horizontal, uiSourceWidth, uiDestWidth, Filter );
+		BuildResampleAxis( pState->Vertical, uiSourceHeight, uiDestHeight, Filter );
+
+		pState->lpPremultiplied = new float[( size_t )uiSourceWidth * 4];
+		pState->lpRing = new float[( size_t )pState->Vertical.uiTaps * uiDestWidth * 4];
+		pState->lpTapRows = new const float *[pState->Vertical.uiTaps];
+	}
+
+	this->pState = pState;
+	return vlTrue;
+}
+
+vlBool CResampler::AddRows( const vlByte *lpRows, vlUInt uiRows )
+{
+	SResamplerState *pState = this->pState;
+	if ( pState == 0 || lpRows == 0 || uiRows > pState->uiSourceHeight - pState->uiNextRow )
+		return vlFalse;
+
+	const size_t uiSourceRowSize = ( size_t )pState->uiSourceWidth * 4;
+	if ( pState->bCopy )
+	{
+		memcpy( pState->lpDest + pState->uiNextRow * uiSourceRowSize, lpRows, uiRows * uiSourceRowSize );
+		pState->uiNextRow += uiRows;
+		return vlTrue;
+	}
+
+	// Footprints only move down, so source row y can live in slot y % uiTaps until every output row using it is done,
+	// which is as soon as the last row of its footprint is added.
+	const SResampleAxis &Vertical = pState->Vertical;
+	const size_t uiRowSize = ( size_t )pState->uiDestWidth * 4;
+	for ( vlUInt i = 0; i < uiRows; i++, lpRows += uiSourceRowSize )
+	{
+		pState->pFunctions->PremultiplyRow( lpRows, pState->lpPremultiplied, pState->uiSourceWidth );
+		pState->pFunctions->FilterRow( pState->lpPremultiplied, pState->lpRing + ( pState->uiNextRow % Vertical.uiTaps ) * uiRowSize, pState->Horizontal, pState->uiDestWidth );
+		pState->uiNextRow++;
+
+		for ( ; pState->uiNextDestRow < pState->uiDestHeight && Vertical.lpStart[pState->uiNextDestRow] + Vertical.uiTaps <= pState->uiNextRow; pState->uiNextDestRow++ )
+		{
+			const vlUInt y = pState->uiNextDestRow;
+			const vlUInt uiStart = Vertical.lpStart[y];
+			for ( vlUInt k = 0; k < Vertical.uiTaps; k++ )
+				pState->lpTapRows[k] = pState->lpRing + ( ( uiStart + k ) % Vertical.uiTaps ) * uiRowSize;
+
+			pState->pFunctions->ResolveRow( pState->lpTapRows, Vertical.lpWeights + ( size_t )y * Vertical.uiTaps, Vertical.uiTaps, pState->lpDest + y * uiRowSize, pState->uiDestWidth );
+		}
+	}
+
+	return vlTrue;
+}
+
+vlBool CResampler::IsComplete() const
+{
+	return this->pState != 0 && this->pState->uiNextRow == this->pState->uiSourceHeight;
+}
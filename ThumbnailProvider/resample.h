@@ -0,0 +1,45 @@
+﻿#pragma once
+
+#include "bcdec_simd.h"
+
+typedef enum tagResampleFilter
+{
+	RESAMPLE_BOX = 0,		//!< Area average when shrinking, nearest texel when growing.
+	RESAMPLE_BILINEAR,		//!< Triangle filter, widened by the scale factor when shrinking.
+	RESAMPLE_LANCZOS3,		//!< Windowed sinc with three lobes, sharpest of the three.
+	RESAMPLE_FILTER_COUNT
+} ResampleFilter;
+
+//! Size of an image scaled so its longest edge is uiSize pixels, keeping the aspect ratio.
+vlVoid ComputeResampleSize( vlUInt uiWidth, vlUInt uiHeight, vlUInt uiSize, vlUInt &uiDestWidth, vlUInt &uiDestHeight );
+
+//! Scales an RGBA8888 or BGRA8888 image. Colors are filtered premultiplied by alpha so transparent texels don't
+//! bleed into their neighbours, the result has straight alpha again. Every level gives the same output.
+vlBool Resample( const vlByte *lpSource, vlUInt uiSourceWidth, vlUInt uiSourceHeight, vlByte *lpDest, vlUInt uiDestWidth, vlUInt uiDestHeight, ResampleFilter Filter );
+vlBool Resample( const vlByte *lpSource, vlUInt uiSourceWidth, vlUInt uiSourceHeight, vlByte *lpDest, vlUInt uiDestWidth, vlUInt uiDestHeight, ResampleFilter Filter, BCDecodeLevel Level );
+
+struct SResamplerState;
+
+//! Resample fed the source a band of rows at a time, for mips too large to hold decoded. Each output row is written
+//! as soon as every source row under it has been added, the result is the same as Resample's.
+class CResampler
+{
+private:
+	SResamplerState *pState;
+
+public:
+	CResampler();
+
+	~CResampler();
+
+	vlVoid Destroy();
+
+	//! lpDest receives uiDestWidth * uiDestHeight pixels and has to stay valid until the last row is added.
+	vlBool Create( vlUInt uiSourceWidth, vlUInt uiSourceHeight, vlByte *lpDest, vlUInt uiDestWidth, vlUInt uiDestHeight, ResampleFilter Filter, BCDecodeLevel Level );
+
+	//! Adds the next uiRows source rows, uiSourceWidth * 4 bytes each. Fails before Create and past the last row.
+	vlBool AddRows( const vlByte *lpRows, vlUInt uiRows );
+
+	//! Whether every source row has been added, and so every output row written.
+	vlBool IsComplete() const;
+};
@@ -0,0 +1,209 @@
+﻿#include "texturecache.h"
+#include <cstring>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <objidl.h>
+#include <shlwapi.h>
+#endif
+
+#define TEXTURE_CACHE_HEADER_LEVEL 0xffffffff
+
+//! Entries larger than this fraction of the budget are not kept, they would push out everything else.
+#define TEXTURE_CACHE_MAX_ENTRY_FRACTION 4
+
+size_t CTextureCache::SKeyHash::operator()( const SKey &Key ) const
+{
+	std::uint64_t uiHash = Key.Identity.uiFile;
+	const std::uint64_t uiValues[4] = { Key.Identity.uiVolume, Key.Identity.uiSize, Key.Identity.uiModified, Key.uiLevel };
+	for ( vlUInt i = 0; i < 4; i++ )
+	{
+		uiHash ^= uiValues[i] + 0x9e3779b97f4a7c15ULL + ( uiHash << 6 ) + ( uiHash >> 2 );
+	}
+
+	return ( size_t )uiHash;
+}
+
+CTextureCache::CTextureCache( std::uint64_t uiBudget )
+{
+	this->uiBudget = uiBudget;
+	memset( &this->Stats, 0, sizeof( this->Stats ) );
+}
+
+CTextureCache::~CTextureCache()
+{
+	this->Clear();
+}
+
+vlVoid CTextureCache::Free( SEntry &Entry )
+{
+	delete Entry.pFile;
+	Entry.pFile = 0;
+	delete[] Entry.lpData;
+	Entry.lpData = 0;
+}
+
+// Takes ownership of Entry's memory, replacing any entry with the same key and evicting from the back to fit.
+vlVoid CTextureCache::Insert( SEntry &Entry )
+{
+	if ( Entry.uiSize > this->uiBudget / TEXTURE_CACHE_MAX_ENTRY_FRACTION )
+	{
+		this->Free( Entry );
+		return;
+	}
+
+	auto It = this->Index.find( Entry.Key );
+	if ( It != this->Index.end() )
+	{
+		this->Stats.uiBytes -= It->second->uiSize;
+		this->Free( *It->second );
+		this->Entries.erase( It->second );
+		this->Index.erase( It );
+	}
+
+	while ( !this->Entries.empty() && this->Stats.uiBytes + Entry.uiSize > this->uiBudget )
+	{
+		SEntry &Oldest = this->Entries.back();
+		this->Stats.uiBytes -= Oldest.uiSize;
+		this->Stats.uiEvictions++;
+		this->Index.erase( Oldest.Key );
+		this->Free( Oldest );
+		this->Entries.pop_back();
+	}
+
+	this->Entries.push_front( Entry );
+	this->Index[Entry.Key] = this->Entries.begin();
+	this->Stats.uiBytes += Entry.uiSize;
+}
+
+vlBool CTextureCache::FindHeader( const STextureIdentity &Identity, CVTFFile &File )
+{
+	std::lock_guard<std::mutex> Lock( this->Mutex );
+
+	const SKey Key = { Identity, TEXTURE_CACHE_HEADER_LEVEL };
+	auto It = this->Index.find( Key );
+	if ( It == this->Index.end() )
+	{
+		this->Stats.uiHeaderMisses++;
+		return vlFalse;
+	}
+
+	this->Entries.splice( this->Entries.begin(), this->Entries, It->second );
+	this->Stats.uiHeaderHits++;
+	return File.CopyHeader( *It->second->pFile );
+}
+
+vlVoid CTextureCache::InsertHeader( const STextureIdentity &Identity, const CVTFFile &File )
+{
+	// The copy is made outside the lock, it allocates for every resource.
+	CVTFFile *pFile = new CVTFFile();
+	if ( !pFile->CopyHeader( File ) )
+	{
+		delete pFile;
+		return;
+	}
+
+	SEntry Entry = { { Identity, TEXTURE_CACHE_HEADER_LEVEL }, pFile, 0, 0, 0, pFile->GetMemorySize() };
+
+	std::lock_guard<std::mutex> Lock( this->Mutex );
+	this->Insert( Entry );
+}
+
+vlBool CTextureCache::FindMip( const STextureIdentity &Identity, vlUInt uiMipmapLevel, vlUInt &uiWidth, vlUInt &uiHeight, vlByte *&lpData )
+{
+	std::lock_guard<std::mutex> Lock( this->Mutex );
+
+	const SKey Key = { Identity, uiMipmapLevel };
+	auto It = this->Index.find( Key );
+	if ( It == this->Index.end() )
+	{
+		this->Stats.uiMipMisses++;
+		return vlFalse;
+	}
+
+	SEntry &Entry = *It->second;
+	this->Entries.splice( this->Entries.begin(), this->Entries, It->second );
+	this->Stats.uiMipHits++;
+
+	uiWidth = Entry.uiWidth;
+	uiHeight = Entry.uiHeight;
+	lpData = new vlByte[Entry.uiSize];
+	memcpy( lpData, Entry.lpData, Entry.uiSize );
+	return vlTrue;
+}
+
+vlVoid CTextureCache::InsertMip( const STextureIdentity &Identity, vlUInt uiMipmapLevel, vlUInt uiWidth, vlUInt uiHeight, const vlByte *lpData )
+{
+	const std::uint64_t uiSize = ( std::uint64_t )uiWidth * uiHeight * 4;
+	if ( uiSize > this->uiBudget / TEXTURE_CACHE_MAX_ENTRY_FRACTION )
+		return;
+
+	SEntry Entry = { { Identity, uiMipmapLevel }, 0, uiWidth, uiHeight, new vlByte[uiSize], uiSize };
+	memcpy( Entry.lpData, lpData, uiSize );
+
+	std::lock_guard<std::mutex> Lock( this->Mutex );
+	this->Insert( Entry );
+}
+
+vlVoid CTextureCache::Clear()
+{
+	std::lock_guard<std::mutex> Lock( this->Mutex );
+
+	for ( SEntry &Entry : this->Entries )
+	{
+		this->Free( Entry );
+	}
+	this->Entries.clear();
+	this->Index.clear();
+	this->Stats.uiBytes = 0;
+}
+
+STextureCacheStats CTextureCache::GetStats()
+{
+	std::lock_guard<std::mutex> Lock( this->Mutex );
+
+	STextureCacheStats Stats = this->Stats;
+	Stats.uiEntries = ( vlUInt )this->Entries.size();
+	return Stats;
+}
+
+#ifdef _WIN32
+vlBool CTextureCache::GetStreamIdentity( IStream *pStream, STextureIdentity &Identity )
+{
+	STATSTG stat;
+	if ( pStream == nullptr || pStream->Stat( &stat, STATFLAG_DEFAULT ) != S_OK )
+		return vlFalse;
+
+	// File streams of the shell report the full path, others a bare file name or none. A bare name is no key,
+	// files of the same name, size and times in different folders would share entries.
+	HANDLE hFile = INVALID_HANDLE_VALUE;
+	if ( stat.pwcsName != nullptr && !PathIsRelativeW( stat.pwcsName ) )
+	{
+		hFile = CreateFileW( stat.pwcsName, FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, 0, nullptr );
+	}
+	CoTaskMemFree( stat.pwcsName );
+	if ( hFile == INVALID_HANDLE_VALUE )
+		return vlFalse;
+
+	BY_HANDLE_FILE_INFORMATION info;
+	const BOOL bInfo = GetFileInformationByHandle( hFile, &info );
+	CloseHandle( hFile );
+	if ( !bInfo )
+		return vlFalse;
+
+	// The path may name another file by now, it has to match what the stream reads.
+	const std::uint64_t uiSize = ( ( std::uint64_t )info.nFileSizeHigh << 32 ) | info.nFileSizeLow;
+	const std::uint64_t uiModified = ( ( std::uint64_t )info.ftLastWriteTime.dwHighDateTime << 32 ) | info.ftLastWriteTime.dwLowDateTime;
+	if ( uiSize != stat.cbSize.QuadPart || uiModified != ( ( ( std::uint64_t )stat.mtime.dwHighDateTime << 32 ) | stat.mtime.dwLowDateTime ) )
+		return vlFalse;
+
+	Identity.uiVolume = info.dwVolumeSerialNumber;
+	Identity.uiFile = ( ( std::uint64_t )info.nFileIndexHigh << 32 ) | info.nFileIndexLow;
+	Identity.uiSize = uiSize;
+	Identity.uiModified = uiModified;
+	return vlTrue;
+}
+#endif
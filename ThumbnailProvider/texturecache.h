@@ -0,0 +1,110 @@
+﻿#pragma once
+
+#include "vtffile.h"
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+#ifdef _WIN32
+struct IStream;
+#endif
+
+//! About a hundred decoded 256x256 mips next to a few thousand headers.
+#define TEXTURE_CACHE_DEFAULT_BUDGET ( 32 << 20 )
+
+//! Identifies a file by volume and file ID, with its size and modification time so a file rewritten in place gets
+//! new entries. Cached entries are found this way before reading anything from the file.
+struct STextureIdentity
+{
+	std::uint64_t uiVolume;		//!< Volume serial number.
+	std::uint64_t uiFile;		//!< File ID on the volume.
+	std::uint64_t uiSize;
+	std::uint64_t uiModified;
+
+	bool operator==( const STextureIdentity &Other ) const
+	{
+		return this->uiVolume == Other.uiVolume && this->uiFile == Other.uiFile && this->uiSize == Other.uiSize && this->uiModified == Other.uiModified;
+	}
+};
+
+struct STextureCacheStats
+{
+	std::uint64_t uiHeaderHits;
+	std::uint64_t uiHeaderMisses;
+	std::uint64_t uiMipHits;
+	std::uint64_t uiMipMisses;
+	std::uint64_t uiEvictions;
+	std::uint64_t uiBytes;		//!< Bytes currently held against the budget.
+	vlUInt uiEntries;
+};
+
+//
+// In-process LRU of parsed headers and decoded mips, shared by every request in the process. Explorer asks
+// for the same file at several sizes in a row, this lets the later requests skip parsing and often decoding.
+// Everything goes in and comes out as a copy, so entries can be evicted while callers still use their data.
+//
+class CTextureCache
+{
+public:
+	CTextureCache( std::uint64_t uiBudget = TEXTURE_CACHE_DEFAULT_BUDGET );
+	~CTextureCache();
+
+	CTextureCache( const CTextureCache & ) = delete;
+	CTextureCache &operator=( const CTextureCache & ) = delete;
+
+	//! Copies the cached header, resources and low-res image into File, which loads image data itself afterwards.
+	vlBool FindHeader( const STextureIdentity &Identity, CVTFFile &File );
+	vlVoid InsertHeader( const STextureIdentity &Identity, const CVTFFile &File );
+
+	//! Finds the BGRA8888 decode of uiMipmapLevel, lpData receives a new[] allocated copy owned by the caller.
+	vlBool FindMip( const STextureIdentity &Identity, vlUInt uiMipmapLevel, vlUInt &uiWidth, vlUInt &uiHeight, vlByte *&lpData );
+	vlVoid InsertMip( const STextureIdentity &Identity, vlUInt uiMipmapLevel, vlUInt uiWidth, vlUInt uiHeight, const vlByte *lpData );
+
+	vlVoid Clear();
+
+	STextureCacheStats GetStats();
+
+#ifdef _WIN32
+	//! Fails for streams not backed by a file whose full path they report, such a stream is not cached.
+	static vlBool GetStreamIdentity( IStream *pStream, STextureIdentity &Identity );
+#endif
+
+private:
+	struct SKey
+	{
+		STextureIdentity Identity;
+		vlUInt uiLevel;		//!< TEXTURE_CACHE_HEADER_LEVEL for the header.
+
+		bool operator==( const SKey &Other ) const
+		{
+			return this->Identity == Other.Identity && this->uiLevel == Other.uiLevel;
+		}
+	};
+
+	struct SKeyHash
+	{
+		size_t operator()( const SKey &Key ) const;
+	};
+
+	struct SEntry
+	{
+		SKey Key;
+		CVTFFile *pFile;
+		vlUInt uiWidth;
+		vlUInt uiHeight;
+		vlByte *lpData;
+		std::uint64_t uiSize;
+	};
+
+	typedef std::list<SEntry> EntryList;
+
+	vlVoid Insert( SEntry &Entry );
+	vlVoid Free( SEntry &Entry );
+
+	std::mutex Mutex;
+	EntryList Entries;		//!< Most recently used first.
+	std::unordered_map<SKey, EntryList::iterator, SKeyHash> Index;
+	std::uint64_t uiBudget;
+	STextureCacheStats Stats;
+};
@@ -0,0 +1,98 @@
+﻿#include "threadpool.h"
+
+CThreadPool::CThreadPool( vlUInt uiThreads )
+{
+	if ( uiThreads == 0 )
+		uiThreads = std::thread::hardware_concurrency();
+
+	this->uiThreadCount = uiThreads != 0 ? uiThreads : 1;
+	this->pJob = 0;
+	this->uiJobCount = 0;
+	this->uiNextJob = 0;
+	this->uiGeneration = 0;
+	this->uiBusyThreads = 0;
+	this->bStop = vlFalse;
+}
+
+CThreadPool::~CThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> Lock( this->Mutex );
+		this->bStop = vlTrue;
+	}
+	this->WorkCondition.notify_all();
+
+	for ( auto &Thread : this->Threads )
+		Thread.join();
+}
+
+vlUInt CThreadPool::GetThreadCount() const
+{
+	return this->uiThreadCount;
+}
+
+vlVoid CThreadPool::Start()
+{
+	if ( !this->Threads.empty() )
+		return;
+
+	this->Threads.reserve( this->uiThreadCount - 1 );
+	for ( vlUInt i = 1; i < this->uiThreadCount; i++ )
+		this->Threads.emplace_back( &CThreadPool::WorkerMain, this );
+}
+
+vlVoid CThreadPool::ParallelFor( vlUInt uiCount, const std::function<vlVoid( vlUInt )> &Job )
+{
+	if ( this->uiThreadCount == 1 || uiCount <= 1 )
+	{
+		for ( vlUInt i = 0; i < uiCount; i++ )
+			Job( i );
+		return;
+	}
+
+	this->Start();
+
+	{
+		std::lock_guard<std::mutex> Lock( this->Mutex );
+		this->pJob = &Job;
+		this->uiJobCount = uiCount;
+		this->uiNextJob = 0;
+		this->uiBusyThreads = ( vlUInt )this->Threads.size();
+		this->uiGeneration++;
+	}
+	this->WorkCondition.notify_all();
+
+	this->RunJobs();
+
+	std::unique_lock<std::mutex> Lock( this->Mutex );
+	this->DoneCondition.wait( Lock, [this] { return this->uiBusyThreads == 0; } );
+	this->pJob = 0;
+}
+
+vlVoid CThreadPool::WorkerMain()
+{
+	vlUInt uiSeenGeneration = 0;
+	for ( ;; )
+	{
+		{
+			std::unique_lock<std::mutex> Lock( this->Mutex );
+			this->WorkCondition.wait( Lock, [&] { return this->bStop || this->uiGeneration != uiSeenGeneration; } );
+			if ( this->bStop )
+				return;
+
+			uiSeenGeneration = this->uiGeneration;
+		}
+
+		this->RunJobs();
+
+		std::lock_guard<std::mutex> Lock( this->Mutex );
+		if ( --this->uiBusyThreads == 0 )
+			this->DoneCondition.notify_one();
+	}
+}
+
+vlVoid CThreadPool::RunJobs()
+{
+	for ( vlUInt i = this->uiNextJob++; i < this->uiJobCount; i = this->uiNextJob++ )
+		( *this->pJob )( i );
+}
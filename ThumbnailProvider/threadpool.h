@@ -0,0 +1,49 @@
+﻿#pragma once
+
+#include "vtffile.h"
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//
+// Fixed size pool for data parallel loops. Worker threads are only started by the first
+// ParallelFor that has more than one job, so creating a pool for a small image costs nothing.
+//
+class CThreadPool
+{
+public:
+	//! uiThreads of 0 uses one thread per hardware thread. The calling thread counts as one of them.
+	CThreadPool( vlUInt uiThreads = 0 );
+	~CThreadPool();
+
+	CThreadPool( const CThreadPool & ) = delete;
+	CThreadPool &operator=( const CThreadPool & ) = delete;
+
+	vlUInt GetThreadCount() const;
+
+	//! Calls Job( i ) for every i in [0, uiCount) and returns once all of them are done. Not reentrant.
+	vlVoid ParallelFor( vlUInt uiCount, const std::function<vlVoid( vlUInt )> &Job );
+
+private:
+	vlVoid Start();
+	vlVoid WorkerMain();
+	vlVoid RunJobs();
+
+private:
+	vlUInt uiThreadCount;
+	std::vector<std::thread> Threads;
+
+	std::mutex Mutex;
+	std::condition_variable WorkCondition;
+	std::condition_variable DoneCondition;
+
+	const std::function<vlVoid( vlUInt )> *pJob;
+	vlUInt uiJobCount;
+	std::atomic<vlUInt> uiNextJob;
+	vlUInt uiGeneration;		//!< Bumped for every ParallelFor so workers know there is new work.
+	vlUInt uiBusyThreads;		//!< Workers that have not finished the current generation yet.
+	vlBool bStop;
+};
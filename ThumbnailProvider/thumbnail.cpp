@@ -0,0 +1,336 @@
+﻿#include "thumbnail.h"
+#include "readers.h"
+#include "texturecache.h"
+#include "thumbnailcache.h"
+#include <algorithm>
+
+//! Bump when decoding or resampling changes its output, so stale cache entries stop matching.
+#define THUMBNAIL_CACHE_KEY_VERSION 2
+
+CThumbnail::CThumbnail()
+{
+	this->uiWidth = 0;
+	this->uiHeight = 0;
+	this->lpData = 0;
+	this->bLowRes = vlFalse;
+	this->bFromCache = vlFalse;
+}
+
+CThumbnail::~CThumbnail()
+{
+	this->Destroy();
+}
+
+vlVoid CThumbnail::Destroy()
+{
+	this->uiWidth = 0;
+	this->uiHeight = 0;
+	delete[] this->lpData;
+	this->lpData = 0;
+	this->bLowRes = vlFalse;
+	this->bFromCache = vlFalse;
+}
+
+// Icon sized requests come from the low-res image Load always reads, the image data is never touched.
+vlBool CThumbnail::UseLowRes( CVTFFile &File, vlUInt uiSize, const SThumbnailOptions &Options )
+{
+	return Options.bLowRes && uiSize <= THUMBNAIL_LOWRES_MAX_SIZE && File.GetHasThumbnail() &&
+		CVTFFile::GetImageFormatInfo( File.GetThumbnailFormat() ).bIsSupported;
+}
+
+// vtex stores a CRC of the source image, so with it the header alone identifies the content.
+vlBool CThumbnail::HasContentCRC( CVTFFile &File )
+{
+	vlUInt uiCRCSize;
+	return File.GetResourceData( VTF_RSRC_CRC, uiCRCSize ) != 0;
+}
+
+// A single huge mip is read a block in every uiStep along each edge, the same step for both keeps the aspect ratio.
+vlBool CThumbnail::UseSampled( CVTFFile &File, vlUInt uiMipmapLevel, vlUInt &uiStep )
+{
+	uiStep = 1;
+
+	const vlUInt64 uiDataSize = File.GetDataSize( 0, 0, 0, uiMipmapLevel );
+	if ( File.IsAuxCompressed() || uiDataSize <= THUMBNAIL_MAX_SOURCE_SIZE )
+		return vlFalse;
+
+	// Decoding grows blocks to BGRA, which bounds the decoded image as well as the data read.
+	vlUInt uiWidth, uiHeight, uiDepth;
+	CVTFFile::ComputeMipmapDimensions( File.GetWidth(), File.GetHeight(), File.GetDepth(), uiMipmapLevel, uiWidth, uiHeight, uiDepth );
+	const vlUInt64 uiSize = std::max( uiDataSize, CVTFFile::ComputeImageSize( uiWidth, uiHeight, 1, IMAGE_FORMAT_BGRA8888 ) );
+	while ( uiSize / ( ( vlUInt64 )uiStep * uiStep ) > THUMBNAIL_MAX_SOURCE_SIZE )
+		uiStep++;
+
+	return vlTrue;
+}
+
+// Aux compressed mips can't be read sampled, the ones too large to hold decoded are scaled as they are inflated instead.
+// Formats ConvertBands can't stream are decoded whole.
+vlBool CThumbnail::UseBanded( CVTFFile &File, vlUInt uiMipmapLevel )
+{
+	vlUInt uiWidth, uiHeight, uiDepth;
+	CVTFFile::ComputeMipmapDimensions( File.GetWidth(), File.GetHeight(), File.GetDepth(), uiMipmapLevel, uiWidth, uiHeight, uiDepth );
+	return File.IsAuxCompressed() && CVTFFile::ComputeImageSize( uiWidth, uiHeight, 1, IMAGE_FORMAT_BGRA8888 ) > THUMBNAIL_MAX_SOURCE_SIZE &&
+		CVTFFile::CanConvertBands( File.GetFormat(), IMAGE_FORMAT_BGRA8888 );
+}
+
+vlUInt CThumbnail::GetConvertFlags( CVTFFile &File, VTFImageFormat Format, const SThumbnailOptions &Options )
+{
+	// Source only uses ATI2N for normal maps, flagged or not. Its Z is reconstructed either way so it looks
+	// like any other normal map; the low-res image of such a file is in another format and has Z already.
+	const vlUInt uiReconstructZ = Format == IMAGE_FORMAT_ATI2N ? VTF_CONVERT_RECONSTRUCT_Z : 0;
+	if ( !Options.bShadeNormalMaps )
+		return uiReconstructZ;
+
+	if ( ( File.GetFlags() & TEXTUREFLAGS_SSBUMP ) != 0 )
+		return VTF_CONVERT_SHADE_SSBUMP;
+
+	if ( ( File.GetFlags() & TEXTUREFLAGS_NORMAL ) != 0 || File.GetFormat() == IMAGE_FORMAT_ATI2N )
+		return uiReconstructZ | VTF_CONVERT_SHADE_NORMALS;
+
+	return uiReconstructZ;
+}
+
+vlBool CThumbnail::ComputeCacheKey( CVTFFile &File, vlUInt uiSize, const SThumbnailOptions &Options, vlBool bLowRes, std::uint64_t &uiKey )
+{
+	const vlUInt uiParameters[5] = { THUMBNAIL_CACHE_KEY_VERSION, uiSize, ( vlUInt )Options.Filter, bLowRes, Options.bShadeNormalMaps };
+	uiKey = CThumbnailCache::Hash( uiParameters, sizeof( uiParameters ), 0 );
+
+	// The header includes the resource dictionary and with it the CRC and the AXC sizes. The low-res image is
+	// always in memory and is regenerated from the content, so it also catches edits that kept a stale CRC.
+	const SVTFHeader &Header = File.GetHeader();
+	uiKey = CThumbnailCache::Hash( &Header, Header.HeaderSize, uiKey );
+	if ( File.GetHasThumbnail() )
+		uiKey = CThumbnailCache::Hash( File.GetThumbnailData(), CVTFFile::ComputeImageSize( File.GetThumbnailWidth(), File.GetThumbnailHeight(), 1, File.GetThumbnailFormat() ), uiKey );
+
+	if ( bLowRes )
+		return vlTrue;
+
+	if ( CThumbnail::HasContentCRC( File ) )
+		return vlTrue;
+
+	const vlUInt uiMipmapLevel = File.GetMipmapLevelForSize( uiSize );
+	const vlByte *lpSource = File.GetData( 0, 0, 0, uiMipmapLevel );
+	vlUInt64 uiSourceSize = File.GetDataSize( 0, 0, 0, uiMipmapLevel );
+	if ( lpSource == 0 )
+	{
+		vlUInt uiSampledWidth, uiSampledHeight;
+		lpSource = File.GetSampledData( uiSampledWidth, uiSampledHeight );
+		uiSourceSize = CVTFFile::ComputeImageSize( uiSampledWidth, uiSampledHeight, 1, File.GetFormat() );
+	}
+
+	if ( lpSource == 0 )
+		return vlFalse;
+
+	uiKey = CThumbnailCache::Hash( lpSource, ( size_t )uiSourceSize, uiKey );
+	return vlTrue;
+}
+
+vlBool CThumbnail::LoadSource( CVTFFile &File, IO::Readers::IReader *Reader, vlUInt uiSize, const SThumbnailOptions &Options, vlUInt64 &uiSourceSize )
+{
+	uiSourceSize = 0;
+
+	if ( !File.IsLoaded() || File.GetFormat() == IMAGE_FORMAT_NONE || uiSize == 0 )
+		return vlFalse;
+
+	if ( CThumbnail::UseLowRes( File, uiSize, Options ) )
+		return vlTrue;
+
+	// Only the smallest mip that still covers the requested size is read.
+	const vlUInt uiMipmapLevel = File.GetMipmapLevelForSize( uiSize );
+	vlUInt uiStep;
+	if ( CThumbnail::UseSampled( File, uiMipmapLevel, uiStep ) )
+	{
+		if ( !File.LoadImageDataSampled( Reader, 0, 0, 0, uiMipmapLevel, uiStep, uiStep ) )
+			return vlFalse;
+
+		vlUInt uiSampledWidth, uiSampledHeight;
+		File.GetSampledData( uiSampledWidth, uiSampledHeight );
+		uiSourceSize = CVTFFile::ComputeImageSize( uiSampledWidth, uiSampledHeight, 1, File.GetFormat() );
+		return vlTrue;
+	}
+
+	if ( !File.LoadImageData( Reader, 0, 0, 0, uiMipmapLevel ) )
+		return vlFalse;
+
+	uiSourceSize = File.GetDataSize( 0, 0, 0, uiMipmapLevel );
+	return vlTrue;
+}
+
+vlBool CThumbnail::Create( CVTFFile &File, IO::Readers::IReader *Reader, vlUInt uiSize, const SThumbnailOptions &Options, CThreadPool *pThreadPool )
+{
+	this->Destroy();
+
+	if ( !File.IsLoaded() || File.GetFormat() == IMAGE_FORMAT_NONE || uiSize == 0 )
+		return vlFalse;
+
+	this->bLowRes = CThumbnail::UseLowRes( File, uiSize, Options );
+
+	// A hit costs the header, or with no CRC resource the read and hash of the mip, instead of the decode.
+	std::uint64_t uiCacheKey = 0;
+	CThumbnailCache *pCache = Options.pCache != 0 && Options.pCache->IsOpen() ? Options.pCache : 0;
+	vlUInt64 uiSourceSize;
+	if ( pCache != 0 )
+	{
+		if ( !this->bLowRes && !CThumbnail::HasContentCRC( File ) && Reader != 0 && !CThumbnail::LoadSource( File, Reader, uiSize, Options, uiSourceSize ) )
+			return vlFalse;
+
+		if ( !CThumbnail::ComputeCacheKey( File, uiSize, Options, this->bLowRes, uiCacheKey ) )
+			uiCacheKey = 0;
+		else if ( pCache->Find( uiCacheKey, this->uiWidth, this->uiHeight, this->lpData ) )
+		{
+			this->bFromCache = vlTrue;
+			return vlTrue;
+		}
+	}
+
+	vlUInt uiSourceWidth, uiSourceHeight, uiSourceDepth;
+	vlByte *lpConverted = 0;
+
+	// Another request for this file at a size served by the same mip may have decoded it already. A finer mip is
+	// not used instead, resampling it takes longer than reading and decoding the right one for most formats.
+	// Sampled mips are smaller than the mip they stand for and banded ones are never held decoded, both stay out of the cache.
+	const vlUInt uiMipmapLevel = this->bLowRes ? 0 : File.GetMipmapLevelForSize( uiSize );
+	vlUInt uiStep;
+	const vlBool bSampled = !this->bLowRes && CThumbnail::UseSampled( File, uiMipmapLevel, uiStep );
+	const vlBool bBanded = !this->bLowRes && !bSampled && CThumbnail::UseBanded( File, uiMipmapLevel );
+	CTextureCache *pTextureCache = !this->bLowRes && !bSampled && !bBanded && Options.pIdentity != 0 ? Options.pTextureCache : 0;
+	if ( pTextureCache == 0 || !pTextureCache->FindMip( *Options.pIdentity, uiMipmapLevel, uiSourceWidth, uiSourceHeight, lpConverted ) )
+	{
+		if ( Reader != 0 && !CThumbnail::LoadSource( File, Reader, uiSize, Options, uiSourceSize ) )
+			return vlFalse;
+
+		vlByte *lpSource;
+		VTFImageFormat Format;
+		vlUInt32 uiCompressedSize;
+
+		if ( this->bLowRes )
+		{
+			lpSource = File.GetThumbnailData();
+			Format = File.GetThumbnailFormat();
+			uiCompressedSize = 0;
+			uiSourceWidth = File.GetThumbnailWidth();
+			uiSourceHeight = File.GetThumbnailHeight();
+		}
+		else if ( bSampled )
+		{
+			lpSource = File.GetSampledData( uiSourceWidth, uiSourceHeight );
+			Format = File.GetFormat();
+			uiCompressedSize = 0;
+		}
+		else
+		{
+			lpSource = File.GetData( 0, 0, 0, uiMipmapLevel );
+			Format = File.GetFormat();
+			uiCompressedSize = File.GetCompressedSize( 0, 0, uiMipmapLevel );
+			CVTFFile::ComputeMipmapDimensions( File.GetWidth(), File.GetHeight(), File.GetDepth(), uiMipmapLevel, uiSourceWidth, uiSourceHeight, uiSourceDepth );
+		}
+
+		if ( lpSource == 0 )
+			return vlFalse;
+
+		if ( bBanded )
+		{
+			// Each band is scaled as it is decoded, the source leaves as the output size.
+			vlUInt uiDestWidth, uiDestHeight;
+			ComputeResampleSize( uiSourceWidth, uiSourceHeight, uiSize, uiDestWidth, uiDestHeight );
+			lpConverted = new vlByte[( size_t )CVTFFile::ComputeImageSize( uiDestWidth, uiDestHeight, 1, IMAGE_FORMAT_BGRA8888 )];
+
+			CResampler Resampler;
+			auto AddBand = []( const vlByte *lpRows, vlUInt, vlUInt uiRows, vlVoid *lpContext ) -> vlBool
+			{
+				return static_cast<CResampler *>( lpContext )->AddRows( lpRows, uiRows );
+			};
+			if ( !Resampler.Create( uiSourceWidth, uiSourceHeight, lpConverted, uiDestWidth, uiDestHeight, Options.Filter, GetBCDecodeLevel() ) ||
+				!CVTFFile::ConvertBands( lpSource, uiSourceWidth, uiSourceHeight, Format, IMAGE_FORMAT_BGRA8888, uiCompressedSize, AddBand, &Resampler, pThreadPool, CThumbnail::GetConvertFlags( File, Format, Options ) ) ||
+				!Resampler.IsComplete() )
+			{
+				delete[] lpConverted;
+				return vlFalse;
+			}
+
+			uiSourceWidth = uiDestWidth;
+			uiSourceHeight = uiDestHeight;
+		}
+		else
+		{
+			lpConverted = new vlByte[( size_t )CVTFFile::ComputeImageSize( uiSourceWidth, uiSourceHeight, 1, IMAGE_FORMAT_BGRA8888 )];
+			if ( !CVTFFile::Convert( lpSource, lpConverted, uiSourceWidth, uiSourceHeight, Format, IMAGE_FORMAT_BGRA8888, uiCompressedSize, pThreadPool, CThumbnail::GetConvertFlags( File, Format, Options ) ) )
+			{
+				delete[] lpConverted;
+				return vlFalse;
+			}
+
+			if ( pTextureCache != 0 )
+				pTextureCache->InsertMip( *Options.pIdentity, uiMipmapLevel, uiSourceWidth, uiSourceHeight, lpConverted );
+		}
+	}
+
+	// Mips rarely match the requested size exactly. The output size comes from the whole mip, the blocks a sampled
+	// read drops at the right and bottom edges would otherwise skew the aspect ratio. Banded mips are scaled already.
+	vlUInt uiMipmapWidth = uiSourceWidth, uiMipmapHeight = uiSourceHeight;
+	if ( bSampled || bBanded )
+		CVTFFile::ComputeMipmapDimensions( File.GetWidth(), File.GetHeight(), File.GetDepth(), uiMipmapLevel, uiMipmapWidth, uiMipmapHeight, uiSourceDepth );
+
+	vlUInt uiDestWidth, uiDestHeight;
+	ComputeResampleSize( uiMipmapWidth, uiMipmapHeight, uiSize, uiDestWidth, uiDestHeight );
+	if ( uiDestWidth != uiSourceWidth || uiDestHeight != uiSourceHeight )
+	{
+		vlByte *lpResampled = new vlByte[( size_t )CVTFFile::ComputeImageSize( uiDestWidth, uiDestHeight, 1, IMAGE_FORMAT_BGRA8888 )];
+		const vlBool bResampled = Resample( lpConverted, uiSourceWidth, uiSourceHeight, lpResampled, uiDestWidth, uiDestHeight, Options.Filter );
+		delete[] lpConverted;
+		if ( !bResampled )
+		{
+			delete[] lpResampled;
+			return vlFalse;
+		}
+		lpConverted = lpResampled;
+	}
+
+	this->uiWidth = uiDestWidth;
+	this->uiHeight = uiDestHeight;
+	this->lpData = lpConverted;
+
+	if ( uiCacheKey != 0 )
+		pCache->Insert( uiCacheKey, this->uiWidth, this->uiHeight, this->lpData );
+
+	return vlTrue;
+}
+
+vlBool CThumbnail::Create( const vlVoid *lpFileData, vlUInt64 uiFileSize, vlUInt uiSize, const SThumbnailOptions &Options, CThreadPool *pThreadPool )
+{
+	this->Destroy();
+
+	// The memory reader lets Load borrow the image data instead of copying all of it.
+	IO::Readers::CMemoryReader Reader( lpFileData, uiFileSize );
+	CVTFFile File;
+	if ( !File.Load( &Reader, VTF_LOAD_NO_IMAGE_DATA | VTF_LOAD_BORROW_DATA ) )
+		return vlFalse;
+
+	return this->Create( File, &Reader, uiSize, Options, pThreadPool );
+}
+
+vlUInt CThumbnail::GetWidth() const
+{
+	return this->uiWidth;
+}
+
+vlUInt CThumbnail::GetHeight() const
+{
+	return this->uiHeight;
+}
+
+vlByte *CThumbnail::GetData() const
+{
+	return this->lpData;
+}
+
+vlBool CThumbnail::GetFromLowRes() const
+{
+	return this->bLowRes;
+}
+
+vlBool CThumbnail::GetFromCache() const
+{
+	return this->bFromCache;
+}
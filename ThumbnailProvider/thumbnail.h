@@ -0,0 +1,80 @@
+﻿#pragma once
+
+#include "vtffile.h"
+#include "resample.h"
+#include <cstdint>
+
+class CThumbnailCache;
+class CTextureCache;
+struct STextureIdentity;
+
+//! Largest thumbnail served from the low-res image; it is usually 16x16, icon views ask for 16 to 32 pixels.
+#define THUMBNAIL_LOWRES_MAX_SIZE 32
+
+//! Mips larger than this, usually the only mip of a huge texture, are read sampled instead of whole, or for aux
+//! compressed mips decoded and scaled a band at a time. Still far more pixels than any thumbnail needs, so it only bounds memory.
+#define THUMBNAIL_MAX_SOURCE_SIZE ( 64 * 1024 * 1024 )
+
+struct SThumbnailOptions
+{
+	SThumbnailOptions() : bLowRes( vlTrue ), bShadeNormalMaps( vlTrue ), Filter( RESAMPLE_LANCZOS3 ), pCache( 0 ), pTextureCache( 0 ), pIdentity( 0 ) {}
+
+	vlBool bLowRes;						//!< Serve sizes up to THUMBNAIL_LOWRES_MAX_SIZE from the low-res image when there is one.
+	vlBool bShadeNormalMaps;			//!< Show normal maps, SSBumps and ATI2N textures lit instead of as colors. Decoded mips
+										//!< are kept in pTextureCache as shaded or not, so keep this the same for one cache.
+	ResampleFilter Filter;				//!< Filter scaling the decoded image to the requested size.
+	CThumbnailCache *pCache;			//!< Looked up before decoding and filled after, if set and open.
+	CTextureCache *pTextureCache;		//!< Decoded mips are reused from and kept in it when both it and pIdentity are set.
+	const STextureIdentity *pIdentity;	//!< Identifies the file in pTextureCache.
+};
+
+//
+// Platform neutral thumbnail pipeline: picks the smallest mip covering the requested size, reads only
+// that mip, decodes it and scales it so its longest edge is exactly the requested size.
+//
+class CThumbnail
+{
+private:
+	vlUInt uiWidth;
+	vlUInt uiHeight;
+	vlByte *lpData;
+	vlBool bLowRes;
+	vlBool bFromCache;
+
+private:
+	static vlBool UseLowRes( CVTFFile &File, vlUInt uiSize, const SThumbnailOptions &Options );
+	static vlBool HasContentCRC( CVTFFile &File );
+	static vlBool UseSampled( CVTFFile &File, vlUInt uiMipmapLevel, vlUInt &uiStep );
+	static vlBool UseBanded( CVTFFile &File, vlUInt uiMipmapLevel );
+	static vlUInt GetConvertFlags( CVTFFile &File, VTFImageFormat Format, const SThumbnailOptions &Options );
+	static vlBool ComputeCacheKey( CVTFFile &File, vlUInt uiSize, const SThumbnailOptions &Options, vlBool bLowRes, std::uint64_t &uiKey );
+
+public:
+	CThumbnail();
+
+	~CThumbnail();
+
+	vlVoid Destroy();
+
+	//! Reads the image data Create will need for uiSize into File, so reading and decoding can happen on different threads.
+	//! Returns the number of bytes File now holds for it in uiSourceSize, 0 when the low-res image is used.
+	static vlBool LoadSource( CVTFFile &File, IO::Readers::IReader *Reader, vlUInt uiSize, const SThumbnailOptions &Options, vlUInt64 &uiSourceSize );
+
+	//! File only needs its header loaded, the mip is read through Reader when File does not hold it already.
+	//! Without a Reader, LoadSource must have been called first.
+	vlBool Create( CVTFFile &File, IO::Readers::IReader *Reader, vlUInt uiSize, const SThumbnailOptions &Options, CThreadPool *pThreadPool = 0 );
+	//! Same for a whole file in memory.
+	vlBool Create( const vlVoid *lpFileData, vlUInt64 uiFileSize, vlUInt uiSize, const SThumbnailOptions &Options, CThreadPool *pThreadPool = 0 );
+
+	vlUInt GetWidth() const;
+	vlUInt GetHeight() const;
+
+	//! BGRA8888 with straight alpha, GetWidth() * 4 bytes per row.
+	vlByte *GetData() const;
+
+	//! Whether the thumbnail came from the low-res image instead of a mip.
+	vlBool GetFromLowRes() const;
+
+	//! Whether the last Create was served by the cache.
+	vlBool GetFromCache() const;
+};
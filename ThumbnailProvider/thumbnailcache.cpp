@@ -0,0 +1,570 @@
+﻿#include "thumbnailcache.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define PACK_MAGIC 0x43435456	// "VTCC"
+#define PACK_VERSION 1
+#define PACK_MIN_SLOTS 256
+#define PACK_BYTES_PER_SLOT 16384		//!< One hash table slot per this many bytes of pack file, about one 64x64 thumbnail.
+#define PACK_MAX_ENTRY_FRACTION 4		//!< Largest entry is this fraction of the data region.
+
+//
+// Pack file layout: SPackHeader, uiSlots SPackEntry hash table slots, then the data region.
+//
+
+struct CThumbnailCache::SPackHeader
+{
+	vlUInt32 uiMagic;
+	vlUInt32 uiVersion;
+	vlUInt32 uiSlots;			//!< Power of two.
+	vlUInt32 uiDirty;			//!< Set while a change is under way, a pack found dirty was left by a crash and is reset.
+	std::uint64_t uiFileSize;
+	std::uint64_t uiDataSize;	//!< Size of the data region.
+	std::uint64_t uiHead;		//!< Where the next entry is appended in the data region.
+	std::uint64_t uiLiveBytes;	//!< Bytes of the data region referenced by entries.
+	std::uint64_t uiClock;		//!< Bumped by every hit and insert, the LRU timestamps.
+	vlUInt32 uiEntryCount;
+	vlUInt32 uiReserved;
+};
+
+struct CThumbnailCache::SPackEntry
+{
+	std::uint64_t uiKey;		//!< 0 for an empty slot.
+	std::uint64_t uiOffset;
+	std::uint64_t uiLastUsed;
+	vlUInt32 uiSize;
+	vlUInt16 uiWidth;
+	vlUInt16 uiHeight;
+};
+
+static_assert( sizeof( std::uint64_t ) == 8, "" );
+
+static vlUInt ComputeSlotCount( std::uint64_t uiFileSize )
+{
+	vlUInt uiSlots = PACK_MIN_SLOTS;
+	while ( uiSlots < uiFileSize / PACK_BYTES_PER_SLOT )
+		uiSlots <<= 1;
+	return uiSlots;
+}
+
+CThumbnailCache::CThumbnailCache()
+{
+#ifdef _WIN32
+	this->hFile = INVALID_HANDLE_VALUE;
+	this->hMapping = 0;
+#else
+	this->iFile = -1;
+#endif
+	this->lpView = 0;
+	this->uiViewSize = 0;
+	this->pHeader = 0;
+	this->pEntries = 0;
+	this->lpData = 0;
+}
+
+CThumbnailCache::~CThumbnailCache()
+{
+	this->Close();
+}
+
+vlBool CThumbnailCache::IsOpen() const
+{
+	return this->lpView != 0;
+}
+
+//
+// Platform layer.
+//
+
+#ifdef _WIN32
+vlBool CThumbnailCache::Open( const vlChar *cFileName, std::uint64_t uiSize )
+{
+	const int iLength = MultiByteToWideChar( CP_UTF8, 0, cFileName, -1, 0, 0 );
+	if ( iLength <= 0 )
+		return vlFalse;
+
+	std::vector<wchar_t> FileName( iLength );
+	MultiByteToWideChar( CP_UTF8, 0, cFileName, -1, FileName.data(), iLength );
+	return this->Open( FileName.data(), uiSize );
+}
+
+vlBool CThumbnailCache::Open( const wchar_t *lpFileName, std::uint64_t uiSize )
+{
+	this->Close();
+
+	if ( uiSize < THUMBNAIL_CACHE_MIN_SIZE )
+		return vlFalse;
+
+	std::lock_guard<std::mutex> Guard( this->Mutex );
+
+	this->hFile = CreateFileW( lpFileName, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, 0, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0 );
+	if ( this->hFile == INVALID_HANDLE_VALUE )
+		return vlFalse;
+
+	return this->Map( uiSize ) && this->Attach();
+}
+
+vlBool CThumbnailCache::Map( std::uint64_t uiSize )
+{
+	// Resizing fails while another process has the file mapped, then this process goes without a cache.
+	LARGE_INTEGER FileSize;
+	if ( !GetFileSizeEx( this->hFile, &FileSize ) )
+	{
+		this->Unmap();
+		return vlFalse;
+	}
+
+	if ( ( std::uint64_t )FileSize.QuadPart != uiSize )
+	{
+		LARGE_INTEGER NewSize;
+		NewSize.QuadPart = ( LONGLONG )uiSize;
+		if ( !SetFilePointerEx( this->hFile, NewSize, 0, FILE_BEGIN ) || !SetEndOfFile( this->hFile ) )
+		{
+			this->Unmap();
+			return vlFalse;
+		}
+	}
+
+	this->hMapping = CreateFileMappingW( this->hFile, 0, PAGE_READWRITE, ( DWORD )( uiSize >> 32 ), ( DWORD )uiSize, 0 );
+	if ( this->hMapping == 0 )
+	{
+		this->Unmap();
+		return vlFalse;
+	}
+
+	this->lpView = static_cast<vlByte *>( MapViewOfFile( this->hMapping, FILE_MAP_ALL_ACCESS, 0, 0, ( SIZE_T )uiSize ) );
+	if ( this->lpView == 0 )
+	{
+		this->Unmap();
+		return vlFalse;
+	}
+
+	this->uiViewSize = uiSize;
+	return vlTrue;
+}
+
+vlVoid CThumbnailCache::Unmap()
+{
+	if ( this->lpView != 0 )
+		UnmapViewOfFile( this->lpView );
+	if ( this->hMapping != 0 )
+		CloseHandle( this->hMapping );
+	if ( this->hFile != INVALID_HANDLE_VALUE )
+		CloseHandle( this->hFile );
+
+	this->hFile = INVALID_HANDLE_VALUE;
+	this->hMapping = 0;
+	this->lpView = 0;
+	this->uiViewSize = 0;
+}
+
+vlVoid CThumbnailCache::Lock()
+{
+	OVERLAPPED Overlapped = {};
+	LockFileEx( this->hFile, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &Overlapped );
+}
+
+vlVoid CThumbnailCache::Unlock()
+{
+	OVERLAPPED Overlapped = {};
+	UnlockFileEx( this->hFile, 0, 1, 0, &Overlapped );
+}
+#else
+vlBool CThumbnailCache::Open( const vlChar *cFileName, std::uint64_t uiSize )
+{
+	this->Close();
+
+	if ( uiSize < THUMBNAIL_CACHE_MIN_SIZE )
+		return vlFalse;
+
+	std::lock_guard<std::mutex> Guard( this->Mutex );
+
+	this->iFile = open( cFileName, O_RDWR | O_CREAT | O_CLOEXEC, 0644 );
+	if ( this->iFile < 0 )
+		return vlFalse;
+
+	return this->Map( uiSize ) && this->Attach();
+}
+
+vlBool CThumbnailCache::Map( std::uint64_t uiSize )
+{
+	struct stat Stat;
+	if ( fstat( this->iFile, &Stat ) != 0 || ( ( std::uint64_t )Stat.st_size != uiSize && ftruncate( this->iFile, ( off_t )uiSize ) != 0 ) )
+	{
+		this->Unmap();
+		return vlFalse;
+	}
+
+	void *lpView = mmap( 0, ( size_t )uiSize, PROT_READ | PROT_WRITE, MAP_SHARED, this->iFile, 0 );
+	if ( lpView == MAP_FAILED )
+	{
+		this->Unmap();
+		return vlFalse;
+	}
+
+	this->lpView = static_cast<vlByte *>( lpView );
+	this->uiViewSize = uiSize;
+	return vlTrue;
+}
+
+vlVoid CThumbnailCache::Unmap()
+{
+	if ( this->lpView != 0 )
+		munmap( this->lpView, ( size_t )this->uiViewSize );
+	if ( this->iFile >= 0 )
+		close( this->iFile );
+
+	this->iFile = -1;
+	this->lpView = 0;
+	this->uiViewSize = 0;
+}
+
+vlVoid CThumbnailCache::Lock()
+{
+	while ( flock( this->iFile, LOCK_EX ) != 0 && errno == EINTR )
+		;
+}
+
+vlVoid CThumbnailCache::Unlock()
+{
+	flock( this->iFile, LOCK_UN );
+}
+#endif
+
+//
+// Pack file.
+//
+
+vlVoid CThumbnailCache::Close()
+{
+	std::lock_guard<std::mutex> Guard( this->Mutex );
+
+	this->Unmap();
+	this->pHeader = 0;
+	this->pEntries = 0;
+	this->lpData = 0;
+}
+
+vlBool CThumbnailCache::Attach()
+{
+	this->pHeader = reinterpret_cast<SPackHeader *>( this->lpView );
+	this->pEntries = reinterpret_cast<SPackEntry *>( this->lpView + sizeof( SPackHeader ) );
+	this->lpData = this->lpView + sizeof( SPackHeader ) + ComputeSlotCount( this->uiViewSize ) * sizeof( SPackEntry );
+
+	this->Lock();
+	if ( !this->IsValid() )
+		this->Reset();
+	this->Unlock();
+
+	return vlTrue;
+}
+
+vlBool CThumbnailCache::IsValid() const
+{
+	const vlUInt uiSlots = ComputeSlotCount( this->uiViewSize );
+	const std::uint64_t uiDataSize = this->uiViewSize - sizeof( SPackHeader ) - ( std::uint64_t )uiSlots * sizeof( SPackEntry );
+	return this->pHeader->uiMagic == PACK_MAGIC && this->pHeader->uiVersion == PACK_VERSION && this->pHeader->uiDirty == 0 &&
+		this->pHeader->uiSlots == uiSlots && this->pHeader->uiFileSize == this->uiViewSize && this->pHeader->uiDataSize == uiDataSize &&
+		this->pHeader->uiHead <= uiDataSize && this->pHeader->uiLiveBytes <= this->pHeader->uiHead && this->pHeader->uiEntryCount < uiSlots;
+}
+
+vlVoid CThumbnailCache::Reset()
+{
+	const vlUInt uiSlots = ComputeSlotCount( this->uiViewSize );
+
+	this->pHeader->uiDirty = 1;
+	memset( this->pEntries, 0, uiSlots * sizeof( SPackEntry ) );
+	this->pHeader->uiMagic = PACK_MAGIC;
+	this->pHeader->uiVersion = PACK_VERSION;
+	this->pHeader->uiSlots = uiSlots;
+	this->pHeader->uiFileSize = this->uiViewSize;
+	this->pHeader->uiDataSize = this->uiViewSize - sizeof( SPackHeader ) - ( std::uint64_t )uiSlots * sizeof( SPackEntry );
+	this->pHeader->uiHead = 0;
+	this->pHeader->uiLiveBytes = 0;
+	this->pHeader->uiClock = 0;
+	this->pHeader->uiEntryCount = 0;
+	this->pHeader->uiReserved = 0;
+	this->pHeader->uiDirty = 0;
+}
+
+// A damaged pack may have no empty slot left, so the probe stops after every slot and starts the pack over.
+CThumbnailCache::SPackEntry *CThumbnailCache::FindEntry( std::uint64_t uiKey )
+{
+	const vlUInt uiMask = this->pHeader->uiSlots - 1;
+	vlUInt i = ( vlUInt )uiKey & uiMask;
+	for ( vlUInt uiProbes = 0; uiProbes < this->pHeader->uiSlots; uiProbes++, i = ( i + 1 ) & uiMask )
+	{
+		if ( this->pEntries[i].uiKey == 0 )
+			return 0;
+
+		if ( this->pEntries[i].uiKey == uiKey )
+			return this->pEntries + i;
+	}
+
+	this->Reset();
+	return 0;
+}
+
+// The table is never full, Compact keeps it at most three quarters used.
+CThumbnailCache::SPackEntry *CThumbnailCache::AddEntry( std::uint64_t uiKey )
+{
+	const vlUInt uiMask = this->pHeader->uiSlots - 1;
+	vlUInt i = ( vlUInt )uiKey & uiMask;
+	while ( this->pEntries[i].uiKey != 0 )
+		i = ( i + 1 ) & uiMask;
+
+	this->pEntries[i].uiKey = uiKey;
+	this->pHeader->uiEntryCount++;
+	return this->pEntries + i;
+}
+
+// Drops the least recently used entries until uiNeeded more bytes fit in three quarters of the data region and
+// the table is at most half full, then moves the remaining data to the front. Called with the pack dirty.
+vlVoid CThumbnailCache::Compact( std::uint64_t uiNeeded )
+{
+	std::vector<SPackEntry> Entries;
+	Entries.reserve( this->pHeader->uiEntryCount );
+	for ( vlUInt i = 0; i < this->pHeader->uiSlots; i++ )
+	{
+		if ( this->pEntries[i].uiKey != 0 )
+			Entries.push_back( this->pEntries[i] );
+	}
+
+	std::sort( Entries.begin(), Entries.end(), []( const SPackEntry &a, const SPackEntry &b ) { return a.uiLastUsed > b.uiLastUsed; } );
+
+	const std::uint64_t uiBudget = this->pHeader->uiDataSize / 4 * 3;
+	const vlUInt uiMaxEntries = this->pHeader->uiSlots / 2;
+	std::uint64_t uiKept = 0;
+	size_t uiCount = 0;
+	while ( uiCount < Entries.size() && uiCount < uiMaxEntries && uiKept + Entries[uiCount].uiSize + uiNeeded <= uiBudget )
+		uiKept += Entries[uiCount++].uiSize;
+	Entries.resize( uiCount );
+
+	// In offset order every entry moves down or stays, so no move overwrites data still to be moved.
+	std::sort( Entries.begin(), Entries.end(), []( const SPackEntry &a, const SPackEntry &b ) { return a.uiOffset < b.uiOffset; } );
+
+	memset( this->pEntries, 0, this->pHeader->uiSlots * sizeof( SPackEntry ) );
+	this->pHeader->uiEntryCount = 0;
+
+	std::uint64_t uiHead = 0;
+	for ( SPackEntry &Entry : Entries )
+	{
+		memmove( this->lpData + uiHead, this->lpData + Entry.uiOffset, Entry.uiSize );
+		Entry.uiOffset = uiHead;
+		uiHead += Entry.uiSize;
+
+		*this->AddEntry( Entry.uiKey ) = Entry;
+	}
+
+	this->pHeader->uiHead = uiHead;
+	this->pHeader->uiLiveBytes = uiHead;
+}
+
+vlBool CThumbnailCache::Find( std::uint64_t uiKey, vlUInt &uiWidth, vlUInt &uiHeight, vlByte *&lpData )
+{
+	std::lock_guard<std::mutex> Guard( this->Mutex );
+	if ( !this->IsOpen() || uiKey == 0 )
+		return vlFalse;
+
+	this->Lock();
+
+	vlBool bFound = vlFalse;
+	if ( !this->IsValid() )
+	{
+		this->Reset();
+	}
+	else if ( SPackEntry *pEntry = this->FindEntry( uiKey ) )
+	{
+		// Another process may have written garbage, never trust an entry beyond the data region.
+		if ( pEntry->uiOffset > this->pHeader->uiHead || pEntry->uiSize > this->pHeader->uiHead - pEntry->uiOffset || pEntry->uiSize != ( vlUInt32 )pEntry->uiWidth * pEntry->uiHeight * 4 )
+		{
+			this->Reset();
+		}
+		else
+		{
+			uiWidth = pEntry->uiWidth;
+			uiHeight = pEntry->uiHeight;
+			lpData = new vlByte[pEntry->uiSize];
+			memcpy( lpData, this->lpData + pEntry->uiOffset, pEntry->uiSize );
+			pEntry->uiLastUsed = ++this->pHeader->uiClock;
+			bFound = vlTrue;
+		}
+	}
+
+	this->Unlock();
+	return bFound;
+}
+
+vlBool CThumbnailCache::Insert( std::uint64_t uiKey, vlUInt uiWidth, vlUInt uiHeight, const vlByte *lpData )
+{
+	std::lock_guard<std::mutex> Guard( this->Mutex );
+	if ( !this->IsOpen() || uiKey == 0 || uiWidth == 0 || uiHeight == 0 || uiWidth > 0xffff || uiHeight > 0xffff )
+		return vlFalse;
+
+	const std::uint64_t uiSize = ( std::uint64_t )uiWidth * uiHeight * 4;
+
+	this->Lock();
+
+	if ( !this->IsValid() )
+		this->Reset();
+
+	if ( uiSize > this->pHeader->uiDataSize / PACK_MAX_ENTRY_FRACTION )
+	{
+		this->Unlock();
+		return vlFalse;
+	}
+
+	// Looked up before marking the pack dirty, the lookup may reset a damaged one.
+	const vlBool bExists = this->FindEntry( uiKey ) != 0;
+	this->pHeader->uiDirty = 1;
+
+	if ( this->pHeader->uiHead + uiSize > this->pHeader->uiDataSize || ( !bExists && ( this->pHeader->uiEntryCount + 1 ) * 4 > this->pHeader->uiSlots * 3 ) )
+		this->Compact( uiSize );
+
+	// Compaction rebuilds the table, so the entry is looked up again. Replaced data stays in the region until the next compaction.
+	SPackEntry *pEntry = this->FindEntry( uiKey );
+	if ( pEntry != 0 )
+		this->pHeader->uiLiveBytes -= pEntry->uiSize;
+	else
+		pEntry = this->AddEntry( uiKey );
+
+	memcpy( this->lpData + this->pHeader->uiHead, lpData, ( size_t )uiSize );
+	pEntry->uiOffset = this->pHeader->uiHead;
+	pEntry->uiSize = ( vlUInt32 )uiSize;
+	pEntry->uiWidth = ( vlUInt16 )uiWidth;
+	pEntry->uiHeight = ( vlUInt16 )uiHeight;
+	pEntry->uiLastUsed = ++this->pHeader->uiClock;
+	this->pHeader->uiHead += uiSize;
+	this->pHeader->uiLiveBytes += uiSize;
+
+	this->pHeader->uiDirty = 0;
+	this->Unlock();
+	return vlTrue;
+}
+
+vlUInt CThumbnailCache::GetEntryCount()
+{
+	std::lock_guard<std::mutex> Guard( this->Mutex );
+	if ( !this->IsOpen() )
+		return 0;
+
+	this->Lock();
+	const vlUInt uiCount = this->IsValid() ? this->pHeader->uiEntryCount : 0;
+	this->Unlock();
+	return uiCount;
+}
+
+std::uint64_t CThumbnailCache::GetDataSize()
+{
+	std::lock_guard<std::mutex> Guard( this->Mutex );
+	if ( !this->IsOpen() )
+		return 0;
+
+	this->Lock();
+	const std::uint64_t uiSize = this->IsValid() ? this->pHeader->uiLiveBytes : 0;
+	this->Unlock();
+	return uiSize;
+}
+
+//
+// XXH64.
+//
+
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+static inline std::uint64_t XXHRotate( std::uint64_t uiValue, vlUInt uiBits )
+{
+	return ( uiValue << uiBits ) | ( uiValue >> ( 64 - uiBits ) );
+}
+
+static inline std::uint64_t XXHRead64( const vlByte *lpData )
+{
+	std::uint64_t uiValue;
+	memcpy( &uiValue, lpData, sizeof( uiValue ) );
+	return uiValue;
+}
+
+static inline std::uint64_t XXHRound( std::uint64_t uiAccumulator, std::uint64_t uiInput )
+{
+	return XXHRotate( uiAccumulator + uiInput * XXH_PRIME64_2, 31 ) * XXH_PRIME64_1;
+}
+
+static inline std::uint64_t XXHMerge( std::uint64_t uiHash, std::uint64_t uiAccumulator )
+{
+	return ( uiHash ^ XXHRound( 0, uiAccumulator ) ) * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+std::uint64_t CThumbnailCache::Hash( const vlVoid *lpData, size_t uiSize, std::uint64_t uiSeed )
+{
+	const vlByte *lpByte = static_cast<const vlByte *>( lpData );
+	const vlByte *lpEnd = lpByte + uiSize;
+	std::uint64_t uiHash;
+
+	if ( uiSize >= 32 )
+	{
+		std::uint64_t v1 = uiSeed + XXH_PRIME64_1 + XXH_PRIME64_2;
+		std::uint64_t v2 = uiSeed + XXH_PRIME64_2;
+		std::uint64_t v3 = uiSeed;
+		std::uint64_t v4 = uiSeed - XXH_PRIME64_1;
+		for ( ; lpByte + 32 <= lpEnd; lpByte += 32 )
+		{
+			v1 = XXHRound( v1, XXHRead64( lpByte ) );
+			v2 = XXHRound( v2, XXHRead64( lpByte + 8 ) );
+			v3 = XXHRound( v3, XXHRead64( lpByte + 16 ) );
+			v4 = XXHRound( v4, XXHRead64( lpByte + 24 ) );
+		}
+
+		uiHash = XXHRotate( v1, 1 ) + XXHRotate( v2, 7 ) + XXHRotate( v3, 12 ) + XXHRotate( v4, 18 );
+		uiHash = XXHMerge( uiHash, v1 );
+		uiHash = XXHMerge( uiHash, v2 );
+		uiHash = XXHMerge( uiHash, v3 );
+		uiHash = XXHMerge( uiHash, v4 );
+	}
+	else
+	{
+		uiHash = uiSeed + XXH_PRIME64_5;
+	}
+
+	uiHash += uiSize;
+
+	for ( ; lpByte + 8 <= lpEnd; lpByte += 8 )
+		uiHash = XXHRotate( uiHash ^ XXHRound( 0, XXHRead64( lpByte ) ), 27 ) * XXH_PRIME64_1 + XXH_PRIME64_4;
+
+	if ( lpByte + 4 <= lpEnd )
+	{
+		vlUInt32 uiValue;
+		memcpy( &uiValue, lpByte, sizeof( uiValue ) );
+		uiHash = XXHRotate( uiHash ^ ( uiValue * XXH_PRIME64_1 ), 23 ) * XXH_PRIME64_2 + XXH_PRIME64_3;
+		lpByte += 4;
+	}
+
+	for ( ; lpByte < lpEnd; lpByte++ )
+		uiHash = XXHRotate( uiHash ^ ( *lpByte * XXH_PRIME64_5 ), 11 ) * XXH_PRIME64_1;
+
+	uiHash ^= uiHash >> 33;
+	uiHash *= XXH_PRIME64_2;
+	uiHash ^= uiHash >> 29;
+	uiHash *= XXH_PRIME64_3;
+	uiHash ^= uiHash >> 32;
+
+	return uiHash != 0 ? uiHash : 1;
+}
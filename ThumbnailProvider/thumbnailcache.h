@@ -0,0 +1,78 @@
+﻿#pragma once
+
+#include "vtffile.h"
+#include <cstdint>
+#include <mutex>
+
+//! Size of the whole pack file, index included.
+#define THUMBNAIL_CACHE_DEFAULT_SIZE ( 64 << 20 )
+#define THUMBNAIL_CACHE_MIN_SIZE ( 1 << 20 )
+
+//
+// Persistent thumbnail cache in a single memory mapped pack file, shared by every thread and process that
+// opens the same file. A hash table indexes BGRA8888 thumbnails that are appended to a data region; when the
+// region or the table fills up, the least recently used entries are dropped and the rest are compacted.
+//
+class CThumbnailCache
+{
+public:
+	CThumbnailCache();
+	~CThumbnailCache();
+
+	CThumbnailCache( const CThumbnailCache & ) = delete;
+	CThumbnailCache &operator=( const CThumbnailCache & ) = delete;
+
+	//! Opens or creates the pack file. A file of another size or version, or one left half written by a crash, starts out empty.
+	vlBool Open( const vlChar *cFileName, std::uint64_t uiSize = THUMBNAIL_CACHE_DEFAULT_SIZE );
+#ifdef _WIN32
+	vlBool Open( const wchar_t *lpFileName, std::uint64_t uiSize = THUMBNAIL_CACHE_DEFAULT_SIZE );
+#endif
+	vlVoid Close();
+
+	vlBool IsOpen() const;
+
+	//! On a hit lpData receives a new[] allocated copy of the thumbnail, owned by the caller.
+	vlBool Find( std::uint64_t uiKey, vlUInt &uiWidth, vlUInt &uiHeight, vlByte *&lpData );
+	//! Replaces any entry with the same key. Fails for thumbnails too large for the cache.
+	vlBool Insert( std::uint64_t uiKey, vlUInt uiWidth, vlUInt uiHeight, const vlByte *lpData );
+
+	vlUInt GetEntryCount();
+	//! Bytes of thumbnail data currently indexed.
+	std::uint64_t GetDataSize();
+
+	//! 64-bit XXH64 of lpData, never 0 so 0 can mean no key.
+	static std::uint64_t Hash( const vlVoid *lpData, size_t uiSize, std::uint64_t uiSeed );
+
+private:
+	struct SPackHeader;
+	struct SPackEntry;
+
+	vlBool Map( std::uint64_t uiSize );
+	vlBool Attach();
+	vlVoid Unmap();
+	vlVoid Lock();
+	vlVoid Unlock();
+
+	vlBool IsValid() const;
+	vlVoid Reset();
+	SPackEntry *FindEntry( std::uint64_t uiKey );
+	SPackEntry *AddEntry( std::uint64_t uiKey );
+	vlVoid Compact( std::uint64_t uiNeeded );
+
+private:
+	std::mutex Mutex;	//!< The file lock only excludes other processes.
+
+#ifdef _WIN32
+	void *hFile;
+	void *hMapping;
+#else
+	int iFile;
+#endif
+
+	vlByte *lpView;
+	std::uint64_t uiViewSize;
+
+	SPackHeader *pHeader;
+	SPackEntry *pEntries;
+	vlByte *lpData;
+};
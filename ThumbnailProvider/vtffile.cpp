@@ -1,16 +1,23 @@
 ﻿#include "vtffile.h"
+#include "readers.h"
+#include <algorithm>
 #include <array>
+#include <cstdint>
 #include <cstring>
-#include <cfloat>
 #include <cmath>
+#include <type_traits>
+#include <utility>
 
 #ifndef SHELLINFO_EXPORTS
 #undef next_in
 #include "zlib.h"
 
-#define BCDEC_STATIC
-#define BCDEC_IMPLEMENTATION
 #include "bcdec.h"
+#include "bcdec_simd.h"
+#include "hdr.h"
+#include "inflate.h"
+#include "normalmap.h"
+#include "threadpool.h"
 #endif
 
 enum CubeMapFaceIndex_t
@@ -38,180 +45,11 @@ enum CubeMapFaceIndex_t
 
 #define FILE_BEGIN 0
 #define FILE_END -1
-namespace IO
-{
-	namespace Readers
-	{
-		class IReader
-		{
-		public:
-			virtual vlBool Opened() const = 0;
-
-			virtual vlBool Open() = 0;
-			virtual vlVoid Close() = 0;
-
-			virtual vlUInt GetStreamSize() const = 0;
-			virtual vlUInt GetStreamPointer() const = 0;
-
-			virtual vlUInt Seek( vlLong lOffset, vlUInt uiMode ) = 0;
-
-			virtual vlBool Read( vlChar &cChar ) = 0;
-			virtual vlUInt Read( vlVoid *vData, vlUInt uiBytes ) = 0;
-		};
-		class CMemoryReader : public IReader
-		{
-		private:
-			vlBool bOpened;
-
-			const vlVoid *vData;
-			vlUInt uiBufferSize;
-
-			vlUInt uiPointer;
-
-		public:
-			CMemoryReader( const vlVoid *vData, vlUInt uiBufferSize )
-			{
-				this->bOpened = vlFalse;
-
-				this->vData = vData;
-				this->uiBufferSize = uiBufferSize;
-			}
-			~CMemoryReader()
-			{
-			}
-
-		public:
-			virtual vlBool Opened() const
-			{
-				return this->bOpened;
-			}
-
-			virtual vlBool Open()
-			{
-				if ( vData == 0 )
-				{
-					return vlFalse;
-				}
-
-				this->uiPointer = 0;
-
-				this->bOpened = vlTrue;
-
-				return vlTrue;
-			}
-			virtual vlVoid Close()
-			{
-				this->bOpened = vlFalse;
-			}
-
-			virtual vlUInt GetStreamSize() const
-			{
-				if ( !this->bOpened )
-				{
-					return 0;
-				}
-
-				return this->uiBufferSize;
-			}
-			virtual vlUInt GetStreamPointer() const
-			{
-				if ( !this->bOpened )
-				{
-					return 0;
-				}
-
-				return this->uiPointer;
-			}
-
-			virtual vlUInt Seek( vlLong lOffset, vlUInt uiMode )
-			{
-				if ( !this->bOpened )
-				{
-					return 0;
-				}
-
-				switch ( uiMode )
-				{
-				case 0:
-					this->uiPointer = 0;
-					break;
-				case 1:
-
-					break;
-				case -1:
-					this->uiPointer = this->uiBufferSize;
-					break;
-				}
-
-				vlLong lPointer = ( vlLong )this->uiPointer + lOffset;
-
-				if ( lPointer < 0 )
-				{
-					lPointer = 0;
-				}
-
-				if ( lPointer >( vlLong )this->uiBufferSize )
-				{
-					lPointer = ( vlLong )this->uiBufferSize;
-				}
-
-				this->uiPointer = ( vlUInt )lPointer;
-
-				return this->uiPointer;
-			}
-
-			vlBool Read( vlChar &cChar )
-			{
-				if ( !this->bOpened )
-				{
-					return vlFalse;
-				}
-
-				if ( this->uiPointer == this->uiBufferSize )
-				{
-					return vlFalse;
-				}
-				else
-				{
-					cChar = *( ( vlChar * )this->vData + this->uiPointer++ );
-
-					return vlTrue;
-				}
-			}
-
-			virtual vlUInt Read( vlVoid *vData, vlUInt uiBytes )
-			{
-				if ( !this->bOpened )
-				{
-					return 0;
-				}
-
-				if ( this->uiPointer == this->uiBufferSize )
-				{
-					return 0;
-				}
-				else if ( this->uiPointer + uiBytes > this->uiBufferSize ) // This right?
-				{
-					uiBytes = this->uiBufferSize - this->uiPointer;
-
-					memcpy( vData, ( vlByte * )this->vData + this->uiPointer, uiBytes );
-
-					this->uiPointer = this->uiBufferSize;
-
-					return uiBytes;
-				}
-				else
-				{
-					memcpy( vData, ( vlByte * )this->vData + this->uiPointer, uiBytes );
-
-					this->uiPointer += uiBytes;
 
-					return uiBytes;
-				}
-			}
-		};
-	}
-}
+//! Largest single read handed to a reader, whose Read takes a 32-bit count.
+#define VTF_READ_CHUNK_SIZE ( 1u << 30 )
+//! Most (mip, frame, face, slice) entries Load builds a table for, the header allows far more than any real file has.
+#define VTF_MAX_SUBRESOURCES ( 1u << 20 )
 
 CVTFFile::CVTFFile()
 {
@@ -220,8 +58,25 @@ CVTFFile::CVTFFile()
 	this->uiImageBufferSize = 0;
 	this->lpImageData = 0;
 
+	this->uiImageDataOffset = 0;
+	this->uiImageWindowOffset = 0;
+	this->uiImageWindowSize = 0;
+
+	this->lpSampledData = 0;
+	this->uiSampledWidth = 0;
+	this->uiSampledHeight = 0;
+	this->uiSampledOffset = 0;
+	this->uiSampledStepX = 0;
+	this->uiSampledStepY = 0;
+
 	this->uiThumbnailBufferSize = 0;
 	this->lpThumbnailImageData = 0;
+
+	this->bDataBorrowed = vlFalse;
+
+	this->bAuxCompressed = vlFalse;
+	this->uiSubresourceCount = 0;
+	this->lpSubresources = 0;
 }
 
 CVTFFile::~CVTFFile()
@@ -235,7 +90,7 @@ vlVoid CVTFFile::Destroy()
 	{
 		for ( vlUInt i = 0; i < this->Header->ResourceCount; i++ )
 		{
-			delete[]this->Header->Data[i].Data;
+			this->FreeData( this->Header->Data[i].Data );
 		}
 	}
 
@@ -243,12 +98,31 @@ vlVoid CVTFFile::Destroy()
 	this->Header = 0;
 
 	this->uiImageBufferSize = 0;
-	delete[]this->lpImageData;
+	this->FreeData( this->lpImageData );
 	this->lpImageData = 0;
 
+	this->uiImageDataOffset = 0;
+	this->uiImageWindowOffset = 0;
+	this->uiImageWindowSize = 0;
+
+	delete[]this->lpSampledData;
+	this->lpSampledData = 0;
+	this->uiSampledWidth = 0;
+	this->uiSampledHeight = 0;
+	this->uiSampledOffset = 0;
+	this->uiSampledStepX = 0;
+	this->uiSampledStepY = 0;
+
 	this->uiThumbnailBufferSize = 0;
-	delete[]this->lpThumbnailImageData;
+	this->FreeData( this->lpThumbnailImageData );
 	this->lpThumbnailImageData = 0;
+
+	this->bDataBorrowed = vlFalse;
+
+	this->bAuxCompressed = vlFalse;
+	this->uiSubresourceCount = 0;
+	delete[]this->lpSubresources;
+	this->lpSubresources = 0;
 }
 
 vlBool CVTFFile::IsPowerOfTwo( vlUInt uiSize )
@@ -278,19 +152,194 @@ vlUInt CVTFFile::NextPowerOfTwo( vlUInt uiSize )
 	return uiSize;
 }
 
+vlBool CVTFFile::CheckedAdd( vlUInt64 uiA, vlUInt64 uiB, vlUInt64 &uiResult )
+{
+	if ( uiA > UINT64_MAX - uiB )
+	{
+		return vlFalse;
+	}
+
+	uiResult = uiA + uiB;
+	return vlTrue;
+}
+
+vlBool CVTFFile::CheckedMultiply( vlUInt64 uiA, vlUInt64 uiB, vlUInt64 &uiResult )
+{
+	if ( uiB != 0 && uiA > UINT64_MAX / uiB )
+	{
+		return vlFalse;
+	}
+
+	uiResult = uiA * uiB;
+	return vlTrue;
+}
+
+vlByte *CVTFFile::ReadData( IO::Readers::IReader *Reader, vlUInt64 uiOffset, vlUInt64 uiSize )
+{
+	if ( this->bDataBorrowed )
+	{
+		vlByte *lpData = ( vlByte * )Reader->Map( uiOffset, uiSize );
+		if ( lpData == 0 )
+		{
+			throw 0;
+		}
+
+		return lpData;
+	}
+
+	// new[] would silently truncate a size that does not fit the address space.
+	if ( uiSize > SIZE_MAX )
+	{
+		throw 0;
+	}
+
+	vlByte *lpData = new vlByte[( size_t )uiSize];
+
+	Reader->Seek( ( vlInt64 )uiOffset, FILE_BEGIN );
+	for ( vlUInt64 uiRead = 0; uiRead < uiSize; )
+	{
+		const vlUInt uiChunk = ( vlUInt )std::min<vlUInt64>( uiSize - uiRead, VTF_READ_CHUNK_SIZE );
+		if ( Reader->Read( lpData + uiRead, uiChunk ) != uiChunk )
+		{
+			delete[]lpData;
+			throw 0;
+		}
+		uiRead += uiChunk;
+	}
+
+	return lpData;
+}
+
+vlVoid CVTFFile::FreeData( vlByte *lpData )
+{
+	if ( !this->bDataBorrowed )
+	{
+		delete[]lpData;
+	}
+}
+
+vlUInt64 CVTFFile::BuildSubresourceTable( vlUInt64 uiMaxSize )
+{
+	const vlUInt uiFrameCount = this->Header->Frames;
+	const vlUInt uiFaceCount = this->GetFaceCount();
+	const vlUInt uiSliceCount = std::max<vlUInt>( this->Header->Depth, 1 );
+	const vlUInt uiMipCount = this->Header->MipCount;
+
+	if ( uiFrameCount == 0 || uiMipCount == 0 )
+	{
+		throw 0;
+	}
+
+	vlUInt uiInfoSize = 0;
+	const vlByte *lpInfo = static_cast<const vlByte *>( this->GetResourceData( VTF_RSRC_AUX_COMPRESSION_INFO, uiInfoSize ) );
+	this->bAuxCompressed = lpInfo != 0 && uiInfoSize > sizeof( AuxCompressionInfoHeader_t ) && reinterpret_cast<const AuxCompressionInfoHeader_t *>( lpInfo )->m_CompressionLevel != 0;
+
+	// Reject sizes the file cannot hold before allocating anything for them.
+	if ( this->bAuxCompressed )
+	{
+		if ( uiInfoSize < sizeof( AuxCompressionInfoHeader_t ) + ( vlUInt64 )uiMipCount * uiFrameCount * uiFaceCount * sizeof( AuxCompressionInfoEntry_t ) )
+		{
+			throw 0;
+		}
+	}
+	else if ( this->uiImageBufferSize > uiMaxSize )
+	{
+		throw 0;
+	}
+
+	// Volumes and long animations multiply up quickly, the table is bounded before it is allocated.
+	const vlUInt64 uiSubresourceCount = ( vlUInt64 )uiMipCount * uiFrameCount * uiFaceCount * uiSliceCount;
+	if ( uiSubresourceCount > VTF_MAX_SUBRESOURCES )
+	{
+		throw 0;
+	}
+
+	this->uiSubresourceCount = ( vlUInt )uiSubresourceCount;
+	this->lpSubresources = new SVTFSubresourceInfo[this->uiSubresourceCount];
+
+	// Same walk as the data is laid out in: smallest mip first, then frames, faces and slices.
+	vlUInt64 uiOffset = 0;
+	for ( vlInt iMip = ( vlInt )uiMipCount - 1; iMip >= 0; --iMip )
+	{
+		vlUInt uiMipmapWidth, uiMipmapHeight, uiMipmapDepth;
+		CVTFFile::ComputeMipmapDimensions( this->Header->Width, this->Header->Height, uiSliceCount, iMip, uiMipmapWidth, uiMipmapHeight, uiMipmapDepth );
+
+		const vlUInt64 uiSliceSize = CVTFFile::ComputeImageSize( uiMipmapWidth, uiMipmapHeight, 1, this->Header->ImageFormat );
+
+		for ( vlUInt iFrame = 0; iFrame < uiFrameCount; ++iFrame )
+		{
+			for ( vlUInt iFace = 0; iFace < uiFaceCount; ++iFace )
+			{
+				SVTFSubresourceInfo *lpSubresource = this->lpSubresources + ( ( iMip * uiFrameCount + iFrame ) * uiFaceCount + iFace ) * uiSliceCount;
+
+				if ( this->bAuxCompressed )
+				{
+					// Every face is one compressed stream holding all of its slices.
+					const vlUInt uiSize = reinterpret_cast<const AuxCompressionInfoEntry_t *>( lpInfo + this->GetAuxInfoOffset( iFrame, iFace, iMip ) )->m_CompressedSize;
+					for ( vlUInt iSlice = 0; iSlice < uiSliceCount; ++iSlice )
+					{
+						lpSubresource[iSlice].uiOffset = uiOffset;
+						lpSubresource[iSlice].uiSize = uiSize;
+					}
+					uiOffset += uiSize;
+				}
+				else
+				{
+					// Mips of volume textures have fewer slices, the ones past their depth repeat the last slice.
+					for ( vlUInt iSlice = 0; iSlice < uiSliceCount; ++iSlice )
+					{
+						lpSubresource[iSlice].uiOffset = uiOffset + ( vlUInt64 )std::min( iSlice, uiMipmapDepth - 1 ) * uiSliceSize;
+						lpSubresource[iSlice].uiSize = uiSliceSize;
+					}
+					uiOffset += uiSliceSize * uiMipmapDepth;
+				}
+			}
+		}
+	}
+
+	return uiOffset;
+}
+
+const SVTFSubresourceInfo *CVTFFile::GetSubresource( vlUInt uiFrame, vlUInt uiFace, vlUInt uiSlice, vlUInt uiMipmapLevel ) const
+{
+	if ( this->lpSubresources == 0 )
+	{
+		return 0;
+	}
+
+	const vlUInt uiFrameCount = this->Header->Frames;
+	const vlUInt uiFaceCount = this->GetFaceCount();
+	const vlUInt uiSliceCount = std::max<vlUInt>( this->Header->Depth, 1 );
+	const vlUInt uiMipCount = this->Header->MipCount;
+
+	if ( uiFrame >= uiFrameCount )
+		uiFrame = uiFrameCount - 1;
+
+	if ( uiFace >= uiFaceCount )
+		uiFace = uiFaceCount - 1;
+
+	if ( uiSlice >= uiSliceCount )
+		uiSlice = uiSliceCount - 1;
+
+	if ( uiMipmapLevel >= uiMipCount )
+		uiMipmapLevel = uiMipCount - 1;
+
+	return this->lpSubresources + ( ( uiMipmapLevel * uiFrameCount + uiFrame ) * uiFaceCount + uiFace ) * uiSliceCount + uiSlice;
+}
+
 vlBool CVTFFile::IsLoaded() const
 {
 	return this->Header != 0;
 }
 
 
-vlBool CVTFFile::Load( const vlVoid *lpData, vlUInt uiBufferSize, vlBool bHeaderOnly )
+vlBool CVTFFile::Load( const vlVoid *lpData, vlUInt64 uiBufferSize, vlBool bHeaderOnly )
 {
 	IO::Readers::CMemoryReader i = IO::Readers::CMemoryReader( lpData, uiBufferSize );
-	return this->Load( &i, bHeaderOnly );
+	return this->Load( &i, bHeaderOnly ? VTF_LOAD_HEADER_ONLY : 0 );
 }
 
-vlBool CVTFFile::Load( IO::Readers::IReader *Reader, vlBool bHeaderOnly )
+vlBool CVTFFile::Load( IO::Readers::IReader *Reader, vlUInt uiFlags )
 {
 	this->Destroy();
 
@@ -299,13 +348,16 @@ vlBool CVTFFile::Load( IO::Readers::IReader *Reader, vlBool bHeaderOnly )
 		if ( !Reader->Open() )
 			throw 0;
 
-		vlUInt uiFileSize = Reader->GetStreamSize();
+		vlUInt64 uiFileSize = Reader->GetStreamSize();
 
 		if ( uiFileSize < sizeof( SVTFFileHeader ) )
 		{
 			throw 0;
 		}
 
+		// The whole stream is bounds checked once here, every later Map is a pointer offset.
+		this->bDataBorrowed = ( uiFlags & VTF_LOAD_BORROW_DATA ) && Reader->Map( 0, uiFileSize ) != 0;
+
 		SVTFFileHeader FileHeader;
 
 		memset( &FileHeader, 0, sizeof( SVTFFileHeader ) );
@@ -349,24 +401,43 @@ vlBool CVTFFile::Load( IO::Readers::IReader *Reader, vlBool bHeaderOnly )
 			this->Header->ResourceCount = 0;
 		}
 
-		if ( bHeaderOnly )
+		if ( uiFlags & VTF_LOAD_HEADER_ONLY )
 		{
 			Reader->Close();
 			return vlTrue;
 		}
 
-		this->uiImageBufferSize = CVTFFile::ComputeImageSize( this->Header->Width, this->Header->Height, this->Header->Depth, this->Header->MipCount, this->Header->ImageFormat ) * this->GetFaceCount() * this->GetFrameCount();
+		if ( this->Header->ImageFormat != IMAGE_FORMAT_NONE && ( this->Header->ImageFormat < 0 || this->Header->ImageFormat >= IMAGE_FORMAT_COUNT ) )
+		{
+			throw 0;
+		}
+
+		if ( this->Header->LowResImageFormat != IMAGE_FORMAT_NONE && ( this->Header->LowResImageFormat < 0 || this->Header->LowResImageFormat >= IMAGE_FORMAT_COUNT ) )
+		{
+			throw 0;
+		}
+
+		if ( this->Header->ImageFormat != IMAGE_FORMAT_NONE )
+		{
+			// Many frames of a large HDR cubemap add up past 64 bits, such a header cannot describe a real file.
+			const vlUInt64 uiFaceSize = CVTFFile::ComputeImageSize( this->Header->Width, this->Header->Height, this->Header->Depth, this->Header->MipCount, this->Header->ImageFormat );
+			vlUInt64 uiFrameSize;
+			if ( !CVTFFile::CheckedMultiply( uiFaceSize, this->GetFaceCount(), uiFrameSize ) || !CVTFFile::CheckedMultiply( uiFrameSize, this->GetFrameCount(), this->uiImageBufferSize ) )
+			{
+				throw 0;
+			}
+		}
 
 		if ( this->Header->LowResImageFormat != IMAGE_FORMAT_NONE )
 		{
-			this->uiThumbnailBufferSize = CVTFFile::ComputeImageSize( this->Header->LowResImageWidth, this->Header->LowResImageHeight, 1, this->Header->LowResImageFormat );
+			this->uiThumbnailBufferSize = ( vlUInt )CVTFFile::ComputeImageSize( this->Header->LowResImageWidth, this->Header->LowResImageHeight, 1, this->Header->LowResImageFormat );
 		}
 		else
 		{
 			this->uiThumbnailBufferSize = 0;
 		}
 
-		vlUInt uiThumbnailBufferOffset = 0, uiImageDataOffset = 0, uiImageBufferSize = this->uiImageBufferSize;
+		vlUInt64 uiThumbnailBufferOffset = 0, uiImageDataOffset = 0, uiImageBufferSize = 0;
 		if ( this->Header->ResourceCount )
 		{
 			if ( this->Header->ResourceCount > VTF_RSRC_MAX_DICTIONARY_ENTRIES )
@@ -398,7 +469,7 @@ vlBool CVTFFile::Load( IO::Readers::IReader *Reader, vlBool bHeaderOnly )
 					break;
 				case VTF_RSRC_AUX_COMPRESSION_INFO:
 				{
-					if ( this->Header->Resources[i].Data + sizeof( vlUInt ) > uiFileSize )
+					if ( ( vlUInt64 )this->Header->Resources[i].Data + sizeof( vlUInt ) > uiFileSize )
 					{
 						throw 0;
 					}
@@ -410,52 +481,19 @@ vlBool CVTFFile::Load( IO::Readers::IReader *Reader, vlBool bHeaderOnly )
 						throw 0;
 					}
 
-					if ( this->Header->Resources[i].Data + sizeof( vlUInt ) + uiSize > uiFileSize )
+					if ( ( vlUInt64 )this->Header->Resources[i].Data + sizeof( vlUInt ) + uiSize > uiFileSize )
 					{
 						throw 0;
 					}
 
 					this->Header->Data[i].Size = uiSize;
-					auto pCompressionInfo = this->Header->Data[i].Data = new vlByte[uiSize];
-					if ( Reader->Read( this->Header->Data[i].Data, uiSize ) != uiSize )
-					{
-						throw 0;
-					}
-
-					vlUInt uiFrameCount = this->Header->Frames;
-					vlUInt uiFaceCount = this->GetFaceCount();
-					vlUInt uiSliceCount = this->Header->Depth;
-					vlUInt uiMipCount = this->Header->MipCount;
-
-					bool bIsAuxCompressed = false;
-					if ( uiSize > sizeof( AuxCompressionInfoHeader_t ) )
-						bIsAuxCompressed = ( (AuxCompressionInfoHeader_t *)pCompressionInfo )->m_CompressionLevel != 0;
-
-					if ( bIsAuxCompressed )
-					{
-						uiImageBufferSize = 0;
-						for ( vlInt iMip = uiMipCount - 1; iMip >= 0; --iMip )
-						{
-							for ( vlUInt iFrame = 0; iFrame < uiFrameCount; ++iFrame )
-							{
-								for ( vlUInt iFace = 0; iFace < uiFaceCount; ++iFace )
-								{
-									vlUInt infoOffset = GetAuxInfoOffset( iFrame, iFace, iMip );
-
-									AuxCompressionInfoEntry_t *infoEntry = (AuxCompressionInfoEntry_t *)( pCompressionInfo + infoOffset );
-
-									uiImageBufferSize += infoEntry->m_CompressedSize;
-								}
-							}
-						}
-					}
-
+					this->Header->Data[i].Data = this->ReadData( Reader, this->Header->Resources[i].Data + sizeof( vlUInt ), uiSize );
 				}
 					break;
 				default:
 					if ( ( this->Header->Resources[i].Flags & RSRCF_HAS_NO_DATA_CHUNK ) == 0 )
 					{
-						if ( this->Header->Resources[i].Data + sizeof( vlUInt ) > uiFileSize )
+						if ( ( vlUInt64 )this->Header->Resources[i].Data + sizeof( vlUInt ) > uiFileSize )
 						{
 							throw 0;
 						}
@@ -467,17 +505,13 @@ vlBool CVTFFile::Load( IO::Readers::IReader *Reader, vlBool bHeaderOnly )
 							throw 0;
 						}
 
-						if ( this->Header->Resources[i].Data + sizeof( vlUInt ) + uiSize > uiFileSize )
+						if ( ( vlUInt64 )this->Header->Resources[i].Data + sizeof( vlUInt ) + uiSize > uiFileSize )
 						{
 							throw 0;
 						}
 
 						this->Header->Data[i].Size = uiSize;
-						this->Header->Data[i].Data = new vlByte[uiSize];
-						if ( Reader->Read( this->Header->Data[i].Data, uiSize ) != uiSize )
-						{
-							throw 0;
-						}
+						this->Header->Data[i].Data = this->ReadData( Reader, this->Header->Resources[i].Data + sizeof( vlUInt ), uiSize );
 					}
 					break;
 				}
@@ -489,6 +523,16 @@ vlBool CVTFFile::Load( IO::Readers::IReader *Reader, vlBool bHeaderOnly )
 			uiImageDataOffset = uiThumbnailBufferOffset + this->uiThumbnailBufferSize;
 		}
 
+		if ( this->Header->ImageFormat != IMAGE_FORMAT_NONE && uiImageDataOffset != 0 )
+		{
+			if ( uiImageDataOffset > uiFileSize )
+			{
+				throw 0;
+			}
+
+			uiImageBufferSize = this->BuildSubresourceTable( uiFileSize - uiImageDataOffset );
+		}
+
 		if ( this->Header->HeaderSize > uiFileSize || uiThumbnailBufferOffset + this->uiThumbnailBufferSize > uiFileSize || uiImageDataOffset + uiImageBufferSize > uiFileSize )
 		{
 			throw 0;
@@ -501,13 +545,7 @@ vlBool CVTFFile::Load( IO::Readers::IReader *Reader, vlBool bHeaderOnly )
 
 		if ( this->Header->LowResImageFormat != IMAGE_FORMAT_NONE )
 		{
-			this->lpThumbnailImageData = new vlByte[this->uiThumbnailBufferSize];
-
-			Reader->Seek( uiThumbnailBufferOffset, FILE_BEGIN );
-			if ( Reader->Read( this->lpThumbnailImageData, this->uiThumbnailBufferSize ) != this->uiThumbnailBufferSize )
-			{
-				throw 0;
-			}
+			this->lpThumbnailImageData = this->ReadData( Reader, uiThumbnailBufferOffset, this->uiThumbnailBufferSize );
 		}
 
 		if ( uiImageDataOffset == 0 )
@@ -517,34 +555,295 @@ vlBool CVTFFile::Load( IO::Readers::IReader *Reader, vlBool bHeaderOnly )
 
 		if ( this->Header->ImageFormat != IMAGE_FORMAT_NONE )
 		{
-			if (this->Header->ImageFormat < 0 || this->Header->ImageFormat > IMAGE_FORMAT_COUNT)
+			this->uiImageDataOffset = uiImageDataOffset;
+
+			if ( uiFlags & VTF_LOAD_NO_IMAGE_DATA )
 			{
-				throw 0;
+				Reader->Close();
+				return vlTrue;
 			}
 
-			this->lpImageData = new vlByte[uiImageBufferSize];
+			this->lpImageData = this->ReadData( Reader, uiImageDataOffset, uiImageBufferSize );
+			this->uiImageWindowSize = uiImageBufferSize;
+		}
+	}
+	catch ( ... )
+	{
+		Reader->Close();
+
+		this->Destroy();
+
+		return vlFalse;
+	}
+
+	Reader->Close();
+
+	return vlTrue;
+}
+
+vlBool CVTFFile::LoadImageData( IO::Readers::IReader *Reader, vlUInt uiFrame, vlUInt uiFace, vlUInt uiSlice, vlUInt uiMipmapLevel )
+{
+	if ( !this->IsLoaded() || this->uiImageDataOffset == 0 )
+	{
+		return vlFalse;
+	}
+
+	const vlUInt64 uiOffset = this->ComputeDataOffset( uiFrame, uiFace, uiSlice, uiMipmapLevel );
+	const vlUInt64 uiSize = this->GetDataSize( uiFrame, uiFace, uiSlice, uiMipmapLevel );
+
+	delete[]this->lpSampledData;
+	this->lpSampledData = 0;
+	this->uiSampledWidth = 0;
+	this->uiSampledHeight = 0;
+	this->uiSampledOffset = 0;
+	this->uiSampledStepX = 0;
+	this->uiSampledStepY = 0;
+
+	if ( this->lpImageData != 0 && uiOffset >= this->uiImageWindowOffset && uiOffset + uiSize <= this->uiImageWindowOffset + this->uiImageWindowSize )
+	{
+		return vlTrue;
+	}
+
+	this->FreeData( this->lpImageData );
+	this->lpImageData = 0;
+	this->uiImageWindowOffset = 0;
+	this->uiImageWindowSize = 0;
+
+	if ( !Reader->Open() )
+	{
+		return vlFalse;
+	}
+
+	vlByte *lpData = 0;
+	try
+	{
+		if ( this->uiImageDataOffset + uiOffset + uiSize > Reader->GetStreamSize() )
+		{
+			throw 0;
+		}
+
+		lpData = this->ReadData( Reader, this->uiImageDataOffset + uiOffset, uiSize );
+	}
+	catch ( ... )
+	{
+		Reader->Close();
+		return vlFalse;
+	}
+
+	Reader->Close();
+
+	this->lpImageData = lpData;
+	this->uiImageWindowOffset = uiOffset;
+	this->uiImageWindowSize = uiSize;
+
+	return vlTrue;
+}
+
+//! Pixels covered by every uiStep-th block along an edge of uiSize pixels, the last block may be partial.
+static vlUInt ComputeSampledSize( vlUInt uiSize, vlUInt uiBlockSize, vlUInt uiStep )
+{
+	const vlUInt uiBlocks = ( uiSize + uiBlockSize - 1 ) / uiBlockSize;
+	const vlUInt uiKept = ( uiBlocks + uiStep - 1 ) / uiStep;
+	if ( ( uiKept - 1 ) * uiStep == uiBlocks - 1 )
+		return ( uiKept - 1 ) * uiBlockSize + ( uiSize - ( uiBlocks - 1 ) * uiBlockSize );
+
+	return uiKept * uiBlockSize;
+}
+
+vlBool CVTFFile::LoadImageDataSampled( IO::Readers::IReader *Reader, vlUInt uiFrame, vlUInt uiFace, vlUInt uiSlice, vlUInt uiMipmapLevel, vlUInt uiStepX, vlUInt uiStepY )
+{
+	// Aux compressed faces are one deflate stream, there is no seeking to a row in them.
+	if ( !this->IsLoaded() || this->uiImageDataOffset == 0 || this->bAuxCompressed || uiStepX == 0 || uiStepY == 0 )
+	{
+		return vlFalse;
+	}
+
+	// Block compressed formats are sampled in whole blocks, everything else in pixels.
+	const VTFImageFormat Format = this->Header->ImageFormat;
+	const vlUInt uiBlockSize = CVTFFile::GetImageFormatInfo( Format ).bIsCompressed ? 4 : 1;
+	const vlUInt uiBlockBytes = ( vlUInt )CVTFFile::ComputeImageSize( uiBlockSize, uiBlockSize, 1, Format );
+	if ( uiBlockBytes == 0 )
+	{
+		return vlFalse;
+	}
+
+	vlUInt uiWidth, uiHeight, uiDepth;
+	CVTFFile::ComputeMipmapDimensions( this->Header->Width, this->Header->Height, this->Header->Depth, uiMipmapLevel, uiWidth, uiHeight, uiDepth );
+
+	const vlUInt uiBlocksX = ( uiWidth + uiBlockSize - 1 ) / uiBlockSize;
+	const vlUInt uiBlocksY = ( uiHeight + uiBlockSize - 1 ) / uiBlockSize;
+	const vlUInt uiKeptX = ( uiBlocksX + uiStepX - 1 ) / uiStepX;
+	const vlUInt uiKeptY = ( uiBlocksY + uiStepY - 1 ) / uiStepY;
+	const vlUInt64 uiRowSize = ( vlUInt64 )uiBlocksX * uiBlockBytes;
+	const vlUInt64 uiSampledRowSize = ( vlUInt64 )uiKeptX * uiBlockBytes;
+	const vlUInt64 uiSampledSize = uiSampledRowSize * uiKeptY;
+	if ( uiSampledSize > SIZE_MAX || uiRowSize > VTF_READ_CHUNK_SIZE )
+	{
+		return vlFalse;
+	}
+
+	const vlUInt64 uiOffset = this->uiImageDataOffset + this->ComputeDataOffset( uiFrame, uiFace, uiSlice, uiMipmapLevel );
+	if ( this->lpSampledData != 0 && this->uiSampledOffset == uiOffset && this->uiSampledStepX == uiStepX && this->uiSampledStepY == uiStepY )
+	{
+		return vlTrue;
+	}
+
+	this->FreeData( this->lpImageData );
+	this->lpImageData = 0;
+	this->uiImageWindowOffset = 0;
+	this->uiImageWindowSize = 0;
+
+	delete[]this->lpSampledData;
+	this->lpSampledData = 0;
+	this->uiSampledWidth = 0;
+	this->uiSampledHeight = 0;
+	this->uiSampledOffset = 0;
+	this->uiSampledStepX = 0;
+	this->uiSampledStepY = 0;
+
+	if ( !Reader->Open() )
+	{
+		return vlFalse;
+	}
+
+	vlByte *lpData = 0;
+	vlByte *lpRow = 0;
+	try
+	{
+		if ( uiOffset + this->GetDataSize( uiFrame, uiFace, uiSlice, uiMipmapLevel ) > Reader->GetStreamSize() )
+		{
+			throw 0;
+		}
+
+		// Only one row of blocks is held beyond the result; without horizontal sampling rows are read in place.
+		lpData = new vlByte[( size_t )uiSampledSize];
+		if ( uiStepX > 1 )
+		{
+			lpRow = new vlByte[( size_t )uiRowSize];
+		}
+
+		for ( vlUInt y = 0; y < uiKeptY; y++ )
+		{
+			vlByte *lpDest = lpData + y * uiSampledRowSize;
+			vlByte *lpSource = lpRow != 0 ? lpRow : lpDest;
 
-			Reader->Seek( uiImageDataOffset, FILE_BEGIN );
-			if ( Reader->Read( this->lpImageData, uiImageBufferSize ) != uiImageBufferSize )
+			Reader->Seek( ( vlInt64 )( uiOffset + ( vlUInt64 )y * uiStepY * uiRowSize ), FILE_BEGIN );
+			if ( Reader->Read( lpSource, ( vlUInt )uiRowSize ) != uiRowSize )
 			{
 				throw 0;
 			}
+
+			if ( lpRow != 0 )
+			{
+				for ( vlUInt x = 0; x < uiKeptX; x++ )
+				{
+					memcpy( lpDest + x * uiBlockBytes, lpSource + ( size_t )x * uiStepX * uiBlockBytes, uiBlockBytes );
+				}
+			}
 		}
 	}
 	catch ( ... )
 	{
 		Reader->Close();
+		delete[]lpData;
+		delete[]lpRow;
+		return vlFalse;
+	}
 
-		this->Destroy();
+	Reader->Close();
+	delete[]lpRow;
+
+	this->lpSampledData = lpData;
+	this->uiSampledWidth = ComputeSampledSize( uiWidth, uiBlockSize, uiStepX );
+	this->uiSampledHeight = ComputeSampledSize( uiHeight, uiBlockSize, uiStepY );
+	this->uiSampledOffset = uiOffset;
+	this->uiSampledStepX = uiStepX;
+	this->uiSampledStepY = uiStepY;
+
+	return vlTrue;
+}
+
+vlByte *CVTFFile::GetSampledData( vlUInt &uiWidth, vlUInt &uiHeight ) const
+{
+	uiWidth = this->uiSampledWidth;
+	uiHeight = this->uiSampledHeight;
+
+	return this->lpSampledData;
+}
 
+vlBool CVTFFile::CopyHeader( const CVTFFile &File )
+{
+	this->Destroy();
+
+	if ( !File.IsLoaded() )
+	{
 		return vlFalse;
 	}
 
-	Reader->Close();
+	this->Header = new SVTFHeader;
+	memcpy( this->Header, File.Header, sizeof( SVTFHeader ) );
+
+	// A header only load does not validate the count, the data of anything past the dictionary was never read.
+	const vlUInt uiResourceCount = std::min<vlUInt>( this->Header->ResourceCount, VTF_RSRC_MAX_DICTIONARY_ENTRIES );
+	for ( vlUInt i = 0; i < VTF_RSRC_MAX_DICTIONARY_ENTRIES; i++ )
+	{
+		this->Header->Data[i].Data = 0;
+		if ( i < uiResourceCount && File.Header->Data[i].Data != 0 )
+		{
+			this->Header->Data[i].Data = new vlByte[File.Header->Data[i].Size];
+			memcpy( this->Header->Data[i].Data, File.Header->Data[i].Data, File.Header->Data[i].Size );
+		}
+	}
+
+	this->uiImageBufferSize = File.uiImageBufferSize;
+	this->uiImageDataOffset = File.uiImageDataOffset;
+
+	if ( File.lpThumbnailImageData != 0 )
+	{
+		this->uiThumbnailBufferSize = File.uiThumbnailBufferSize;
+		this->lpThumbnailImageData = new vlByte[File.uiThumbnailBufferSize];
+		memcpy( this->lpThumbnailImageData, File.lpThumbnailImageData, File.uiThumbnailBufferSize );
+	}
+
+	this->bAuxCompressed = File.bAuxCompressed;
+	if ( File.lpSubresources != 0 )
+	{
+		this->uiSubresourceCount = File.uiSubresourceCount;
+		this->lpSubresources = new SVTFSubresourceInfo[File.uiSubresourceCount];
+		memcpy( this->lpSubresources, File.lpSubresources, File.uiSubresourceCount * sizeof( SVTFSubresourceInfo ) );
+	}
 
 	return vlTrue;
 }
 
+vlUInt64 CVTFFile::GetMemorySize() const
+{
+	if ( !this->IsLoaded() )
+		return sizeof( CVTFFile );
+
+	vlUInt64 uiSize = sizeof( CVTFFile ) + sizeof( SVTFHeader ) + ( vlUInt64 )this->uiSubresourceCount * sizeof( SVTFSubresourceInfo );
+	if ( this->lpSampledData != 0 )
+		uiSize += CVTFFile::ComputeImageSize( this->uiSampledWidth, this->uiSampledHeight, 1, this->Header->ImageFormat );
+
+	if ( !this->bDataBorrowed )
+	{
+		const vlUInt uiResourceCount = std::min<vlUInt>( this->Header->ResourceCount, VTF_RSRC_MAX_DICTIONARY_ENTRIES );
+		for ( vlUInt i = 0; i < uiResourceCount; i++ )
+		{
+			if ( this->Header->Data[i].Data != 0 )
+				uiSize += this->Header->Data[i].Size;
+		}
+
+		if ( this->lpThumbnailImageData != 0 )
+			uiSize += this->uiThumbnailBufferSize;
+
+		if ( this->lpImageData != 0 )
+			uiSize += this->uiImageWindowSize;
+	}
+
+	return uiSize;
+}
+
 vlUInt CVTFFile::GetWidth() const
 {
 	if ( !this->IsLoaded() )
@@ -606,7 +905,73 @@ vlByte *CVTFFile::GetData( vlUInt uiFrame, vlUInt uiFace, vlUInt uiSlice, vlUInt
 	if ( !this->IsLoaded() )
 		return 0;
 
-	return this->lpImageData + this->ComputeDataOffset( uiFrame, uiFace, uiSlice, uiMipmapLevel, this->Header->ImageFormat );
+	if ( this->lpImageData == 0 )
+		return 0;
+
+	// The whole subresource has to be in the window, callers read GetDataSize bytes from the pointer.
+	const SVTFSubresourceInfo *lpSubresource = this->GetSubresource( uiFrame, uiFace, uiSlice, uiMipmapLevel );
+	if ( lpSubresource == 0 || lpSubresource->uiOffset < this->uiImageWindowOffset ||
+		lpSubresource->uiOffset + lpSubresource->uiSize > this->uiImageWindowOffset + this->uiImageWindowSize )
+		return 0;
+
+	return this->lpImageData + ( lpSubresource->uiOffset - this->uiImageWindowOffset );
+}
+
+vlBool CVTFFile::GetHasThumbnail() const
+{
+	if ( !this->IsLoaded() )
+		return vlFalse;
+
+	return this->Header->LowResImageFormat != IMAGE_FORMAT_NONE && this->lpThumbnailImageData != 0 && this->uiThumbnailBufferSize != 0;
+}
+
+vlUInt CVTFFile::GetThumbnailWidth() const
+{
+	if ( !this->GetHasThumbnail() )
+		return 0;
+
+	return this->Header->LowResImageWidth;
+}
+
+vlUInt CVTFFile::GetThumbnailHeight() const
+{
+	if ( !this->GetHasThumbnail() )
+		return 0;
+
+	return this->Header->LowResImageHeight;
+}
+
+VTFImageFormat CVTFFile::GetThumbnailFormat() const
+{
+	if ( !this->GetHasThumbnail() )
+		return IMAGE_FORMAT_NONE;
+
+	return this->Header->LowResImageFormat;
+}
+
+vlByte *CVTFFile::GetThumbnailData() const
+{
+	if ( !this->GetHasThumbnail() )
+		return 0;
+
+	return this->lpThumbnailImageData;
+}
+
+vlUInt CVTFFile::GetMipmapLevelForSize( vlUInt uiSize ) const
+{
+	if ( !this->IsLoaded() || this->Header->ImageFormat == IMAGE_FORMAT_NONE )
+		return 0;
+
+	for ( vlInt i = ( vlInt )this->Header->MipCount - 1; i > 0; i-- )
+	{
+		vlUInt uiMipmapWidth, uiMipmapHeight, uiMipmapDepth;
+		CVTFFile::ComputeMipmapDimensions( this->Header->Width, this->Header->Height, this->Header->Depth, i, uiMipmapWidth, uiMipmapHeight, uiMipmapDepth );
+
+		if ( std::max( uiMipmapWidth, uiMipmapHeight ) >= uiSize )
+			return i;
+	}
+
+	return 0;
 }
 
 vlVoid *CVTFFile::GetResourceData( vlUInt uiType, vlUInt &uiSize ) const
@@ -622,7 +987,10 @@ vlVoid *CVTFFile::GetResourceData( vlUInt uiType, vlUInt &uiSize ) const
 				return this->lpThumbnailImageData;
 				break;
 			case VTF_LEGACY_RSRC_IMAGE:
-				uiSize = this->uiImageBufferSize;
+				// Partially loaded files only hold a window of the image data.
+				if ( this->uiImageWindowOffset != 0 )
+					break;
+				uiSize = this->uiImageWindowSize;
 				return this->lpImageData;
 				break;
 			default:
@@ -661,6 +1029,59 @@ vlUInt CVTFFile::GetAuxInfoOffset( vlUInt iFrame, vlUInt iFace, vlUInt iMipLevel
 		sizeof( AuxCompressionInfoEntry_t );
 }
 
+vlUInt64 CVTFFile::GetDataSize( vlUInt uiFrame, vlUInt uiFace, vlUInt uiSlice, vlUInt uiMipmapLevel ) const
+{
+	if ( !this->IsLoaded() )
+		return 0;
+
+	const SVTFSubresourceInfo *lpSubresource = this->GetSubresource( uiFrame, uiFace, uiSlice, uiMipmapLevel );
+	return lpSubresource != 0 ? lpSubresource->uiSize : 0;
+}
+
+vlBool CVTFFile::IsAuxCompressed() const
+{
+	return this->IsLoaded() && this->bAuxCompressed;
+}
+
+vlUInt32 CVTFFile::GetCompressedSize( vlUInt uiFrame, vlUInt uiFace, vlUInt uiMipmapLevel ) const
+{
+	if ( !this->IsAuxCompressed() )
+		return 0;
+
+	// Compressed sizes come from 32-bit entries of the aux resource.
+	return ( vlUInt32 )this->GetDataSize( uiFrame, uiFace, 0, uiMipmapLevel );
+}
+
+vlUInt64 CVTFFile::GetUncompressedDataSize() const
+{
+	if ( !this->IsLoaded() || this->Header->ImageFormat == IMAGE_FORMAT_NONE )
+		return 0;
+
+	// 0 if it does not fit, offsets within it are then never asked for.
+	const vlUInt uiSliceCount = std::max<vlUInt>( this->Header->Depth, 1 );
+	vlUInt64 uiSize = CVTFFile::ComputeImageSize( this->Header->Width, this->Header->Height, uiSliceCount, this->Header->MipCount, this->Header->ImageFormat );
+	if ( !CVTFFile::CheckedMultiply( uiSize, this->Header->Frames, uiSize ) || !CVTFFile::CheckedMultiply( uiSize, this->GetFaceCount(), uiSize ) )
+		return 0;
+
+	return uiSize;
+}
+
+vlUInt64 CVTFFile::GetUncompressedDataOffset( vlUInt uiFrame, vlUInt uiFace, vlUInt uiMipmapLevel ) const
+{
+	if ( !this->IsLoaded() || this->Header->ImageFormat == IMAGE_FORMAT_NONE )
+		return 0;
+
+	const vlUInt uiFaceCount = this->GetFaceCount();
+	const vlUInt uiSliceCount = std::max<vlUInt>( this->Header->Depth, 1 );
+
+	// Smaller mips come first, each holding every frame and face.
+	vlUInt64 uiOffset = 0;
+	for ( vlUInt i = uiMipmapLevel + 1; i < this->Header->MipCount; i++ )
+		uiOffset += CVTFFile::ComputeMipmapSize( this->Header->Width, this->Header->Height, uiSliceCount, i, this->Header->ImageFormat ) * this->Header->Frames * uiFaceCount;
+
+	return uiOffset + ( ( vlUInt64 )uiFrame * uiFaceCount + uiFace ) * CVTFFile::ComputeMipmapSize( this->Header->Width, this->Header->Height, uiSliceCount, uiMipmapLevel, this->Header->ImageFormat );
+}
+
 const SVTFHeader& CVTFFile::GetHeader() const
 {
 	return *this->Header;
@@ -756,7 +1177,7 @@ SVTFImageFormatInfo const &CVTFFile::GetImageFormatInfo( VTFImageFormat ImageFor
 	return VTFImageFormatInfo[ImageFormat];
 }
 
-vlUInt CVTFFile::ComputeImageSize( vlUInt uiWidth, vlUInt uiHeight, vlUInt uiDepth, VTFImageFormat ImageFormat )
+vlUInt64 CVTFFile::ComputeImageSize( vlUInt uiWidth, vlUInt uiHeight, vlUInt uiDepth, VTFImageFormat ImageFormat )
 {
 	switch ( ImageFormat )
 	{
@@ -770,7 +1191,7 @@ vlUInt CVTFFile::ComputeImageSize( vlUInt uiWidth, vlUInt uiHeight, vlUInt uiDep
 		if ( uiHeight < 4 && uiHeight > 0 )
 			uiHeight = 4;
 
-		return ( ( uiWidth + 3 ) / 4 ) * ( ( uiHeight + 3 ) / 4 ) * 8 * uiDepth;
+		return ( vlUInt64 )( ( uiWidth + 3 ) / 4 ) * ( ( uiHeight + 3 ) / 4 ) * 8 * uiDepth;
 	case IMAGE_FORMAT_DXT3:
 	case IMAGE_FORMAT_DXT5:
 	case IMAGE_FORMAT_ATI2N:
@@ -784,15 +1205,15 @@ vlUInt CVTFFile::ComputeImageSize( vlUInt uiWidth, vlUInt uiHeight, vlUInt uiDep
 		if ( uiHeight < 4 && uiHeight > 0 )
 			uiHeight = 4;
 
-		return ( ( uiWidth + 3 ) / 4 ) * ( ( uiHeight + 3 ) / 4 ) * 16 * uiDepth;
+		return ( vlUInt64 )( ( uiWidth + 3 ) / 4 ) * ( ( uiHeight + 3 ) / 4 ) * 16 * uiDepth;
 	default:
-		return uiWidth * uiHeight * uiDepth * CVTFFile::GetImageFormatInfo( ImageFormat ).uiBytesPerPixel;
+		return ( vlUInt64 )uiWidth * uiHeight * uiDepth * CVTFFile::GetImageFormatInfo( ImageFormat ).uiBytesPerPixel;
 	}
 }
 
-vlUInt CVTFFile::ComputeImageSize( vlUInt uiWidth, vlUInt uiHeight, vlUInt uiDepth, vlUInt uiMipmaps, VTFImageFormat ImageFormat )
+vlUInt64 CVTFFile::ComputeImageSize( vlUInt uiWidth, vlUInt uiHeight, vlUInt uiDepth, vlUInt uiMipmaps, VTFImageFormat ImageFormat )
 {
-	vlUInt uiImageSize = 0;
+	vlUInt64 uiImageSize = 0;
 
 	for ( vlUInt i = 0; i < uiMipmaps; i++ )
 	{
@@ -850,7 +1271,7 @@ vlVoid CVTFFile::ComputeMipmapDimensions( vlUInt uiWidth, vlUInt uiHeight, vlUIn
 		uiMipmapDepth = 1;
 }
 
-vlUInt CVTFFile::ComputeMipmapSize( vlUInt uiWidth, vlUInt uiHeight, vlUInt uiDepth, vlUInt uiMipmapLevel, VTFImageFormat ImageFormat )
+vlUInt64 CVTFFile::ComputeMipmapSize( vlUInt uiWidth, vlUInt uiHeight, vlUInt uiDepth, vlUInt uiMipmapLevel, VTFImageFormat ImageFormat )
 {
 	vlUInt uiMipmapWidth, uiMipmapHeight, uiMipmapDepth;
 	CVTFFile::ComputeMipmapDimensions( uiWidth, uiHeight, uiDepth, uiMipmapLevel, uiMipmapWidth, uiMipmapHeight, uiMipmapDepth );
@@ -858,245 +1279,137 @@ vlUInt CVTFFile::ComputeMipmapSize( vlUInt uiWidth, vlUInt uiHeight, vlUInt uiDe
 	return CVTFFile::ComputeImageSize( uiMipmapWidth, uiMipmapHeight, uiMipmapDepth, ImageFormat );
 }
 
-vlUInt CVTFFile::ComputeDataOffset( vlUInt uiFrame, vlUInt uiFace, vlUInt uiSlice, vlUInt uiMipLevel, VTFImageFormat ImageFormat ) const
+vlUInt64 CVTFFile::ComputeDataOffset( vlUInt uiFrame, vlUInt uiFace, vlUInt uiSlice, vlUInt uiMipLevel ) const
 {
-	vlUInt uiOffset = 0;
-
-	vlUInt uiFrameCount = this->GetFrameCount();
-	vlUInt uiFaceCount = this->GetFaceCount();
-	vlUInt uiSliceCount = this->GetDepth();
-	vlUInt uiMipCount = this->GetMipmapCount();
-
-	if ( uiFrame >= uiFrameCount )
-	{
-		uiFrame = uiFrameCount - 1;
-	}
-
-	if ( uiFace >= uiFaceCount )
-	{
-		uiFace = uiFaceCount - 1;
-	}
-
-	if ( uiSlice >= uiSliceCount )
-	{
-		uiSlice = uiSliceCount - 1;
-	}
+	const SVTFSubresourceInfo *lpSubresource = this->GetSubresource( uiFrame, uiFace, uiSlice, uiMipLevel );
+	return lpSubresource != 0 ? lpSubresource->uiOffset : 0;
+}
 
-	if ( uiMipLevel >= uiMipCount )
-	{
-		uiMipLevel = uiMipCount - 1;
-	}
+#ifndef SHELLINFO_EXPORTS
+//
+// Decodes whole rows of blocks with pfnDecodeRow; blocks hanging over the right or bottom edge
+// go through a scratch block so mips smaller than 4x4 and odd sizes never write out of bounds.
+//
+static vlVoid DecompressBlockRows( const vlByte *src, vlByte *dst, vlUInt uiWidth, vlUInt uiHeight, vlUInt uiBlockSize, BCDecodeRowFunc pfnDecodeRow )
+{
+	const vlUInt uiPitch = uiWidth * 4;
+	const vlUInt uiBlocksX = ( uiWidth + 3 ) / 4;
+	const vlUInt uiFullBlocksX = uiWidth / 4;
 
-	bool bIsAuxCompressed = false;
-	vlUInt compressionInfoSize = 0;
-	unsigned char *pCompressionInfo = (unsigned char *)GetResourceData( VTF_RSRC_AUX_COMPRESSION_INFO, compressionInfoSize );
-	if ( pCompressionInfo != nullptr )
+	for ( vlUInt y = 0; y < uiHeight; y += 4 )
 	{
-		AuxCompressionInfoHeader_t *infoHeader = (AuxCompressionInfoHeader_t *)pCompressionInfo;
-
-		if ( compressionInfoSize > sizeof( AuxCompressionInfoHeader_t ) )
-			bIsAuxCompressed = infoHeader->m_CompressionLevel != 0;
-	}
+		const vlUInt uiRows = std::min( uiHeight - y, 4u );
+		auto *dest = dst + ( size_t )y * uiPitch;
 
-	if ( bIsAuxCompressed )
-	{
-		// For aux compression, we have to go through the compression info resource
-		// to find the correct offset
-		for ( vlInt iMip = uiMipCount - 1; iMip >= static_cast<vlInt>( uiMipLevel ); --iMip )
+		vlUInt x = 0;
+		if ( uiRows == 4 )
 		{
-			for ( vlUInt iFrame = 0; iFrame < uiFrameCount; ++iFrame )
-			{
-				for ( vlUInt iFace = 0; iFace < uiFaceCount; ++iFace )
-				{
-					vlUInt infoOffset = GetAuxInfoOffset( iFrame, iFace, iMip );
-
-					AuxCompressionInfoEntry_t *infoEntry = (AuxCompressionInfoEntry_t *)( pCompressionInfo + infoOffset );
-
-					if ( iMip == uiMipLevel && iFrame == uiFrame && iFace == uiFace )
-						return uiOffset;
-
-					uiOffset += infoEntry->m_CompressedSize;
-				}
-			}
+			pfnDecodeRow( src, dest, uiFullBlocksX, uiPitch );
+			x = uiFullBlocksX;
 		}
 
-		return uiOffset;
-	}
-
-	for ( vlInt i = ( vlInt )uiMipCount - 1; i > ( vlInt )uiMipLevel; i-- )
-	{
-		uiOffset += this->ComputeMipmapSize( this->Header->Width, this->Header->Height, this->Header->Depth, i, ImageFormat ) * uiFrameCount * uiFaceCount;
-	}
-
-	vlUInt uiTemp1 = this->ComputeMipmapSize( this->Header->Width, this->Header->Height, this->Header->Depth, uiMipLevel, ImageFormat );
-	vlUInt uiTemp2 = this->ComputeMipmapSize( this->Header->Width, this->Header->Height, 1, uiMipLevel, ImageFormat );
-
-	uiOffset += uiTemp1 * uiFrame * uiFaceCount * uiSliceCount;
-	uiOffset += uiTemp1 * uiFace * uiSliceCount;
-	uiOffset += uiTemp2 * uiSlice;
-
-	return uiOffset;
-}
-
-#ifndef SHELLINFO_EXPORTS
-vlBool CVTFFile::DecompressDXT1( vlByte *src, vlByte *dst, vlUInt uiWidth, vlUInt uiHeight )
-{
-	for ( vlUInt y = 0; y < uiHeight; y += 4 )
-	{
-		for ( vlUInt x = 0; x < uiWidth; x += 4 )
+		for ( ; x < uiBlocksX; x++ )
 		{
-			auto *dest = dst + ( y * uiWidth + x ) * 4;
-			bcdec_bc1( src, dest, uiWidth * 4 );
-			src += 8;
+			vlByte buf[4 * 4 * 4];
+			pfnDecodeRow( src + x * uiBlockSize, buf, 1, 4 * 4 );
+
+			const vlUInt uiColumns = std::min( uiWidth - x * 4, 4u );
+			for ( vlUInt y1 = 0; y1 < uiRows; y1++ )
+				memcpy( dest + y1 * uiPitch + x * 4 * 4, buf + y1 * 4 * 4, uiColumns * 4 );
 		}
+
+		src += uiBlocksX * uiBlockSize;
 	}
-	return vlTrue;
 }
 
-vlBool CVTFFile::DecompressDXT3( vlByte *src, vlByte *dst, vlUInt uiWidth, vlUInt uiHeight )
+vlBool CVTFFile::DecompressDXT1( vlByte *src, vlByte *dst, vlUInt uiWidth, vlUInt uiHeight, vlBool bBGRA )
 {
-	for ( vlUInt y = 0; y < uiHeight; y += 4 )
-	{
-		for ( vlUInt x = 0; x < uiWidth; x += 4 )
-		{
-			auto *dest = dst + ( y * uiWidth + x ) * 4;
-			bcdec_bc2( src, dest, uiWidth * 4 );
-			src += 16;
-		}
-	}
+	DecompressBlockRows( src, dst, uiWidth, uiHeight, 8, GetBCDecodeFunctions().BC1[bBGRA ? BCDECODE_BGRA : BCDECODE_RGBA] );
 	return vlTrue;
 }
 
-vlBool CVTFFile::DecompressDXT5( vlByte *src, vlByte *dst, vlUInt uiWidth, vlUInt uiHeight )
+vlBool CVTFFile::DecompressDXT3( vlByte *src, vlByte *dst, vlUInt uiWidth, vlUInt uiHeight, vlBool bBGRA )
 {
-	for ( vlUInt y = 0; y < uiHeight; y += 4 )
-	{
-		for ( vlUInt x = 0; x < uiWidth; x += 4 )
-		{
-			auto *dest = dst + ( y * uiWidth + x ) * 4;
-			bcdec_bc3( src, dest, uiWidth * 4 );
-			src += 16;
-		}
-	}
+	DecompressBlockRows( src, dst, uiWidth, uiHeight, 16, GetBCDecodeFunctions().BC2[bBGRA ? BCDECODE_BGRA : BCDECODE_RGBA] );
 	return vlTrue;
 }
 
-vlBool CVTFFile::DecompressATI1N( vlByte *src, vlByte *dst, vlUInt uiWidth, vlUInt uiHeight )
+vlBool CVTFFile::DecompressDXT5( vlByte *src, vlByte *dst, vlUInt uiWidth, vlUInt uiHeight, vlBool bBGRA )
 {
-	for ( vlUInt y = 0; y < uiHeight; y += 4 )
-	{
-		for ( vlUInt x = 0; x < uiWidth; x += 4 )
-		{
-			vlByte buf[4 * 4];
-			bcdec_bc4( src, buf, 4 );
-			auto *dest = dst + ( y * uiWidth + x ) * 4;
-			for ( int y1 = 0; y1 < 4; y1++ )
-			{
-				for ( int x1 = 0; x1 < 4; x1++ )
-				{
-					auto dstLoc = ( y1 * uiWidth + x1 ) * 4;
-					dest[dstLoc + 0] = buf[y1 * 4 + x1];
-					dest[dstLoc + 1] = 0;
-					dest[dstLoc + 2] = 0;
-					dest[dstLoc + 3] = 255;
-				}
-			}
-			src += 8;
-		}
-	}
+	DecompressBlockRows( src, dst, uiWidth, uiHeight, 16, GetBCDecodeFunctions().BC3[bBGRA ? BCDECODE_BGRA : BCDECODE_RGBA] );
 	return vlTrue;
 }
 
-vlBool CVTFFile::DecompressATI2N( vlByte *src, vlByte *dst, vlUInt uiWidth, vlUInt uiHeight )
+vlBool CVTFFile::DecompressATI1N( vlByte *src, vlByte *dst, vlUInt uiWidth, vlUInt uiHeight, vlBool bBGRA )
 {
-	for ( vlUInt y = 0; y < uiHeight; y += 4 )
-	{
-		for ( vlUInt x = 0; x < uiWidth; x += 4 )
-		{
-			vlByte buf[4 * 4 * 2];
-			bcdec_bc5( src, buf, 4 * 2 );
-			auto *dest = dst + ( y * uiWidth + x ) * 4;
-			for ( int y1 = 0; y1 < 4; y1++ )
-			{
-				for ( int x1 = 0; x1 < 4; x1++ )
-				{
-					auto dstLoc = ( y1 * uiWidth + x1 ) * 4;
-					dest[dstLoc + 0] = buf[y1 * 4 + x1 + 0];
-					dest[dstLoc + 1] = buf[y1 * 4 + x1 + 1];
-					dest[dstLoc + 2] = 0;
-					dest[dstLoc + 3] = 255;
-				}
-			}
-			src += 16;
-		}
-	}
+	DecompressBlockRows( src, dst, uiWidth, uiHeight, 8, GetBCDecodeFunctions().BC4[bBGRA ? BCDECODE_BGRA : BCDECODE_RGBA] );
 	return vlTrue;
 }
 
-static float ScaleValue( float f, float overbright )
+vlBool CVTFFile::DecompressATI2N( vlByte *src, vlByte *dst, vlUInt uiWidth, vlUInt uiHeight, vlBool bBGRA, vlBool bReconstructZ )
 {
-	return static_cast<int>( std::min( 255.0f, ceil( f * ( 1.0f / overbright ) * 255.f ) ) ) * ( overbright / 255.0f );
+	const SBCDecodeFunctions &Functions = GetBCDecodeFunctions();
+	DecompressBlockRows( src, dst, uiWidth, uiHeight, 16, ( bReconstructZ ? Functions.BC5Z : Functions.BC5 )[bBGRA ? BCDECODE_BGRA : BCDECODE_RGBA] );
+	return vlTrue;
 }
 
-vlBool CVTFFile::DecompressBC6H( vlByte *src, vlByte *dst, vlUInt uiWidth, vlUInt uiHeight )
+//! Blocks DecompressBC6H decodes twice to pick the exposure, spread evenly over the image.
+#define BC6H_EXPOSURE_BLOCKS 1024
+
+vlBool CVTFFile::DecompressBC6H( vlByte *src, vlByte *dst, vlUInt uiWidth, vlUInt uiHeight, vlBool bBGRA )
 {
-	float *block = new float[uiWidth * uiHeight * 3];
-	for ( vlUInt y = 0; y < uiHeight; y += 4 )
-	{
-		for ( vlUInt x = 0; x < uiWidth; x += 4 )
-		{
-			auto *dest = block + ( y * uiWidth + x ) * 3;
-			bcdec_bc6h_float( src, dest, uiWidth * 3, true );
-			src += 16;
-		}
-	}
+	const SHDRFunctions &Functions = GetHDRFunctions();
+	const vlUInt uiBlocksX = ( uiWidth + 3 ) / 4;
+	const vlUInt uiBlocksY = ( uiHeight + 3 ) / 4;
+	const vlUInt uiRowSize = uiBlocksX * 4 * 3;
+
+	// The exposure comes from a grid of blocks rather than the whole image, so each block row can be
+	// tonemapped as soon as it is decoded.
+	const vlUInt uiStep = ComputeHDRSampleStep( uiBlocksX, uiBlocksY, BC6H_EXPOSURE_BLOCKS );
 
-	float largest = -FLT_MAX;
-	for ( vlUInt y = 0; y < uiHeight; ++y )
+	vlSingle fLargest = 0.0f;
+	for ( vlUInt y = uiStep / 2; y < uiBlocksY; y += uiStep )
 	{
-		for ( vlUInt x = 0; x < uiWidth; x += 4 )
+		for ( vlUInt x = uiStep / 2; x < uiBlocksX; x += uiStep )
 		{
-			auto *dest = block + ( y * uiWidth + x ) * 3;
-			float m = std::max( { dest[0], dest[1], dest[2] } );
-			largest = std::max( largest, ScaleValue( m, 8.0f ) );
-			dest[0] = std::min( dest[0], 8.0f );
-			dest[1] = std::min( dest[1], 8.0f );
-			dest[2] = std::min( dest[2], 8.0f );
+			vlUInt16 uiHalves[4 * 4 * 3];
+			vlSingle fValues[4 * 4 * 3];
+			bcdec_bc6h_half( src + ( ( size_t )y * uiBlocksX + x ) * 16, uiHalves, 4 * 3, true );
+			Functions.HalfToFloat( uiHalves, fValues, 4 * 4 * 3 );
+
+			// Written so NaNs are skipped.
+			for ( vlUInt i = 0; i < 4 * 4 * 3; i++ )
+				fLargest = fValues[i] > fLargest ? fValues[i] : fLargest;
 		}
 	}
 
-	largest = std::max( 0.1f, largest );
+	const vlSingle fWhite = ComputeHDRWhite( fLargest );
+	const TonemapRowFunc pfnTonemap = Functions.Tonemap[bBGRA ? BCDECODE_BGRA : BCDECODE_RGBA];
 
-	memset( dst, 0, size_t( 4 ) * uiWidth * uiHeight );
-	for ( vlUInt y = 0; y < uiHeight; ++y )
+	// One row of blocks as halves and one row of texels as floats.
+	vlUInt16 *lpHalves = new vlUInt16[( size_t )uiRowSize * 4];
+	vlSingle *lpValues = new vlSingle[uiRowSize];
+	for ( vlUInt y = 0; y < uiHeight; y += 4, src += ( size_t )uiBlocksX * 16 )
 	{
-		for ( vlUInt x = 0; x < uiWidth; ++x )
-		{
-			auto *dest = block + ( y * uiWidth + x ) * 3;
-			auto *dest2 = dst + ( y * uiWidth + x ) * 4;
+		for ( vlUInt x = 0; x < uiBlocksX; x++ )
+			bcdec_bc6h_half( src + ( size_t )x * 16, lpHalves + x * 4 * 3, uiRowSize, true );
 
-			dest2[0] = static_cast<vlByte>( 255 * ( dest[0] / largest ) + 0.5f );
-			dest2[1] = static_cast<vlByte>( 255 * ( dest[1] / largest ) + 0.5f );
-			dest2[2] = static_cast<vlByte>( 255 * ( dest[2] / largest ) + 0.5f );
-			dest2[3] = 255;
+		const vlUInt uiRows = std::min( uiHeight - y, 4u );
+		for ( vlUInt y1 = 0; y1 < uiRows; y1++ )
+		{
+			Functions.HalfToFloat( lpHalves + ( size_t )y1 * uiRowSize, lpValues, ( size_t )uiWidth * 3 );
+			pfnTonemap( lpValues, 3, dst + ( ( size_t )y + y1 ) * uiWidth * 4, uiWidth, fWhite );
 		}
 	}
 
-	delete[] block;
+	delete[] lpValues;
+	delete[] lpHalves;
 	return vlTrue;
 }
 
-vlBool CVTFFile::DecompressBC7( vlByte *src, vlByte *dst, vlUInt uiWidth, vlUInt uiHeight )
+vlBool CVTFFile::DecompressBC7( vlByte *src, vlByte *dst, vlUInt uiWidth, vlUInt uiHeight, vlBool bBGRA )
 {
-	for ( vlUInt y = 0; y < uiHeight; y += 4 )
-	{
-		for ( vlUInt x = 0; x < uiWidth; x += 4 )
-		{
-			auto *dest = dst + ( y * uiWidth + x ) * 4;
-			bcdec_bc7( src, dest, uiWidth * 4 );
-			src += 16;
-		}
-	}
+	DecompressBlockRows( src, dst, uiWidth, uiHeight, 16, GetBCDecodeFunctions().BC7[bBGRA ? BCDECODE_BGRA : BCDECODE_RGBA] );
 	return vlTrue;
 }
 
@@ -1146,15 +1459,15 @@ static constexpr SVTFImageConvertInfo VTFImageConvertInfo[] =
 	{ 64,  8, 16, 16, 16, 16,	 0,	 1,	 2,	 3, vlFalse,  vlTrue,	IMAGE_FORMAT_RGBA16161616F },
 	{ 64,  8, 16, 16, 16, 16,	 0,	 1,	 2,	 3, vlFalse,  vlTrue,	IMAGE_FORMAT_RGBA16161616 },
 	{ 32,  4,  8,  8,  8,  8,	 0,	 1,	 2,	 3, vlFalse,  vlTrue,	IMAGE_FORMAT_UVLX8888 },
-	{ 32,  4, 32,  0,  0,  0,	 0,	-1,	-1,	-1, vlFalse, vlFalse,	IMAGE_FORMAT_R32F },
-	{ 96, 12, 32, 32, 32,  0,	 0,	 1,	 2,	-1, vlFalse, vlFalse,	IMAGE_FORMAT_RGB323232F },
-	{ 128, 16, 32, 32, 32, 32,	 0,	 1,	 2,	 3, vlFalse, vlFalse,	IMAGE_FORMAT_RGBA32323232F },
+	{ 32,  4, 32,  0,  0,  0,	 0,	-1,	-1,	-1, vlFalse,  vlTrue,	IMAGE_FORMAT_R32F },
+	{ 96, 12, 32, 32, 32,  0,	 0,	 1,	 2,	-1, vlFalse,  vlTrue,	IMAGE_FORMAT_RGB323232F },
+	{ 128, 16, 32, 32, 32, 32,	 0,	 1,	 2,	 3, vlFalse,  vlTrue,	IMAGE_FORMAT_RGBA32323232F },
 	{ 16,  2, 16,  0,  0,  0,	 0,	-1,	-1,	-1, vlFalse,  vlTrue,	IMAGE_FORMAT_NV_DST16 },
 	{ 16,  2, 16,  0,  0,  0,	 0,	-1,	-1,	-1, vlFalse,  vlTrue,	IMAGE_FORMAT_ATI_DST16 },
 	{ 24,  3, 24,  0,  0,  0,	 0,	-1,	-1,	-1, vlFalse,  vlTrue,	IMAGE_FORMAT_ATI_DST24 },
 	{ 32,  4,  0,  0,  0,  0,	-1,	-1,	-1,	-1, vlFalse, vlFalse,	IMAGE_FORMAT_NV_NULL },
-	{ 4,  0,  0,  0,  0,  0,	-1, -1, -1, -1,	 vlTrue, vlFalse,	IMAGE_FORMAT_ATI1N },
-	{ 8,  0,  0,  0,  0,  0,	-1, -1, -1, -1,	 vlTrue, vlFalse,	IMAGE_FORMAT_ATI2N },
+	{ 4,  0,  0,  0,  0,  0,	-1, -1, -1, -1,	 vlTrue, vlTrue,	IMAGE_FORMAT_ATI1N },
+	{ 8,  0,  0,  0,  0,  0,	-1, -1, -1, -1,	 vlTrue, vlTrue,	IMAGE_FORMAT_ATI2N },
 	{},
 	{},
 	{},
@@ -1195,7 +1508,7 @@ static constexpr SVTFImageConvertInfo VTFImageConvertInfo[] =
 static_assert(std::size(VTFImageConvertInfo) == IMAGE_FORMAT_COUNT);
 
 template<typename T>
-vlVoid GetShiftAndMask( const SVTFImageConvertInfo& Info, T &uiRShift, T &uiGShift, T &uiBShift, T &uiAShift, T &uiRMask, T &uiGMask, T &uiBMask, T &uiAMask )
+constexpr vlVoid GetShiftAndMask( const SVTFImageConvertInfo& Info, T &uiRShift, T &uiGShift, T &uiBShift, T &uiAShift, T &uiRMask, T &uiGMask, T &uiBMask, T &uiAMask )
 {
 	if ( Info.iR >= 0 )
 	{
@@ -1255,7 +1568,7 @@ vlVoid GetShiftAndMask( const SVTFImageConvertInfo& Info, T &uiRShift, T &uiGShi
 }
 
 template<typename T>
-T Shrink( const T& S, const T& SourceBits, const T& DestBits )
+constexpr T Shrink( const T& S, const T& SourceBits, const T& DestBits )
 {
 	if ( SourceBits == 0 || DestBits == 0 )
 		return 0;
@@ -1264,7 +1577,7 @@ T Shrink( const T& S, const T& SourceBits, const T& DestBits )
 }
 
 template<typename T>
-T Expand( T S, T SourceBits, T DestBits )
+constexpr T Expand( T S, T SourceBits, T DestBits )
 {
 	if ( SourceBits == 0 || DestBits == 0 )
 		return 0;
@@ -1300,7 +1613,7 @@ vlBool ConvertTemplated( vlByte *lpSource, vlByte *lpDest, vlUInt uiWidth, vlUIn
 	GetShiftAndMask<vlUInt16>( SourceInfo, uiSourceRShift, uiSourceGShift, uiSourceBShift, uiSourceAShift, uiSourceRMask, uiSourceGMask, uiSourceBMask, uiSourceAMask );
 	GetShiftAndMask<vlUInt16>( DestInfo, uiDestRShift, uiDestGShift, uiDestBShift, uiDestAShift, uiDestRMask, uiDestGMask, uiDestBMask, uiDestAMask );
 
-	vlByte *lpSourceEnd = lpSource + ( uiWidth * uiHeight * SourceInfo.uiBytesPerPixel );
+	vlByte *lpSourceEnd = lpSource + ( ( size_t )uiWidth * uiHeight * SourceInfo.uiBytesPerPixel );
 	for ( ; lpSource < lpSourceEnd; lpSource += SourceInfo.uiBytesPerPixel, lpDest += DestInfo.uiBytesPerPixel )
 	{
 		vlUInt i;
@@ -1375,7 +1688,437 @@ vlBool ConvertTemplated( vlByte *lpSource, vlByte *lpDest, vlUInt uiWidth, vlUIn
 	return vlTrue;
 }
 
-vlBool CVTFFile::Convert( vlByte *lpSource, vlByte *lpDest, vlUInt uiWidth, vlUInt uiHeight, VTFImageFormat SourceFormat, VTFImageFormat DestFormat, vlUInt32 uiCompressedSize )
+//
+// ConvertTemplated specialized per (source, dest) pair at compile time, so the shifts, masks and
+// Expand/Shrink calls fold into constants and the per pixel loop has no branches left.
+//
+
+struct SVTFChannelLayout
+{
+	vlUInt16 uiShift[4];
+	vlUInt16 uiMask[4];
+	vlUInt16 uiBits[4];
+};
+
+static constexpr SVTFChannelLayout GetChannelLayout( const SVTFImageConvertInfo &Info )
+{
+	SVTFChannelLayout Layout = {};
+	GetShiftAndMask<vlUInt16>( Info, Layout.uiShift[0], Layout.uiShift[1], Layout.uiShift[2], Layout.uiShift[3], Layout.uiMask[0], Layout.uiMask[1], Layout.uiMask[2], Layout.uiMask[3] );
+	Layout.uiBits[0] = ( vlUInt16 )Info.uiRBitsPerPixel;
+	Layout.uiBits[1] = ( vlUInt16 )Info.uiGBitsPerPixel;
+	Layout.uiBits[2] = ( vlUInt16 )Info.uiBBitsPerPixel;
+	Layout.uiBits[3] = ( vlUInt16 )Info.uiABitsPerPixel;
+	return Layout;
+}
+
+//! Channels of the float formats, which are tonemapped by ConvertFloat instead of converted bit for bit; 0 for every other format.
+static constexpr vlUInt GetFloatChannels( VTFImageFormat Format )
+{
+	switch ( Format )
+	{
+	case IMAGE_FORMAT_R32F:
+		return 1;
+	case IMAGE_FORMAT_RGB323232F:
+		return 3;
+	case IMAGE_FORMAT_RGBA16161616F:
+	case IMAGE_FORMAT_RGBA32323232F:
+		return 4;
+	default:
+		return 0;
+	}
+}
+
+//! Formats ConvertTemplated handles with 16 bit channels, which is every uncompressed supported format but the float ones and ATI_DST24.
+static constexpr vlBool HasConvertKernel( VTFImageFormat Format )
+{
+	const SVTFImageConvertInfo &Info = VTFImageConvertInfo[Format];
+	return Info.bIsSupported && !Info.bIsCompressed && Info.uiBytesPerPixel != 0 && GetFloatChannels( Format ) == 0 &&
+		Info.uiRBitsPerPixel <= 16 && Info.uiGBitsPerPixel <= 16 && Info.uiBBitsPerPixel <= 16 && Info.uiABitsPerPixel <= 16;
+}
+
+template<vlUInt uiBytes>
+using ConvertPixelType = std::conditional_t<( uiBytes <= 1 ), vlUInt8, std::conditional_t<( uiBytes <= 2 ), vlUInt16, std::conditional_t<( uiBytes <= 4 ), vlUInt32, unsigned long long>>>;
+
+template<VTFImageFormat SourceFormat, VTFImageFormat DestFormat, vlUInt uiChannel, typename T, typename U>
+static inline U ConvertChannel( T Source )
+{
+	constexpr SVTFChannelLayout SourceLayout = GetChannelLayout( VTFImageConvertInfo[SourceFormat] );
+	constexpr SVTFChannelLayout DestLayout = GetChannelLayout( VTFImageConvertInfo[DestFormat] );
+	constexpr vlUInt16 uiSourceBits = SourceLayout.uiBits[uiChannel];
+	constexpr vlUInt16 uiDestBits = DestLayout.uiBits[uiChannel];
+
+	// Missing color channels become 0 and a missing alpha becomes opaque, like ConvertTemplated.
+	vlUInt16 D = uiChannel == 3 ? ( vlUInt16 )~0 : 0;
+	if constexpr ( SourceLayout.uiMask[uiChannel] != 0 && DestLayout.uiMask[uiChannel] != 0 )
+	{
+		const vlUInt16 S = ( vlUInt16 )( Source >> SourceLayout.uiShift[uiChannel] ) & SourceLayout.uiMask[uiChannel];
+		if constexpr ( uiDestBits < uiSourceBits )
+			D = Shrink<vlUInt16>( S, uiSourceBits, uiDestBits );
+		else if constexpr ( uiDestBits > uiSourceBits )
+			D = Expand<vlUInt16>( S, uiSourceBits, uiDestBits );
+		else
+			D = S;
+	}
+
+	return ( U )( D & DestLayout.uiMask[uiChannel] ) << DestLayout.uiShift[uiChannel];
+}
+
+template<VTFImageFormat SourceFormat, VTFImageFormat DestFormat>
+static vlVoid ConvertKernel( const vlByte *lpSource, vlByte *lpDest, size_t uiPixels )
+{
+	constexpr vlUInt uiSourceBytes = VTFImageConvertInfo[SourceFormat].uiBytesPerPixel;
+	constexpr vlUInt uiDestBytes = VTFImageConvertInfo[DestFormat].uiBytesPerPixel;
+	using T = ConvertPixelType<uiSourceBytes>;
+	using U = ConvertPixelType<uiDestBytes>;
+
+	for ( size_t i = 0; i < uiPixels; i++, lpSource += uiSourceBytes, lpDest += uiDestBytes )
+	{
+		T Source = 0;
+		for ( vlUInt j = 0; j < uiSourceBytes; j++ )
+			Source |= ( T )lpSource[j] << ( j * 8 );
+
+		const U Dest = ConvertChannel<SourceFormat, DestFormat, 0, T, U>( Source ) | ConvertChannel<SourceFormat, DestFormat, 1, T, U>( Source ) |
+			ConvertChannel<SourceFormat, DestFormat, 2, T, U>( Source ) | ConvertChannel<SourceFormat, DestFormat, 3, T, U>( Source );
+
+		for ( vlUInt j = 0; j < uiDestBytes; j++ )
+			lpDest[j] = ( vlByte )( Dest >> ( j * 8 ) );
+	}
+}
+
+typedef vlVoid ( *ConvertKernelFunc )( const vlByte *lpSource, vlByte *lpDest, size_t uiPixels );
+
+template<VTFImageFormat SourceFormat, VTFImageFormat DestFormat>
+static constexpr ConvertKernelFunc GetConvertKernel()
+{
+	if constexpr ( HasConvertKernel( SourceFormat ) && HasConvertKernel( DestFormat ) )
+		return ConvertKernel<SourceFormat, DestFormat>;
+	else
+		return 0;
+}
+
+template<VTFImageFormat DestFormat, size_t... Formats>
+static constexpr std::array<ConvertKernelFunc, sizeof...( Formats )> MakeConvertKernels( std::index_sequence<Formats...> )
+{
+	return { { GetConvertKernel<( VTFImageFormat )Formats, DestFormat>()... } };
+}
+
+//! Destination formats with specialized kernels, the ones thumbnails and Convert's RGBA8888 fallback use.
+static constexpr VTFImageFormat ConvertKernelDestFormats[] = { IMAGE_FORMAT_RGBA8888, IMAGE_FORMAT_BGRA8888 };
+
+static constexpr std::array<ConvertKernelFunc, IMAGE_FORMAT_COUNT> ConvertKernels[] =
+{
+	MakeConvertKernels<IMAGE_FORMAT_RGBA8888>( std::make_index_sequence<IMAGE_FORMAT_COUNT>() ),
+	MakeConvertKernels<IMAGE_FORMAT_BGRA8888>( std::make_index_sequence<IMAGE_FORMAT_COUNT>() ),
+};
+static_assert( std::size( ConvertKernels ) == std::size( ConvertKernelDestFormats ) );
+
+//! ConvertTemplated instantiated for the pixel sizes of both formats.
+static vlBool ConvertUncompressed( vlByte *lpSource, vlByte *lpDest, vlUInt uiWidth, vlUInt uiHeight, const SVTFImageConvertInfo& SourceInfo, const SVTFImageConvertInfo& DestInfo )
+{
+	if ( SourceInfo.uiBytesPerPixel <= 1 )
+	{
+		if ( DestInfo.uiBytesPerPixel <= 1 )
+			return ConvertTemplated<vlUInt8, vlUInt8>( lpSource, lpDest, uiWidth, uiHeight, SourceInfo, DestInfo );
+		else if ( DestInfo.uiBytesPerPixel <= 2 )
+			return ConvertTemplated<vlUInt8, vlUInt16>( lpSource, lpDest, uiWidth, uiHeight, SourceInfo, DestInfo );
+		else if ( DestInfo.uiBytesPerPixel <= 4 )
+			return ConvertTemplated<vlUInt8, vlUInt32>( lpSource, lpDest, uiWidth, uiHeight, SourceInfo, DestInfo );
+		else if ( DestInfo.uiBytesPerPixel <= 8 )
+			return ConvertTemplated<vlUInt8, vlUInt64>( lpSource, lpDest, uiWidth, uiHeight, SourceInfo, DestInfo );
+	}
+	else if ( SourceInfo.uiBytesPerPixel <= 2 )
+	{
+		if ( DestInfo.uiBytesPerPixel <= 1 )
+			return ConvertTemplated<vlUInt16, vlUInt8>( lpSource, lpDest, uiWidth, uiHeight, SourceInfo, DestInfo );
+		else if ( DestInfo.uiBytesPerPixel <= 2 )
+			return ConvertTemplated<vlUInt16, vlUInt16>( lpSource, lpDest, uiWidth, uiHeight, SourceInfo, DestInfo );
+		else if ( DestInfo.uiBytesPerPixel <= 4 )
+			return ConvertTemplated<vlUInt16, vlUInt32>( lpSource, lpDest, uiWidth, uiHeight, SourceInfo, DestInfo );
+		else if ( DestInfo.uiBytesPerPixel <= 8 )
+			return ConvertTemplated<vlUInt16, vlUInt64>( lpSource, lpDest, uiWidth, uiHeight, SourceInfo, DestInfo );
+	}
+	else if ( SourceInfo.uiBytesPerPixel <= 4 )
+	{
+		if ( DestInfo.uiBytesPerPixel <= 1 )
+			return ConvertTemplated<vlUInt32, vlUInt8>( lpSource, lpDest, uiWidth, uiHeight, SourceInfo, DestInfo );
+		else if ( DestInfo.uiBytesPerPixel <= 2 )
+			return ConvertTemplated<vlUInt32, vlUInt16>( lpSource, lpDest, uiWidth, uiHeight, SourceInfo, DestInfo );
+		else if ( DestInfo.uiBytesPerPixel <= 4 )
+			return ConvertTemplated<vlUInt32, vlUInt32>( lpSource, lpDest, uiWidth, uiHeight, SourceInfo, DestInfo );
+		else if ( DestInfo.uiBytesPerPixel <= 8 )
+			return ConvertTemplated<vlUInt32, vlUInt64>( lpSource, lpDest, uiWidth, uiHeight, SourceInfo, DestInfo );
+	}
+	else if ( SourceInfo.uiBytesPerPixel <= 8 )
+	{
+		if ( DestInfo.uiBytesPerPixel <= 1 )
+			return ConvertTemplated<vlUInt64, vlUInt8>( lpSource, lpDest, uiWidth, uiHeight, SourceInfo, DestInfo );
+		else if ( DestInfo.uiBytesPerPixel <= 2 )
+			return ConvertTemplated<vlUInt64, vlUInt16>( lpSource, lpDest, uiWidth, uiHeight, SourceInfo, DestInfo );
+		else if ( DestInfo.uiBytesPerPixel <= 4 )
+			return ConvertTemplated<vlUInt64, vlUInt32>( lpSource, lpDest, uiWidth, uiHeight, SourceInfo, DestInfo );
+		else if ( DestInfo.uiBytesPerPixel <= 8 )
+			return ConvertTemplated<vlUInt64, vlUInt64>( lpSource, lpDest, uiWidth, uiHeight, SourceInfo, DestInfo );
+	}
+	return vlFalse;
+}
+
+static ConvertKernelFunc FindConvertKernel( VTFImageFormat SourceFormat, VTFImageFormat DestFormat )
+{
+	for ( vlUInt i = 0; i < std::size( ConvertKernelDestFormats ); i++ )
+	{
+		if ( ConvertKernelDestFormats[i] == DestFormat )
+			return ConvertKernels[i][SourceFormat];
+	}
+
+	return 0;
+}
+
+//! Smallest image worth splitting across threads, below this waking the workers costs more than it saves.
+#define CONVERT_PARALLEL_MIN_PIXELS ( 256 * 256 )
+
+//! Block rows per band when streaming aux compressed data, each chunk holds one band per thread.
+#define CONVERT_STREAM_BAND_BLOCK_ROWS 8
+
+//! Inflates exactly uiSize more bytes of the stream into lpDest.
+static vlBool InflateChunk( z_stream &zStream, vlByte *lpDest, vlUInt uiSize )
+{
+	zStream.next_out = lpDest;
+	zStream.avail_out = uiSize;
+
+	while ( zStream.avail_out )
+	{
+		const int zRet = inflate( &zStream, Z_NO_FLUSH );
+		if ( zRet == Z_STREAM_END )
+			break;
+
+		if ( zRet != Z_OK )
+			return vlFalse;
+	}
+
+	return zStream.avail_out == 0;
+}
+
+//! True if the stream, Adler-32 included, ends right after the bytes inflated so far.
+static vlBool InflateFinished( z_stream &zStream )
+{
+	vlByte uiExtra;
+	zStream.next_out = &uiExtra;
+	zStream.avail_out = 1;
+
+	return inflate( &zStream, Z_FINISH ) == Z_STREAM_END && zStream.avail_out == 1;
+}
+
+//
+// Aux compressed images are inflated a chunk of block rows at a time into a two chunk ring buffer
+// instead of a whole face up front. While the bands of one chunk are converted, the next chunk
+// is inflated as one more job of the same ParallelFor, so inflate and decode overlap. With pfnBand
+// each converted chunk goes to it instead of lpDest, so only one chunk is ever held converted.
+//
+static vlBool ConvertStreamed( vlByte *lpSource, vlByte *lpDest, vlUInt uiWidth, vlUInt uiHeight, VTFImageFormat SourceFormat, VTFImageFormat DestFormat, vlUInt32 uiCompressedSize, CThreadPool *pThreadPool, vlUInt uiFlags,
+	CVTFFile::ConvertBandFunc pfnBand = 0, vlVoid *lpContext = 0 )
+{
+	const vlUInt uiBandHeight = CONVERT_STREAM_BAND_BLOCK_ROWS * 4;
+	const vlUInt uiBandsPerChunk = pThreadPool ? pThreadPool->GetThreadCount() : 1;
+	const vlUInt uiChunkHeight = uiBandHeight * uiBandsPerChunk;
+	const vlUInt uiChunkCount = ( uiHeight + uiChunkHeight - 1 ) / uiChunkHeight;
+	const size_t uiChunkSize = ( size_t )CVTFFile::ComputeImageSize( uiWidth, std::min( uiChunkHeight, uiHeight ), 1, SourceFormat );
+
+	z_stream zStream;
+	memset( &zStream, 0, sizeof( zStream ) );
+	if ( inflateInit( &zStream ) != Z_OK )
+		return vlFalse;
+
+	zStream.next_in = lpSource;
+	zStream.avail_in = uiCompressedSize;
+
+	vlByte *lpRing = new vlByte[uiChunkSize * 2];
+	vlByte *lpBand = pfnBand ? new vlByte[( size_t )CVTFFile::ComputeImageSize( uiWidth, std::min( uiChunkHeight, uiHeight ), 1, DestFormat )] : 0;
+	auto ChunkRows = [&]( vlUInt uiChunk ) { return std::min( uiChunkHeight, uiHeight - uiChunk * uiChunkHeight ); };
+
+	// The stream has to end with the last chunk, so a truncated trailer is caught before that chunk is converted.
+	auto InflateRing = [&]( vlUInt uiChunk )
+	{
+		return InflateChunk( zStream, lpRing + ( uiChunk & 1 ) * uiChunkSize, ( vlUInt )CVTFFile::ComputeImageSize( uiWidth, ChunkRows( uiChunk ), 1, SourceFormat ) ) &&
+			( uiChunk + 1 < uiChunkCount || InflateFinished( zStream ) );
+	};
+
+	vlBool bInflated = InflateRing( 0 );
+	std::atomic<vlBool> bConverted( vlTrue );
+
+	for ( vlUInt uiChunk = 0; uiChunk < uiChunkCount && bInflated && bConverted; uiChunk++ )
+	{
+		vlByte *lpChunk = lpRing + ( uiChunk & 1 ) * uiChunkSize;
+		const vlUInt uiChunkY = uiChunk * uiChunkHeight;
+		const vlUInt uiRows = ChunkRows( uiChunk );
+		const vlUInt uiBands = ( uiRows + uiBandHeight - 1 ) / uiBandHeight;
+		const vlBool bInflateNext = uiChunk + 1 < uiChunkCount;
+
+		auto Job = [&]( vlUInt uiJob )
+		{
+			if ( uiJob == uiBands )
+			{
+				bInflated = InflateRing( uiChunk + 1 );
+				return;
+			}
+
+			const vlUInt y = uiJob * uiBandHeight;
+			vlByte *lpRows = lpBand ? lpBand + CVTFFile::ComputeImageSize( uiWidth, y, 1, DestFormat ) : lpDest + CVTFFile::ComputeImageSize( uiWidth, uiChunkY + y, 1, DestFormat );
+			if ( !CVTFFile::Convert( lpChunk + CVTFFile::ComputeImageSize( uiWidth, y, 1, SourceFormat ), lpRows, uiWidth, std::min( uiBandHeight, uiRows - y ), SourceFormat, DestFormat, 0, 0, uiFlags ) )
+				bConverted = vlFalse;
+		};
+
+		const vlUInt uiJobs = uiBands + ( bInflateNext ? 1 : 0 );
+		if ( pThreadPool )
+		{
+			pThreadPool->ParallelFor( uiJobs, Job );
+		}
+		else
+		{
+			for ( vlUInt i = 0; i < uiJobs; i++ )
+				Job( i );
+		}
+
+		if ( pfnBand && bConverted && !pfnBand( lpBand, uiChunkY, uiRows, lpContext ) )
+			bConverted = vlFalse;
+	}
+
+	inflateEnd( &zStream );
+	delete[] lpBand;
+	delete[] lpRing;
+
+	return bInflated && bConverted;
+}
+
+//! Pixels ConvertFloat samples to pick the exposure, as many texels as DecompressBC6H looks at.
+#define FLOAT_EXPOSURE_PIXELS ( BC6H_EXPOSURE_BLOCKS * 16 )
+
+//! uiCount values of a float format as floats, halves are converted into lpValues and 32 bit floats are used in place.
+static inline const vlSingle *GetFloatValues( const vlByte *lpSource, VTFImageFormat Format, vlUInt uiCount, vlSingle *lpValues, const SHDRFunctions &Functions )
+{
+	if ( Format != IMAGE_FORMAT_RGBA16161616F )
+		return reinterpret_cast<const vlSingle *>( lpSource );
+
+	Functions.HalfToFloat( reinterpret_cast<const vlUInt16 *>( lpSource ), lpValues, uiCount );
+	return lpValues;
+}
+
+//
+// Float formats are tonemapped to 8 bit with the BC6H exposure: the white point comes from a grid of
+// pixels, then every row is converted and tonemapped on its own. The exposure has to be known before
+// the first row, so these formats are banded here rather than by Convert.
+//
+static vlBool ConvertFloat( vlByte *lpSource, vlByte *lpDest, vlUInt uiWidth, vlUInt uiHeight, VTFImageFormat SourceFormat, VTFImageFormat DestFormat, CThreadPool *pThreadPool )
+{
+	if ( DestFormat != IMAGE_FORMAT_RGBA8888 && DestFormat != IMAGE_FORMAT_BGRA8888 )
+	{
+		vlByte *lpRGBA = new vlByte[( size_t )CVTFFile::ComputeImageSize( uiWidth, uiHeight, 1, IMAGE_FORMAT_RGBA8888 )];
+		const vlBool bResult = ConvertFloat( lpSource, lpRGBA, uiWidth, uiHeight, SourceFormat, IMAGE_FORMAT_RGBA8888, pThreadPool ) &&
+			CVTFFile::Convert( lpRGBA, lpDest, uiWidth, uiHeight, IMAGE_FORMAT_RGBA8888, DestFormat, 0, pThreadPool );
+		delete[] lpRGBA;
+		return bResult;
+	}
+
+	const SHDRFunctions &Functions = GetHDRFunctions();
+	const vlUInt uiChannels = GetFloatChannels( SourceFormat );
+	const size_t uiPixelSize = VTFImageConvertInfo[SourceFormat].uiBytesPerPixel;
+	const size_t uiRowSize = uiPixelSize * uiWidth;
+
+	// Alpha does not count towards the white point.
+	const vlUInt uiStep = ComputeHDRSampleStep( uiWidth, uiHeight, FLOAT_EXPOSURE_PIXELS );
+	const vlUInt uiColors = std::min( uiChannels, 3u );
+	vlSingle fLargest = 0.0f;
+	for ( vlUInt y = uiStep / 2; y < uiHeight; y += uiStep )
+	{
+		for ( vlUInt x = uiStep / 2; x < uiWidth; x += uiStep )
+		{
+			vlSingle fValues[4];
+			const vlSingle *lpPixel = GetFloatValues( lpSource + y * uiRowSize + x * uiPixelSize, SourceFormat, uiChannels, fValues, Functions );
+
+			// Written so NaNs are skipped.
+			for ( vlUInt i = 0; i < uiColors; i++ )
+				fLargest = lpPixel[i] > fLargest ? lpPixel[i] : fLargest;
+		}
+	}
+
+	const vlSingle fWhite = ComputeHDRWhite( fLargest );
+	const TonemapRowFunc pfnTonemap = Functions.Tonemap[DestFormat == IMAGE_FORMAT_BGRA8888 ? BCDECODE_BGRA : BCDECODE_RGBA];
+
+	auto Band = [&]( vlUInt y, vlUInt uiRows )
+	{
+		vlSingle *lpValues = SourceFormat == IMAGE_FORMAT_RGBA16161616F ? new vlSingle[( size_t )uiWidth * uiChannels] : 0;
+		for ( vlUInt y1 = y; y1 < y + uiRows; y1++ )
+			pfnTonemap( GetFloatValues( lpSource + y1 * uiRowSize, SourceFormat, uiWidth * uiChannels, lpValues, Functions ), uiChannels, lpDest + ( size_t )y1 * uiWidth * 4, uiWidth, fWhite );
+
+		delete[] lpValues;
+	};
+
+	if ( pThreadPool && pThreadPool->GetThreadCount() > 1 && ( vlUInt64 )uiWidth * uiHeight >= CONVERT_PARALLEL_MIN_PIXELS )
+	{
+		const vlUInt uiBandCount = std::min( pThreadPool->GetThreadCount() * 4, uiHeight );
+		const vlUInt uiBandHeight = ( uiHeight + uiBandCount - 1 ) / uiBandCount;
+		pThreadPool->ParallelFor( ( uiHeight + uiBandHeight - 1 ) / uiBandHeight, [&]( vlUInt uiBand )
+		{
+			const vlUInt y = uiBand * uiBandHeight;
+			Band( y, std::min( uiBandHeight, uiHeight - y ) );
+		} );
+	}
+	else
+	{
+		Band( 0, uiHeight );
+	}
+
+	return vlTrue;
+}
+
+//! Output bytes each ConvertShaded strip decodes before shading them, small enough to still be in L2 when the shading reads them back.
+#define SHADE_STRIP_SIZE ( 64 * 1024 )
+
+#define VTF_CONVERT_SHADE_MASK ( VTF_CONVERT_SHADE_NORMALS | VTF_CONVERT_SHADE_SSBUMP )
+
+//
+// Normal map previews are shaded in the same pass as the decode: the image is converted a strip of
+// block rows at a time and each strip is shaded right after, while it is still in cache, instead of
+// decoding the whole image and then reading it all back from memory.
+//
+static vlBool ConvertShaded( vlByte *lpSource, vlByte *lpDest, vlUInt uiWidth, vlUInt uiHeight, VTFImageFormat SourceFormat, VTFImageFormat DestFormat, CThreadPool *pThreadPool, vlUInt uiFlags )
+{
+	const SNormalMapFunctions &Functions = GetNormalMapFunctions();
+	const BCDecodeOrder Order = DestFormat == IMAGE_FORMAT_BGRA8888 ? BCDECODE_BGRA : BCDECODE_RGBA;
+	const ShadeRowFunc pfnShade = ( uiFlags & VTF_CONVERT_SHADE_SSBUMP ) != 0 ? Functions.SSBump[Order] : Functions.Normal[Order];
+	const vlUInt uiConvertFlags = uiFlags & ~VTF_CONVERT_SHADE_MASK;
+
+	const vlUInt uiStripHeight = std::max( 4u, ( vlUInt )( SHADE_STRIP_SIZE / ( ( vlUInt64 )uiWidth * 4 ) ) & ~3u );
+	const vlUInt uiStripCount = ( uiHeight + uiStripHeight - 1 ) / uiStripHeight;
+
+	std::atomic<vlBool> bResult( vlTrue );
+	auto Strip = [&]( vlUInt uiStrip )
+	{
+		const vlUInt y = uiStrip * uiStripHeight;
+		const vlUInt uiRows = std::min( uiStripHeight, uiHeight - y );
+		vlByte *lpStrip = lpDest + CVTFFile::ComputeImageSize( uiWidth, y, 1, DestFormat );
+		if ( !CVTFFile::Convert( lpSource + CVTFFile::ComputeImageSize( uiWidth, y, 1, SourceFormat ), lpStrip, uiWidth, uiRows, SourceFormat, DestFormat, 0, 0, uiConvertFlags ) )
+		{
+			bResult = vlFalse;
+			return;
+		}
+
+		pfnShade( lpStrip, ( size_t )uiWidth * uiRows );
+	};
+
+	if ( pThreadPool && pThreadPool->GetThreadCount() > 1 && ( vlUInt64 )uiWidth * uiHeight >= CONVERT_PARALLEL_MIN_PIXELS )
+	{
+		pThreadPool->ParallelFor( uiStripCount, Strip );
+	}
+	else
+	{
+		for ( vlUInt i = 0; i < uiStripCount; i++ )
+			Strip( i );
+	}
+
+	return bResult;
+}
+
+vlBool CVTFFile::Convert( vlByte *lpSource, vlByte *lpDest, vlUInt uiWidth, vlUInt uiHeight, VTFImageFormat SourceFormat, VTFImageFormat DestFormat, vlUInt32 uiCompressedSize, CThreadPool *pThreadPool, vlUInt uiFlags )
 {
 	const SVTFImageConvertInfo& SourceInfo = VTFImageConvertInfo[SourceFormat];
 	const SVTFImageConvertInfo& DestInfo = VTFImageConvertInfo[DestFormat];
@@ -1397,41 +2140,69 @@ vlBool CVTFFile::Convert( vlByte *lpSource, vlByte *lpDest, vlUInt uiWidth, vlUI
 
 	if ( uiCompressedSize != 0 )
 	{
-		z_stream zStream;
-		memset( &zStream, 0, sizeof( zStream ) );
-		if ( inflateInit( &zStream ) != Z_OK )
+		const VTFInflateBackend Backend = GetInflateBackend();
+		const vlUInt64 size = CVTFFile::ComputeImageSize( uiWidth, uiHeight, 1, SourceFormat );
+
+		// Streaming keeps memory flat for large faces; BC6H and the float formats need the whole image to normalize, so they never stream.
+		// The one-shot decoders take 32-bit sizes, anything larger has to stream.
+		const vlBool bStream = Backend == VTF_INFLATE_ZLIB || ( Backend == VTF_INFLATE_AUTO && size > INFLATE_ONESHOT_MAX_SIZE ) || size > 0xffffffff;
+		if ( bStream && SourceFormat != IMAGE_FORMAT_BC6H && GetFloatChannels( SourceFormat ) == 0 && !DestInfo.bIsCompressed )
+		{
+			return ConvertStreamed( lpSource, lpDest, uiWidth, uiHeight, SourceFormat, DestFormat, uiCompressedSize, pThreadPool, uiFlags );
+		}
+
+		if ( size > 0xffffffff || size > SIZE_MAX )
 			return vlFalse;
 
-		zStream.next_in = lpSource;
-		zStream.avail_in = uiCompressedSize;
-		zStream.total_out = 0;
+		vlByte* pConverted = new vlByte[( size_t )size];
+		delMe.ptr = pConverted;
 
-		vlUInt32 size = CVTFFile::ComputeImageSize( uiWidth, uiHeight, 1, SourceFormat );
-		vlByte* pConverted = new vlByte[size];
-		while ( zStream.avail_in )
-		{
-			zStream.next_out = pConverted + zStream.total_out;
-			zStream.avail_out = size - zStream.total_out;
+		const InflateFunc pfnInflate = Backend == VTF_INFLATE_ZLIB ? InflateZlib : InflateOneShot;
+		if ( !pfnInflate( lpSource, uiCompressedSize, pConverted, ( vlUInt )size ) )
+			return vlFalse;
 
-			int zRet = inflate( &zStream, Z_NO_FLUSH );
-			bool zFailure = ( zRet != Z_OK ) && ( zRet != Z_STREAM_END );
-			if ( zFailure || ( ( zRet == Z_STREAM_END ) && ( zStream.total_out != size ) ) )
-			{
-				inflateEnd( &zStream );
-				return vlFalse;
-			}
-		}
+		lpSource = pConverted;
+	}
 
-		inflateEnd( &zStream );
-		delMe.ptr = lpSource = pConverted;
+	// BC6H and the float formats are light, not normals.
+	if ( ( uiFlags & VTF_CONVERT_SHADE_MASK ) != 0 && ( DestFormat == IMAGE_FORMAT_RGBA8888 || DestFormat == IMAGE_FORMAT_BGRA8888 ) &&
+		SourceFormat != IMAGE_FORMAT_BC6H && GetFloatChannels( SourceFormat ) == 0 )
+	{
+		return ConvertShaded( lpSource, lpDest, uiWidth, uiHeight, SourceFormat, DestFormat, pThreadPool, uiFlags );
 	}
 
 	if ( SourceFormat == DestFormat )
 	{
-		memcpy( lpDest, lpSource, CVTFFile::ComputeImageSize( uiWidth, uiHeight, 1, DestFormat ) );
+		memcpy( lpDest, lpSource, ( size_t )CVTFFile::ComputeImageSize( uiWidth, uiHeight, 1, DestFormat ) );
 		return vlTrue;
 	}
 
+	// Float formats are only read, writing them would need the tonemap undone.
+	if ( GetFloatChannels( DestFormat ) != 0 )
+		return vlFalse;
+
+	if ( GetFloatChannels( SourceFormat ) != 0 )
+		return ConvertFloat( lpSource, lpDest, uiWidth, uiHeight, SourceFormat, DestFormat, pThreadPool );
+
+	// Every format but BC6H (exposed from a sample of the whole image) converts rows of blocks
+	// independently, so split the image into bands of whole block rows and convert each one serially.
+	if ( pThreadPool && pThreadPool->GetThreadCount() > 1 && ( vlUInt64 )uiWidth * uiHeight >= CONVERT_PARALLEL_MIN_PIXELS &&
+		SourceFormat != IMAGE_FORMAT_BC6H && !DestInfo.bIsCompressed )
+	{
+		const vlUInt uiBandCount = std::min( pThreadPool->GetThreadCount() * 4, ( uiHeight + 3 ) / 4 );
+		const vlUInt uiBandHeight = ( ( uiHeight + uiBandCount - 1 ) / uiBandCount + 3 ) & ~3u;
+
+		std::atomic<vlBool> bResult( vlTrue );
+		pThreadPool->ParallelFor( ( uiHeight + uiBandHeight - 1 ) / uiBandHeight, [&]( vlUInt uiBand )
+		{
+			const vlUInt y = uiBand * uiBandHeight;
+			const vlUInt uiRows = std::min( uiBandHeight, uiHeight - y );
+			if ( !CVTFFile::Convert( lpSource + CVTFFile::ComputeImageSize( uiWidth, y, 1, SourceFormat ), lpDest + CVTFFile::ComputeImageSize( uiWidth, y, 1, DestFormat ), uiWidth, uiRows, SourceFormat, DestFormat, 0, 0, uiFlags ) )
+				bResult = vlFalse;
+		} );
+		return bResult;
+	}
+
 	if ( SourceFormat == IMAGE_FORMAT_RGB888 && DestFormat == IMAGE_FORMAT_RGBA8888 )
 	{
 		vlByte *lpLast = lpSource + CVTFFile::ComputeImageSize( uiWidth, uiHeight, 1, SourceFormat );
@@ -1459,12 +2230,20 @@ vlBool CVTFFile::Convert( vlByte *lpSource, vlByte *lpDest, vlUInt uiWidth, vlUI
 
 	if ( SourceInfo.bIsCompressed || DestInfo.bIsCompressed )
 	{
+		// The block decoders write RGBA8888 or BGRA8888 themselves, so those targets skip the intermediate copy.
+		const vlBool bDirect = DestFormat == IMAGE_FORMAT_RGBA8888 || DestFormat == IMAGE_FORMAT_BGRA8888;
+		const vlBool bBGRA = DestFormat == IMAGE_FORMAT_BGRA8888;
+
 		vlByte *lpSourceRGBA = lpSource;
 		vlBool bResult = vlTrue;
 
-		if ( SourceFormat != IMAGE_FORMAT_RGBA8888 )
+		if ( bDirect )
 		{
-			lpSourceRGBA = new vlByte[CVTFFile::ComputeImageSize( uiWidth, uiHeight, 1, IMAGE_FORMAT_RGBA8888 )];
+			lpSourceRGBA = lpDest;
+		}
+		else if ( SourceFormat != IMAGE_FORMAT_RGBA8888 )
+		{
+			lpSourceRGBA = new vlByte[( size_t )CVTFFile::ComputeImageSize( uiWidth, uiHeight, 1, IMAGE_FORMAT_RGBA8888 )];
 		}
 
 		switch ( SourceFormat )
@@ -1474,34 +2253,34 @@ vlBool CVTFFile::Convert( vlByte *lpSource, vlByte *lpDest, vlUInt uiWidth, vlUI
 		case IMAGE_FORMAT_DXT1:
 		case IMAGE_FORMAT_DXT1_ONEBITALPHA:
 		case IMAGE_FORMAT_DXT1_RUNTIME:
-			bResult = CVTFFile::DecompressDXT1( lpSource, lpSourceRGBA, uiWidth, uiHeight );
+			bResult = CVTFFile::DecompressDXT1( lpSource, lpSourceRGBA, uiWidth, uiHeight, bBGRA );
 			break;
 		case IMAGE_FORMAT_DXT3:
 		case IMAGE_FORMAT_DXT3_RUNTIME:
-			bResult = CVTFFile::DecompressDXT3( lpSource, lpSourceRGBA, uiWidth, uiHeight );
+			bResult = CVTFFile::DecompressDXT3( lpSource, lpSourceRGBA, uiWidth, uiHeight, bBGRA );
 			break;
 		case IMAGE_FORMAT_DXT5:
 		case IMAGE_FORMAT_DXT5_RUNTIME:
-			bResult = CVTFFile::DecompressDXT5( lpSource, lpSourceRGBA, uiWidth, uiHeight );
+			bResult = CVTFFile::DecompressDXT5( lpSource, lpSourceRGBA, uiWidth, uiHeight, bBGRA );
 			break;
 		case IMAGE_FORMAT_ATI1N:
-			bResult = CVTFFile::DecompressATI1N( lpSource, lpSourceRGBA, uiWidth, uiHeight );
+			bResult = CVTFFile::DecompressATI1N( lpSource, lpSourceRGBA, uiWidth, uiHeight, bBGRA );
 			break;
 		case IMAGE_FORMAT_ATI2N:
-			bResult = CVTFFile::DecompressATI2N( lpSource, lpSourceRGBA, uiWidth, uiHeight );
+			bResult = CVTFFile::DecompressATI2N( lpSource, lpSourceRGBA, uiWidth, uiHeight, bBGRA, ( uiFlags & VTF_CONVERT_RECONSTRUCT_Z ) != 0 );
 			break;
 		case IMAGE_FORMAT_BC6H:
-			bResult = CVTFFile::DecompressBC6H( lpSource, lpSourceRGBA, uiWidth, uiHeight );
+			bResult = CVTFFile::DecompressBC6H( lpSource, lpSourceRGBA, uiWidth, uiHeight, bBGRA );
 			break;
 		case IMAGE_FORMAT_BC7:
-			bResult = CVTFFile::DecompressBC7( lpSource, lpSourceRGBA, uiWidth, uiHeight );
+			bResult = CVTFFile::DecompressBC7( lpSource, lpSourceRGBA, uiWidth, uiHeight, bBGRA );
 			break;
 		default:
-			bResult = CVTFFile::Convert( lpSource, lpSourceRGBA, uiWidth, uiHeight, SourceFormat, IMAGE_FORMAT_RGBA8888, 0 );
+			bResult = CVTFFile::Convert( lpSource, lpSourceRGBA, uiWidth, uiHeight, SourceFormat, bDirect ? DestFormat : IMAGE_FORMAT_RGBA8888, 0 );
 			break;
 		}
 
-		if ( bResult )
+		if ( bResult && !bDirect )
 		{
 			switch ( DestFormat )
 			{
@@ -1523,7 +2302,7 @@ vlBool CVTFFile::Convert( vlByte *lpSource, vlByte *lpDest, vlUInt uiWidth, vlUI
 			}
 		}
 
-		if ( lpSourceRGBA != lpSource )
+		if ( lpSourceRGBA != lpSource && lpSourceRGBA != lpDest )
 		{
 			delete[]lpSourceRGBA;
 		}
@@ -1532,51 +2311,102 @@ vlBool CVTFFile::Convert( vlByte *lpSource, vlByte *lpDest, vlUInt uiWidth, vlUI
 	}
 	else
 	{
-		if ( SourceInfo.uiBytesPerPixel <= 1 )
-		{
-			if ( DestInfo.uiBytesPerPixel <= 1 )
-				return ConvertTemplated<vlUInt8, vlUInt8>( lpSource, lpDest, uiWidth, uiHeight, SourceInfo, DestInfo );
-			else if ( DestInfo.uiBytesPerPixel <= 2 )
-				return ConvertTemplated<vlUInt8, vlUInt16>( lpSource, lpDest, uiWidth, uiHeight, SourceInfo, DestInfo );
-			else if ( DestInfo.uiBytesPerPixel <= 4 )
-				return ConvertTemplated<vlUInt8, vlUInt32>( lpSource, lpDest, uiWidth, uiHeight, SourceInfo, DestInfo );
-			else if ( DestInfo.uiBytesPerPixel <= 8 )
-				return ConvertTemplated<vlUInt8, vlUInt64>( lpSource, lpDest, uiWidth, uiHeight, SourceInfo, DestInfo );
-		}
-		else if ( SourceInfo.uiBytesPerPixel <= 2 )
+		const ConvertKernelFunc pfnKernel = FindConvertKernel( SourceFormat, DestFormat );
+		if ( pfnKernel != 0 )
 		{
-			if ( DestInfo.uiBytesPerPixel <= 1 )
-				return ConvertTemplated<vlUInt16, vlUInt8>( lpSource, lpDest, uiWidth, uiHeight, SourceInfo, DestInfo );
-			else if ( DestInfo.uiBytesPerPixel <= 2 )
-				return ConvertTemplated<vlUInt16, vlUInt16>( lpSource, lpDest, uiWidth, uiHeight, SourceInfo, DestInfo );
-			else if ( DestInfo.uiBytesPerPixel <= 4 )
-				return ConvertTemplated<vlUInt16, vlUInt32>( lpSource, lpDest, uiWidth, uiHeight, SourceInfo, DestInfo );
-			else if ( DestInfo.uiBytesPerPixel <= 8 )
-				return ConvertTemplated<vlUInt16, vlUInt64>( lpSource, lpDest, uiWidth, uiHeight, SourceInfo, DestInfo );
-		}
-		else if ( SourceInfo.uiBytesPerPixel <= 4 )
-		{
-			if ( DestInfo.uiBytesPerPixel <= 1 )
-				return ConvertTemplated<vlUInt32, vlUInt8>( lpSource, lpDest, uiWidth, uiHeight, SourceInfo, DestInfo );
-			else if ( DestInfo.uiBytesPerPixel <= 2 )
-				return ConvertTemplated<vlUInt32, vlUInt16>( lpSource, lpDest, uiWidth, uiHeight, SourceInfo, DestInfo );
-			else if ( DestInfo.uiBytesPerPixel <= 4 )
-				return ConvertTemplated<vlUInt32, vlUInt32>( lpSource, lpDest, uiWidth, uiHeight, SourceInfo, DestInfo );
-			else if ( DestInfo.uiBytesPerPixel <= 8 )
-				return ConvertTemplated<vlUInt32, vlUInt64>( lpSource, lpDest, uiWidth, uiHeight, SourceInfo, DestInfo );
+			pfnKernel( lpSource, lpDest, ( size_t )uiWidth * uiHeight );
+			return vlTrue;
 		}
-		else if ( SourceInfo.uiBytesPerPixel <= 8 )
+
+		return ConvertUncompressed( lpSource, lpDest, uiWidth, uiHeight, SourceInfo, DestInfo );
+	}
+}
+
+//! Declared in vtfthumb/convertgeneric.h, vtfbench checks and times the kernels against it.
+vlBool ConvertGeneric( vlByte *lpSource, vlByte *lpDest, vlUInt uiWidth, vlUInt uiHeight, VTFImageFormat SourceFormat, VTFImageFormat DestFormat )
+{
+	const SVTFImageConvertInfo& SourceInfo = VTFImageConvertInfo[SourceFormat];
+	const SVTFImageConvertInfo& DestInfo = VTFImageConvertInfo[DestFormat];
+
+	// Only uncompressed integer formats of different layouts reach the kernels, the rest take the same path either way.
+	if ( !SourceInfo.bIsSupported || !DestInfo.bIsSupported || SourceInfo.bIsCompressed || DestInfo.bIsCompressed ||
+		GetFloatChannels( SourceFormat ) != 0 || GetFloatChannels( DestFormat ) != 0 || SourceFormat == DestFormat )
+	{
+		return CVTFFile::Convert( lpSource, lpDest, uiWidth, uiHeight, SourceFormat, DestFormat, 0 );
+	}
+
+	return ConvertUncompressed( lpSource, lpDest, uiWidth, uiHeight, SourceInfo, DestInfo );
+}
+
+vlBool CVTFFile::ConvertBands( vlByte *lpSource, vlUInt uiWidth, vlUInt uiHeight, VTFImageFormat SourceFormat, VTFImageFormat DestFormat, vlUInt32 uiCompressedSize, ConvertBandFunc pfnBand, vlVoid *lpContext, CThreadPool *pThreadPool, vlUInt uiFlags )
+{
+	if ( lpSource == 0 || pfnBand == 0 || uiCompressedSize == 0 || uiWidth == 0 || uiHeight == 0 || !CVTFFile::CanConvertBands( SourceFormat, DestFormat ) )
+		return vlFalse;
+
+	return ConvertStreamed( lpSource, 0, uiWidth, uiHeight, SourceFormat, DestFormat, uiCompressedSize, pThreadPool, uiFlags, pfnBand, lpContext );
+}
+
+vlBool CVTFFile::CanConvertBands( VTFImageFormat SourceFormat, VTFImageFormat DestFormat )
+{
+	return VTFImageConvertInfo[SourceFormat].bIsSupported && VTFImageConvertInfo[DestFormat].bIsSupported && !VTFImageConvertInfo[DestFormat].bIsCompressed &&
+		SourceFormat != IMAGE_FORMAT_BC6H && GetFloatChannels( SourceFormat ) == 0 && GetFloatChannels( DestFormat ) == 0;
+}
+
+vlBool CVTFFile::DecompressImageData( vlByte *lpDest, vlUInt64 uiDestSize, const SVTFSubresourceRange &Range, CThreadPool *pThreadPool ) const
+{
+	if ( !this->IsLoaded() || this->lpImageData == 0 || lpDest == 0 || this->GetUncompressedDataSize() == 0 )
+		return vlFalse;
+
+	if ( Range.uiFrameCount == 0 || Range.uiFaceCount == 0 || Range.uiMipmapCount == 0 ||
+		Range.uiFirstFrame + Range.uiFrameCount > this->Header->Frames ||
+		Range.uiFirstFace + Range.uiFaceCount > this->GetFaceCount() ||
+		Range.uiFirstMipmap + Range.uiMipmapCount > this->Header->MipCount ||
+		uiDestSize < this->GetUncompressedDataSize() )
+		return vlFalse;
+
+	const vlUInt uiSliceCount = std::max<vlUInt>( this->Header->Depth, 1 );
+	const InflateFunc pfnInflate = GetInflateBackend() == VTF_INFLATE_ZLIB ? InflateZlib : InflateOneShot;
+
+	// Jobs go out largest mip first so the big faces don't end up running alone at the end.
+	const vlUInt uiFacesPerMip = Range.uiFrameCount * Range.uiFaceCount;
+	std::atomic<vlBool> bResult( vlTrue );
+	auto Job = [&]( vlUInt uiJob )
+	{
+		const vlUInt uiMipmapLevel = Range.uiFirstMipmap + uiJob / uiFacesPerMip;
+		const vlUInt uiFrame = Range.uiFirstFrame + uiJob % uiFacesPerMip / Range.uiFaceCount;
+		const vlUInt uiFace = Range.uiFirstFace + uiJob % Range.uiFaceCount;
+
+		// Every slice of an aux compressed face is one stream, uncompressed slices are contiguous.
+		const vlUInt64 uiFaceSize = CVTFFile::ComputeMipmapSize( this->Header->Width, this->Header->Height, uiSliceCount, uiMipmapLevel, this->Header->ImageFormat );
+		const vlUInt64 uiOffset = this->ComputeDataOffset( uiFrame, uiFace, 0, uiMipmapLevel );
+		const vlUInt64 uiSize = this->bAuxCompressed ? this->GetDataSize( uiFrame, uiFace, 0, uiMipmapLevel ) : uiFaceSize;
+		if ( uiOffset < this->uiImageWindowOffset || uiOffset + uiSize > this->uiImageWindowOffset + this->uiImageWindowSize ||
+			( this->bAuxCompressed && uiFaceSize > 0xffffffff ) )
 		{
-			if ( DestInfo.uiBytesPerPixel <= 1 )
-				return ConvertTemplated<vlUInt64, vlUInt8>( lpSource, lpDest, uiWidth, uiHeight, SourceInfo, DestInfo );
-			else if ( DestInfo.uiBytesPerPixel <= 2 )
-				return ConvertTemplated<vlUInt64, vlUInt16>( lpSource, lpDest, uiWidth, uiHeight, SourceInfo, DestInfo );
-			else if ( DestInfo.uiBytesPerPixel <= 4 )
-				return ConvertTemplated<vlUInt64, vlUInt32>( lpSource, lpDest, uiWidth, uiHeight, SourceInfo, DestInfo );
-			else if ( DestInfo.uiBytesPerPixel <= 8 )
-				return ConvertTemplated<vlUInt64, vlUInt64>( lpSource, lpDest, uiWidth, uiHeight, SourceInfo, DestInfo );
+			bResult = vlFalse;
+			return;
 		}
-		return vlFalse;
+
+		const vlByte *lpSource = this->lpImageData + ( uiOffset - this->uiImageWindowOffset );
+		vlByte *lpFace = lpDest + this->GetUncompressedDataOffset( uiFrame, uiFace, uiMipmapLevel );
+
+		if ( !this->bAuxCompressed )
+			memcpy( lpFace, lpSource, ( size_t )uiFaceSize );
+		else if ( !pfnInflate( lpSource, ( vlUInt )uiSize, lpFace, ( vlUInt )uiFaceSize ) )
+			bResult = vlFalse;
+	};
+
+	const vlUInt uiJobs = uiFacesPerMip * Range.uiMipmapCount;
+	if ( pThreadPool )
+	{
+		pThreadPool->ParallelFor( uiJobs, Job );
 	}
+	else
+	{
+		for ( vlUInt i = 0; i < uiJobs; i++ )
+			Job( i );
+	}
+
+	return bResult;
 }
 #endif
@@ -11,7 +11,8 @@ typedef unsigned int	vlUInt;
 typedef unsigned char	vlUInt8;
 typedef unsigned short	vlUInt16;
 typedef unsigned int	vlUInt32;
-typedef unsigned long	vlUInt64;
+typedef unsigned long long	vlUInt64;
+typedef signed long long	vlInt64;
 typedef signed long		vlLong;
 typedef unsigned long	vlULong;
 typedef float			vlSingle;
@@ -164,6 +165,20 @@ typedef enum tagVTFImageFlag
 	TEXTUREFLAGS_COUNT = 30
 } VTFImageFlag;
 
+typedef enum tagVTFLoadFlag
+{
+	VTF_LOAD_HEADER_ONLY = 0x01,	//!< Only parse the header, resources and image data are skipped.
+	VTF_LOAD_NO_IMAGE_DATA = 0x02,	//!< Parse the header and resources, image data is fetched later with LoadImageData.
+	VTF_LOAD_BORROW_DATA = 0x04		//!< Reference image, thumbnail and resource data in the reader's memory instead of copying it, the memory must outlive the file.
+} VTFLoadFlag;
+
+typedef enum tagVTFConvertFlag
+{
+	VTF_CONVERT_RECONSTRUCT_Z = 0x01,	//!< Decode ATI2N normal maps with blue set to the Z of the normal instead of 0.
+	VTF_CONVERT_SHADE_NORMALS = 0x02,	//!< Write the N.L shading of the normals the image holds instead of the image, RGBA8888 and BGRA8888 only.
+	VTF_CONVERT_SHADE_SSBUMP = 0x04		//!< Same for self-shadowed bump maps, whose channels weight the bump basis. Takes precedence over VTF_CONVERT_SHADE_NORMALS.
+} VTFConvertFlag;
+
 #pragma pack(1)
 struct SVTFResource
 {
@@ -219,7 +234,7 @@ struct SVTFHeader_73 : public SVTFHeader_72
 	vlUInt		ResourceCount;							//!< Number of image resources
 };
 struct SVTFHeader_74 : public SVTFHeader_73 {};
-__declspec( align( 16 ) ) struct SVTFHeader_74_A : public SVTFHeader_74 {};
+struct alignas( 16 ) SVTFHeader_74_A : public SVTFHeader_74 {};
 struct SVTFHeader : public SVTFHeader_74_A
 {
 	vlByte				Padding3[8];
@@ -250,6 +265,23 @@ struct AuxCompressionInfoEntry_t
 	vlUInt32 m_CompressedSize; // Size of compressed face image data
 };
 
+struct SVTFSubresourceInfo
+{
+	vlUInt64 uiOffset;	//!< Offset from the start of the image data.
+	vlUInt64 uiSize;	//!< Size as stored in the file, the compressed size for aux compressed images.
+};
+
+//! A box of (mip, frame, face) subresources, each face with all of its slices.
+struct SVTFSubresourceRange
+{
+	vlUInt uiFirstFrame;
+	vlUInt uiFrameCount;
+	vlUInt uiFirstFace;
+	vlUInt uiFaceCount;
+	vlUInt uiFirstMipmap;
+	vlUInt uiMipmapCount;
+};
+
 namespace IO
 {
 	namespace Readers
@@ -257,17 +289,35 @@ namespace IO
 		class IReader;
 	}
 }
+class CThreadPool;
 class CVTFFile
 {
 private:
 	SVTFHeader * Header;
 
-	vlUInt uiImageBufferSize;
+	vlUInt64 uiImageBufferSize;
 	vlByte *lpImageData;
 
+	vlUInt64 uiImageDataOffset;		//!< Offset of the image data from the start of the file.
+	vlUInt64 uiImageWindowOffset;	//!< Offset of lpImageData from the start of the image data.
+	vlUInt64 uiImageWindowSize;		//!< Number of bytes of image data held in lpImageData.
+
+	vlByte *lpSampledData;		//!< Blocks read by LoadImageDataSampled, always owned.
+	vlUInt uiSampledWidth;
+	vlUInt uiSampledHeight;
+	vlUInt64 uiSampledOffset;	//!< What lpSampledData was read for, so asking again does not read it again.
+	vlUInt uiSampledStepX;
+	vlUInt uiSampledStepY;
+
 	vlUInt uiThumbnailBufferSize;
 	vlByte *lpThumbnailImageData;
 
+	vlBool bDataBorrowed;	//!< Image, thumbnail and resource data point into a reader's memory and are not owned.
+
+	vlBool bAuxCompressed;
+	vlUInt uiSubresourceCount;
+	SVTFSubresourceInfo *lpSubresources;	//!< Every (mip, frame, face, slice) of the image data, built once by Load.
+
 public:
 	CVTFFile();
 
@@ -277,13 +327,39 @@ public:
 
 	vlBool IsLoaded() const;
 
-	vlBool Load( const vlVoid *lpData, vlUInt uiBufferSize, vlBool bHeaderOnly = vlFalse );
+	vlBool Load( const vlVoid *lpData, vlUInt64 uiBufferSize, vlBool bHeaderOnly = vlFalse );
+	vlBool Load( IO::Readers::IReader *Reader, vlUInt uiFlags = 0 );
+
+	//! Reads only the byte range of one subresource, replacing any image data held so far.
+	vlBool LoadImageData( IO::Readers::IReader *Reader, vlUInt uiFrame, vlUInt uiFace, vlUInt uiSlice, vlUInt uiMipmapLevel );
+
+	//! Reads every uiStepX-th block of every uiStepY-th row of blocks of one subresource, one row at a time, so an image
+	//! too large to hold can still be previewed. Replaces any image data held so far, GetSampledData returns the result.
+	vlBool LoadImageDataSampled( IO::Readers::IReader *Reader, vlUInt uiFrame, vlUInt uiFace, vlUInt uiSlice, vlUInt uiMipmapLevel, vlUInt uiStepX, vlUInt uiStepY );
+
+	//! The blocks LoadImageDataSampled kept, packed into an image of uiWidth by uiHeight pixels, or 0 if it was not called.
+	vlByte *GetSampledData( vlUInt &uiWidth, vlUInt &uiHeight ) const;
+
+	//! Copies what Load parsed from File, the header, resources, low-res image and layout, but none of its image data.
+	//! The copy owns all of its memory even if File borrowed it, and can fetch image data with LoadImageData.
+	vlBool CopyHeader( const CVTFFile &File );
+
+	//! Bytes held by this file, for budgeting caches.
+	vlUInt64 GetMemorySize() const;
 
 private:
 	static vlBool IsPowerOfTwo( vlUInt uiSize );
 	static vlUInt NextPowerOfTwo( vlUInt uiSize );
 
-	vlBool Load( IO::Readers::IReader *Reader, vlBool bHeaderOnly );
+	//! Overflow checked arithmetic for sizes taken from the header, false if the result does not fit.
+	static vlBool CheckedAdd( vlUInt64 uiA, vlUInt64 uiB, vlUInt64 &uiResult );
+	static vlBool CheckedMultiply( vlUInt64 uiA, vlUInt64 uiB, vlUInt64 &uiResult );
+
+	vlByte *ReadData( IO::Readers::IReader *Reader, vlUInt64 uiOffset, vlUInt64 uiSize );
+	vlVoid FreeData( vlByte *lpData );
+
+	vlUInt64 BuildSubresourceTable( vlUInt64 uiMaxSize );
+	const SVTFSubresourceInfo *GetSubresource( vlUInt uiFrame, vlUInt uiFace, vlUInt uiSlice, vlUInt uiMipmapLevel ) const;
 
 public:
 	vlUInt GetWidth() const;
@@ -297,36 +373,74 @@ public:
 
 	vlByte *GetData( vlUInt uiFrame = 0, vlUInt uiFace = 0, vlUInt uiSlice = 0, vlUInt uiMipmapLevel = 0 ) const;
 
+	//! The low resolution image stored next to the header, read by Load even without the image data.
+	vlBool GetHasThumbnail() const;
+	vlUInt GetThumbnailWidth() const;
+	vlUInt GetThumbnailHeight() const;
+	VTFImageFormat GetThumbnailFormat() const;
+	vlByte *GetThumbnailData() const;
+
+	//! Smallest mipmap level whose longest edge still covers uiSize pixels (0 if none do).
+	vlUInt GetMipmapLevelForSize( vlUInt uiSize ) const;
+
 	vlVoid *GetResourceData( vlUInt uiType, vlUInt &uiSize ) const;
 
 	vlUInt GetAuxInfoOffset( vlUInt iFrame, vlUInt iFace, vlUInt iMipLevel ) const;
 
+	//! Size of the subresource as stored in the file, compressed size for aux compressed images.
+	vlUInt64 GetDataSize( vlUInt uiFrame = 0, vlUInt uiFace = 0, vlUInt uiSlice = 0, vlUInt uiMipmapLevel = 0 ) const;
+
+	vlBool IsAuxCompressed() const;
+	//! Compressed size of a face as expected by Convert, 0 if the image is not aux compressed.
+	vlUInt32 GetCompressedSize( vlUInt uiFrame = 0, vlUInt uiFace = 0, vlUInt uiMipmapLevel = 0 ) const;
+
+	//! Size of the image data laid out as in an uncompressed file, with every aux compressed face inflated.
+	vlUInt64 GetUncompressedDataSize() const;
+	//! Offset of a face within that layout.
+	vlUInt64 GetUncompressedDataOffset( vlUInt uiFrame, vlUInt uiFace, vlUInt uiMipmapLevel ) const;
+
+	//! Inflates every face in Range into lpDest, which is laid out as GetUncompressedDataOffset describes; faces outside
+	//! Range are left untouched. With a thread pool the faces inflate concurrently. Needs their image data loaded.
+	vlBool DecompressImageData( vlByte *lpDest, vlUInt64 uiDestSize, const SVTFSubresourceRange &Range, CThreadPool *pThreadPool = 0 ) const;
+
 	const SVTFHeader& GetHeader() const;
 
 public:
 	static SVTFImageFormatInfo const &GetImageFormatInfo( VTFImageFormat ImageFormat );
 
-	static vlUInt ComputeImageSize( vlUInt uiWidth, vlUInt uiHeight, vlUInt uiDepth, VTFImageFormat ImageFormat );
-	static vlUInt ComputeImageSize( vlUInt uiWidth, vlUInt uiHeight, vlUInt uiDepth, vlUInt uiMipmaps, VTFImageFormat ImageFormat );
+	//! 64-bit so every size the 16-bit header dimensions allow fits; totals over faces and frames are checked by Load.
+	static vlUInt64 ComputeImageSize( vlUInt uiWidth, vlUInt uiHeight, vlUInt uiDepth, VTFImageFormat ImageFormat );
+	static vlUInt64 ComputeImageSize( vlUInt uiWidth, vlUInt uiHeight, vlUInt uiDepth, vlUInt uiMipmaps, VTFImageFormat ImageFormat );
 
 	static vlUInt ComputeMipmapCount( vlUInt uiWidth, vlUInt uiHeight, vlUInt uiDepth );
 	static vlVoid ComputeMipmapDimensions( vlUInt uiWidth, vlUInt uiHeight, vlUInt uiDepth, vlUInt uiMipmapLevel, vlUInt &uiMipmapWidth, vlUInt &uiMipmapHeight, vlUInt &uiMipmapDepth );
-	static vlUInt ComputeMipmapSize( vlUInt uiWidth, vlUInt uiHeight, vlUInt uiDepth, vlUInt uiMipmapLevel, VTFImageFormat ImageFormat );
+	static vlUInt64 ComputeMipmapSize( vlUInt uiWidth, vlUInt uiHeight, vlUInt uiDepth, vlUInt uiMipmapLevel, VTFImageFormat ImageFormat );
 
 private:
-	vlUInt ComputeDataOffset( vlUInt uiFrame, vlUInt uiFace, vlUInt uiSlice, vlUInt uiMipmapLevel, VTFImageFormat ImageFormat ) const;
+	vlUInt64 ComputeDataOffset( vlUInt uiFrame, vlUInt uiFace, vlUInt uiSlice, vlUInt uiMipmapLevel ) const;
 
 public:
-	static vlBool Convert( vlByte *lpSource, vlByte *lpDest, vlUInt uiWidth, vlUInt uiHeight, VTFImageFormat SourceFormat, VTFImageFormat DestFormat, vlUInt32 uiCompressedSize );
+	//! With a thread pool, large images are converted in bands of whole block rows; the output is identical to the serial path.
+	//! uiFlags is a combination of VTFConvertFlag.
+	static vlBool Convert( vlByte *lpSource, vlByte *lpDest, vlUInt uiWidth, vlUInt uiHeight, VTFImageFormat SourceFormat, VTFImageFormat DestFormat, vlUInt32 uiCompressedSize, CThreadPool *pThreadPool = 0, vlUInt uiFlags = 0 );
+
+	//! Receives the rows uiY to uiY + uiRows of a ConvertBands image, which are only valid during the call.
+	typedef vlBool ( *ConvertBandFunc )( const vlByte *lpRows, vlUInt uiY, vlUInt uiRows, vlVoid *lpContext );
+	//! Converts an aux compressed image to an uncompressed format a band of rows at a time, top to bottom, so images too
+	//! large to hold converted can still be scaled down. Only for the formats CanConvertBands allows.
+	static vlBool ConvertBands( vlByte *lpSource, vlUInt uiWidth, vlUInt uiHeight, VTFImageFormat SourceFormat, VTFImageFormat DestFormat, vlUInt32 uiCompressedSize, ConvertBandFunc pfnBand, vlVoid *lpContext, CThreadPool *pThreadPool = 0, vlUInt uiFlags = 0 );
+	//! False for BC6H and float sources, which need the whole image to pick an exposure, and for compressed or float destinations.
+	static vlBool CanConvertBands( VTFImageFormat SourceFormat, VTFImageFormat DestFormat );
 
 private:
-	static vlBool DecompressDXT1( vlByte *src, vlByte *dst, vlUInt uiWidth, vlUInt uiHeight );
-	static vlBool DecompressDXT3( vlByte *src, vlByte *dst, vlUInt uiWidth, vlUInt uiHeight );
-	static vlBool DecompressDXT5( vlByte *src, vlByte *dst, vlUInt uiWidth, vlUInt uiHeight );
-	static vlBool DecompressATI1N( vlByte *src, vlByte *dst, vlUInt uiWidth, vlUInt uiHeight );
-	static vlBool DecompressATI2N( vlByte *src, vlByte *dst, vlUInt uiWidth, vlUInt uiHeight );
-	static vlBool DecompressBC6H( vlByte *src, vlByte *dst, vlUInt uiWidth, vlUInt uiHeight );
-	static vlBool DecompressBC7( vlByte *src, vlByte *dst, vlUInt uiWidth, vlUInt uiHeight );
+	// Decoders write RGBA8888, or BGRA8888 when bBGRA is set.
+	static vlBool DecompressDXT1( vlByte *src, vlByte *dst, vlUInt uiWidth, vlUInt uiHeight, vlBool bBGRA = vlFalse );
+	static vlBool DecompressDXT3( vlByte *src, vlByte *dst, vlUInt uiWidth, vlUInt uiHeight, vlBool bBGRA = vlFalse );
+	static vlBool DecompressDXT5( vlByte *src, vlByte *dst, vlUInt uiWidth, vlUInt uiHeight, vlBool bBGRA = vlFalse );
+	static vlBool DecompressATI1N( vlByte *src, vlByte *dst, vlUInt uiWidth, vlUInt uiHeight, vlBool bBGRA = vlFalse );
+	static vlBool DecompressATI2N( vlByte *src, vlByte *dst, vlUInt uiWidth, vlUInt uiHeight, vlBool bBGRA = vlFalse, vlBool bReconstructZ = vlFalse );
+	static vlBool DecompressBC6H( vlByte *src, vlByte *dst, vlUInt uiWidth, vlUInt uiHeight, vlBool bBGRA = vlFalse );
+	static vlBool DecompressBC7( vlByte *src, vlByte *dst, vlUInt uiWidth, vlUInt uiHeight, vlBool bBGRA = vlFalse );
 };
 
 
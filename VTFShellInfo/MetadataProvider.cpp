@@ -1,6 +1,7 @@
 ﻿#include "Common.h"
 #include "MetadataProvider.h"
 #include "PropVariantSafe.h"
+#include "texturecache.h"
 #include <propkey.h>
 
 constexpr PROPERTYKEY CreatePropertyKey( const GUID& fmtid, DWORD pid )
@@ -30,6 +31,13 @@ static constexpr PROPERTYKEY PKEY_VTF_Flags = CreatePropertyKey( CLSID_VTFShellI
 static constexpr PROPERTYKEY PKEY_VTF_FormatName = CreatePropertyKey( CLSID_VTFShellInfoProps, FormatName );
 static constexpr PROPERTYKEY PKEY_VTF_Version = CreatePropertyKey( CLSID_VTFShellInfoProps, Version );
 
+// Only headers are kept, the Details pane and a folder's columns query the same files over and over.
+static CTextureCache& GetTextureCache()
+{
+	static CTextureCache cache( 4 << 20 );
+	return cache;
+}
+
 MetadataProvider::MetadataProvider()
 {
 	DllAddRef();
@@ -92,25 +100,34 @@ HRESULT MetadataProvider::Initialize( IStream* pstream, DWORD grfMode )
 	if ( grfMode & STGM_READWRITE )
 		return STG_E_ACCESSDENIED;
 
-	STATSTG stat;
-	if ( pstream->Stat( &stat, STATFLAG_NONAME ) != S_OK )
-		return S_FALSE;
+	STextureIdentity identity;
+	const bool hasIdentity = CTextureCache::GetStreamIdentity( pstream, identity );
 
-	ULONG len;
-	const vlUInt size = static_cast<vlUInt>( min( stat.cbSize.QuadPart, sizeof( SVTFHeader ) ) );
-	byte* data = new byte[size];
-	if ( pstream->Read( data, size, &len ) != S_OK )
+	CVTFFile vtfFile;
+	if ( !hasIdentity || !GetTextureCache().FindHeader( identity, vtfFile ) )
 	{
+		STATSTG stat;
+		if ( pstream->Stat( &stat, STATFLAG_NONAME ) != S_OK )
+			return S_FALSE;
+
+		ULONG len;
+		const vlUInt size = static_cast<vlUInt>( min( stat.cbSize.QuadPart, sizeof( SVTFHeader ) ) );
+		byte* data = new byte[size];
+		if ( pstream->Read( data, size, &len ) != S_OK )
+		{
+			delete[] data;
+			return S_FALSE;
+		}
+
+		const bool succsess = vtfFile.Load( data, size, true );
 		delete[] data;
-		return S_FALSE;
-	}
 
-	CVTFFile vtfFile;
-	const bool succsess = vtfFile.Load( data, size, true );
-	delete[] data;
+		if ( !succsess )
+			return S_FALSE;
 
-	if ( !succsess )
-		return S_FALSE;
+		if ( hasIdentity )
+			GetTextureCache().InsertHeader( identity, vtfFile );
+	}
 
 	// Initialize cache
 	if ( const auto hr = PSCreateMemoryPropertyStore( IID_PPV_ARGS( &m_pCache ) ); hr != S_OK )
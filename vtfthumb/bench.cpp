@@ -0,0 +1,2144 @@
+﻿#include "synthetic.h"
+#include "bcdec_simd.h"
+#include "convertgeneric.h"
+#include "hdr.h"
+#include "inflate.h"
+#include "normalmap.h"
+#include "readers.h"
+#include "resample.h"
+#include "texturecache.h"
+#include "thumbnail.h"
+#include "threadpool.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bcdec.h"
+
+//
+// Allocation counters. Every operator new in the process goes through here, so the counts include the
+// allocations the library makes on the benchmark's behalf.
+//
+
+static std::atomic<std::uint64_t> uiAllocCount( 0 );
+static std::atomic<std::uint64_t> uiAllocBytes( 0 );
+
+void *operator new( size_t uiSize )
+{
+	uiAllocCount.fetch_add( 1, std::memory_order_relaxed );
+	uiAllocBytes.fetch_add( uiSize, std::memory_order_relaxed );
+	void *lpData = malloc( uiSize != 0 ? uiSize : 1 );
+	if ( lpData == 0 )
+		throw std::bad_alloc();
+	return lpData;
+}
+
+void *operator new[]( size_t uiSize )
+{
+	return operator new( uiSize );
+}
+
+void operator delete( void *lpData ) noexcept
+{
+	free( lpData );
+}
+
+void operator delete[]( void *lpData ) noexcept
+{
+	free( lpData );
+}
+
+void operator delete( void *lpData, size_t ) noexcept
+{
+	free( lpData );
+}
+
+void operator delete[]( void *lpData, size_t ) noexcept
+{
+	free( lpData );
+}
+
+//
+// Cases and stages.
+//
+
+#define DEFAULT_MIN_TIME_MS 50
+#define DEFAULT_THUMBNAIL_SIZE 256
+#define MIN_ITERATIONS 3
+#define ANIMATED_FRAMES 4
+#define BC7_MODE_COUNT 8
+#define SUBRESOURCE_FRAMES 64
+#define VERIFY_THREADS 4
+#define MAX_SWEEP_THREADS 256
+
+typedef enum tagBenchVariant
+{
+	BENCH_VARIANT_PLAIN = 0,
+	BENCH_VARIANT_AXC,
+	BENCH_VARIANT_CUBEMAP,
+	BENCH_VARIANT_ANIMATED,
+	BENCH_VARIANT_COUNT
+} BenchVariant;
+
+static const vlChar *lpVariantNames[BENCH_VARIANT_COUNT] =
+{
+	"plain",
+	"axc",
+	"cubemap",
+	"animated"
+};
+
+static const vlChar *lpDecodeLevelNames[BCDECODE_COUNT] =
+{
+	"scalar",
+	"sse2",
+	"avx2"
+};
+
+static const vlChar *lpInflateBackendNames[VTF_INFLATE_COUNT] =
+{
+	"auto",
+	"zlib",
+	"oneshot"
+};
+
+struct SOptions
+{
+	SOptions() : uiMinTimeMs( DEFAULT_MIN_TIME_MS ), uiThumbnailSize( DEFAULT_THUMBNAIL_SIZE ), uiThreads( 1 ), InflateBackend( VTF_INFLATE_AUTO ), cMatch( 0 ), cOutput( 0 ) {}
+
+	std::vector<vlUInt> Sizes;
+	vlUInt uiMinTimeMs;
+	vlUInt uiThumbnailSize;
+	vlUInt uiThreads;		//!< Threads handed to Convert and DecompressImageData, 1 keeps every stage on the calling thread.
+	std::vector<vlUInt> Threads;	//!< Thread counts the Threads cases time Convert at.
+	VTFInflateBackend InflateBackend;	//!< Backend the load, decompress, decode and thumbnail stages inflate AXC faces with.
+	const vlChar *cMatch;	//!< Only run cases whose name contains this.
+	const vlChar *cOutput;
+};
+
+struct SStageResult
+{
+	vlBool bOK;
+	vlUInt uiIterations;
+	double dMeanNs;
+	double dMedianNs;
+	double dMinNs;
+	double dAllocsPerOp;
+	double dAllocBytesPerOp;
+};
+
+//! Runs Stage until it has taken at least uiMinTimeMs and MIN_ITERATIONS calls, after one untimed warm-up call.
+static SStageResult RunStage( const std::function<vlBool()> &Stage, vlUInt uiMinTimeMs )
+{
+	SStageResult Result = {};
+	Result.bOK = Stage();
+	if ( !Result.bOK )
+		return Result;
+
+	typedef std::chrono::steady_clock Clock;
+	const Clock::duration MinTime = std::chrono::milliseconds( uiMinTimeMs );
+	std::vector<double> Times;
+
+	// Counted per call so the bookkeeping here does not show up as allocations of the stage.
+	std::uint64_t uiCount = 0;
+	std::uint64_t uiBytes = 0;
+	Clock::duration Total = Clock::duration::zero();
+	while ( Total < MinTime || Times.size() < MIN_ITERATIONS )
+	{
+		const std::uint64_t uiStartCount = uiAllocCount.load();
+		const std::uint64_t uiStartBytes = uiAllocBytes.load();
+		const Clock::time_point Start = Clock::now();
+		const vlBool bOK = Stage();
+		const Clock::duration Elapsed = Clock::now() - Start;
+		uiCount += uiAllocCount.load() - uiStartCount;
+		uiBytes += uiAllocBytes.load() - uiStartBytes;
+		if ( !bOK )
+		{
+			Result.bOK = vlFalse;
+			return Result;
+		}
+
+		Total += Elapsed;
+		Times.push_back( ( double )std::chrono::duration_cast<std::chrono::nanoseconds>( Elapsed ).count() );
+	}
+
+	Result.uiIterations = ( vlUInt )Times.size();
+	Result.dAllocsPerOp = ( double )uiCount / Times.size();
+	Result.dAllocBytesPerOp = ( double )uiBytes / Times.size();
+
+	std::sort( Times.begin(), Times.end() );
+	double dSum = 0.0;
+	for ( double dTime : Times )
+		dSum += dTime;
+	Result.dMeanNs = dSum / Times.size();
+	Result.dMedianNs = Times[Times.size() / 2];
+	Result.dMinNs = Times[0];
+	return Result;
+}
+
+//! Bounds checked, the level loops run up to GetBCDecodeLevel() which the compiler cannot tie to the table size.
+static const vlChar *GetDecodeLevelName( vlUInt uiLevel )
+{
+	return uiLevel < BCDECODE_COUNT ? lpDecodeLevelNames[uiLevel] : "unknown";
+}
+
+static std::string GetFormatName( VTFImageFormat Format )
+{
+	// Names are plain ASCII.
+	const wchar_t *lpName = CVTFFile::GetImageFormatInfo( Format ).lpName;
+	std::string sName;
+	while ( *lpName != L'\0' )
+		sName += ( vlChar )*lpName++;
+	return sName;
+}
+
+//! One JSON object per line so results can be appended to and diffed over time.
+static vlVoid WriteResult( FILE *hFile, const std::string &sCase, const std::string &sFormat, vlUInt uiSize, BenchVariant Variant, size_t uiFileSize,
+	const vlChar *cStage, const SStageResult &Result, std::uint64_t uiBytes, std::uint64_t uiPixels )
+{
+	fprintf( hFile, "{\"case\":\"%s\",\"format\":\"%s\",\"width\":%u,\"height\":%u,\"variant\":\"%s\",\"file_bytes\":%llu,\"stage\":\"%s\",\"ok\":%s",
+		sCase.c_str(), sFormat.c_str(), uiSize, uiSize, lpVariantNames[Variant], ( unsigned long long )uiFileSize, cStage, Result.bOK ? "true" : "false" );
+	if ( Result.bOK )
+	{
+		const double dSeconds = Result.dMedianNs * 1e-9;
+		fprintf( hFile, ",\"iterations\":%u,\"mean_ns\":%.0f,\"median_ns\":%.0f,\"min_ns\":%.0f,\"bytes\":%llu,\"mb_per_s\":%.2f,\"mpix_per_s\":%.2f,\"allocs_per_op\":%.2f,\"alloc_bytes_per_op\":%.0f",
+			Result.uiIterations, Result.dMeanNs, Result.dMedianNs, Result.dMinNs, ( unsigned long long )uiBytes,
+			dSeconds > 0.0 ? uiBytes / dSeconds / 1048576.0 : 0.0, dSeconds > 0.0 ? uiPixels / dSeconds / 1e6 : 0.0,
+			Result.dAllocsPerOp, Result.dAllocBytesPerOp );
+	}
+	fprintf( hFile, "}\n" );
+	fflush( hFile );
+}
+
+//! Returns false if the case could not be set up, stages that fail are reported in the output and counted in uiFailedStages.
+static vlBool RunCase( FILE *hFile, VTFImageFormat Format, vlUInt uiSize, BenchVariant Variant, const SOptions &Options, CThreadPool *pThreadPool, vlUInt &uiFailedStages )
+{
+	const std::string sFormat = GetFormatName( Format );
+	const std::string sCase = sFormat + "/" + std::to_string( uiSize ) + "/" + lpVariantNames[Variant];
+	if ( Options.cMatch != 0 && sCase.find( Options.cMatch ) == std::string::npos )
+		return vlTrue;
+
+	SSyntheticVTF Desc;
+	Desc.Format = Format;
+	Desc.uiWidth = uiSize;
+	Desc.uiHeight = uiSize;
+	Desc.bAuxCompressed = Variant == BENCH_VARIANT_AXC;
+	Desc.bCubemap = Variant == BENCH_VARIANT_CUBEMAP;
+	Desc.uiFrames = Variant == BENCH_VARIANT_ANIMATED ? ANIMATED_FRAMES : 1;
+
+	std::vector<vlByte> Data;
+	if ( !BuildSyntheticVTF( Desc, Data ) )
+	{
+		fprintf( stderr, "vtfbench: cannot build %s\n", sCase.c_str() );
+		return vlFalse;
+	}
+
+	const vlUInt uiDataSize = ( vlUInt )Data.size();
+
+	// Load: parsing plus copying the whole file.
+	SStageResult Result = RunStage( [&]()
+	{
+		IO::Readers::CMemoryReader Reader( Data.data(), uiDataSize );
+		CVTFFile File;
+		return File.Load( &Reader, 0 );
+	}, Options.uiMinTimeMs );
+	WriteResult( hFile, sCase, sFormat, uiSize, Variant, Data.size(), "load", Result, uiDataSize, 0 );
+	uiFailedStages += !Result.bOK;
+
+	// Load borrowed: the same parse with the image data left in the caller's buffer, compare allocations with load.
+	Result = RunStage( [&]()
+	{
+		IO::Readers::CMemoryReader Reader( Data.data(), uiDataSize );
+		CVTFFile File;
+		return File.Load( &Reader, VTF_LOAD_BORROW_DATA );
+	}, Options.uiMinTimeMs );
+	WriteResult( hFile, sCase, sFormat, uiSize, Variant, Data.size(), "load_borrowed", Result, uiDataSize, 0 );
+	uiFailedStages += !Result.bOK;
+
+	// Load mapped: mapping the file and borrowing from the mapping, as vtfthumb reads files.
+	const std::string sFileName = ( std::filesystem::temp_directory_path() / ( "vtfbench_" + std::to_string( uiSize ) + ".vtf" ) ).string();
+	FILE *hVTF = fopen( sFileName.c_str(), "wb" );
+	const vlBool bWritten = hVTF != 0 && fwrite( Data.data(), 1, Data.size(), hVTF ) == Data.size();
+	if ( hVTF != 0 )
+		fclose( hVTF );
+
+	Result = RunStage( [&]()
+	{
+		IO::Readers::CMappedFileReader Reader( sFileName.c_str() );
+		CVTFFile File;
+		return bWritten && File.Load( &Reader, VTF_LOAD_BORROW_DATA );
+	}, Options.uiMinTimeMs );
+	WriteResult( hFile, sCase, sFormat, uiSize, Variant, Data.size(), "load_mapped", Result, uiDataSize, 0 );
+	uiFailedStages += !Result.bOK;
+	remove( sFileName.c_str() );
+
+	// Load header: what the shell pays before it asks for a thumbnail.
+	Result = RunStage( [&]()
+	{
+		IO::Readers::CMemoryReader Reader( Data.data(), uiDataSize );
+		CVTFFile File;
+		return File.Load( &Reader, VTF_LOAD_NO_IMAGE_DATA );
+	}, Options.uiMinTimeMs );
+	WriteResult( hFile, sCase, sFormat, uiSize, Variant, Data.size(), "load_header", Result, 0, 0 );
+	uiFailedStages += !Result.bOK;
+
+	IO::Readers::CMemoryReader Reader( Data.data(), uiDataSize );
+	CVTFFile File;
+	if ( !File.Load( &Reader, VTF_LOAD_BORROW_DATA ) )
+	{
+		fprintf( stderr, "vtfbench: cannot load %s\n", sCase.c_str() );
+		return vlFalse;
+	}
+
+	// Decompress: inflating every AXC face of the file.
+	if ( Variant == BENCH_VARIANT_AXC )
+	{
+		SVTFSubresourceRange Range;
+		Range.uiFirstFrame = 0;
+		Range.uiFrameCount = File.GetFrameCount();
+		Range.uiFirstFace = 0;
+		Range.uiFaceCount = File.GetFaceCount();
+		Range.uiFirstMipmap = 0;
+		Range.uiMipmapCount = File.GetMipmapCount();
+
+		const vlUInt64 uiUncompressedSize = File.GetUncompressedDataSize();
+		std::vector<vlByte> Uncompressed( ( size_t )uiUncompressedSize );
+		Result = RunStage( [&]()
+		{
+			return File.DecompressImageData( Uncompressed.data(), uiUncompressedSize, Range, pThreadPool );
+		}, Options.uiMinTimeMs );
+		WriteResult( hFile, sCase, sFormat, uiSize, Variant, Data.size(), "decompress", Result, uiUncompressedSize, 0 );
+		uiFailedStages += !Result.bOK;
+	}
+
+	// Decode: the largest mip of the first face to BGRA8888, the Decompress* and ConvertTemplated paths.
+	const vlUInt64 uiDecodedSize = CVTFFile::ComputeImageSize( uiSize, uiSize, 1, IMAGE_FORMAT_BGRA8888 );
+	std::vector<vlByte> Decoded( ( size_t )uiDecodedSize );
+	Result = RunStage( [&]()
+	{
+		return CVTFFile::Convert( File.GetData( 0, 0, 0, 0 ), Decoded.data(), uiSize, uiSize, Format, IMAGE_FORMAT_BGRA8888, File.GetCompressedSize( 0, 0, 0 ), pThreadPool );
+	}, Options.uiMinTimeMs );
+	WriteResult( hFile, sCase, sFormat, uiSize, Variant, Data.size(), "decode", Result, uiDecodedSize, ( std::uint64_t )uiSize * uiSize );
+	uiFailedStages += !Result.bOK;
+
+	// Thumbnail: bytes in, scaled BGRA out.
+	SThumbnailOptions ThumbnailOptions;
+	Result = RunStage( [&]()
+	{
+		CThumbnail Thumbnail;
+		return Thumbnail.Create( Data.data(), uiDataSize, Options.uiThumbnailSize, ThumbnailOptions, pThreadPool );
+	}, Options.uiMinTimeMs );
+	WriteResult( hFile, sCase, sFormat, uiSize, Variant, Data.size(), "thumbnail", Result, uiDataSize, ( std::uint64_t )Options.uiThumbnailSize * Options.uiThumbnailSize );
+	uiFailedStages += !Result.bOK;
+
+	// Thumbnail low-res: time to first pixel for an icon sized request, served from the low-res image with
+	// bLowRes and decoded from the smallest mip covering it without, which takes the low-res path is checked.
+	for ( vlBool bLowRes : { vlTrue, vlFalse } )
+	{
+		SThumbnailOptions LowResOptions;
+		LowResOptions.bLowRes = bLowRes;
+		Result = RunStage( [&]()
+		{
+			CThumbnail Thumbnail;
+			return Thumbnail.Create( Data.data(), uiDataSize, THUMBNAIL_LOWRES_MAX_SIZE, LowResOptions, pThreadPool ) && Thumbnail.GetFromLowRes() == bLowRes;
+		}, Options.uiMinTimeMs );
+		WriteResult( hFile, sCase, sFormat, uiSize, Variant, Data.size(), bLowRes ? "thumbnail_lowres" : "thumbnail_lowres_off", Result, uiDataSize, ( std::uint64_t )THUMBNAIL_LOWRES_MAX_SIZE * THUMBNAIL_LOWRES_MAX_SIZE );
+		uiFailedStages += !Result.bOK;
+	}
+
+	// Thumbnail reuse: Explorer asking again at a different size the same mip serves, the header and decoded mip
+	// come from the in-process cache. Compare with the thumbnail stage, which has the same output size.
+	CTextureCache TextureCache;
+	const STextureIdentity Identity = { 0, 0, uiDataSize, 0 };
+	ThumbnailOptions.pTextureCache = &TextureCache;
+	ThumbnailOptions.pIdentity = &Identity;
+	{
+		CVTFFile Header;
+		CThumbnail Thumbnail;
+		if ( Header.Load( &Reader, VTF_LOAD_NO_IMAGE_DATA ) )
+		{
+			TextureCache.InsertHeader( Identity, Header );
+			Thumbnail.Create( Header, &Reader, std::max( Options.uiThumbnailSize * 3 / 4, 1u ), ThumbnailOptions, pThreadPool );
+		}
+	}
+	const STextureCacheStats Before = TextureCache.GetStats();
+	Result = RunStage( [&]()
+	{
+		CVTFFile Header;
+		CThumbnail Thumbnail;
+		return TextureCache.FindHeader( Identity, Header ) && Thumbnail.Create( Header, &Reader, Options.uiThumbnailSize, ThumbnailOptions, pThreadPool );
+	}, Options.uiMinTimeMs );
+
+	// Without hits the stage timed decoding, not reuse.
+	const STextureCacheStats After = TextureCache.GetStats();
+	if ( Result.bOK && ( After.uiHeaderHits <= Before.uiHeaderHits || After.uiMipHits <= Before.uiMipHits ) )
+	{
+		fprintf( stderr, "vtfbench: %s thumbnail_reuse did not hit the texture cache\n", sCase.c_str() );
+		Result.bOK = vlFalse;
+	}
+	WriteResult( hFile, sCase, sFormat, uiSize, Variant, Data.size(), "thumbnail_reuse", Result, 0, ( std::uint64_t )Options.uiThumbnailSize * Options.uiThumbnailSize );
+	uiFailedStages += !Result.bOK;
+
+	return vlTrue;
+}
+
+//
+// Uncompressed conversions. Random pixels of every uncompressed format through the per format kernels and
+// through ConvertTemplated, which must write the same bytes, to both 8888 orders.
+//
+
+//! Returns false if the kernel and ConvertTemplated disagree.
+static vlBool RunConvert( FILE *hFile, VTFImageFormat Format, vlUInt uiSize, const SOptions &Options, vlUInt &uiFailedStages )
+{
+	const std::string sFormat = GetFormatName( Format );
+	const std::string sCase = "Convert/" + std::to_string( uiSize ) + "/" + sFormat;
+	if ( Options.cMatch != 0 && sCase.find( Options.cMatch ) == std::string::npos )
+		return vlTrue;
+
+	std::vector<vlByte> Source( ( size_t )CVTFFile::ComputeImageSize( uiSize, uiSize, 1, Format ) );
+	std::mt19937 Random( Format * 65536 + uiSize );
+	for ( size_t i = 0; i < Source.size(); i++ )
+		Source[i] = ( vlByte )Random();
+
+	const std::uint64_t uiPixels = ( std::uint64_t )uiSize * uiSize;
+	std::vector<vlByte> Kernel( ( size_t )uiPixels * 4 );
+	std::vector<vlByte> Generic( Kernel.size() );
+
+	// A format neither path converts is a failed stage like in RunCase, only a difference is a mismatch.
+	SStageResult Result = {};
+	Result.bOK = vlTrue;
+	vlBool bMatch = vlTrue;
+	for ( VTFImageFormat DestFormat : { IMAGE_FORMAT_RGBA8888, IMAGE_FORMAT_BGRA8888 } )
+	{
+		const vlBool bKernel = CVTFFile::Convert( Source.data(), Kernel.data(), uiSize, uiSize, Format, DestFormat, 0 );
+		const vlBool bGeneric = ConvertGeneric( Source.data(), Generic.data(), uiSize, uiSize, Format, DestFormat );
+		if ( bKernel != bGeneric || ( bKernel && Kernel != Generic ) )
+		{
+			fprintf( stderr, "vtfbench: %s to %s kernel does not match ConvertTemplated\n", sCase.c_str(), GetFormatName( DestFormat ).c_str() );
+			bMatch = vlFalse;
+		}
+		Result.bOK = Result.bOK && bKernel && bGeneric && bMatch;
+	}
+	WriteResult( hFile, sCase, sFormat, uiSize, BENCH_VARIANT_PLAIN, Source.size(), "verify", Result, 0, 0 );
+	uiFailedStages += !Result.bOK;
+	if ( !Result.bOK )
+		return bMatch;
+
+	Result = RunStage( [&]()
+	{
+		return ConvertGeneric( Source.data(), Kernel.data(), uiSize, uiSize, Format, IMAGE_FORMAT_BGRA8888 );
+	}, Options.uiMinTimeMs );
+	WriteResult( hFile, sCase, sFormat, uiSize, BENCH_VARIANT_PLAIN, Source.size(), "convert_generic", Result, Kernel.size(), uiPixels );
+
+	Result = RunStage( [&]()
+	{
+		return CVTFFile::Convert( Source.data(), Kernel.data(), uiSize, uiSize, Format, IMAGE_FORMAT_BGRA8888, 0 );
+	}, Options.uiMinTimeMs );
+	WriteResult( hFile, sCase, sFormat, uiSize, BENCH_VARIANT_PLAIN, Source.size(), "convert_kernel", Result, Kernel.size(), uiPixels );
+
+	return vlTrue;
+}
+
+//
+// Inflate backends. Every mip of an AXC file through zlib and the one-shot decoder, which must write the
+// same bytes, then truncated and bit flipped streams, which neither may accept with different bytes or
+// inflate past the end of the face.
+//
+
+#define INFLATE_GUARD_SIZE 64
+#define INFLATE_GUARD_BYTE 0xcd
+#define INFLATE_FLIPS_PER_MIP 16
+
+//! Inflates into Dest with guard bytes after the face, returns false if the backend wrote over them.
+static vlBool InflateGuarded( InflateFunc pfnInflate, const vlByte *lpSource, vlUInt uiSourceSize, vlUInt uiDestSize, std::vector<vlByte> &Dest, vlBool &bInflated )
+{
+	Dest.assign( ( size_t )uiDestSize + INFLATE_GUARD_SIZE, INFLATE_GUARD_BYTE );
+	bInflated = pfnInflate( lpSource, uiSourceSize, Dest.data(), uiDestSize );
+	return std::all_of( Dest.begin() + uiDestSize, Dest.end(), []( vlByte uiByte ) { return uiByte == INFLATE_GUARD_BYTE; } );
+}
+
+//! Returns false if the backends disagree on a valid stream or either mishandles a damaged one.
+static vlBool RunInflate( FILE *hFile, VTFImageFormat Format, vlUInt uiSize, const SOptions &Options, vlUInt &uiFailedStages )
+{
+	const std::string sFormat = GetFormatName( Format );
+	const std::string sCase = "Inflate/" + std::to_string( uiSize ) + "/" + sFormat;
+	if ( Options.cMatch != 0 && sCase.find( Options.cMatch ) == std::string::npos )
+		return vlTrue;
+
+	SSyntheticVTF Desc;
+	Desc.Format = Format;
+	Desc.uiWidth = uiSize;
+	Desc.uiHeight = uiSize;
+	Desc.bAuxCompressed = vlTrue;
+
+	std::vector<vlByte> Data;
+	if ( !BuildSyntheticVTF( Desc, Data ) )
+	{
+		fprintf( stderr, "vtfbench: cannot build %s\n", sCase.c_str() );
+		uiFailedStages++;
+		return vlTrue;
+	}
+
+	IO::Readers::CMemoryReader Reader( Data.data(), Data.size() );
+	CVTFFile File;
+	if ( !File.Load( &Reader, VTF_LOAD_BORROW_DATA ) )
+	{
+		fprintf( stderr, "vtfbench: cannot load %s\n", sCase.c_str() );
+		uiFailedStages++;
+		return vlTrue;
+	}
+
+	const vlUInt uiMipmapCount = File.GetMipmapCount();
+	std::uint64_t uiInflatedSize = 0;
+	for ( vlUInt uiMipmap = 0; uiMipmap < uiMipmapCount; uiMipmap++ )
+		uiInflatedSize += CVTFFile::ComputeMipmapSize( uiSize, uiSize, 1, uiMipmap, Format );
+
+	// Verify: both backends on every mip, then the damaged streams.
+	std::mt19937 Random( Format * 65536 + uiSize );
+	std::vector<vlByte> Zlib, OneShot, Damaged;
+	vlBool bMatch = vlTrue;
+	for ( vlUInt uiMipmap = 0; uiMipmap < uiMipmapCount && bMatch; uiMipmap++ )
+	{
+		const vlByte *lpSource = File.GetData( 0, 0, 0, uiMipmap );
+		const vlUInt uiSourceSize = File.GetCompressedSize( 0, 0, uiMipmap );
+		const vlUInt uiFaceSize = ( vlUInt )CVTFFile::ComputeMipmapSize( uiSize, uiSize, 1, uiMipmap, Format );
+
+		vlBool bZlib, bOneShot;
+		if ( !InflateGuarded( InflateZlib, lpSource, uiSourceSize, uiFaceSize, Zlib, bZlib ) ||
+			!InflateGuarded( InflateOneShot, lpSource, uiSourceSize, uiFaceSize, OneShot, bOneShot ) ||
+			!bZlib || !bOneShot || Zlib != OneShot )
+		{
+			fprintf( stderr, "vtfbench: %s mip %u inflates differently with zlib and one-shot\n", sCase.c_str(), uiMipmap );
+			bMatch = vlFalse;
+			break;
+		}
+
+		// Truncated streams must fail. Bit flipped ones mostly fail too, but the Adler-32 trailer cannot catch every
+		// change, so there both backends must only agree on the result and the bytes.
+		std::vector<vlByte> DamagedZlib;
+		auto CheckDamaged = [&]( vlUInt uiDamagedSize, vlBool bMayInflate )
+		{
+			vlBool bZlibInflated, bOneShotInflated;
+			const vlBool bZlibGuard = InflateGuarded( InflateZlib, Damaged.data(), uiDamagedSize, uiFaceSize, DamagedZlib, bZlibInflated );
+			const vlBool bOneShotGuard = InflateGuarded( InflateOneShot, Damaged.data(), uiDamagedSize, uiFaceSize, OneShot, bOneShotInflated );
+			if ( !bZlibGuard || !bOneShotGuard || bZlibInflated != bOneShotInflated ||
+				( bZlibInflated && ( !bMayInflate || DamagedZlib != OneShot ) ) )
+			{
+				fprintf( stderr, "vtfbench: %s mip %u damaged stream of %u bytes is not rejected the same by zlib and one-shot\n", sCase.c_str(), uiMipmap, uiDamagedSize );
+				bMatch = vlFalse;
+			}
+		};
+
+		// The trailer cut short, half the stream and the header alone.
+		Damaged.assign( lpSource, lpSource + uiSourceSize );
+		for ( vlUInt uiTruncatedSize : { uiSourceSize - 1, uiSourceSize / 2, 2u } )
+			CheckDamaged( uiTruncatedSize, vlFalse );
+
+		for ( vlUInt uiFlip = 0; uiFlip < INFLATE_FLIPS_PER_MIP; uiFlip++ )
+		{
+			Damaged.assign( lpSource, lpSource + uiSourceSize );
+			Damaged[Random() % uiSourceSize] ^= ( vlByte )( 1 << ( Random() % 8 ) );
+			CheckDamaged( uiSourceSize, vlTrue );
+		}
+	}
+
+	SStageResult Result = {};
+	Result.bOK = bMatch;
+	WriteResult( hFile, sCase, sFormat, uiSize, BENCH_VARIANT_AXC, Data.size(), "verify", Result, 0, 0 );
+	uiFailedStages += !Result.bOK;
+	if ( !Result.bOK )
+		return vlFalse;
+
+	// Inflate: every mip with each backend, the choice VTF_INFLATE_AUTO makes by face size.
+	std::vector<vlByte> Inflated( ( size_t )CVTFFile::ComputeMipmapSize( uiSize, uiSize, 1, 0, Format ) );
+	for ( InflateFunc pfnInflate : { InflateZlib, InflateOneShot } )
+	{
+		Result = RunStage( [&]()
+		{
+			vlBool bInflated = vlTrue;
+			for ( vlUInt uiMipmap = 0; uiMipmap < uiMipmapCount && bInflated; uiMipmap++ )
+				bInflated = pfnInflate( File.GetData( 0, 0, 0, uiMipmap ), File.GetCompressedSize( 0, 0, uiMipmap ), Inflated.data(), ( vlUInt )CVTFFile::ComputeMipmapSize( uiSize, uiSize, 1, uiMipmap, Format ) );
+			return bInflated;
+		}, Options.uiMinTimeMs );
+		WriteResult( hFile, sCase, sFormat, uiSize, BENCH_VARIANT_AXC, Data.size(), pfnInflate == InflateZlib ? "inflate_zlib" : "inflate_oneshot", Result, uiInflatedSize, 0 );
+		uiFailedStages += !Result.bOK;
+	}
+
+	return vlTrue;
+}
+
+//
+// Decompressing subresources. AXC cubemaps and long animations have the most faces to inflate at once; the
+// buffer DecompressImageData writes, for every face and for a box inside, serially and on VERIFY_THREADS
+// threads, must hold the image data of the same file written without AXC and leave the faces outside alone.
+//
+
+#define DECOMPRESS_FRAMES 64
+#define DECOMPRESS_GUARD_BYTE 0xcd
+
+struct SDecompressCase
+{
+	VTFImageFormat Format;
+	vlBool bCubemap;
+	vlUInt uiFrames;
+	const vlChar *cFormat;
+	const vlChar *cName;
+};
+
+static const SDecompressCase DecompressCases[] =
+{
+	{ IMAGE_FORMAT_RGBA16161616F, vlTrue, 1, "RGBA16161616F", "cubemap" },
+	{ IMAGE_FORMAT_DXT5, vlFalse, DECOMPRESS_FRAMES, "DXT5", "animated" },
+};
+
+//! Returns false if a range decompresses to anything other than the uncompressed file's data.
+static vlBool RunDecompress( FILE *hFile, const SDecompressCase &Case, vlUInt uiSize, const SOptions &Options, CThreadPool *pThreadPool, CThreadPool &VerifyPool, vlUInt &uiFailedStages )
+{
+	const std::string sFormat = Case.cFormat;
+	const std::string sCase = "Decompress/" + std::to_string( uiSize ) + "/" + sFormat + "_" + Case.cName;
+	if ( Options.cMatch != 0 && sCase.find( Options.cMatch ) == std::string::npos )
+		return vlTrue;
+
+	// The same seed gives the same texels with and without AXC.
+	SSyntheticVTF Desc;
+	Desc.Format = Case.Format;
+	Desc.uiWidth = uiSize;
+	Desc.uiHeight = uiSize;
+	Desc.uiFrames = Case.uiFrames;
+	Desc.bCubemap = Case.bCubemap;
+
+	std::vector<vlByte> PlainData, Data;
+	const vlBool bPlainBuilt = BuildSyntheticVTF( Desc, PlainData );
+	Desc.bAuxCompressed = vlTrue;
+	if ( !bPlainBuilt || !BuildSyntheticVTF( Desc, Data ) )
+	{
+		fprintf( stderr, "vtfbench: cannot build %s\n", sCase.c_str() );
+		uiFailedStages++;
+		return vlTrue;
+	}
+
+	IO::Readers::CMemoryReader PlainReader( PlainData.data(), PlainData.size() );
+	IO::Readers::CMemoryReader Reader( Data.data(), Data.size() );
+	CVTFFile PlainFile, File;
+	if ( !PlainFile.Load( &PlainReader, VTF_LOAD_BORROW_DATA ) || !File.Load( &Reader, VTF_LOAD_BORROW_DATA ) )
+	{
+		fprintf( stderr, "vtfbench: cannot load %s\n", sCase.c_str() );
+		uiFailedStages++;
+		return vlTrue;
+	}
+
+	const vlUInt uiFrames = File.GetFrameCount();
+	const vlUInt uiFaces = File.GetFaceCount();
+	const vlUInt uiMips = File.GetMipmapCount();
+	const vlUInt64 uiUncompressedSize = File.GetUncompressedDataSize();
+
+	// Smallest mip first, so the last mip of the first face is where the uncompressed image data starts.
+	const vlByte *lpPlain = PlainFile.GetData( 0, 0, 0, uiMips - 1 );
+
+	SVTFSubresourceRange Full;
+	Full.uiFirstFrame = 0;
+	Full.uiFrameCount = uiFrames;
+	Full.uiFirstFace = 0;
+	Full.uiFaceCount = uiFaces;
+	Full.uiFirstMipmap = 0;
+	Full.uiMipmapCount = uiMips;
+
+	// A box that leaves out faces on every side it can.
+	SVTFSubresourceRange Partial;
+	Partial.uiFirstFrame = uiFrames > 2 ? 1 : 0;
+	Partial.uiFrameCount = uiFrames > 2 ? uiFrames / 2 : uiFrames;
+	Partial.uiFirstFace = uiFaces > 2 ? 2 : 0;
+	Partial.uiFaceCount = uiFaces > 2 ? uiFaces - 3 : uiFaces;
+	Partial.uiFirstMipmap = uiMips > 2 ? 1 : 0;
+	Partial.uiMipmapCount = uiMips > 2 ? uiMips - 2 : uiMips;
+
+	SStageResult Result = {};
+	Result.bOK = lpPlain != 0 && uiUncompressedSize != 0 && uiUncompressedSize == PlainFile.GetUncompressedDataSize();
+	std::vector<vlByte> Expected, Decompressed;
+	for ( const SVTFSubresourceRange *pRange : { &Full, &Partial } )
+	{
+		if ( !Result.bOK )
+			break;
+
+		const SVTFSubresourceRange &Range = *pRange;
+		Expected.assign( ( size_t )uiUncompressedSize, DECOMPRESS_GUARD_BYTE );
+		for ( vlUInt uiMip = Range.uiFirstMipmap; uiMip < Range.uiFirstMipmap + Range.uiMipmapCount; uiMip++ )
+		{
+			const size_t uiFaceSize = ( size_t )CVTFFile::ComputeMipmapSize( uiSize, uiSize, 1, uiMip, Case.Format );
+			for ( vlUInt uiFrame = Range.uiFirstFrame; uiFrame < Range.uiFirstFrame + Range.uiFrameCount; uiFrame++ )
+			{
+				for ( vlUInt uiFace = Range.uiFirstFace; uiFace < Range.uiFirstFace + Range.uiFaceCount; uiFace++ )
+				{
+					const size_t uiOffset = ( size_t )File.GetUncompressedDataOffset( uiFrame, uiFace, uiMip );
+					memcpy( Expected.data() + uiOffset, lpPlain + uiOffset, uiFaceSize );
+				}
+			}
+		}
+
+		for ( CThreadPool *pPool : { ( CThreadPool * )0, &VerifyPool } )
+		{
+			Decompressed.assign( ( size_t )uiUncompressedSize, DECOMPRESS_GUARD_BYTE );
+			if ( !File.DecompressImageData( Decompressed.data(), uiUncompressedSize, Range, pPool ) || Decompressed != Expected )
+			{
+				fprintf( stderr, "vtfbench: %s %s range on %u threads does not match the uncompressed file\n", sCase.c_str(), pRange == &Full ? "full" : "partial", pPool ? pPool->GetThreadCount() : 1 );
+				Result.bOK = vlFalse;
+			}
+		}
+	}
+	WriteResult( hFile, sCase, sFormat, uiSize, Case.bCubemap ? BENCH_VARIANT_CUBEMAP : BENCH_VARIANT_ANIMATED, Data.size(), "verify", Result, 0, 0 );
+	uiFailedStages += !Result.bOK;
+	if ( !Result.bOK )
+		return vlFalse;
+
+	// Decompress: every face one after another, then on the -j pool.
+	for ( CThreadPool *pPool : { ( CThreadPool * )0, pThreadPool } )
+	{
+		Result = RunStage( [&]()
+		{
+			return File.DecompressImageData( Decompressed.data(), uiUncompressedSize, Full, pPool );
+		}, Options.uiMinTimeMs );
+		WriteResult( hFile, sCase, sFormat, uiSize, Case.bCubemap ? BENCH_VARIANT_CUBEMAP : BENCH_VARIANT_ANIMATED, Data.size(), pPool ? "decompress" : "decompress_serial", Result, uiUncompressedSize, 0 );
+		uiFailedStages += !Result.bOK;
+		if ( pThreadPool == 0 )
+			break;
+	}
+
+	return vlTrue;
+}
+
+//
+// Thread scaling. Convert on one image at every -threads count, with and without AXC. Before timing, an
+// image tall enough to be split into bands is converted at every count and must come out as the serial
+// conversion did.
+//
+
+//! Pixels from which Convert splits an image into bands, the verify image is at least this large.
+#define THREADS_VERIFY_MIN_PIXELS ( 256 * 256 )
+
+static const VTFImageFormat ThreadsFormats[] =
+{
+	IMAGE_FORMAT_DXT1,
+	IMAGE_FORMAT_DXT5,
+	IMAGE_FORMAT_BC7,
+	IMAGE_FORMAT_BC6H,
+	IMAGE_FORMAT_ATI2N,
+	IMAGE_FORMAT_BGRA8888,
+	IMAGE_FORMAT_RGB888,
+	IMAGE_FORMAT_RGBA16161616F
+};
+
+//! Generates a file and loads it borrowing from Data, so mip 0 is where the conversions read from.
+static vlBool BuildThreadsSource( VTFImageFormat Format, vlUInt uiWidth, vlUInt uiHeight, vlBool bAuxCompressed, std::vector<vlByte> &Data, CVTFFile &File )
+{
+	SSyntheticVTF Desc;
+	Desc.Format = Format;
+	Desc.uiWidth = uiWidth;
+	Desc.uiHeight = uiHeight;
+	Desc.bAuxCompressed = bAuxCompressed;
+	if ( !BuildSyntheticVTF( Desc, Data ) )
+		return vlFalse;
+
+	IO::Readers::CMemoryReader Reader( Data.data(), Data.size() );
+	return File.Load( &Reader, VTF_LOAD_BORROW_DATA );
+}
+
+//! Returns false if a thread count does not give the serial output.
+static vlBool RunThreads( FILE *hFile, VTFImageFormat Format, vlUInt uiSize, const SOptions &Options, const std::vector<CThreadPool *> &Pools, vlUInt &uiFailedStages )
+{
+	const std::string sFormat = GetFormatName( Format );
+	const std::string sCase = "Threads/" + std::to_string( uiSize ) + "/" + sFormat;
+	if ( Options.cMatch != 0 && sCase.find( Options.cMatch ) == std::string::npos )
+		return vlTrue;
+
+	// Not a multiple of 4 high, so the last band is cut short.
+	const vlUInt uiVerifyHeight = std::max( uiSize, ( THREADS_VERIFY_MIN_PIXELS + uiSize - 1 ) / uiSize ) | 1;
+	std::vector<vlByte> Data, AuxData;
+	CVTFFile File, AuxFile;
+
+	SStageResult Result = {};
+	Result.bOK = BuildThreadsSource( Format, uiSize, uiVerifyHeight, vlFalse, Data, File ) && BuildThreadsSource( Format, uiSize, uiVerifyHeight, vlTrue, AuxData, AuxFile );
+	if ( !Result.bOK )
+	{
+		fprintf( stderr, "vtfbench: cannot build %s\n", sCase.c_str() );
+		uiFailedStages++;
+		return vlTrue;
+	}
+
+	std::vector<vlByte> Expected( ( size_t )CVTFFile::ComputeImageSize( uiSize, uiVerifyHeight, 1, IMAGE_FORMAT_BGRA8888 ) );
+	std::vector<vlByte> Decoded( Expected.size() );
+	Result.bOK = CVTFFile::Convert( File.GetData( 0, 0, 0, 0 ), Expected.data(), uiSize, uiVerifyHeight, Format, IMAGE_FORMAT_BGRA8888, 0 );
+	for ( CThreadPool *pPool : Pools )
+	{
+		for ( CVTFFile *pFile : { &File, &AuxFile } )
+		{
+			if ( !Result.bOK )
+				break;
+
+			std::fill( Decoded.begin(), Decoded.end(), 0 );
+			if ( !CVTFFile::Convert( pFile->GetData( 0, 0, 0, 0 ), Decoded.data(), uiSize, uiVerifyHeight, Format, IMAGE_FORMAT_BGRA8888, pFile->GetCompressedSize( 0, 0, 0 ), pPool ) || Decoded != Expected )
+			{
+				fprintf( stderr, "vtfbench: %s %ux%u %s on %u threads does not match the serial conversion\n", sCase.c_str(), uiSize, uiVerifyHeight, pFile == &AuxFile ? "AXC" : "plain", pPool ? pPool->GetThreadCount() : 1 );
+				Result.bOK = vlFalse;
+			}
+		}
+	}
+	WriteResult( hFile, sCase, sFormat, uiSize, BENCH_VARIANT_PLAIN, Data.size(), "verify", Result, 0, 0 );
+	uiFailedStages += !Result.bOK;
+	if ( !Result.bOK )
+		return vlFalse;
+
+	// Convert: the square image at each thread count, convert_<n> and convert_axc_<n>.
+	if ( !BuildThreadsSource( Format, uiSize, uiSize, vlFalse, Data, File ) || !BuildThreadsSource( Format, uiSize, uiSize, vlTrue, AuxData, AuxFile ) )
+	{
+		fprintf( stderr, "vtfbench: cannot build %s\n", sCase.c_str() );
+		uiFailedStages++;
+		return vlTrue;
+	}
+
+	const std::uint64_t uiPixels = ( std::uint64_t )uiSize * uiSize;
+	Decoded.resize( ( size_t )uiPixels * 4 );
+	for ( CThreadPool *pPool : Pools )
+	{
+		const vlUInt uiThreads = pPool ? pPool->GetThreadCount() : 1;
+		for ( CVTFFile *pFile : { &File, &AuxFile } )
+		{
+			Result = RunStage( [&]()
+			{
+				return CVTFFile::Convert( pFile->GetData( 0, 0, 0, 0 ), Decoded.data(), uiSize, uiSize, Format, IMAGE_FORMAT_BGRA8888, pFile->GetCompressedSize( 0, 0, 0 ), pPool );
+			}, Options.uiMinTimeMs );
+			const std::string sStage = ( pFile == &AuxFile ? "convert_axc_" : "convert_" ) + std::to_string( uiThreads );
+			WriteResult( hFile, sCase, sFormat, uiSize, pFile == &AuxFile ? BENCH_VARIANT_AXC : BENCH_VARIANT_PLAIN, pFile == &AuxFile ? AuxData.size() : Data.size(), sStage.c_str(), Result, Decoded.size(), uiPixels );
+			uiFailedStages += !Result.bOK;
+		}
+	}
+
+	return vlTrue;
+}
+
+//
+// Streamed AXC conversion. With the zlib backend Convert and ConvertBands inflate a chunk of block rows at a
+// time into a two chunk ring while converting the one before, on every thread count up to VERIFY_THREADS and
+// at heights that leave the last chunk short. Both must give the conversion of the same uncompressed file and
+// reject streams cut short.
+//
+
+//! Rows of one streamed band, the chunks hold one band per thread.
+#define STREAMED_BAND_HEIGHT 32
+
+static const VTFImageFormat StreamedFormats[] =
+{
+	IMAGE_FORMAT_DXT1,
+	IMAGE_FORMAT_DXT5,
+	IMAGE_FORMAT_BC7,
+	IMAGE_FORMAT_ATI2N,
+	IMAGE_FORMAT_BGRA8888,
+	IMAGE_FORMAT_RGB888
+};
+
+struct SStreamedBands
+{
+	std::vector<vlByte> *pDest;
+	vlUInt uiRowSize;
+	vlUInt uiNextRow;		//!< Bands must arrive top to bottom without gaps.
+};
+
+static vlBool CopyStreamedBand( const vlByte *lpRows, vlUInt uiY, vlUInt uiRows, vlVoid *lpContext )
+{
+	SStreamedBands &Bands = *static_cast<SStreamedBands *>( lpContext );
+	if ( uiY != Bands.uiNextRow || ( size_t )( uiY + uiRows ) * Bands.uiRowSize > Bands.pDest->size() )
+		return vlFalse;
+
+	memcpy( Bands.pDest->data() + ( size_t )uiY * Bands.uiRowSize, lpRows, ( size_t )uiRows * Bands.uiRowSize );
+	Bands.uiNextRow = uiY + uiRows;
+	return vlTrue;
+}
+
+//! Returns false if a streamed conversion differs from the uncompressed one or accepts a truncated stream.
+static vlBool RunStreamed( FILE *hFile, VTFImageFormat Format, vlUInt uiSize, const SOptions &Options, vlUInt &uiFailedStages )
+{
+	const std::string sFormat = GetFormatName( Format );
+	const std::string sCase = "Streamed/" + std::to_string( uiSize ) + "/" + sFormat;
+	if ( Options.cMatch != 0 && sCase.find( Options.cMatch ) == std::string::npos )
+		return vlTrue;
+
+	std::vector<CThreadPool *> Pools( 1, ( CThreadPool * )0 );
+	std::vector<std::unique_ptr<CThreadPool>> OwnedPools;
+	for ( vlUInt uiThreads = 2; uiThreads <= VERIFY_THREADS; uiThreads++ )
+	{
+		OwnedPools.emplace_back( new CThreadPool( uiThreads ) );
+		Pools.push_back( OwnedPools.back().get() );
+	}
+
+	SetInflateBackend( VTF_INFLATE_ZLIB );
+
+	SStageResult Result = {};
+	Result.bOK = vlTrue;
+	vlBool bMatch = vlTrue;
+	std::vector<vlByte> PlainData, Data, Expected, Decoded;
+
+	// One row, less than a band, the size itself and a few rows past two full chunks of the largest pool.
+	for ( vlUInt uiHeight : { 1u, STREAMED_BAND_HEIGHT - 3u, uiSize, STREAMED_BAND_HEIGHT * VERIFY_THREADS * 2 + 5u } )
+	{
+		CVTFFile PlainFile, File;
+		const vlBool bPlainBuilt = BuildThreadsSource( Format, uiSize, uiHeight, vlFalse, PlainData, PlainFile );
+		if ( !bPlainBuilt || !BuildThreadsSource( Format, uiSize, uiHeight, vlTrue, Data, File ) )
+		{
+			fprintf( stderr, "vtfbench: cannot build %s %ux%u\n", sCase.c_str(), uiSize, uiHeight );
+			Result.bOK = vlFalse;
+			break;
+		}
+
+		vlByte *lpSource = File.GetData( 0, 0, 0, 0 );
+		const vlUInt uiCompressedSize = File.GetCompressedSize( 0, 0, 0 );
+		Expected.assign( ( size_t )CVTFFile::ComputeImageSize( uiSize, uiHeight, 1, IMAGE_FORMAT_BGRA8888 ), 0 );
+		if ( !CVTFFile::Convert( PlainFile.GetData( 0, 0, 0, 0 ), Expected.data(), uiSize, uiHeight, Format, IMAGE_FORMAT_BGRA8888, 0 ) )
+		{
+			Result.bOK = vlFalse;
+			break;
+		}
+
+		for ( CThreadPool *pPool : Pools )
+		{
+			const vlUInt uiThreads = pPool ? pPool->GetThreadCount() : 1;
+			Decoded.assign( Expected.size(), 0 );
+			if ( !CVTFFile::Convert( lpSource, Decoded.data(), uiSize, uiHeight, Format, IMAGE_FORMAT_BGRA8888, uiCompressedSize, pPool ) || Decoded != Expected )
+			{
+				fprintf( stderr, "vtfbench: %s %ux%u Convert on %u threads does not match the uncompressed file\n", sCase.c_str(), uiSize, uiHeight, uiThreads );
+				bMatch = vlFalse;
+			}
+
+			Decoded.assign( Expected.size(), 0 );
+			SStreamedBands Bands = { &Decoded, uiSize * 4, 0 };
+			if ( !CVTFFile::ConvertBands( lpSource, uiSize, uiHeight, Format, IMAGE_FORMAT_BGRA8888, uiCompressedSize, CopyStreamedBand, &Bands, pPool ) ||
+				Bands.uiNextRow != uiHeight || Decoded != Expected )
+			{
+				fprintf( stderr, "vtfbench: %s %ux%u ConvertBands on %u threads does not match the uncompressed file\n", sCase.c_str(), uiSize, uiHeight, uiThreads );
+				bMatch = vlFalse;
+			}
+
+			// The trailer cut short and half the stream.
+			for ( vlUInt uiTruncatedSize : { uiCompressedSize - 1, uiCompressedSize / 2 } )
+			{
+				Bands.uiNextRow = 0;
+				if ( CVTFFile::Convert( lpSource, Decoded.data(), uiSize, uiHeight, Format, IMAGE_FORMAT_BGRA8888, uiTruncatedSize, pPool ) ||
+					CVTFFile::ConvertBands( lpSource, uiSize, uiHeight, Format, IMAGE_FORMAT_BGRA8888, uiTruncatedSize, CopyStreamedBand, &Bands, pPool ) )
+				{
+					fprintf( stderr, "vtfbench: %s %ux%u on %u threads accepts a stream cut to %u of %u bytes\n", sCase.c_str(), uiSize, uiHeight, uiThreads, uiTruncatedSize, uiCompressedSize );
+					bMatch = vlFalse;
+				}
+			}
+		}
+	}
+
+	SetInflateBackend( Options.InflateBackend );
+
+	Result.bOK = Result.bOK && bMatch;
+	WriteResult( hFile, sCase, sFormat, uiSize, BENCH_VARIANT_AXC, Data.size(), "verify", Result, 0, 0 );
+	uiFailedStages += !Result.bOK;
+	return bMatch;
+}
+
+//
+// Subresource lookups. Many-frame animated cubemaps have the most subresources per file; every frame,
+// face and mip is looked up through the table Load builds and through the walk over the smaller mips
+// the table replaced, after checking both give the same offsets.
+//
+
+static vlBool RunSubresources( FILE *hFile, vlUInt uiSize, const SOptions &Options, vlUInt &uiFailedStages )
+{
+	const std::string sCase = "Subresource/" + std::to_string( uiSize ) + "/animated_cubemap";
+	if ( Options.cMatch != 0 && sCase.find( Options.cMatch ) == std::string::npos )
+		return vlTrue;
+
+	SSyntheticVTF Desc;
+	Desc.Format = IMAGE_FORMAT_DXT1;
+	Desc.uiWidth = uiSize;
+	Desc.uiHeight = uiSize;
+	Desc.uiFrames = SUBRESOURCE_FRAMES;
+	Desc.bCubemap = vlTrue;
+
+	std::vector<vlByte> Data;
+	if ( !BuildSyntheticVTF( Desc, Data ) )
+	{
+		fprintf( stderr, "vtfbench: cannot build %s\n", sCase.c_str() );
+		return vlFalse;
+	}
+
+	IO::Readers::CMemoryReader Reader( Data.data(), Data.size() );
+	CVTFFile File;
+	if ( !File.Load( &Reader, VTF_LOAD_BORROW_DATA ) )
+	{
+		fprintf( stderr, "vtfbench: cannot load %s\n", sCase.c_str() );
+		return vlFalse;
+	}
+
+	const vlUInt uiFrames = File.GetFrameCount();
+	const vlUInt uiFaces = File.GetFaceCount();
+	const vlUInt uiMips = File.GetMipmapCount();
+	const std::uint64_t uiLookups = ( std::uint64_t )uiFrames * uiFaces * uiMips;
+
+	// Smallest mip first, so the last mip of the first face is where the image data starts.
+	const vlByte *lpBase = File.GetData( 0, 0, 0, uiMips - 1 );
+	SStageResult Result = {};
+	Result.bOK = lpBase != 0;
+	for ( vlUInt uiMip = 0; uiMip < uiMips && Result.bOK; uiMip++ )
+	{
+		for ( vlUInt uiFrame = 0; uiFrame < uiFrames; uiFrame++ )
+		{
+			for ( vlUInt uiFace = 0; uiFace < uiFaces; uiFace++ )
+			{
+				if ( ( std::uint64_t )( File.GetData( uiFrame, uiFace, 0, uiMip ) - lpBase ) != File.GetUncompressedDataOffset( uiFrame, uiFace, uiMip ) )
+					Result.bOK = vlFalse;
+			}
+		}
+	}
+	WriteResult( hFile, sCase, "DXT1", uiSize, BENCH_VARIANT_ANIMATED, Data.size(), "verify", Result, 0, 0 );
+	uiFailedStages += !Result.bOK;
+	if ( !Result.bOK )
+	{
+		fprintf( stderr, "vtfbench: %s table offsets do not match the walk\n", sCase.c_str() );
+		return vlFalse;
+	}
+
+	// The sums keep the lookups from being optimized away.
+	std::uint64_t uiSum = 0;
+	Result = RunStage( [&]()
+	{
+		for ( vlUInt uiMip = 0; uiMip < uiMips; uiMip++ )
+		{
+			for ( vlUInt uiFrame = 0; uiFrame < uiFrames; uiFrame++ )
+			{
+				for ( vlUInt uiFace = 0; uiFace < uiFaces; uiFace++ )
+					uiSum += ( std::uint64_t )( File.GetData( uiFrame, uiFace, 0, uiMip ) - lpBase );
+			}
+		}
+		return vlTrue;
+	}, Options.uiMinTimeMs );
+	WriteResult( hFile, sCase, "DXT1", uiSize, BENCH_VARIANT_ANIMATED, Data.size(), "lookup_table", Result, 0, uiLookups );
+
+	Result = RunStage( [&]()
+	{
+		for ( vlUInt uiMip = 0; uiMip < uiMips; uiMip++ )
+		{
+			for ( vlUInt uiFrame = 0; uiFrame < uiFrames; uiFrame++ )
+			{
+				for ( vlUInt uiFace = 0; uiFace < uiFaces; uiFace++ )
+					uiSum += File.GetUncompressedDataOffset( uiFrame, uiFace, uiMip );
+			}
+		}
+		return vlTrue;
+	}, Options.uiMinTimeMs );
+	WriteResult( hFile, sCase, "DXT1", uiSize, BENCH_VARIANT_ANIMATED, Data.size(), "lookup_walk", Result, 0, uiLookups );
+
+	return uiSum != 0;
+}
+
+//
+// BC7 modes. Real files mix modes, so the decode stage above cannot tell a slow mode from a rare one. Each
+// case here is random blocks of a single mode, checked bit-exact against bcdec_bc7 at every decode level
+// before being timed against it.
+//
+
+typedef vlVoid ( *BC7DecodeRowFunc )( const vlByte *lpSource, vlByte *lpDest, vlUInt uiBlocks, vlUInt uiPitch );
+
+static vlVoid DecodeBC7RowReference( const vlByte *lpSource, vlByte *lpDest, vlUInt uiBlocks, vlUInt uiPitch )
+{
+	for ( vlUInt i = 0; i < uiBlocks; i++, lpSource += 16, lpDest += 16 )
+		bcdec_bc7( lpSource, lpDest, ( int )uiPitch );
+}
+
+static vlVoid DecodeBC7Image( BC7DecodeRowFunc Decode, const vlByte *lpSource, vlByte *lpDest, vlUInt uiBlocks )
+{
+	const vlUInt uiPitch = uiBlocks * 16;
+	for ( vlUInt y = 0; y < uiBlocks; y++ )
+		Decode( lpSource + ( size_t )y * uiBlocks * 16, lpDest + ( size_t )y * uiPitch * 4, uiBlocks, uiPitch );
+}
+
+//! Returns false if any level does not match bcdec.
+static vlBool RunBC7Mode( FILE *hFile, vlUInt uiMode, vlUInt uiSize, const SOptions &Options, vlUInt &uiFailedStages )
+{
+	const std::string sCase = "BC7/" + std::to_string( uiSize ) + "/mode" + std::to_string( uiMode );
+	if ( Options.cMatch != 0 && sCase.find( Options.cMatch ) == std::string::npos )
+		return vlTrue;
+
+	// Random payload, the mode is the number of zero bits before the first set one.
+	const vlUInt uiBlocks = ( uiSize + 3 ) / 4;
+	std::vector<vlByte> Source( ( size_t )uiBlocks * uiBlocks * 16 );
+	std::mt19937 Random( uiMode * 65536 + uiSize );
+	for ( size_t i = 0; i < Source.size(); i++ )
+		Source[i] = ( vlByte )Random();
+	for ( size_t i = 0; i < Source.size(); i += 16 )
+		Source[i] = ( vlByte )( ( Source[i] & ~( ( 2u << uiMode ) - 1 ) ) | ( 1u << uiMode ) );
+
+	const size_t uiDecodedSize = ( size_t )uiBlocks * uiBlocks * 64;
+	const std::uint64_t uiPixels = ( std::uint64_t )uiBlocks * uiBlocks * 16;
+	std::vector<vlByte> Reference( uiDecodedSize );
+	std::vector<vlByte> Decoded( uiDecodedSize );
+	DecodeBC7Image( DecodeBC7RowReference, Source.data(), Reference.data(), uiBlocks );
+
+	std::vector<vlByte> ReferenceBGRA( Reference );
+	for ( size_t i = 0; i < ReferenceBGRA.size(); i += 4 )
+		std::swap( ReferenceBGRA[i], ReferenceBGRA[i + 2] );
+
+	SStageResult Result = {};
+	Result.bOK = vlTrue;
+	for ( vlUInt uiLevel = 0; uiLevel <= ( vlUInt )GetBCDecodeLevel(); uiLevel++ )
+	{
+		const SBCDecodeFunctions &Functions = GetBCDecodeFunctions( ( BCDecodeLevel )uiLevel );
+		for ( vlUInt uiOrder = 0; uiOrder < BCDECODE_ORDER_COUNT; uiOrder++ )
+		{
+			DecodeBC7Image( Functions.BC7[uiOrder], Source.data(), Decoded.data(), uiBlocks );
+			if ( Decoded != ( uiOrder == BCDECODE_BGRA ? ReferenceBGRA : Reference ) )
+			{
+				fprintf( stderr, "vtfbench: %s %s %s does not match bcdec\n", sCase.c_str(), GetDecodeLevelName( uiLevel ), uiOrder == BCDECODE_BGRA ? "BGRA" : "RGBA" );
+				Result.bOK = vlFalse;
+			}
+		}
+	}
+	WriteResult( hFile, sCase, "BC7", uiSize, BENCH_VARIANT_PLAIN, Source.size(), "verify", Result, 0, 0 );
+	uiFailedStages += !Result.bOK;
+	if ( !Result.bOK )
+		return vlFalse;
+
+	Result = RunStage( [&]()
+	{
+		DecodeBC7Image( DecodeBC7RowReference, Source.data(), Decoded.data(), uiBlocks );
+		return vlTrue;
+	}, Options.uiMinTimeMs );
+	WriteResult( hFile, sCase, "BC7", uiSize, BENCH_VARIANT_PLAIN, Source.size(), "decode_bcdec", Result, uiDecodedSize, uiPixels );
+
+	for ( vlUInt uiLevel = 0; uiLevel <= ( vlUInt )GetBCDecodeLevel(); uiLevel++ )
+	{
+		const BC7DecodeRowFunc Decode = GetBCDecodeFunctions( ( BCDecodeLevel )uiLevel ).BC7[BCDECODE_BGRA];
+		Result = RunStage( [&]()
+		{
+			DecodeBC7Image( Decode, Source.data(), Decoded.data(), uiBlocks );
+			return vlTrue;
+		}, Options.uiMinTimeMs );
+		WriteResult( hFile, sCase, "BC7", uiSize, BENCH_VARIANT_PLAIN, Source.size(), ( std::string( "decode_" ) + GetDecodeLevelName( uiLevel ) ).c_str(), Result, uiDecodedSize, uiPixels );
+	}
+
+	return vlTrue;
+}
+
+//
+// BC1, BC2 and BC3. Random blocks through each level's row kernel against bcdec, then through
+// CVTFFile::Convert at a size that is not a multiple of 4 so the edge blocks take the scratch path.
+//
+
+typedef enum tagBenchBC13Kind
+{
+	BENCH_BC1 = 0,
+	BENCH_BC2,
+	BENCH_BC3,
+	BENCH_BC13_COUNT
+} BenchBC13Kind;
+
+static const vlChar *const lpBC13Cases[BENCH_BC13_COUNT] = { "BC1/%u/random", "BC2/%u/random", "BC3/%u/random" };
+static const vlChar *const lpBC13Formats[BENCH_BC13_COUNT] = { "DXT1", "DXT3", "DXT5" };
+static const VTFImageFormat BC13Formats[BENCH_BC13_COUNT] = { IMAGE_FORMAT_DXT1, IMAGE_FORMAT_DXT3, IMAGE_FORMAT_DXT5 };
+
+template<BenchBC13Kind Kind>
+static vlVoid DecodeBC13RowReference( const vlByte *lpSource, vlByte *lpDest, vlUInt uiBlocks, vlUInt uiPitch )
+{
+	for ( vlUInt i = 0; i < uiBlocks; i++, lpSource += Kind == BENCH_BC1 ? 8 : 16, lpDest += 16 )
+	{
+		if ( Kind == BENCH_BC1 )
+			bcdec_bc1( lpSource, lpDest, ( int )uiPitch );
+		else if ( Kind == BENCH_BC2 )
+			bcdec_bc2( lpSource, lpDest, ( int )uiPitch );
+		else
+			bcdec_bc3( lpSource, lpDest, ( int )uiPitch );
+	}
+}
+
+static const BCDecodeRowFunc BC13References[BENCH_BC13_COUNT] = { DecodeBC13RowReference<BENCH_BC1>, DecodeBC13RowReference<BENCH_BC2>, DecodeBC13RowReference<BENCH_BC3> };
+
+static BCDecodeRowFunc GetBC13Function( const SBCDecodeFunctions &Functions, BenchBC13Kind Kind, vlUInt uiOrder )
+{
+	return Kind == BENCH_BC1 ? Functions.BC1[uiOrder] : Kind == BENCH_BC2 ? Functions.BC2[uiOrder] : Functions.BC3[uiOrder];
+}
+
+//! Returns false if any level or the edge blocks do not match bcdec.
+static vlBool RunBC13( FILE *hFile, BenchBC13Kind Kind, vlUInt uiSize, const SOptions &Options, vlUInt &uiFailedStages )
+{
+	vlChar cCase[64];
+	snprintf( cCase, sizeof( cCase ), lpBC13Cases[Kind], uiSize );
+	const std::string sCase = cCase;
+	const vlChar *cFormat = lpBC13Formats[Kind];
+	if ( Options.cMatch != 0 && sCase.find( Options.cMatch ) == std::string::npos )
+		return vlTrue;
+
+	// Random blocks hit both BC1 color modes and every index.
+	const vlUInt uiBlocks = ( uiSize + 3 ) / 4;
+	const vlUInt uiBlockSize = Kind == BENCH_BC1 ? 8 : 16;
+	std::vector<vlByte> Source( ( size_t )uiBlocks * uiBlocks * uiBlockSize );
+	std::mt19937 Random( ( Kind + 8 ) * 65536 + uiSize );
+	for ( size_t i = 0; i < Source.size(); i++ )
+		Source[i] = ( vlByte )Random();
+
+	const vlUInt uiPitch = uiBlocks * 16;
+	const size_t uiDecodedSize = ( size_t )uiBlocks * uiBlocks * 64;
+	const std::uint64_t uiPixels = ( std::uint64_t )uiBlocks * uiBlocks * 16;
+	std::vector<vlByte> Reference( uiDecodedSize );
+	std::vector<vlByte> Decoded( uiDecodedSize );
+	auto DecodeImage = [&]( BCDecodeRowFunc Decode, vlByte *lpDest )
+	{
+		for ( vlUInt y = 0; y < uiBlocks; y++ )
+			Decode( Source.data() + ( size_t )y * uiBlocks * uiBlockSize, lpDest + ( size_t )y * uiPitch * 4, uiBlocks, uiPitch );
+	};
+	DecodeImage( BC13References[Kind], Reference.data() );
+
+	std::vector<vlByte> ReferenceBGRA( Reference );
+	for ( size_t i = 0; i < ReferenceBGRA.size(); i += 4 )
+		std::swap( ReferenceBGRA[i], ReferenceBGRA[i + 2] );
+
+	SStageResult Result = {};
+	Result.bOK = vlTrue;
+	for ( vlUInt uiLevel = 0; uiLevel <= ( vlUInt )GetBCDecodeLevel(); uiLevel++ )
+	{
+		const SBCDecodeFunctions &Functions = GetBCDecodeFunctions( ( BCDecodeLevel )uiLevel );
+		for ( vlUInt uiOrder = 0; uiOrder < BCDECODE_ORDER_COUNT; uiOrder++ )
+		{
+			DecodeImage( GetBC13Function( Functions, Kind, uiOrder ), Decoded.data() );
+			if ( Decoded != ( uiOrder == BCDECODE_BGRA ? ReferenceBGRA : Reference ) )
+			{
+				fprintf( stderr, "vtfbench: %s %s %s does not match bcdec\n", sCase.c_str(), GetDecodeLevelName( uiLevel ), uiOrder == BCDECODE_BGRA ? "BGRA" : "RGBA" );
+				Result.bOK = vlFalse;
+			}
+		}
+	}
+
+	// The same blocks cropped: every block of the last column and row is decoded through the scratch block.
+	const vlUInt uiEdgeWidth = uiBlocks * 4 - 1;
+	const vlUInt uiEdgeHeight = uiBlocks * 4 - 3;
+	std::vector<vlByte> Edge( ( size_t )uiEdgeWidth * uiEdgeHeight * 4 );
+	for ( vlUInt uiOrder = 0; uiOrder < BCDECODE_ORDER_COUNT; uiOrder++ )
+	{
+		const std::vector<vlByte> &Expected = uiOrder == BCDECODE_BGRA ? ReferenceBGRA : Reference;
+		vlBool bMatch = CVTFFile::Convert( Source.data(), Edge.data(), uiEdgeWidth, uiEdgeHeight, BC13Formats[Kind], uiOrder == BCDECODE_BGRA ? IMAGE_FORMAT_BGRA8888 : IMAGE_FORMAT_RGBA8888, 0 );
+		for ( vlUInt y = 0; y < uiEdgeHeight && bMatch; y++ )
+			bMatch = memcmp( Edge.data() + ( size_t )y * uiEdgeWidth * 4, Expected.data() + ( size_t )y * uiPitch, ( size_t )uiEdgeWidth * 4 ) == 0;
+
+		if ( !bMatch )
+		{
+			fprintf( stderr, "vtfbench: %s %ux%u %s does not match bcdec\n", sCase.c_str(), uiEdgeWidth, uiEdgeHeight, uiOrder == BCDECODE_BGRA ? "BGRA" : "RGBA" );
+			Result.bOK = vlFalse;
+		}
+	}
+	WriteResult( hFile, sCase, cFormat, uiSize, BENCH_VARIANT_PLAIN, Source.size(), "verify", Result, 0, 0 );
+	uiFailedStages += !Result.bOK;
+	if ( !Result.bOK )
+		return vlFalse;
+
+	Result = RunStage( [&]()
+	{
+		DecodeImage( BC13References[Kind], Decoded.data() );
+		return vlTrue;
+	}, Options.uiMinTimeMs );
+	WriteResult( hFile, sCase, cFormat, uiSize, BENCH_VARIANT_PLAIN, Source.size(), "decode_bcdec", Result, uiDecodedSize, uiPixels );
+
+	for ( vlUInt uiLevel = 0; uiLevel <= ( vlUInt )GetBCDecodeLevel(); uiLevel++ )
+	{
+		const BCDecodeRowFunc Decode = GetBC13Function( GetBCDecodeFunctions( ( BCDecodeLevel )uiLevel ), Kind, BCDECODE_BGRA );
+		Result = RunStage( [&]()
+		{
+			DecodeImage( Decode, Decoded.data() );
+			return vlTrue;
+		}, Options.uiMinTimeMs );
+		WriteResult( hFile, sCase, cFormat, uiSize, BENCH_VARIANT_PLAIN, Source.size(), ( std::string( "decode_" ) + GetDecodeLevelName( uiLevel ) ).c_str(), Result, uiDecodedSize, uiPixels );
+	}
+
+	return vlTrue;
+}
+
+//
+// BC4 and BC5. The kernels against bcdec_bc4 and bcdec_bc5 scattered into pixels the way DecompressATI1N
+// and DecompressATI2N used to, with Z reconstructed per pixel afterwards for the normal map variant.
+//
+
+typedef enum tagBenchBC45Kind
+{
+	BENCH_BC4 = 0,
+	BENCH_BC5,
+	BENCH_BC5_Z,
+	BENCH_BC45_COUNT
+} BenchBC45Kind;
+
+static const vlChar *const lpBC45Cases[BENCH_BC45_COUNT] = { "BC4/%u/random", "BC5/%u/random", "BC5/%u/reconstruct_z" };
+
+template<BenchBC45Kind Kind>
+static vlVoid DecodeBC45RowReference( const vlByte *lpSource, vlByte *lpDest, vlUInt uiBlocks, vlUInt uiPitch )
+{
+	for ( vlUInt i = 0; i < uiBlocks; i++, lpSource += Kind == BENCH_BC4 ? 8 : 16, lpDest += 16 )
+	{
+		vlByte buf[4 * 4 * 2];
+		if ( Kind == BENCH_BC4 )
+			bcdec_bc4( lpSource, buf, 4 );
+		else
+			bcdec_bc5( lpSource, buf, 4 * 2 );
+
+		for ( vlUInt y1 = 0; y1 < 4; y1++ )
+		{
+			for ( vlUInt x1 = 0; x1 < 4; x1++ )
+			{
+				vlByte *dest = lpDest + y1 * uiPitch + x1 * 4;
+				dest[0] = Kind == BENCH_BC4 ? buf[y1 * 4 + x1] : buf[( y1 * 4 + x1 ) * 2 + 0];
+				dest[1] = Kind == BENCH_BC4 ? 0 : buf[( y1 * 4 + x1 ) * 2 + 1];
+				dest[2] = 0;
+				dest[3] = 255;
+				if ( Kind == BENCH_BC5_Z )
+				{
+					const vlSingle fX = dest[0] * ( 2.0f / 255.0f ) - 1.0f;
+					const vlSingle fY = dest[1] * ( 2.0f / 255.0f ) - 1.0f;
+					dest[2] = ( vlByte )( std::sqrt( std::max( 1.0f - fX * fX - fY * fY, 0.0f ) ) * 127.5f + 128.0f );
+				}
+			}
+		}
+	}
+}
+
+static const BCDecodeRowFunc BC45References[BENCH_BC45_COUNT] = { DecodeBC45RowReference<BENCH_BC4>, DecodeBC45RowReference<BENCH_BC5>, DecodeBC45RowReference<BENCH_BC5_Z> };
+
+static BCDecodeRowFunc GetBC45Function( const SBCDecodeFunctions &Functions, BenchBC45Kind Kind, vlUInt uiOrder )
+{
+	return Kind == BENCH_BC4 ? Functions.BC4[uiOrder] : Kind == BENCH_BC5 ? Functions.BC5[uiOrder] : Functions.BC5Z[uiOrder];
+}
+
+//! Returns false if any level does not match bcdec.
+static vlBool RunBC45( FILE *hFile, BenchBC45Kind Kind, vlUInt uiSize, const SOptions &Options, vlUInt &uiFailedStages )
+{
+	vlChar cCase[64];
+	snprintf( cCase, sizeof( cCase ), lpBC45Cases[Kind], uiSize );
+	const std::string sCase = cCase;
+	const vlChar *cFormat = Kind == BENCH_BC4 ? "ATI1N" : "ATI2N";
+	if ( Options.cMatch != 0 && sCase.find( Options.cMatch ) == std::string::npos )
+		return vlTrue;
+
+	// Random blocks hit both palette modes and every index.
+	const vlUInt uiBlocks = ( uiSize + 3 ) / 4;
+	const vlUInt uiBlockSize = Kind == BENCH_BC4 ? 8 : 16;
+	std::vector<vlByte> Source( ( size_t )uiBlocks * uiBlocks * uiBlockSize );
+	std::mt19937 Random( Kind * 65536 + uiSize );
+	for ( size_t i = 0; i < Source.size(); i++ )
+		Source[i] = ( vlByte )Random();
+
+	const size_t uiDecodedSize = ( size_t )uiBlocks * uiBlocks * 64;
+	const std::uint64_t uiPixels = ( std::uint64_t )uiBlocks * uiBlocks * 16;
+	std::vector<vlByte> Reference( uiDecodedSize );
+	std::vector<vlByte> Decoded( uiDecodedSize );
+	auto DecodeImage = [&]( BCDecodeRowFunc Decode, vlByte *lpDest )
+	{
+		const vlUInt uiPitch = uiBlocks * 16;
+		for ( vlUInt y = 0; y < uiBlocks; y++ )
+			Decode( Source.data() + ( size_t )y * uiBlocks * uiBlockSize, lpDest + ( size_t )y * uiPitch * 4, uiBlocks, uiPitch );
+	};
+	DecodeImage( BC45References[Kind], Reference.data() );
+
+	std::vector<vlByte> ReferenceBGRA( Reference );
+	for ( size_t i = 0; i < ReferenceBGRA.size(); i += 4 )
+		std::swap( ReferenceBGRA[i], ReferenceBGRA[i + 2] );
+
+	SStageResult Result = {};
+	Result.bOK = vlTrue;
+	for ( vlUInt uiLevel = 0; uiLevel <= ( vlUInt )GetBCDecodeLevel(); uiLevel++ )
+	{
+		const SBCDecodeFunctions &Functions = GetBCDecodeFunctions( ( BCDecodeLevel )uiLevel );
+		for ( vlUInt uiOrder = 0; uiOrder < BCDECODE_ORDER_COUNT; uiOrder++ )
+		{
+			DecodeImage( GetBC45Function( Functions, Kind, uiOrder ), Decoded.data() );
+			if ( Decoded != ( uiOrder == BCDECODE_BGRA ? ReferenceBGRA : Reference ) )
+			{
+				fprintf( stderr, "vtfbench: %s %s %s does not match bcdec\n", sCase.c_str(), GetDecodeLevelName( uiLevel ), uiOrder == BCDECODE_BGRA ? "BGRA" : "RGBA" );
+				Result.bOK = vlFalse;
+			}
+		}
+	}
+	WriteResult( hFile, sCase, cFormat, uiSize, BENCH_VARIANT_PLAIN, Source.size(), "verify", Result, 0, 0 );
+	uiFailedStages += !Result.bOK;
+	if ( !Result.bOK )
+		return vlFalse;
+
+	Result = RunStage( [&]()
+	{
+		DecodeImage( BC45References[Kind], Decoded.data() );
+		return vlTrue;
+	}, Options.uiMinTimeMs );
+	WriteResult( hFile, sCase, cFormat, uiSize, BENCH_VARIANT_PLAIN, Source.size(), "decode_bcdec", Result, uiDecodedSize, uiPixels );
+
+	for ( vlUInt uiLevel = 0; uiLevel <= ( vlUInt )GetBCDecodeLevel(); uiLevel++ )
+	{
+		const BCDecodeRowFunc Decode = GetBC45Function( GetBCDecodeFunctions( ( BCDecodeLevel )uiLevel ), Kind, BCDECODE_BGRA );
+		Result = RunStage( [&]()
+		{
+			DecodeImage( Decode, Decoded.data() );
+			return vlTrue;
+		}, Options.uiMinTimeMs );
+		WriteResult( hFile, sCase, cFormat, uiSize, BENCH_VARIANT_PLAIN, Source.size(), ( std::string( "decode_" ) + GetDecodeLevelName( uiLevel ) ).c_str(), Result, uiDecodedSize, uiPixels );
+	}
+
+	return vlTrue;
+}
+
+//
+// BC6H. The tiled decoder against the float staging image it replaced, kept here as it was, and the half
+// to float conversion it is built on at every level, checked bit-exact against scalar on every half first.
+//
+
+static vlVoid DecompressBC6HStaged( const vlByte *lpSource, vlByte *lpDest, vlUInt uiWidth, vlUInt uiHeight )
+{
+	const vlUInt uiBlockWidth = ( uiWidth + 3 ) & ~3u;
+	const vlUInt uiBlockHeight = ( uiHeight + 3 ) & ~3u;
+
+	vlSingle *lpBlock = new vlSingle[( size_t )uiBlockWidth * uiBlockHeight * 3];
+	for ( vlUInt y = 0; y < uiHeight; y += 4 )
+	{
+		for ( vlUInt x = 0; x < uiWidth; x += 4, lpSource += 16 )
+			bcdec_bc6h_float( lpSource, lpBlock + ( ( size_t )y * uiBlockWidth + x ) * 3, uiBlockWidth * 3, true );
+	}
+
+	vlSingle fLargest = -1e30f;
+	for ( vlUInt y = 0; y < uiHeight; y++ )
+	{
+		for ( vlUInt x = 0; x < uiWidth; x += 4 )
+		{
+			vlSingle *lpTexel = lpBlock + ( ( size_t )y * uiBlockWidth + x ) * 3;
+			const vlSingle fMax = std::max( { lpTexel[0], lpTexel[1], lpTexel[2] } );
+			fLargest = std::max( fLargest, static_cast<int>( std::min( 255.0f, std::ceil( fMax * ( 1.0f / 8.0f ) * 255.0f ) ) ) * ( 8.0f / 255.0f ) );
+			lpTexel[0] = std::min( lpTexel[0], 8.0f );
+			lpTexel[1] = std::min( lpTexel[1], 8.0f );
+			lpTexel[2] = std::min( lpTexel[2], 8.0f );
+		}
+	}
+	fLargest = std::max( 0.1f, fLargest );
+
+	for ( vlUInt y = 0; y < uiHeight; y++ )
+	{
+		for ( vlUInt x = 0; x < uiWidth; x++ )
+		{
+			const vlSingle *lpTexel = lpBlock + ( ( size_t )y * uiBlockWidth + x ) * 3;
+			vlByte *lpPixel = lpDest + ( ( size_t )y * uiWidth + x ) * 4;
+			lpPixel[2] = static_cast<vlByte>( 255 * ( lpTexel[0] / fLargest ) + 0.5f );
+			lpPixel[1] = static_cast<vlByte>( 255 * ( lpTexel[1] / fLargest ) + 0.5f );
+			lpPixel[0] = static_cast<vlByte>( 255 * ( lpTexel[2] / fLargest ) + 0.5f );
+			lpPixel[3] = 255;
+		}
+	}
+
+	delete[] lpBlock;
+}
+
+//! Returns false if a level converts a half differently from scalar.
+static vlBool RunBC6H( FILE *hFile, vlUInt uiSize, const SOptions &Options, vlUInt &uiFailedStages )
+{
+	const std::string sCase = "BC6H/" + std::to_string( uiSize ) + "/tonemap";
+	if ( Options.cMatch != 0 && sCase.find( Options.cMatch ) == std::string::npos )
+		return vlTrue;
+
+	// Every half, compared as bits so signed zeros and denormals count. F16C quiets signaling NaNs, which the
+	// tonemap turns into 0 like any other NaN, so NaNs only have to stay NaNs.
+	std::vector<vlUInt16> AllHalves( 65536 );
+	for ( size_t i = 0; i < AllHalves.size(); i++ )
+		AllHalves[i] = ( vlUInt16 )i;
+
+	std::vector<vlSingle> Expected( AllHalves.size() ), Actual( AllHalves.size() );
+	GetHDRFunctions( BCDECODE_SCALAR ).HalfToFloat( AllHalves.data(), Expected.data(), AllHalves.size() );
+
+	SStageResult Result = {};
+	Result.bOK = vlTrue;
+	for ( vlUInt uiLevel = BCDECODE_SCALAR + 1; uiLevel <= ( vlUInt )GetBCDecodeLevel(); uiLevel++ )
+	{
+		GetHDRFunctions( ( BCDecodeLevel )uiLevel ).HalfToFloat( AllHalves.data(), Actual.data(), AllHalves.size() );
+		vlBool bMatch = vlTrue;
+		for ( size_t i = 0; i < Expected.size() && bMatch; i++ )
+			bMatch = memcmp( &Actual[i], &Expected[i], sizeof( vlSingle ) ) == 0 || ( std::isnan( Actual[i] ) && std::isnan( Expected[i] ) );
+
+		if ( !bMatch )
+		{
+			fprintf( stderr, "vtfbench: %s %s half to float does not match scalar\n", sCase.c_str(), GetDecodeLevelName( uiLevel ) );
+			Result.bOK = vlFalse;
+		}
+	}
+	WriteResult( hFile, sCase, "BC6H", uiSize, BENCH_VARIANT_PLAIN, 0, "verify", Result, 0, 0 );
+	uiFailedStages += !Result.bOK;
+	if ( !Result.bOK )
+		return vlFalse;
+
+	// Random blocks cover every mode and a wide range of values.
+	const vlUInt uiBlocks = ( uiSize + 3 ) / 4;
+	std::vector<vlByte> Source( ( size_t )uiBlocks * uiBlocks * 16 );
+	std::mt19937 Random( uiSize );
+	for ( size_t i = 0; i < Source.size(); i++ )
+		Source[i] = ( vlByte )Random();
+
+	const std::uint64_t uiPixels = ( std::uint64_t )uiSize * uiSize;
+	std::vector<vlByte> Decoded( ( size_t )uiPixels * 4 );
+
+	Result = RunStage( [&]()
+	{
+		DecompressBC6HStaged( Source.data(), Decoded.data(), uiSize, uiSize );
+		return vlTrue;
+	}, Options.uiMinTimeMs );
+	WriteResult( hFile, sCase, "BC6H", uiSize, BENCH_VARIANT_PLAIN, Source.size(), "decode_staged", Result, Decoded.size(), uiPixels );
+
+	Result = RunStage( [&]()
+	{
+		return CVTFFile::Convert( Source.data(), Decoded.data(), uiSize, uiSize, IMAGE_FORMAT_BC6H, IMAGE_FORMAT_BGRA8888, 0 );
+	}, Options.uiMinTimeMs );
+	WriteResult( hFile, sCase, "BC6H", uiSize, BENCH_VARIANT_PLAIN, Source.size(), "decode_tiled", Result, Decoded.size(), uiPixels );
+	uiFailedStages += !Result.bOK;
+
+	std::vector<vlUInt16> Halves( ( size_t )uiBlocks * uiBlocks * 16 * 3 );
+	for ( size_t i = 0; i < Source.size() / 16; i++ )
+		bcdec_bc6h_half( Source.data() + i * 16, Halves.data() + i * 16 * 3, 4 * 3, true );
+
+	std::vector<vlSingle> Floats( Halves.size() );
+	for ( vlUInt uiLevel = 0; uiLevel <= ( vlUInt )GetBCDecodeLevel(); uiLevel++ )
+	{
+		const HalfToFloatFunc pfnHalfToFloat = GetHDRFunctions( ( BCDecodeLevel )uiLevel ).HalfToFloat;
+		Result = RunStage( [&]()
+		{
+			pfnHalfToFloat( Halves.data(), Floats.data(), Halves.size() );
+			return vlTrue;
+		}, Options.uiMinTimeMs );
+		WriteResult( hFile, sCase, "BC6H", uiSize, BENCH_VARIANT_PLAIN, Source.size(), ( std::string( "half_to_float_" ) + GetDecodeLevelName( uiLevel ) ).c_str(), Result, Halves.size() * sizeof( vlUInt16 ), 0 );
+	}
+
+	return vlTrue;
+}
+
+//
+// Float tonemapping. Every level's row tonemap against the scalar one for 1, 3 and 4 channels on values that
+// include NaNs, infinities, negatives and denormals, then whole images through Convert against a reference
+// tonemap written out here, and the row tonemap timed at each level.
+//
+
+//! Side of the Convert check image, small enough that the exposure samples every pixel.
+#define TONEMAP_VERIFY_SIZE 64
+
+static const VTFImageFormat TonemapFormats[] =
+{
+	IMAGE_FORMAT_R32F,
+	IMAGE_FORMAT_RGB323232F,
+	IMAGE_FORMAT_RGBA32323232F,
+	IMAGE_FORMAT_RGBA16161616F
+};
+
+static vlUInt GetTonemapChannels( VTFImageFormat Format )
+{
+	return Format == IMAGE_FORMAT_R32F ? 1 : Format == IMAGE_FORMAT_RGB323232F ? 3 : 4;
+}
+
+//! Half to double the long way, for finite halves.
+static double HalfToDouble( vlUInt16 uiHalf )
+{
+	const vlInt iExponent = ( uiHalf >> 10 ) & 0x1f;
+	const vlInt iMantissa = uiHalf & 0x3ff;
+	const double dValue = iExponent == 0 ? std::ldexp( ( double )iMantissa, -24 ) : std::ldexp( ( double )( iMantissa | 0x400 ), iExponent - 25 );
+	return ( uiHalf & 0x8000 ) != 0 ? -dValue : dValue;
+}
+
+static vlByte TonemapReference( double dValue, double dWhite )
+{
+	return ( vlByte )std::min( 255.0, std::max( 0.0, std::floor( dValue / dWhite * 255.0 + 0.5 ) ) );
+}
+
+//! Returns false if a level differs from scalar or Convert strays more than a step from the reference.
+static vlBool RunTonemap( FILE *hFile, VTFImageFormat Format, vlUInt uiSize, const SOptions &Options, vlUInt &uiFailedStages )
+{
+	const std::string sFormat = GetFormatName( Format );
+	const std::string sCase = "Tonemap/" + std::to_string( uiSize ) + "/" + sFormat;
+	if ( Options.cMatch != 0 && sCase.find( Options.cMatch ) == std::string::npos )
+		return vlTrue;
+
+	const vlUInt uiChannels = GetTonemapChannels( Format );
+	const vlUInt uiPixels = uiSize * uiSize;
+	const vlSingle fSpecials[] = { std::numeric_limits<vlSingle>::quiet_NaN(), std::numeric_limits<vlSingle>::infinity(), -std::numeric_limits<vlSingle>::infinity(),
+		0.0f, -0.0f, 1e-40f, 1e30f, -1e30f, HDR_MAX_WHITE, 1.0f };
+	std::vector<vlSingle> Values( ( size_t )uiPixels * uiChannels );
+	std::mt19937 Random( Format * 65536 + uiSize );
+	std::uniform_real_distribution<vlSingle> Distribution( -1.0f, 12.0f );
+	for ( size_t i = 0; i < Values.size(); i++ )
+		Values[i] = Random() % 16 == 0 ? fSpecials[Random() % std::size( fSpecials )] : Distribution( Random );
+
+	// Kernels: bytes identical to scalar, the odd sizes leave a tail for the scalar loop.
+	const vlSingle fWhite = ComputeHDRWhite( 4.0f );
+	std::vector<vlByte> Expected( ( size_t )uiPixels * 4 ), Actual( Expected.size() );
+	SStageResult Result = {};
+	Result.bOK = vlTrue;
+	for ( vlUInt uiOrder = 0; uiOrder < BCDECODE_ORDER_COUNT; uiOrder++ )
+	{
+		GetHDRFunctions( BCDECODE_SCALAR ).Tonemap[uiOrder]( Values.data(), uiChannels, Expected.data(), uiPixels, fWhite );
+		for ( vlUInt uiLevel = BCDECODE_SCALAR + 1; uiLevel <= ( vlUInt )GetBCDecodeLevel(); uiLevel++ )
+		{
+			GetHDRFunctions( ( BCDecodeLevel )uiLevel ).Tonemap[uiOrder]( Values.data(), uiChannels, Actual.data(), uiPixels, fWhite );
+			if ( Actual != Expected )
+			{
+				fprintf( stderr, "vtfbench: %s %s %s tonemap does not match scalar\n", sCase.c_str(), GetDecodeLevelName( uiLevel ), uiOrder == BCDECODE_BGRA ? "BGRA" : "RGBA" );
+				Result.bOK = vlFalse;
+			}
+		}
+	}
+
+	// Convert: finite values, some past HDR_MAX_WHITE, within a step of the reference in both orders.
+	const vlUInt uiVerifyPixels = TONEMAP_VERIFY_SIZE * TONEMAP_VERIFY_SIZE;
+	std::vector<double> Reference( ( size_t )uiVerifyPixels * uiChannels );
+	std::vector<vlByte> Source( ( size_t )CVTFFile::ComputeImageSize( TONEMAP_VERIFY_SIZE, TONEMAP_VERIFY_SIZE, 1, Format ) );
+	for ( size_t i = 0; i < Reference.size(); i++ )
+	{
+		if ( Format == IMAGE_FORMAT_RGBA16161616F )
+		{
+			// Positive and finite, up to 16.
+			const vlUInt16 uiHalf = ( vlUInt16 )( Random() % 0x4c00 );
+			memcpy( Source.data() + i * sizeof( uiHalf ), &uiHalf, sizeof( uiHalf ) );
+			Reference[i] = HalfToDouble( uiHalf );
+		}
+		else
+		{
+			const vlSingle fValue = std::uniform_real_distribution<vlSingle>( 0.0f, 10.0f )( Random );
+			memcpy( Source.data() + i * sizeof( fValue ), &fValue, sizeof( fValue ) );
+			Reference[i] = fValue;
+		}
+	}
+
+	double dLargest = 0.0;
+	for ( size_t i = 0; i < Reference.size(); i++ )
+	{
+		if ( i % uiChannels < 3 )
+			dLargest = std::max( dLargest, Reference[i] );
+	}
+	const double dWhite = ComputeHDRWhite( ( vlSingle )dLargest );
+
+	std::vector<vlByte> Converted( ( size_t )uiVerifyPixels * 4 );
+	for ( VTFImageFormat DestFormat : { IMAGE_FORMAT_RGBA8888, IMAGE_FORMAT_BGRA8888 } )
+	{
+		vlBool bMatch = CVTFFile::Convert( Source.data(), Converted.data(), TONEMAP_VERIFY_SIZE, TONEMAP_VERIFY_SIZE, Format, DestFormat, 0 );
+		for ( vlUInt i = 0; i < uiVerifyPixels && bMatch; i++ )
+		{
+			const double *lpPixel = Reference.data() + ( size_t )i * uiChannels;
+			const vlByte uiExpected[4] =
+			{
+				TonemapReference( lpPixel[0], dWhite ),
+				uiChannels >= 3 ? TonemapReference( lpPixel[1], dWhite ) : ( vlByte )0,
+				uiChannels >= 3 ? TonemapReference( lpPixel[2], dWhite ) : ( vlByte )0,
+				uiChannels == 4 ? TonemapReference( lpPixel[3], 1.0 ) : ( vlByte )255
+			};
+
+			const vlByte *lpConverted = Converted.data() + ( size_t )i * 4;
+			for ( vlUInt uiChannel = 0; uiChannel < 4; uiChannel++ )
+			{
+				const vlUInt uiSource = DestFormat == IMAGE_FORMAT_BGRA8888 && uiChannel != 1 && uiChannel != 3 ? 2 - uiChannel : uiChannel;
+				if ( std::abs( ( vlInt )lpConverted[uiChannel] - ( vlInt )uiExpected[uiSource] ) > 1 )
+					bMatch = vlFalse;
+			}
+		}
+
+		if ( !bMatch )
+		{
+			fprintf( stderr, "vtfbench: %s to %s is more than a step from the reference tonemap\n", sCase.c_str(), GetFormatName( DestFormat ).c_str() );
+			Result.bOK = vlFalse;
+		}
+	}
+	WriteResult( hFile, sCase, sFormat, uiSize, BENCH_VARIANT_PLAIN, Source.size(), "verify", Result, 0, 0 );
+	uiFailedStages += !Result.bOK;
+	if ( !Result.bOK )
+		return vlFalse;
+
+	for ( vlUInt uiLevel = 0; uiLevel <= ( vlUInt )GetBCDecodeLevel(); uiLevel++ )
+	{
+		const TonemapRowFunc pfnTonemap = GetHDRFunctions( ( BCDecodeLevel )uiLevel ).Tonemap[BCDECODE_BGRA];
+		Result = RunStage( [&]()
+		{
+			pfnTonemap( Values.data(), uiChannels, Actual.data(), uiPixels, fWhite );
+			return vlTrue;
+		}, Options.uiMinTimeMs );
+		WriteResult( hFile, sCase, sFormat, uiSize, BENCH_VARIANT_PLAIN, Source.size(), ( std::string( "tonemap_" ) + GetDecodeLevelName( uiLevel ) ).c_str(), Result, Values.size() * sizeof( vlSingle ), uiPixels );
+	}
+
+	return vlTrue;
+}
+
+//
+// Resampling. Random texels with many transparent ones through each filter at every level, shrinking to the
+// thumbnail size and to an odd size and growing, against the scalar output, then timed at the thumbnail size.
+//
+
+static const vlChar *lpResampleFilterNames[RESAMPLE_FILTER_COUNT] =
+{
+	"box",
+	"bilinear",
+	"lanczos3"
+};
+
+//! Returns false if a level does not give the scalar output.
+static vlBool RunResample( FILE *hFile, ResampleFilter Filter, vlUInt uiSize, const SOptions &Options, vlUInt &uiFailedStages )
+{
+	const std::string sCase = "Resample/" + std::to_string( uiSize ) + "/" + lpResampleFilterNames[Filter];
+	if ( Options.cMatch != 0 && sCase.find( Options.cMatch ) == std::string::npos )
+		return vlTrue;
+
+	// Not square, so both passes scale by different factors.
+	const vlUInt uiSourceWidth = uiSize;
+	const vlUInt uiSourceHeight = std::max( uiSize * 3 / 4, 1u );
+	std::vector<vlByte> Source( ( size_t )uiSourceWidth * uiSourceHeight * 4 );
+	std::mt19937 Random( Filter * 65536 + uiSize );
+	for ( size_t i = 0; i < Source.size(); i++ )
+		Source[i] = ( vlByte )Random();
+	for ( size_t i = 3; i < Source.size(); i += 4 )
+		Source[i] = Source[i] < 64 ? 0 : Source[i] > 192 ? 255 : Source[i];
+
+	vlBool bMatch = vlTrue;
+	for ( vlUInt uiDestSize : { Options.uiThumbnailSize, 37u, uiSize + uiSize / 2 + 1 } )
+	{
+		vlUInt uiDestWidth, uiDestHeight;
+		ComputeResampleSize( uiSourceWidth, uiSourceHeight, uiDestSize, uiDestWidth, uiDestHeight );
+
+		std::vector<vlByte> Expected( ( size_t )uiDestWidth * uiDestHeight * 4 );
+		std::vector<vlByte> Actual( Expected.size() );
+		if ( !Resample( Source.data(), uiSourceWidth, uiSourceHeight, Expected.data(), uiDestWidth, uiDestHeight, Filter, BCDECODE_SCALAR ) )
+		{
+			bMatch = vlFalse;
+			break;
+		}
+
+		for ( vlUInt uiLevel = BCDECODE_SCALAR + 1; uiLevel <= ( vlUInt )GetBCDecodeLevel(); uiLevel++ )
+		{
+			if ( !Resample( Source.data(), uiSourceWidth, uiSourceHeight, Actual.data(), uiDestWidth, uiDestHeight, Filter, ( BCDecodeLevel )uiLevel ) || Actual != Expected )
+			{
+				fprintf( stderr, "vtfbench: %s to %ux%u at %s does not match scalar\n", sCase.c_str(), uiDestWidth, uiDestHeight, GetDecodeLevelName( uiLevel ) );
+				bMatch = vlFalse;
+			}
+		}
+	}
+
+	SStageResult Result = {};
+	Result.bOK = bMatch;
+	WriteResult( hFile, sCase, "RGBA8888", uiSize, BENCH_VARIANT_PLAIN, Source.size(), "verify", Result, 0, 0 );
+	uiFailedStages += !Result.bOK;
+	if ( !Result.bOK )
+		return vlFalse;
+
+	vlUInt uiDestWidth, uiDestHeight;
+	ComputeResampleSize( uiSourceWidth, uiSourceHeight, Options.uiThumbnailSize, uiDestWidth, uiDestHeight );
+	std::vector<vlByte> Dest( ( size_t )uiDestWidth * uiDestHeight * 4 );
+	for ( vlUInt uiLevel = 0; uiLevel <= ( vlUInt )GetBCDecodeLevel(); uiLevel++ )
+	{
+		Result = RunStage( [&]()
+		{
+			return Resample( Source.data(), uiSourceWidth, uiSourceHeight, Dest.data(), uiDestWidth, uiDestHeight, Filter, ( BCDecodeLevel )uiLevel );
+		}, Options.uiMinTimeMs );
+		WriteResult( hFile, sCase, "RGBA8888", uiSize, BENCH_VARIANT_PLAIN, Source.size(), ( std::string( "resample_" ) + GetDecodeLevelName( uiLevel ) ).c_str(), Result, Source.size(), ( std::uint64_t )uiSourceWidth * uiSourceHeight );
+		uiFailedStages += !Result.bOK;
+	}
+
+	return vlTrue;
+}
+
+//
+// Normal map previews. Shading fused into the decode, a strip at a time, against decoding the whole image
+// and shading it afterwards, with the plain decode as the floor and the shading alone at every level.
+//
+
+struct SNormalMapCase
+{
+	VTFImageFormat Format;
+	vlUInt uiFlags;
+	const vlChar *cFormat;
+	const vlChar *cName;
+};
+
+static const SNormalMapCase NormalMapCases[] =
+{
+	{ IMAGE_FORMAT_DXT5, VTF_CONVERT_SHADE_NORMALS, "DXT5", "normal" },
+	{ IMAGE_FORMAT_ATI2N, VTF_CONVERT_SHADE_NORMALS | VTF_CONVERT_RECONSTRUCT_Z, "ATI2N", "normal" },
+	{ IMAGE_FORMAT_BGRA8888, VTF_CONVERT_SHADE_NORMALS, "BGRA8888", "normal" },
+	{ IMAGE_FORMAT_DXT1, VTF_CONVERT_SHADE_SSBUMP, "DXT1", "ssbump" },
+};
+
+static ShadeRowFunc GetShadeFunction( const SNormalMapFunctions &Functions, vlUInt uiFlags, vlUInt uiOrder )
+{
+	return ( uiFlags & VTF_CONVERT_SHADE_SSBUMP ) != 0 ? Functions.SSBump[uiOrder] : Functions.Normal[uiOrder];
+}
+
+//! Returns false if the levels or the fused and two pass results disagree.
+static vlBool RunNormalMap( FILE *hFile, const SNormalMapCase &Case, vlUInt uiSize, const SOptions &Options, CThreadPool *pThreadPool, vlUInt &uiFailedStages )
+{
+	const std::string sFormat = Case.cFormat;
+	const std::string sCase = "NormalMap/" + std::to_string( uiSize ) + "/" + sFormat + "_" + Case.cName;
+	if ( Options.cMatch != 0 && sCase.find( Options.cMatch ) == std::string::npos )
+		return vlTrue;
+
+	// Random data covers every direction, lengths far from 1 and blank SSBump texels.
+	const vlUInt uiPlainFlags = Case.uiFlags & VTF_CONVERT_RECONSTRUCT_Z;
+	std::vector<vlByte> Source( ( size_t )CVTFFile::ComputeImageSize( uiSize, uiSize, 1, Case.Format ) );
+	std::mt19937 Random( Case.Format * 65536 + uiSize );
+	for ( size_t i = 0; i < Source.size(); i++ )
+		Source[i] = ( vlByte )Random();
+
+	const std::uint64_t uiPixels = ( std::uint64_t )uiSize * uiSize;
+	std::vector<vlByte> Plain( ( size_t )uiPixels * 4 );
+	std::vector<vlByte> Reference( Plain.size() );
+	std::vector<vlByte> Decoded( Plain.size() );
+
+	SStageResult Result = {};
+	Result.bOK = CVTFFile::Convert( Source.data(), Plain.data(), uiSize, uiSize, Case.Format, IMAGE_FORMAT_RGBA8888, 0, 0, uiPlainFlags );
+	Reference = Plain;
+	GetShadeFunction( GetNormalMapFunctions( BCDECODE_SCALAR ), Case.uiFlags, BCDECODE_RGBA )( Reference.data(), ( size_t )uiPixels );
+
+	std::vector<vlByte> PlainBGRA( Plain );
+	for ( size_t i = 0; i < PlainBGRA.size(); i += 4 )
+		std::swap( PlainBGRA[i], PlainBGRA[i + 2] );
+
+	for ( vlUInt uiLevel = 0; uiLevel <= ( vlUInt )GetBCDecodeLevel() && Result.bOK; uiLevel++ )
+	{
+		const SNormalMapFunctions &Functions = GetNormalMapFunctions( ( BCDecodeLevel )uiLevel );
+		for ( vlUInt uiOrder = 0; uiOrder < BCDECODE_ORDER_COUNT; uiOrder++ )
+		{
+			// Gray is the same in either order.
+			Decoded = uiOrder == BCDECODE_BGRA ? PlainBGRA : Plain;
+			GetShadeFunction( Functions, Case.uiFlags, uiOrder )( Decoded.data(), ( size_t )uiPixels );
+			if ( Decoded != Reference )
+			{
+				fprintf( stderr, "vtfbench: %s %s %s does not match the scalar shading\n", sCase.c_str(), GetDecodeLevelName( uiLevel ), uiOrder == BCDECODE_BGRA ? "BGRA" : "RGBA" );
+				Result.bOK = vlFalse;
+			}
+		}
+	}
+
+	if ( Result.bOK && ( !CVTFFile::Convert( Source.data(), Decoded.data(), uiSize, uiSize, Case.Format, IMAGE_FORMAT_BGRA8888, 0, pThreadPool, Case.uiFlags ) || Decoded != Reference ) )
+	{
+		fprintf( stderr, "vtfbench: %s fused shading does not match shading after the decode\n", sCase.c_str() );
+		Result.bOK = vlFalse;
+	}
+	WriteResult( hFile, sCase, sFormat, uiSize, BENCH_VARIANT_PLAIN, Source.size(), "verify", Result, 0, 0 );
+	uiFailedStages += !Result.bOK;
+	if ( !Result.bOK )
+		return vlFalse;
+
+	Result = RunStage( [&]()
+	{
+		return CVTFFile::Convert( Source.data(), Decoded.data(), uiSize, uiSize, Case.Format, IMAGE_FORMAT_BGRA8888, 0, pThreadPool, uiPlainFlags );
+	}, Options.uiMinTimeMs );
+	WriteResult( hFile, sCase, sFormat, uiSize, BENCH_VARIANT_PLAIN, Source.size(), "decode_plain", Result, Decoded.size(), uiPixels );
+
+	const ShadeRowFunc pfnShade = GetShadeFunction( GetNormalMapFunctions(), Case.uiFlags, BCDECODE_BGRA );
+	Result = RunStage( [&]()
+	{
+		if ( !CVTFFile::Convert( Source.data(), Decoded.data(), uiSize, uiSize, Case.Format, IMAGE_FORMAT_BGRA8888, 0, pThreadPool, uiPlainFlags ) )
+			return vlFalse;
+
+		pfnShade( Decoded.data(), ( size_t )uiPixels );
+		return vlTrue;
+	}, Options.uiMinTimeMs );
+	WriteResult( hFile, sCase, sFormat, uiSize, BENCH_VARIANT_PLAIN, Source.size(), "decode_two_pass", Result, Decoded.size(), uiPixels );
+
+	Result = RunStage( [&]()
+	{
+		return CVTFFile::Convert( Source.data(), Decoded.data(), uiSize, uiSize, Case.Format, IMAGE_FORMAT_BGRA8888, 0, pThreadPool, Case.uiFlags );
+	}, Options.uiMinTimeMs );
+	WriteResult( hFile, sCase, sFormat, uiSize, BENCH_VARIANT_PLAIN, Source.size(), "decode_shaded", Result, Decoded.size(), uiPixels );
+
+	// The shading takes as long on gray as on the decoded image, so it runs in place over and over.
+	for ( vlUInt uiLevel = 0; uiLevel <= ( vlUInt )GetBCDecodeLevel(); uiLevel++ )
+	{
+		const ShadeRowFunc pfnLevelShade = GetShadeFunction( GetNormalMapFunctions( ( BCDecodeLevel )uiLevel ), Case.uiFlags, BCDECODE_BGRA );
+		Result = RunStage( [&]()
+		{
+			pfnLevelShade( Decoded.data(), ( size_t )uiPixels );
+			return vlTrue;
+		}, Options.uiMinTimeMs );
+		WriteResult( hFile, sCase, sFormat, uiSize, BENCH_VARIANT_PLAIN, Source.size(), ( std::string( "shade_" ) + GetDecodeLevelName( uiLevel ) ).c_str(), Result, Decoded.size(), uiPixels );
+	}
+
+	return vlTrue;
+}
+
+static vlVoid PrintUsage()
+{
+	fprintf( stderr,
+		"usage: vtfbench [options]\n"
+		"\n"
+		"Benchmarks load, decompress, decode and thumbnail stages on generated VTF files for every supported\n"
+		"format, writing one JSON object per case and stage. Optimized paths are also checked against their\n"
+		"references, the run fails on any mismatch.\n"
+		"\n"
+		"Cases, named <family>/<size>/<name>:\n"
+		"  <format>          load to thumbnail of plain, axc, cubemap and animated files\n"
+		"  BC1 to BC5, BC7   random blocks at every decode level against bcdec\n"
+		"  BC6H, Tonemap     BC6H and float formats tonemapped at every level against scalar\n"
+		"  Convert           per format kernels against ConvertTemplated\n"
+		"  Inflate           zlib and the one-shot decoder, truncated and corrupt streams\n"
+		"  Decompress        DecompressImageData of AXC cubemaps and animations against plain files\n"
+		"  Threads           Convert at each -threads count against one thread\n"
+		"  Streamed          band by band AXC conversion against the inflated mip\n"
+		"  Subresource       offset table lookups against walking the mips\n"
+		"  Resample          every filter at every level against scalar\n"
+		"  NormalMap         shading fused into the decode against a second pass\n"
+		"\n"
+		"  -sizes <n,n,...>  texture sizes (default 64,256,1024)\n"
+		"  -match <text>     only run cases whose name, e.g. DXT1/256/axc or BC7/256/mode6, contains text\n"
+		"  -min-time <ms>    minimum timed duration per stage (default %u)\n"
+		"  -thumb <size>     thumbnail size (default %u)\n"
+		"  -j <threads>      threads for decode and decompress, 0 for one per hardware thread (default 1)\n"
+		"  -threads <n,...>  thread counts the Threads/<size>/<format> cases time Convert at (default 1,2,4,8)\n"
+		"  -inflate <name>   AXC inflate backend: auto, zlib or oneshot (default auto)\n"
+		"  -o <file>         write results to file instead of stdout\n",
+		DEFAULT_MIN_TIME_MS, DEFAULT_THUMBNAIL_SIZE );
+}
+
+static vlBool ParseUInt( const vlChar *cValue, vlUInt &uiValue )
+{
+	vlChar *cEnd;
+	const unsigned long ulValue = strtoul( cValue, &cEnd, 10 );
+	if ( *cValue == '\0' || *cEnd != '\0' || ulValue > 0xffffffffUL )
+		return vlFalse;
+
+	uiValue = ( vlUInt )ulValue;
+	return vlTrue;
+}
+
+//! Comma separated values from 1 to uiMax.
+static vlBool ParseList( const vlChar *cValue, vlUInt uiMax, std::vector<vlUInt> &Values )
+{
+	std::string sValue( cValue );
+	size_t uiStart = 0;
+	while ( uiStart <= sValue.size() )
+	{
+		size_t uiEnd = sValue.find( ',', uiStart );
+		if ( uiEnd == std::string::npos )
+			uiEnd = sValue.size();
+
+		vlUInt uiValue;
+		if ( !ParseUInt( sValue.substr( uiStart, uiEnd - uiStart ).c_str(), uiValue ) || uiValue == 0 || uiValue > uiMax )
+			return vlFalse;
+
+		Values.push_back( uiValue );
+		uiStart = uiEnd + 1;
+	}
+	return !Values.empty();
+}
+
+static vlBool ParseArguments( int argc, char **argv, SOptions &Options )
+{
+	for ( int i = 1; i < argc; i++ )
+	{
+		const vlChar *cArg = argv[i];
+		if ( i + 1 >= argc )
+			return vlFalse;
+
+		const vlChar *cValue = argv[++i];
+		if ( strcmp( cArg, "-sizes" ) == 0 )
+		{
+			if ( !ParseList( cValue, 0xffff, Options.Sizes ) )
+				return vlFalse;
+		}
+		else if ( strcmp( cArg, "-match" ) == 0 )
+		{
+			Options.cMatch = cValue;
+		}
+		else if ( strcmp( cArg, "-min-time" ) == 0 )
+		{
+			if ( !ParseUInt( cValue, Options.uiMinTimeMs ) )
+				return vlFalse;
+		}
+		else if ( strcmp( cArg, "-thumb" ) == 0 )
+		{
+			if ( !ParseUInt( cValue, Options.uiThumbnailSize ) || Options.uiThumbnailSize == 0 )
+				return vlFalse;
+		}
+		else if ( strcmp( cArg, "-j" ) == 0 )
+		{
+			if ( !ParseUInt( cValue, Options.uiThreads ) )
+				return vlFalse;
+		}
+		else if ( strcmp( cArg, "-threads" ) == 0 )
+		{
+			if ( !ParseList( cValue, MAX_SWEEP_THREADS, Options.Threads ) )
+				return vlFalse;
+		}
+		else if ( strcmp( cArg, "-inflate" ) == 0 )
+		{
+			const vlChar *const *lpName = std::find_if( lpInflateBackendNames, lpInflateBackendNames + VTF_INFLATE_COUNT, [&]( const vlChar *cName ) { return strcmp( cName, cValue ) == 0; } );
+			if ( lpName == lpInflateBackendNames + VTF_INFLATE_COUNT )
+				return vlFalse;
+
+			Options.InflateBackend = ( VTFInflateBackend )( lpName - lpInflateBackendNames );
+		}
+		else if ( strcmp( cArg, "-o" ) == 0 )
+		{
+			Options.cOutput = cValue;
+		}
+		else
+		{
+			return vlFalse;
+		}
+	}
+
+	if ( Options.Sizes.empty() )
+		Options.Sizes = { 64, 256, 1024 };
+	if ( Options.Threads.empty() )
+		Options.Threads = { 1, 2, 4, 8 };
+
+	return vlTrue;
+}
+
+int main( int argc, char **argv )
+{
+	SOptions Options;
+	if ( !ParseArguments( argc, argv, Options ) )
+	{
+		PrintUsage();
+		return 2;
+	}
+
+	FILE *hFile = stdout;
+	if ( Options.cOutput != 0 )
+	{
+		hFile = fopen( Options.cOutput, "w" );
+		if ( hFile == 0 )
+		{
+			fprintf( stderr, "vtfbench: cannot write %s\n", Options.cOutput );
+			return 2;
+		}
+	}
+
+	SetInflateBackend( Options.InflateBackend );
+
+	CThreadPool ThreadPool( Options.uiThreads );
+	CThreadPool *pThreadPool = ThreadPool.GetThreadCount() > 1 ? &ThreadPool : 0;
+
+	// Verify stages compare the threaded paths against the serial ones at a fixed count, whatever -j is.
+	CThreadPool VerifyPool( VERIFY_THREADS );
+
+	// One pool per -threads count, a count of 1 converts without one.
+	std::vector<std::unique_ptr<CThreadPool>> SweepPools;
+	std::vector<CThreadPool *> Pools;
+	for ( vlUInt uiThreads : Options.Threads )
+	{
+		if ( uiThreads > 1 )
+			SweepPools.emplace_back( new CThreadPool( uiThreads ) );
+		Pools.push_back( uiThreads > 1 ? SweepPools.back().get() : 0 );
+	}
+
+	// Context line so results from different machines and builds are not compared blindly.
+	fprintf( hFile, "{\"context\":true,\"decode_level\":\"%s\",\"inflate\":\"%s\",\"threads\":%u,\"min_time_ms\":%u,\"thumbnail_size\":%u}\n",
+		GetDecodeLevelName( GetBCDecodeLevel() ), lpInflateBackendNames[GetInflateBackend()], ThreadPool.GetThreadCount(), Options.uiMinTimeMs, Options.uiThumbnailSize );
+
+	vlUInt uiFailed = 0;
+	vlUInt uiFailedStages = 0;
+	vlUInt uiMismatched = 0;
+	for ( vlInt iFormat = 0; iFormat < IMAGE_FORMAT_COUNT; iFormat++ )
+	{
+		const VTFImageFormat Format = ( VTFImageFormat )iFormat;
+		if ( !CVTFFile::GetImageFormatInfo( Format ).bIsSupported )
+			continue;
+
+		for ( vlUInt uiSize : Options.Sizes )
+		{
+			for ( vlUInt uiVariant = 0; uiVariant < BENCH_VARIANT_COUNT; uiVariant++ )
+			{
+				if ( !RunCase( hFile, Format, uiSize, ( BenchVariant )uiVariant, Options, pThreadPool, uiFailedStages ) )
+					uiFailed++;
+			}
+
+			if ( !RunInflate( hFile, Format, uiSize, Options, uiFailedStages ) )
+				uiMismatched++;
+		}
+	}
+
+	for ( vlUInt uiSize : Options.Sizes )
+	{
+		if ( !RunSubresources( hFile, uiSize, Options, uiFailedStages ) )
+			uiFailed++;
+
+		for ( VTFImageFormat Format : ThreadsFormats )
+		{
+			if ( !RunThreads( hFile, Format, uiSize, Options, Pools, uiFailedStages ) )
+				uiMismatched++;
+		}
+
+		for ( VTFImageFormat Format : StreamedFormats )
+		{
+			if ( !RunStreamed( hFile, Format, uiSize, Options, uiFailedStages ) )
+				uiMismatched++;
+		}
+
+		for ( const SDecompressCase &Case : DecompressCases )
+		{
+			if ( !RunDecompress( hFile, Case, uiSize, Options, pThreadPool, VerifyPool, uiFailedStages ) )
+				uiMismatched++;
+		}
+
+		for ( vlInt iFormat = 0; iFormat < IMAGE_FORMAT_COUNT; iFormat++ )
+		{
+			const SVTFImageFormatInfo &Info = CVTFFile::GetImageFormatInfo( ( VTFImageFormat )iFormat );
+			if ( Info.bIsSupported && !Info.bIsCompressed && !RunConvert( hFile, ( VTFImageFormat )iFormat, uiSize, Options, uiFailedStages ) )
+				uiMismatched++;
+		}
+
+		for ( vlUInt uiMode = 0; uiMode < BC7_MODE_COUNT; uiMode++ )
+		{
+			if ( !RunBC7Mode( hFile, uiMode, uiSize, Options, uiFailedStages ) )
+				uiMismatched++;
+		}
+
+		for ( vlUInt uiKind = 0; uiKind < BENCH_BC13_COUNT; uiKind++ )
+		{
+			if ( !RunBC13( hFile, ( BenchBC13Kind )uiKind, uiSize, Options, uiFailedStages ) )
+				uiMismatched++;
+		}
+
+		for ( vlUInt uiKind = 0; uiKind < BENCH_BC45_COUNT; uiKind++ )
+		{
+			if ( !RunBC45( hFile, ( BenchBC45Kind )uiKind, uiSize, Options, uiFailedStages ) )
+				uiMismatched++;
+		}
+
+		if ( !RunBC6H( hFile, uiSize, Options, uiFailedStages ) )
+			uiMismatched++;
+
+		for ( VTFImageFormat Format : TonemapFormats )
+		{
+			if ( !RunTonemap( hFile, Format, uiSize, Options, uiFailedStages ) )
+				uiMismatched++;
+		}
+
+		for ( vlUInt uiFilter = 0; uiFilter < RESAMPLE_FILTER_COUNT; uiFilter++ )
+		{
+			if ( !RunResample( hFile, ( ResampleFilter )uiFilter, uiSize, Options, uiFailedStages ) )
+				uiMismatched++;
+		}
+
+		for ( const SNormalMapCase &Case : NormalMapCases )
+		{
+			if ( !RunNormalMap( hFile, Case, uiSize, Options, pThreadPool, uiFailedStages ) )
+				uiMismatched++;
+		}
+	}
+
+	if ( hFile != stdout )
+		fclose( hFile );
+
+	// Failing stages are formats a stage cannot handle yet, they are part of the results rather than an error.
+	if ( uiFailedStages != 0 )
+		fprintf( stderr, "vtfbench: %u stages failed\n", uiFailedStages );
+	if ( uiFailed != 0 )
+		fprintf( stderr, "vtfbench: %u cases could not be set up\n", uiFailed );
+	if ( uiMismatched != 0 )
+		fprintf( stderr, "vtfbench: %u BC1 to BC5, BC6H, BC7, inflate, decompress, thread, streaming, conversion, tonemap, resample or normal map cases do not match their reference\n", uiMismatched );
+
+	return uiFailed != 0 || uiMismatched != 0 ? 1 : 0;
+}
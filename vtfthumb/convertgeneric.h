@@ -0,0 +1,7 @@
+﻿#pragma once
+
+#include "vtffile.h"
+
+//! CVTFFile::Convert with ConvertTemplated in place of the per format kernels, which must write the same bytes.
+//! Defined in vtffile.cpp for vtfbench only, it is not part of the library interface.
+vlBool ConvertGeneric( vlByte *lpSource, vlByte *lpDest, vlUInt uiWidth, vlUInt uiHeight, VTFImageFormat SourceFormat, VTFImageFormat DestFormat );
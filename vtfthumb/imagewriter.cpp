@@ -0,0 +1,142 @@
+﻿#include "imagewriter.h"
+#include <cstdio>
+#include <cstring>
+#include <zlib.h>
+
+static const vlChar *lpImageFileExtensions[IMAGE_FILE_COUNT] =
+{
+	".png",
+	".pam"
+};
+
+const vlChar *GetImageFileExtension( ImageFileFormat Format )
+{
+	if ( Format < 0 || Format >= IMAGE_FILE_COUNT )
+		return 0;
+
+	return lpImageFileExtensions[Format];
+}
+
+static vlVoid PutUInt32BE( vlByte *lpDest, vlUInt32 uiValue )
+{
+	lpDest[0] = ( vlByte )( uiValue >> 24 );
+	lpDest[1] = ( vlByte )( uiValue >> 16 );
+	lpDest[2] = ( vlByte )( uiValue >> 8 );
+	lpDest[3] = ( vlByte )uiValue;
+}
+
+static vlVoid SwapRedBlue( vlByte *lpDest, const vlByte *lpSource, vlUInt uiPixels )
+{
+	for ( vlUInt i = 0; i < uiPixels; i++, lpDest += 4, lpSource += 4 )
+	{
+		lpDest[0] = lpSource[2];
+		lpDest[1] = lpSource[1];
+		lpDest[2] = lpSource[0];
+		lpDest[3] = lpSource[3];
+	}
+}
+
+static vlBool WritePNGChunk( FILE *hFile, const vlChar *cType, const vlByte *lpData, vlUInt uiSize )
+{
+	vlByte uiHeader[8];
+	PutUInt32BE( uiHeader, uiSize );
+	memcpy( uiHeader + 4, cType, 4 );
+
+	uLong uiCRC = crc32( 0, uiHeader + 4, 4 );
+	if ( uiSize != 0 )
+		uiCRC = crc32( uiCRC, lpData, uiSize );
+
+	vlByte uiFooter[4];
+	PutUInt32BE( uiFooter, ( vlUInt32 )uiCRC );
+
+	return fwrite( uiHeader, 1, 8, hFile ) == 8 &&
+		( uiSize == 0 || fwrite( lpData, 1, uiSize, hFile ) == uiSize ) &&
+		fwrite( uiFooter, 1, 4, hFile ) == 4;
+}
+
+static vlBool WritePNG( FILE *hFile, const vlByte *lpData, vlUInt uiWidth, vlUInt uiHeight )
+{
+	// Every row is stored unfiltered, thumbnails are small enough that picking filters is not worth it.
+	const vlUInt uiRowSize = 1 + uiWidth * 4;
+	const uLong uiRawSize = ( uLong )uiRowSize * uiHeight;
+	vlByte *lpRaw = new vlByte[uiRawSize];
+	for ( vlUInt y = 0; y < uiHeight; y++ )
+	{
+		lpRaw[y * uiRowSize] = 0;
+		SwapRedBlue( lpRaw + y * uiRowSize + 1, lpData + y * uiWidth * 4, uiWidth );
+	}
+
+	uLongf uiCompressedSize = compressBound( uiRawSize );
+	vlByte *lpCompressed = new vlByte[uiCompressedSize];
+	const vlBool bCompressed = compress2( lpCompressed, &uiCompressedSize, lpRaw, uiRawSize, Z_DEFAULT_COMPRESSION ) == Z_OK;
+	delete[] lpRaw;
+
+	static const vlByte uiSignature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+	vlByte uiIHDR[13];
+	PutUInt32BE( uiIHDR, uiWidth );
+	PutUInt32BE( uiIHDR + 4, uiHeight );
+	uiIHDR[8] = 8;	// Bit depth.
+	uiIHDR[9] = 6;	// Truecolour with alpha.
+	uiIHDR[10] = 0;	// Deflate.
+	uiIHDR[11] = 0;	// Adaptive filtering.
+	uiIHDR[12] = 0;	// No interlace.
+
+	const vlBool bResult = bCompressed &&
+		fwrite( uiSignature, 1, sizeof( uiSignature ), hFile ) == sizeof( uiSignature ) &&
+		WritePNGChunk( hFile, "IHDR", uiIHDR, sizeof( uiIHDR ) ) &&
+		WritePNGChunk( hFile, "IDAT", lpCompressed, ( vlUInt )uiCompressedSize ) &&
+		WritePNGChunk( hFile, "IEND", 0, 0 );
+
+	delete[] lpCompressed;
+	return bResult;
+}
+
+static vlBool WritePAM( FILE *hFile, const vlByte *lpData, vlUInt uiWidth, vlUInt uiHeight )
+{
+	if ( fprintf( hFile, "P7\nWIDTH %u\nHEIGHT %u\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n", uiWidth, uiHeight ) < 0 )
+		return vlFalse;
+
+	vlByte *lpRow = new vlByte[uiWidth * 4];
+	vlBool bResult = vlTrue;
+	for ( vlUInt y = 0; y < uiHeight && bResult; y++ )
+	{
+		SwapRedBlue( lpRow, lpData + y * uiWidth * 4, uiWidth );
+		bResult = fwrite( lpRow, 4, uiWidth, hFile ) == uiWidth;
+	}
+
+	delete[] lpRow;
+	return bResult;
+}
+
+vlBool WriteImageFile( const vlChar *cFileName, const vlByte *lpData, vlUInt uiWidth, vlUInt uiHeight, ImageFileFormat Format )
+{
+	if ( lpData == 0 || uiWidth == 0 || uiHeight == 0 )
+		return vlFalse;
+
+	FILE *hFile = fopen( cFileName, "wb" );
+	if ( hFile == 0 )
+		return vlFalse;
+
+	vlBool bResult;
+	switch ( Format )
+	{
+	case IMAGE_FILE_PNG:
+		bResult = WritePNG( hFile, lpData, uiWidth, uiHeight );
+		break;
+	case IMAGE_FILE_PAM:
+		bResult = WritePAM( hFile, lpData, uiWidth, uiHeight );
+		break;
+	default:
+		bResult = vlFalse;
+		break;
+	}
+
+	if ( fclose( hFile ) != 0 )
+		bResult = vlFalse;
+
+	if ( !bResult )
+		remove( cFileName );
+
+	return bResult;
+}
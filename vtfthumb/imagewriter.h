@@ -0,0 +1,16 @@
+﻿#pragma once
+
+#include "vtffile.h"
+
+typedef enum tagImageFileFormat
+{
+	IMAGE_FILE_PNG = 0,
+	IMAGE_FILE_PAM,
+	IMAGE_FILE_COUNT
+} ImageFileFormat;
+
+//! File extension including the dot.
+const vlChar *GetImageFileExtension( ImageFileFormat Format );
+
+//! Writes a BGRA8888 image with straight alpha as an 8 bit RGBA file.
+vlBool WriteImageFile( const vlChar *cFileName, const vlByte *lpData, vlUInt uiWidth, vlUInt uiHeight, ImageFileFormat Format );
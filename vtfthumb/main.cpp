@@ -0,0 +1,383 @@
+﻿#include "imagewriter.h"
+#include "pipeline.h"
+#include "readers.h"
+#include "thumbnail.h"
+#include "thumbnailcache.h"
+#include "threadpool.h"
+#include "workpool.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <system_error>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+#define DEFAULT_THUMBNAIL_SIZE 256
+
+struct SOptions
+{
+	SOptions() : uiSize( DEFAULT_THUMBNAIL_SIZE ), Format( IMAGE_FILE_PNG ), uiThreads( 0 ), bPipeline( vlFalse ), uiReadThreads( PIPELINE_DEFAULT_READ_THREADS ),
+		uiWriteThreads( PIPELINE_DEFAULT_WRITE_THREADS ), uiQueueDepth( PIPELINE_DEFAULT_QUEUE_DEPTH ), uiQueueMB( PIPELINE_DEFAULT_QUEUE_BYTES >> 20 ), cCache( 0 ),
+		uiCacheMB( THUMBNAIL_CACHE_DEFAULT_SIZE >> 20 ), cInput( 0 ), cOutput( 0 ) {}
+
+	vlUInt uiSize;
+	ImageFileFormat Format;
+	SThumbnailOptions Thumbnail;
+	vlUInt uiThreads;		//!< Files converted at once, or decode threads with bPipeline. 0 uses every hardware thread.
+	vlBool bPipeline;		//!< Read, decode and write on separate threads instead of one file per task.
+	vlUInt uiReadThreads;
+	vlUInt uiWriteThreads;
+	vlUInt uiQueueDepth;
+	vlUInt uiQueueMB;
+	const vlChar *cCache;	//!< Thumbnail cache pack file, 0 for none.
+	vlUInt uiCacheMB;
+	const vlChar *cInput;
+	const vlChar *cOutput;
+};
+
+static vlVoid PrintUsage()
+{
+	fprintf( stderr,
+		"usage: vtfthumb [options] <input dir|file> <output dir>\n"
+		"\n"
+		"Writes a thumbnail for every .vtf file under the input, mirroring its directory tree.\n"
+		"\n"
+		"  -s <size>        longest edge of the thumbnails (default %u)\n"
+		"  -f <png|pam>     output file format (default png)\n"
+		"  -filter <box|bilinear|lanczos3>\n"
+		"                   resampling filter (default lanczos3)\n"
+		"  -nolowres        never use the embedded low-res image\n"
+		"  -noshade         show normal maps as their colors instead of lit\n"
+		"  -cache <file>    reuse thumbnails kept in this pack file between runs\n"
+		"  -cache-mb <n>    size of the cache pack file (default %u)\n"
+		"  -j <threads>     files converted at once, 0 for one per hardware thread (default 0)\n"
+		"\n"
+		"  -pipeline        read, decode and write in separate stages, -j sets the decode threads\n"
+		"  -read-threads <n>  pipeline read threads (default %u)\n"
+		"  -write-threads <n> pipeline write threads (default %u)\n"
+		"  -queue <n>       items queued between pipeline stages (default %u)\n"
+		"  -queue-mb <n>    megabytes queued between pipeline stages (default %u)\n",
+		DEFAULT_THUMBNAIL_SIZE, THUMBNAIL_CACHE_DEFAULT_SIZE >> 20, PIPELINE_DEFAULT_READ_THREADS, PIPELINE_DEFAULT_WRITE_THREADS, PIPELINE_DEFAULT_QUEUE_DEPTH, PIPELINE_DEFAULT_QUEUE_BYTES >> 20 );
+}
+
+static vlBool ParseUInt( const vlChar *cValue, vlUInt &uiValue )
+{
+	vlChar *cEnd;
+	const unsigned long ulValue = strtoul( cValue, &cEnd, 10 );
+	if ( *cValue == '\0' || *cEnd != '\0' || ulValue > 0xffffffffUL )
+		return vlFalse;
+
+	uiValue = ( vlUInt )ulValue;
+	return vlTrue;
+}
+
+static vlBool ParseArguments( int argc, char **argv, SOptions &Options )
+{
+	vlUInt uiPositional = 0;
+	for ( int i = 1; i < argc; i++ )
+	{
+		const vlChar *cArg = argv[i];
+		const vlBool bHasValue = i + 1 < argc;
+		if ( strcmp( cArg, "-s" ) == 0 && bHasValue )
+		{
+			if ( !ParseUInt( argv[++i], Options.uiSize ) || Options.uiSize == 0 )
+				return vlFalse;
+		}
+		else if ( strcmp( cArg, "-f" ) == 0 && bHasValue )
+		{
+			const vlChar *cValue = argv[++i];
+			if ( strcmp( cValue, "png" ) == 0 )
+				Options.Format = IMAGE_FILE_PNG;
+			else if ( strcmp( cValue, "pam" ) == 0 )
+				Options.Format = IMAGE_FILE_PAM;
+			else
+				return vlFalse;
+		}
+		else if ( strcmp( cArg, "-filter" ) == 0 && bHasValue )
+		{
+			const vlChar *cValue = argv[++i];
+			if ( strcmp( cValue, "box" ) == 0 )
+				Options.Thumbnail.Filter = RESAMPLE_BOX;
+			else if ( strcmp( cValue, "bilinear" ) == 0 )
+				Options.Thumbnail.Filter = RESAMPLE_BILINEAR;
+			else if ( strcmp( cValue, "lanczos3" ) == 0 )
+				Options.Thumbnail.Filter = RESAMPLE_LANCZOS3;
+			else
+				return vlFalse;
+		}
+		else if ( strcmp( cArg, "-nolowres" ) == 0 )
+		{
+			Options.Thumbnail.bLowRes = vlFalse;
+		}
+		else if ( strcmp( cArg, "-noshade" ) == 0 )
+		{
+			Options.Thumbnail.bShadeNormalMaps = vlFalse;
+		}
+		else if ( strcmp( cArg, "-cache" ) == 0 && bHasValue )
+		{
+			Options.cCache = argv[++i];
+		}
+		else if ( strcmp( cArg, "-cache-mb" ) == 0 && bHasValue )
+		{
+			if ( !ParseUInt( argv[++i], Options.uiCacheMB ) || Options.uiCacheMB == 0 )
+				return vlFalse;
+		}
+		else if ( strcmp( cArg, "-j" ) == 0 && bHasValue )
+		{
+			if ( !ParseUInt( argv[++i], Options.uiThreads ) )
+				return vlFalse;
+		}
+		else if ( strcmp( cArg, "-pipeline" ) == 0 )
+		{
+			Options.bPipeline = vlTrue;
+		}
+		else if ( strcmp( cArg, "-read-threads" ) == 0 && bHasValue )
+		{
+			if ( !ParseUInt( argv[++i], Options.uiReadThreads ) || Options.uiReadThreads == 0 )
+				return vlFalse;
+		}
+		else if ( strcmp( cArg, "-write-threads" ) == 0 && bHasValue )
+		{
+			if ( !ParseUInt( argv[++i], Options.uiWriteThreads ) || Options.uiWriteThreads == 0 )
+				return vlFalse;
+		}
+		else if ( strcmp( cArg, "-queue" ) == 0 && bHasValue )
+		{
+			if ( !ParseUInt( argv[++i], Options.uiQueueDepth ) || Options.uiQueueDepth == 0 )
+				return vlFalse;
+		}
+		else if ( strcmp( cArg, "-queue-mb" ) == 0 && bHasValue )
+		{
+			if ( !ParseUInt( argv[++i], Options.uiQueueMB ) || Options.uiQueueMB == 0 )
+				return vlFalse;
+		}
+		else if ( cArg[0] == '-' && cArg[1] != '\0' )
+		{
+			return vlFalse;
+		}
+		else if ( uiPositional == 0 )
+		{
+			Options.cInput = cArg;
+			uiPositional++;
+		}
+		else if ( uiPositional == 1 )
+		{
+			Options.cOutput = cArg;
+			uiPositional++;
+		}
+		else
+		{
+			return vlFalse;
+		}
+	}
+
+	return uiPositional == 2;
+}
+
+static vlBool IsVTFFile( const fs::path &Path )
+{
+	std::string sExtension = Path.extension().string();
+	std::transform( sExtension.begin(), sExtension.end(), sExtension.begin(), []( unsigned char c ) { return ( char )tolower( c ); } );
+	return sExtension == ".vtf";
+}
+
+struct SInputFile
+{
+	fs::path Path;
+	fs::path RelativePath;
+	std::uint64_t uiSize;
+
+	bool operator<( const SInputFile &Other ) const
+	{
+		return this->Path < Other.Path;
+	}
+};
+
+//! Collects input files with their path relative to the input, sorted so runs are repeatable.
+static vlBool FindInputFiles( const fs::path &Input, std::vector<SInputFile> &Files )
+{
+	std::error_code Error;
+	if ( fs::is_regular_file( Input, Error ) )
+	{
+		Files.push_back( { Input, Input.filename(), fs::file_size( Input, Error ) } );
+		return !Error;
+	}
+
+	if ( !fs::is_directory( Input, Error ) )
+		return vlFalse;
+
+	fs::recursive_directory_iterator It( Input, fs::directory_options::skip_permission_denied, Error );
+	for ( ; !Error && It != fs::recursive_directory_iterator(); It.increment( Error ) )
+	{
+		if ( It->is_regular_file( Error ) && IsVTFFile( It->path() ) )
+		{
+			// A size that cannot be read only affects scheduling, the conversion reports the real error.
+			std::error_code SizeError;
+			const std::uint64_t uiSize = It->file_size( SizeError );
+			Files.push_back( { It->path(), It->path().lexically_relative( Input ), SizeError ? 0 : uiSize } );
+		}
+	}
+
+	std::sort( Files.begin(), Files.end() );
+	return !Error;
+}
+
+static vlBool CreateThumbnailFile( const fs::path &Input, const fs::path &Output, const SOptions &Options, CThreadPool *pThreadPool )
+{
+	// Only the header and resources are read up front, Create then reads the single mip it needs.
+	IO::Readers::CFileReader Reader( Input.string().c_str() );
+	CVTFFile File;
+	if ( !File.Load( &Reader, VTF_LOAD_NO_IMAGE_DATA ) )
+		return vlFalse;
+
+	CThumbnail Thumbnail;
+	if ( !Thumbnail.Create( File, &Reader, Options.uiSize, Options.Thumbnail, pThreadPool ) )
+		return vlFalse;
+
+	std::error_code Error;
+	fs::create_directories( Output.parent_path(), Error );
+	if ( Error )
+		return vlFalse;
+
+	return WriteImageFile( Output.string().c_str(), Thumbnail.GetData(), Thumbnail.GetWidth(), Thumbnail.GetHeight(), Options.Format );
+}
+
+//! One task per file on the work-stealing pool, files are spread over the workers by size.
+static vlVoid RunBatch( const std::vector<SPipelineTask> &Tasks, const std::vector<std::uint64_t> &Weights, const SOptions &Options, std::vector<vlBool> &Succeeded, std::vector<double> &Latencies )
+{
+	typedef std::chrono::steady_clock Clock;
+
+	// A single file gets the threads for its decode instead.
+	CWorkStealingPool Pool( Options.uiThreads );
+	CThreadPool DecodePool( Tasks.size() == 1 ? Pool.GetThreadCount() : 1 );
+	CThreadPool *pDecodePool = Tasks.size() == 1 ? &DecodePool : 0;
+
+	Succeeded.assign( Tasks.size(), vlFalse );
+	Latencies.assign( Tasks.size(), 0.0 );
+	Pool.Run( Weights, [&]( vlUInt uiTask, vlUInt )
+	{
+		const Clock::time_point Start = Clock::now();
+		Succeeded[uiTask] = CreateThumbnailFile( Tasks[uiTask].Input, Tasks[uiTask].Output, Options, pDecodePool );
+		Latencies[uiTask] = std::chrono::duration<double, std::milli>( Clock::now() - Start ).count();
+	} );
+
+	printf( "%u threads, %u steals\n", Pool.GetThreadCount(), Pool.GetStealCount() );
+}
+
+static vlVoid RunPipeline( const std::vector<SPipelineTask> &Tasks, const SOptions &Options, std::vector<vlBool> &Succeeded, std::vector<double> &Latencies )
+{
+	SPipelineOptions PipelineOptions;
+	PipelineOptions.uiSize = Options.uiSize;
+	PipelineOptions.Thumbnail = Options.Thumbnail;
+	PipelineOptions.Format = Options.Format;
+	PipelineOptions.uiThreads[PIPELINE_STAGE_READ] = Options.uiReadThreads;
+	PipelineOptions.uiThreads[PIPELINE_STAGE_DECODE] = Options.uiThreads;
+	PipelineOptions.uiThreads[PIPELINE_STAGE_WRITE] = Options.uiWriteThreads;
+	PipelineOptions.uiQueueDepth = Options.uiQueueDepth;
+	PipelineOptions.uiQueueBytes = ( std::uint64_t )Options.uiQueueMB << 20;
+
+	CThumbnailPipeline Pipeline( PipelineOptions );
+	SPipelineStats Stats;
+	Pipeline.Run( Tasks, Succeeded, Latencies, Stats );
+
+	// Utilization near 100% marks the bottleneck stage. Producers blocking on a queue means the stage after it is
+	// too slow, consumers waiting means the stage before it is.
+	for ( vlUInt i = 0; i < PIPELINE_STAGE_COUNT; i++ )
+	{
+		const PipelineStage Stage = ( PipelineStage )i;
+		const SPipelineStageStats &StageStats = Stats.Stages[i];
+		printf( "%-6s %2u threads, %u items, %5.1f%% busy", GetPipelineStageName( Stage ), StageStats.uiThreads, StageStats.uiItems, StageStats.dUtilization * 100.0 );
+		if ( Stage != PIPELINE_STAGE_READ )
+		{
+			const SPipelineQueueStats &QueueStats = Stats.Queues[i];
+			printf( ", queue depth mean %.1f max %u/%u, max %.1f MB, producers blocked %.2f s, consumers waited %.2f s",
+				QueueStats.dMeanDepth, QueueStats.uiMaxDepth, QueueStats.uiCapacity, QueueStats.uiMaxBytes / 1048576.0, QueueStats.dPushWaitSeconds, QueueStats.dPopWaitSeconds );
+		}
+		printf( "\n" );
+	}
+}
+
+int main( int argc, char **argv )
+{
+	SOptions Options;
+	if ( !ParseArguments( argc, argv, Options ) )
+	{
+		PrintUsage();
+		return 2;
+	}
+
+	std::vector<SInputFile> Files;
+	if ( !FindInputFiles( Options.cInput, Files ) )
+	{
+		fprintf( stderr, "vtfthumb: cannot read %s\n", Options.cInput );
+		return 2;
+	}
+
+	CThumbnailCache Cache;
+	if ( Options.cCache != 0 )
+	{
+		if ( !Cache.Open( Options.cCache, ( std::uint64_t )Options.uiCacheMB << 20 ) )
+		{
+			fprintf( stderr, "vtfthumb: cannot open cache %s\n", Options.cCache );
+			return 2;
+		}
+		Options.Thumbnail.pCache = &Cache;
+	}
+
+	const fs::path OutputRoot( Options.cOutput );
+	std::vector<SPipelineTask> Tasks( Files.size() );
+	std::vector<std::uint64_t> Weights( Files.size() );
+	std::uint64_t uiTotalSize = 0;
+	for ( size_t i = 0; i < Files.size(); i++ )
+	{
+		Tasks[i].Input = Files[i].Path;
+		Tasks[i].Output = OutputRoot / Files[i].RelativePath;
+		Tasks[i].Output.replace_extension( GetImageFileExtension( Options.Format ) );
+		Weights[i] = Files[i].uiSize;
+		uiTotalSize += Files[i].uiSize;
+	}
+
+	typedef std::chrono::steady_clock Clock;
+	const Clock::time_point Start = Clock::now();
+
+	std::vector<vlBool> Succeeded;
+	std::vector<double> Latencies;
+	if ( Options.bPipeline )
+		RunPipeline( Tasks, Options, Succeeded, Latencies );
+	else
+		RunBatch( Tasks, Weights, Options, Succeeded, Latencies );
+
+	const double dSeconds = std::chrono::duration<double>( Clock::now() - Start ).count();
+	const vlUInt uiCount = ( vlUInt )Files.size();
+	vlUInt uiFailed = 0;
+	for ( vlUInt i = 0; i < uiCount; i++ )
+	{
+		if ( !Succeeded[i] )
+		{
+			fprintf( stderr, "vtfthumb: failed %s\n", Files[i].Path.string().c_str() );
+			uiFailed++;
+		}
+	}
+
+	printf( "%u of %u thumbnails written\n", uiCount - uiFailed, uiCount );
+
+	if ( uiCount != 0 )
+	{
+		std::sort( Latencies.begin(), Latencies.end() );
+		const auto Percentile = [&]( vlUInt uiPercent ) { return Latencies[( uiCount * uiPercent + 99 ) / 100 - 1]; };
+		printf( "%.2f s, %.1f files/s, %.1f MB/s read, latency p50 %.2f ms p99 %.2f ms max %.2f ms\n",
+			dSeconds, dSeconds > 0.0 ? uiCount / dSeconds : 0.0, dSeconds > 0.0 ? uiTotalSize / dSeconds / 1048576.0 : 0.0,
+			Percentile( 50 ), Percentile( 99 ), Latencies.back() );
+	}
+
+	if ( Cache.IsOpen() )
+		printf( "cache %u entries, %.1f MB\n", Cache.GetEntryCount(), Cache.GetDataSize() / 1048576.0 );
+
+	return uiFailed != 0 ? 1 : 0;
+}
@@ -0,0 +1,289 @@
+﻿#include "pipeline.h"
+#include "readers.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+
+typedef std::chrono::steady_clock Clock;
+
+static const vlChar *lpStageNames[PIPELINE_STAGE_COUNT] =
+{
+	"read",
+	"decode",
+	"write"
+};
+
+const vlChar *GetPipelineStageName( PipelineStage Stage )
+{
+	if ( Stage < 0 || Stage >= PIPELINE_STAGE_COUNT )
+		return 0;
+
+	return lpStageNames[Stage];
+}
+
+static double GetSeconds( Clock::duration Duration )
+{
+	return std::chrono::duration<double>( Duration ).count();
+}
+
+//
+// Blocking queue bounded by both item count and bytes, with the counters behind SPipelineQueueStats.
+//
+template<typename T>
+class CBoundedQueue
+{
+public:
+	CBoundedQueue( vlUInt uiCapacity, std::uint64_t uiMaxBytes, vlUInt uiProducers )
+	{
+		this->uiCapacity = std::max<vlUInt>( uiCapacity, 1 );
+		this->uiMaxBytes = uiMaxBytes;
+		this->uiProducers = uiProducers;
+		this->uiBytes = 0;
+		this->Start = this->LastChange = Clock::now();
+		this->dDepthIntegral = 0.0;
+		this->uiMaxDepth = 0;
+		this->uiPeakBytes = 0;
+		this->PushWait = Clock::duration::zero();
+		this->PopWait = Clock::duration::zero();
+	}
+
+	vlVoid Push( T &&Item, std::uint64_t uiItemBytes )
+	{
+		std::unique_lock<std::mutex> Lock( this->Mutex );
+		const Clock::time_point WaitStart = Clock::now();
+		this->NotFull.wait( Lock, [&] { return this->Items.empty() || ( this->Items.size() < this->uiCapacity && this->uiBytes + uiItemBytes <= this->uiMaxBytes ); } );
+		this->PushWait += Clock::now() - WaitStart;
+
+		this->Record();
+		this->Items.emplace_back( std::move( Item ), uiItemBytes );
+		this->uiBytes += uiItemBytes;
+		this->uiMaxDepth = std::max<vlUInt>( this->uiMaxDepth, ( vlUInt )this->Items.size() );
+		this->uiPeakBytes = std::max( this->uiPeakBytes, this->uiBytes );
+		this->NotEmpty.notify_one();
+	}
+
+	//! False once every producer is done and the queue is empty.
+	vlBool Pop( T &Item )
+	{
+		std::unique_lock<std::mutex> Lock( this->Mutex );
+		const Clock::time_point WaitStart = Clock::now();
+		this->NotEmpty.wait( Lock, [&] { return !this->Items.empty() || this->uiProducers == 0; } );
+		this->PopWait += Clock::now() - WaitStart;
+
+		if ( this->Items.empty() )
+			return vlFalse;
+
+		this->Record();
+		Item = std::move( this->Items.front().first );
+		this->uiBytes -= this->Items.front().second;
+		this->Items.pop_front();
+		this->NotFull.notify_one();
+		return vlTrue;
+	}
+
+	vlVoid ProducerDone()
+	{
+		std::lock_guard<std::mutex> Lock( this->Mutex );
+		if ( --this->uiProducers == 0 )
+			this->NotEmpty.notify_all();
+	}
+
+	vlVoid GetStats( SPipelineQueueStats &Stats )
+	{
+		std::lock_guard<std::mutex> Lock( this->Mutex );
+		this->Record();
+		const double dSeconds = GetSeconds( this->LastChange - this->Start );
+		Stats.uiCapacity = this->uiCapacity;
+		Stats.uiMaxDepth = this->uiMaxDepth;
+		Stats.dMeanDepth = dSeconds > 0.0 ? this->dDepthIntegral / dSeconds : 0.0;
+		Stats.uiMaxBytes = this->uiPeakBytes;
+		Stats.dPushWaitSeconds = GetSeconds( this->PushWait );
+		Stats.dPopWaitSeconds = GetSeconds( this->PopWait );
+	}
+
+private:
+	//! Adds the time at the current depth to the integral, called with the lock held before the depth changes.
+	vlVoid Record()
+	{
+		const Clock::time_point Now = Clock::now();
+		this->dDepthIntegral += this->Items.size() * GetSeconds( Now - this->LastChange );
+		this->LastChange = Now;
+	}
+
+private:
+	std::mutex Mutex;
+	std::condition_variable NotFull;
+	std::condition_variable NotEmpty;
+	std::deque<std::pair<T, std::uint64_t>> Items;
+	vlUInt uiCapacity;
+	std::uint64_t uiMaxBytes;
+	std::uint64_t uiBytes;
+	vlUInt uiProducers;
+
+	Clock::time_point Start;
+	Clock::time_point LastChange;
+	double dDepthIntegral;
+	vlUInt uiMaxDepth;
+	std::uint64_t uiPeakBytes;
+	Clock::duration PushWait;
+	Clock::duration PopWait;
+};
+
+struct SReadItem
+{
+	vlUInt uiTask;
+	std::unique_ptr<CVTFFile> File;
+};
+
+struct SDecodedItem
+{
+	vlUInt uiTask;
+	std::unique_ptr<CThumbnail> Thumbnail;
+};
+
+CThumbnailPipeline::CThumbnailPipeline( const SPipelineOptions &Options ) : Options( Options )
+{
+	for ( vlUInt i = 0; i < PIPELINE_STAGE_COUNT; i++ )
+	{
+		if ( this->Options.uiThreads[i] == 0 )
+			this->Options.uiThreads[i] = std::max<vlUInt>( std::thread::hardware_concurrency(), 1 );
+	}
+}
+
+vlVoid CThumbnailPipeline::Run( const std::vector<SPipelineTask> &Tasks, std::vector<vlBool> &Succeeded, std::vector<double> &Latencies, SPipelineStats &Stats )
+{
+	const vlUInt uiCount = ( vlUInt )Tasks.size();
+	const SPipelineOptions &Options = this->Options;
+
+	Succeeded.assign( uiCount, vlFalse );
+	Latencies.assign( uiCount, 0.0 );
+	std::vector<Clock::time_point> StartTimes( uiCount );
+
+	CBoundedQueue<SReadItem> ReadQueue( Options.uiQueueDepth, Options.uiQueueBytes, Options.uiThreads[PIPELINE_STAGE_READ] );
+	CBoundedQueue<SDecodedItem> DecodedQueue( Options.uiQueueDepth, Options.uiQueueBytes, Options.uiThreads[PIPELINE_STAGE_DECODE] );
+
+	std::atomic<vlUInt> uiNextTask( 0 );
+	std::atomic<vlUInt> uiItems[PIPELINE_STAGE_COUNT];
+	std::atomic<std::int64_t> iBusy[PIPELINE_STAGE_COUNT];
+	for ( vlUInt i = 0; i < PIPELINE_STAGE_COUNT; i++ )
+	{
+		uiItems[i] = 0;
+		iBusy[i] = 0;
+	}
+
+	const auto Finish = [&]( vlUInt uiTask, vlBool bSucceeded )
+	{
+		Succeeded[uiTask] = bSucceeded;
+		Latencies[uiTask] = std::chrono::duration<double, std::milli>( Clock::now() - StartTimes[uiTask] ).count();
+	};
+
+	const auto AddBusy = [&]( PipelineStage Stage, Clock::time_point BusyStart )
+	{
+		iBusy[Stage] += ( Clock::now() - BusyStart ).count();
+		uiItems[Stage]++;
+	};
+
+	// Reads the header and only the byte range of the mip, the reader is closed again before the item is queued.
+	const auto ReadMain = [&]()
+	{
+		for ( vlUInt uiTask; ( uiTask = uiNextTask++ ) < uiCount; )
+		{
+			const Clock::time_point BusyStart = StartTimes[uiTask] = Clock::now();
+
+			IO::Readers::CFileReader Reader( Tasks[uiTask].Input.string().c_str() );
+			std::unique_ptr<CVTFFile> File( new CVTFFile() );
+			vlUInt64 uiSourceSize = 0;
+			const vlBool bRead = File->Load( &Reader, VTF_LOAD_NO_IMAGE_DATA ) && CThumbnail::LoadSource( *File, &Reader, Options.uiSize, Options.Thumbnail, uiSourceSize );
+			AddBusy( PIPELINE_STAGE_READ, BusyStart );
+
+			if ( !bRead )
+			{
+				Finish( uiTask, vlFalse );
+				continue;
+			}
+
+			SReadItem Item;
+			Item.uiTask = uiTask;
+			Item.File = std::move( File );
+			ReadQueue.Push( std::move( Item ), uiSourceSize );
+		}
+		ReadQueue.ProducerDone();
+	};
+
+	const auto DecodeMain = [&]()
+	{
+		SReadItem Item;
+		while ( ReadQueue.Pop( Item ) )
+		{
+			const Clock::time_point BusyStart = Clock::now();
+			std::unique_ptr<CThumbnail> Thumbnail( new CThumbnail() );
+			const vlBool bDecoded = Thumbnail->Create( *Item.File, 0, Options.uiSize, Options.Thumbnail );
+			Item.File.reset();
+			AddBusy( PIPELINE_STAGE_DECODE, BusyStart );
+
+			if ( !bDecoded )
+			{
+				Finish( Item.uiTask, vlFalse );
+				continue;
+			}
+
+			const std::uint64_t uiBytes = ( std::uint64_t )Thumbnail->GetWidth() * Thumbnail->GetHeight() * 4;
+			SDecodedItem Decoded;
+			Decoded.uiTask = Item.uiTask;
+			Decoded.Thumbnail = std::move( Thumbnail );
+			DecodedQueue.Push( std::move( Decoded ), uiBytes );
+		}
+		DecodedQueue.ProducerDone();
+	};
+
+	const auto WriteMain = [&]()
+	{
+		SDecodedItem Item;
+		while ( DecodedQueue.Pop( Item ) )
+		{
+			const Clock::time_point BusyStart = Clock::now();
+			const std::filesystem::path &Output = Tasks[Item.uiTask].Output;
+
+			std::error_code Error;
+			std::filesystem::create_directories( Output.parent_path(), Error );
+			const vlBool bWritten = !Error && WriteImageFile( Output.string().c_str(), Item.Thumbnail->GetData(), Item.Thumbnail->GetWidth(), Item.Thumbnail->GetHeight(), Options.Format );
+			Item.Thumbnail.reset();
+			AddBusy( PIPELINE_STAGE_WRITE, BusyStart );
+
+			Finish( Item.uiTask, bWritten );
+		}
+	};
+
+	const Clock::time_point Start = Clock::now();
+
+	std::vector<std::thread> Threads;
+	for ( vlUInt i = 0; i < Options.uiThreads[PIPELINE_STAGE_READ]; i++ )
+		Threads.emplace_back( ReadMain );
+	for ( vlUInt i = 0; i < Options.uiThreads[PIPELINE_STAGE_DECODE]; i++ )
+		Threads.emplace_back( DecodeMain );
+	for ( vlUInt i = 0; i < Options.uiThreads[PIPELINE_STAGE_WRITE]; i++ )
+		Threads.emplace_back( WriteMain );
+
+	for ( auto &Thread : Threads )
+		Thread.join();
+
+	Stats.dSeconds = GetSeconds( Clock::now() - Start );
+	for ( vlUInt i = 0; i < PIPELINE_STAGE_COUNT; i++ )
+	{
+		SPipelineStageStats &Stage = Stats.Stages[i];
+		Stage.uiThreads = Options.uiThreads[i];
+		Stage.uiItems = uiItems[i];
+		Stage.dBusySeconds = GetSeconds( Clock::duration( iBusy[i].load() ) );
+		Stage.dUtilization = Stats.dSeconds > 0.0 ? Stage.dBusySeconds / ( Stats.dSeconds * Stage.uiThreads ) : 0.0;
+	}
+
+	Stats.Queues[PIPELINE_STAGE_READ] = SPipelineQueueStats();
+	ReadQueue.GetStats( Stats.Queues[PIPELINE_STAGE_DECODE] );
+	DecodedQueue.GetStats( Stats.Queues[PIPELINE_STAGE_WRITE] );
+}
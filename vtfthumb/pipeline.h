@@ -0,0 +1,87 @@
+﻿#pragma once
+
+#include "imagewriter.h"
+#include "thumbnail.h"
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+#define PIPELINE_DEFAULT_READ_THREADS 2
+#define PIPELINE_DEFAULT_WRITE_THREADS 1
+#define PIPELINE_DEFAULT_QUEUE_DEPTH 16
+#define PIPELINE_DEFAULT_QUEUE_BYTES ( 256 << 20 )
+
+typedef enum tagPipelineStage
+{
+	PIPELINE_STAGE_READ = 0,	//!< Header and the byte range of the one mip the thumbnail needs.
+	PIPELINE_STAGE_DECODE,		//!< Decode and resample.
+	PIPELINE_STAGE_WRITE,		//!< Encode and write the image file.
+	PIPELINE_STAGE_COUNT
+} PipelineStage;
+
+struct SPipelineOptions
+{
+	SPipelineOptions() : uiSize( 256 ), Format( IMAGE_FILE_PNG ), uiQueueDepth( PIPELINE_DEFAULT_QUEUE_DEPTH ), uiQueueBytes( PIPELINE_DEFAULT_QUEUE_BYTES )
+	{
+		this->uiThreads[PIPELINE_STAGE_READ] = PIPELINE_DEFAULT_READ_THREADS;
+		this->uiThreads[PIPELINE_STAGE_DECODE] = 0;
+		this->uiThreads[PIPELINE_STAGE_WRITE] = PIPELINE_DEFAULT_WRITE_THREADS;
+	}
+
+	vlUInt uiSize;
+	SThumbnailOptions Thumbnail;
+	ImageFileFormat Format;
+	vlUInt uiThreads[PIPELINE_STAGE_COUNT];		//!< 0 uses one thread per hardware thread.
+	vlUInt uiQueueDepth;						//!< Items each queue between two stages holds before producers block.
+	std::uint64_t uiQueueBytes;					//!< Bytes each queue holds before producers block, a single larger item is still let through.
+};
+
+struct SPipelineTask
+{
+	std::filesystem::path Input;
+	std::filesystem::path Output;
+};
+
+struct SPipelineStageStats
+{
+	vlUInt uiThreads;
+	vlUInt uiItems;			//!< Items the stage finished, failed ones included.
+	double dBusySeconds;	//!< Time spent working, summed over the stage's threads.
+	double dUtilization;	//!< Busy time over wall time times threads.
+};
+
+//! Queue feeding the stage of the same index, so there is none for PIPELINE_STAGE_READ.
+struct SPipelineQueueStats
+{
+	vlUInt uiCapacity;
+	vlUInt uiMaxDepth;
+	double dMeanDepth;			//!< Averaged over time.
+	std::uint64_t uiMaxBytes;
+	double dPushWaitSeconds;	//!< Producers blocked on a full queue, back-pressure.
+	double dPopWaitSeconds;		//!< Consumers waiting on an empty queue, starvation.
+};
+
+struct SPipelineStats
+{
+	double dSeconds;
+	SPipelineStageStats Stages[PIPELINE_STAGE_COUNT];
+	SPipelineQueueStats Queues[PIPELINE_STAGE_COUNT];
+};
+
+//
+// Bulk thumbnail generation as three stages connected by bounded queues, so reading the next files
+// overlaps with decoding and writing the previous ones while memory stays limited by the queue sizes.
+//
+class CThumbnailPipeline
+{
+public:
+	CThumbnailPipeline( const SPipelineOptions &Options );
+
+	//! Runs every task. Succeeded and Latencies, in milliseconds from the start of the read to the end of the write, are indexed like Tasks.
+	vlVoid Run( const std::vector<SPipelineTask> &Tasks, std::vector<vlBool> &Succeeded, std::vector<double> &Latencies, SPipelineStats &Stats );
+
+private:
+	SPipelineOptions Options;
+};
+
+const vlChar *GetPipelineStageName( PipelineStage Stage );
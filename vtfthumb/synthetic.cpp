@@ -0,0 +1,158 @@
+﻿#include "synthetic.h"
+#include <cstring>
+#include <zlib.h>
+
+#define SYNTHETIC_LOWRES_SIZE 16
+#define SYNTHETIC_AXC_LEVEL 6
+
+static vlUInt NextRandom( vlUInt &uiState )
+{
+	uiState = uiState * 1664525 + 1013904223;
+	return uiState >> 16;
+}
+
+// Only covers the positive normal range the generator produces.
+static vlUShort FloatToHalf( vlSingle fValue )
+{
+	if ( fValue < 6.103515625e-05f )
+		return 0;
+
+	vlUInt uiBits;
+	memcpy( &uiBits, &fValue, sizeof( uiBits ) );
+	return ( vlUShort )( ( ( ( uiBits >> 23 ) & 0xff ) - 112 ) << 10 | ( ( uiBits >> 13 ) & 0x3ff ) );
+}
+
+static vlVoid FillImage( vlByte *lpData, vlUInt uiSize, VTFImageFormat Format, vlUInt &uiState )
+{
+	switch ( Format )
+	{
+	case IMAGE_FORMAT_RGBA16161616F:
+	case IMAGE_FORMAT_R16F:
+		for ( vlUInt i = 0; i + 2 <= uiSize; i += 2 )
+		{
+			const vlUShort uiHalf = FloatToHalf( ( ( i / 32 ) % 256 + NextRandom( uiState ) % 4 ) / 64.0f );
+			memcpy( lpData + i, &uiHalf, sizeof( uiHalf ) );
+		}
+		break;
+	case IMAGE_FORMAT_R32F:
+	case IMAGE_FORMAT_RGB323232F:
+	case IMAGE_FORMAT_RGBA32323232F:
+		for ( vlUInt i = 0; i + 4 <= uiSize; i += 4 )
+		{
+			const vlSingle fValue = ( ( i / 64 ) % 256 + NextRandom( uiState ) % 4 ) / 64.0f;
+			memcpy( lpData + i, &fValue, sizeof( fValue ) );
+		}
+		break;
+	default:
+		for ( vlUInt i = 0; i < uiSize; i++ )
+		{
+			lpData[i] = ( vlByte )( ( i / 16 ) % 251 + NextRandom( uiState ) % 7 );
+		}
+		break;
+	}
+}
+
+static vlVoid AppendUInt( std::vector<vlByte> &Data, vlUInt uiValue )
+{
+	const vlByte *lpValue = reinterpret_cast<const vlByte *>( &uiValue );
+	Data.insert( Data.end(), lpValue, lpValue + sizeof( uiValue ) );
+}
+
+vlBool BuildSyntheticVTF( const SSyntheticVTF &Desc, std::vector<vlByte> &Data )
+{
+	Data.clear();
+
+	if ( Desc.Format < 0 || Desc.Format >= IMAGE_FORMAT_COUNT || Desc.uiWidth == 0 || Desc.uiHeight == 0 || Desc.uiWidth > 0xffff || Desc.uiHeight > 0xffff || Desc.uiFrames == 0 || Desc.uiFrames > 0xffff )
+		return vlFalse;
+
+	const vlUInt uiMipCount = CVTFFile::ComputeMipmapCount( Desc.uiWidth, Desc.uiHeight, 1 );
+	const vlUInt uiFaceCount = Desc.bCubemap ? 6 : 1;
+	vlUInt uiState = Desc.uiSeed;
+
+	// Faces in file order: smallest mip first, then frames and faces.
+	std::vector<vlByte> Image;
+	std::vector<vlUInt> FaceSizes;
+	for ( vlInt iMip = ( vlInt )uiMipCount - 1; iMip >= 0; --iMip )
+	{
+		vlUInt uiMipWidth, uiMipHeight, uiMipDepth;
+		CVTFFile::ComputeMipmapDimensions( Desc.uiWidth, Desc.uiHeight, 1, iMip, uiMipWidth, uiMipHeight, uiMipDepth );
+		const vlUInt uiFaceSize = CVTFFile::ComputeImageSize( uiMipWidth, uiMipHeight, 1, Desc.Format );
+
+		std::vector<vlByte> Face( uiFaceSize );
+		for ( vlUInt i = 0; i < Desc.uiFrames * uiFaceCount; i++ )
+		{
+			FillImage( Face.data(), uiFaceSize, Desc.Format, uiState );
+			if ( !Desc.bAuxCompressed )
+			{
+				Image.insert( Image.end(), Face.begin(), Face.end() );
+				continue;
+			}
+
+			uLongf uiCompressedSize = compressBound( uiFaceSize );
+			const size_t uiStart = Image.size();
+			Image.resize( uiStart + uiCompressedSize );
+			if ( compress2( Image.data() + uiStart, &uiCompressedSize, Face.data(), uiFaceSize, SYNTHETIC_AXC_LEVEL ) != Z_OK )
+				return vlFalse;
+
+			Image.resize( uiStart + uiCompressedSize );
+			FaceSizes.push_back( ( vlUInt )uiCompressedSize );
+		}
+	}
+
+	std::vector<vlByte> LowRes( CVTFFile::ComputeImageSize( SYNTHETIC_LOWRES_SIZE, SYNTHETIC_LOWRES_SIZE, 1, IMAGE_FORMAT_DXT1 ) );
+	FillImage( LowRes.data(), ( vlUInt )LowRes.size(), IMAGE_FORMAT_DXT1, uiState );
+
+	// The AXC chunk is prefixed by its size like every resource with data.
+	std::vector<vlByte> AuxInfo;
+	if ( Desc.bAuxCompressed )
+	{
+		AppendUInt( AuxInfo, ( vlUInt )( sizeof( AuxCompressionInfoHeader_t ) + FaceSizes.size() * sizeof( AuxCompressionInfoEntry_t ) ) );
+		AppendUInt( AuxInfo, SYNTHETIC_AXC_LEVEL );
+		for ( vlUInt uiSize : FaceSizes )
+			AppendUInt( AuxInfo, uiSize );
+	}
+
+	SVTFHeader Header;
+	memset( &Header, 0, sizeof( Header ) );
+	memcpy( Header.TypeString, "VTF", 4 );
+	Header.Version[0] = 7;
+	Header.Version[1] = Desc.bAuxCompressed ? 6 : 5;
+	Header.Width = ( vlUShort )Desc.uiWidth;
+	Header.Height = ( vlUShort )Desc.uiHeight;
+	Header.Flags = Desc.bCubemap ? ( vlUInt )TEXTUREFLAGS_ENVMAP : 0;
+	Header.Frames = ( vlUShort )Desc.uiFrames;
+	Header.Reflectivity[0] = Header.Reflectivity[1] = Header.Reflectivity[2] = 0.5f;
+	Header.BumpScale = 1.0f;
+	Header.ImageFormat = Desc.Format;
+	Header.MipCount = ( vlByte )uiMipCount;
+	Header.LowResImageFormat = IMAGE_FORMAT_DXT1;
+	Header.LowResImageWidth = SYNTHETIC_LOWRES_SIZE;
+	Header.LowResImageHeight = SYNTHETIC_LOWRES_SIZE;
+	Header.Depth = 1;
+
+	const vlUInt uiResourceOffset = ( vlUInt )( reinterpret_cast<const vlByte *>( Header.Resources ) - reinterpret_cast<const vlByte *>( &Header ) );
+	Header.ResourceCount = Desc.bAuxCompressed ? 3 : 2;
+	Header.HeaderSize = uiResourceOffset + Header.ResourceCount * sizeof( SVTFResource );
+
+	vlUInt uiOffset = Header.HeaderSize;
+	vlUInt uiResource = 0;
+	Header.Resources[uiResource].Type = VTF_LEGACY_RSRC_LOW_RES_IMAGE;
+	Header.Resources[uiResource++].Data = uiOffset;
+	uiOffset += ( vlUInt )LowRes.size();
+	if ( Desc.bAuxCompressed )
+	{
+		Header.Resources[uiResource].Type = VTF_RSRC_AUX_COMPRESSION_INFO;
+		Header.Resources[uiResource++].Data = uiOffset;
+		uiOffset += ( vlUInt )AuxInfo.size();
+	}
+	Header.Resources[uiResource].Type = VTF_LEGACY_RSRC_IMAGE;
+	Header.Resources[uiResource++].Data = uiOffset;
+
+	const vlByte *lpHeader = reinterpret_cast<const vlByte *>( &Header );
+	Data.reserve( uiOffset + Image.size() );
+	Data.insert( Data.end(), lpHeader, lpHeader + Header.HeaderSize );
+	Data.insert( Data.end(), LowRes.begin(), LowRes.end() );
+	Data.insert( Data.end(), AuxInfo.begin(), AuxInfo.end() );
+	Data.insert( Data.end(), Image.begin(), Image.end() );
+	return vlTrue;
+}
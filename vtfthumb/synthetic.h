@@ -0,0 +1,24 @@
+﻿#pragma once
+
+#include "vtffile.h"
+#include <vector>
+
+//
+// Writes VTF files with generated content for benchmarks. The pixels follow a smooth pattern with a little
+// noise so AXC streams compress about as well as real textures do, float formats hold finite values.
+//
+struct SSyntheticVTF
+{
+	SSyntheticVTF() : Format( IMAGE_FORMAT_DXT1 ), uiWidth( 256 ), uiHeight( 256 ), uiFrames( 1 ), bCubemap( vlFalse ), bAuxCompressed( vlFalse ), uiSeed( 1 ) {}
+
+	VTFImageFormat Format;
+	vlUInt uiWidth;
+	vlUInt uiHeight;
+	vlUInt uiFrames;
+	vlBool bCubemap;		//!< Six faces.
+	vlBool bAuxCompressed;	//!< Version 7.6 file with every face deflated and described by an AXC resource.
+	vlUInt uiSeed;
+};
+
+//! Builds a complete file with all mips and a DXT1 low-res image.
+vlBool BuildSyntheticVTF( const SSyntheticVTF &Desc, std::vector<vlByte> &Data );
@@ -0,0 +1,643 @@
+﻿#include "synthetic.h"
+#include "readers.h"
+#include "resample.h"
+#include "thumbnail.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <new>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+//
+// Largest single allocation, so tests can check a path never holds a whole image.
+//
+
+static std::atomic<size_t> uiLargestAlloc( 0 );
+
+void *operator new( size_t uiSize )
+{
+	size_t uiLargest = uiLargestAlloc.load( std::memory_order_relaxed );
+	while ( uiSize > uiLargest && !uiLargestAlloc.compare_exchange_weak( uiLargest, uiSize, std::memory_order_relaxed ) )
+		;
+
+	void *lpData = malloc( uiSize != 0 ? uiSize : 1 );
+	if ( lpData == 0 )
+		throw std::bad_alloc();
+	return lpData;
+}
+
+void *operator new[]( size_t uiSize )
+{
+	return operator new( uiSize );
+}
+
+void operator delete( void *lpData ) noexcept
+{
+	free( lpData );
+}
+
+void operator delete[]( void *lpData ) noexcept
+{
+	free( lpData );
+}
+
+void operator delete( void *lpData, size_t ) noexcept
+{
+	free( lpData );
+}
+
+void operator delete[]( void *lpData, size_t ) noexcept
+{
+	free( lpData );
+}
+
+//
+// Correctness tests run by ctest, each registered under the name vtftest takes on its command line. They
+// print what they compared and fail on the first wrong result of a case.
+//
+
+typedef std::chrono::steady_clock Clock;
+
+static vlBool Check( vlBool bCondition, const vlChar *cFormat, ... )
+{
+	if ( !bCondition )
+	{
+		va_list Arguments;
+		va_start( Arguments, cFormat );
+		fprintf( stderr, "vtftest: " );
+		vfprintf( stderr, cFormat, Arguments );
+		fprintf( stderr, "\n" );
+		va_end( Arguments );
+	}
+	return bCondition;
+}
+
+static double MicrosecondsSince( Clock::time_point Start )
+{
+	return std::chrono::duration<double, std::micro>( Clock::now() - Start ).count();
+}
+
+//
+// Mip selection. A thumbnail decodes only the smallest mip covering the requested size; against decoding
+// mip 0 and scaling it down, which it replaced, it must give the same output size from less decoded data.
+//
+
+struct SMipSelectionCase
+{
+	VTFImageFormat Format;
+	const vlChar *cFormat;
+	vlUInt uiWidth;
+	vlUInt uiHeight;
+	vlBool bAuxCompressed;
+};
+
+static const SMipSelectionCase MipSelectionCases[] =
+{
+	{ IMAGE_FORMAT_DXT1, "DXT1", 1024, 1024, vlFalse },
+	{ IMAGE_FORMAT_DXT5, "DXT5", 1024, 256, vlFalse },
+	{ IMAGE_FORMAT_BGRA8888, "BGRA8888", 300, 200, vlFalse },
+	{ IMAGE_FORMAT_RGB565, "RGB565", 512, 512, vlTrue },
+	{ IMAGE_FORMAT_DXT5, "DXT5", 200, 1000, vlTrue },
+};
+
+static const vlUInt MipSelectionSizes[] = { 256, 100, 32, 1500 };
+
+static vlBool TestMipSelectionCase( const SMipSelectionCase &Case, vlUInt uiSize )
+{
+	const std::string sCase = std::string( Case.cFormat ) + " " + std::to_string( Case.uiWidth ) + "x" + std::to_string( Case.uiHeight ) + ( Case.bAuxCompressed ? " axc" : "" ) +
+		" at " + std::to_string( uiSize );
+
+	SSyntheticVTF Desc;
+	Desc.Format = Case.Format;
+	Desc.uiWidth = Case.uiWidth;
+	Desc.uiHeight = Case.uiHeight;
+	Desc.bAuxCompressed = Case.bAuxCompressed;
+
+	std::vector<vlByte> Data;
+	if ( !Check( BuildSyntheticVTF( Desc, Data ), "%s: cannot build the file", sCase.c_str() ) )
+		return vlFalse;
+
+	IO::Readers::CMemoryReader Reader( Data.data(), Data.size() );
+	CVTFFile File;
+	if ( !Check( File.Load( &Reader, VTF_LOAD_BORROW_DATA ), "%s: cannot load the file", sCase.c_str() ) )
+		return vlFalse;
+
+	// The selected mip covers the size and the next one does not, or there is no mip that covers it.
+	const vlUInt uiMipmapLevel = File.GetMipmapLevelForSize( uiSize );
+	vlUInt uiMipmapWidth, uiMipmapHeight, uiMipmapDepth;
+	CVTFFile::ComputeMipmapDimensions( Case.uiWidth, Case.uiHeight, 1, uiMipmapLevel, uiMipmapWidth, uiMipmapHeight, uiMipmapDepth );
+	if ( !Check( uiMipmapLevel == 0 || std::max( uiMipmapWidth, uiMipmapHeight ) >= uiSize, "%s: mip %u is %ux%u", sCase.c_str(), uiMipmapLevel, uiMipmapWidth, uiMipmapHeight ) )
+		return vlFalse;
+
+	if ( uiMipmapLevel + 1 < File.GetMipmapCount() )
+	{
+		vlUInt uiNextWidth, uiNextHeight, uiNextDepth;
+		CVTFFile::ComputeMipmapDimensions( Case.uiWidth, Case.uiHeight, 1, uiMipmapLevel + 1, uiNextWidth, uiNextHeight, uiNextDepth );
+		if ( !Check( std::max( uiNextWidth, uiNextHeight ) < uiSize, "%s: mip %u is %ux%u and still covers the size", sCase.c_str(), uiMipmapLevel + 1, uiNextWidth, uiNextHeight ) )
+			return vlFalse;
+	}
+
+	// Only the selected mip is read.
+	SThumbnailOptions Options;
+	Options.bLowRes = vlFalse;
+	CVTFFile Header;
+	vlUInt64 uiSourceSize;
+	if ( !Check( Header.Load( &Reader, VTF_LOAD_NO_IMAGE_DATA ) && CThumbnail::LoadSource( Header, &Reader, uiSize, Options, uiSourceSize ), "%s: cannot read the mip", sCase.c_str() ) ||
+		!Check( uiSourceSize == File.GetDataSize( 0, 0, 0, uiMipmapLevel ) && uiSourceSize <= File.GetDataSize( 0, 0, 0, 0 ), "%s: read %llu bytes for mip %u", sCase.c_str(), ( unsigned long long )uiSourceSize, uiMipmapLevel ) )
+		return vlFalse;
+
+	Clock::time_point Start = Clock::now();
+	CThumbnail Thumbnail;
+	const vlBool bCreated = Thumbnail.Create( Data.data(), Data.size(), uiSize, Options );
+	const double dThumbnailUs = MicrosecondsSince( Start );
+	if ( !Check( bCreated, "%s: cannot create the thumbnail", sCase.c_str() ) )
+		return vlFalse;
+
+	// The full-res path: mip 0 decoded and scaled to the size.
+	Start = Clock::now();
+	std::vector<vlByte> Full( ( size_t )CVTFFile::ComputeImageSize( Case.uiWidth, Case.uiHeight, 1, IMAGE_FORMAT_BGRA8888 ) );
+	vlUInt uiFullWidth, uiFullHeight;
+	ComputeResampleSize( Case.uiWidth, Case.uiHeight, uiSize, uiFullWidth, uiFullHeight );
+	std::vector<vlByte> FullThumbnail( ( size_t )uiFullWidth * uiFullHeight * 4 );
+	const vlBool bFull = CVTFFile::Convert( File.GetData( 0, 0, 0, 0 ), Full.data(), Case.uiWidth, Case.uiHeight, Case.Format, IMAGE_FORMAT_BGRA8888, File.GetCompressedSize( 0, 0, 0 ) ) &&
+		Resample( Full.data(), Case.uiWidth, Case.uiHeight, FullThumbnail.data(), uiFullWidth, uiFullHeight, Options.Filter );
+	const double dFullUs = MicrosecondsSince( Start );
+	if ( !Check( bFull, "%s: cannot decode mip 0", sCase.c_str() ) )
+		return vlFalse;
+
+	// Mips round their edges down, so the short edge may be a pixel off the full-res one; the long edge is exact.
+	const vlUInt uiLongEdge = std::max( Thumbnail.GetWidth(), Thumbnail.GetHeight() );
+	const vlUInt uiFullLongEdge = std::max( uiFullWidth, uiFullHeight );
+	if ( !Check( uiLongEdge == uiFullLongEdge &&
+		std::max( Thumbnail.GetWidth(), uiFullWidth ) - std::min( Thumbnail.GetWidth(), uiFullWidth ) <= 1 &&
+		std::max( Thumbnail.GetHeight(), uiFullHeight ) - std::min( Thumbnail.GetHeight(), uiFullHeight ) <= 1,
+		"%s: thumbnail is %ux%u, the full-res path gives %ux%u", sCase.c_str(), Thumbnail.GetWidth(), Thumbnail.GetHeight(), uiFullWidth, uiFullHeight ) )
+		return vlFalse;
+
+	// A mip of exactly the requested size is the thumbnail as decoded.
+	if ( Thumbnail.GetWidth() == uiMipmapWidth && Thumbnail.GetHeight() == uiMipmapHeight )
+	{
+		std::vector<vlByte> Mipmap( ( size_t )uiMipmapWidth * uiMipmapHeight * 4 );
+		if ( !Check( CVTFFile::Convert( File.GetData( 0, 0, 0, uiMipmapLevel ), Mipmap.data(), uiMipmapWidth, uiMipmapHeight, Case.Format, IMAGE_FORMAT_BGRA8888, File.GetCompressedSize( 0, 0, uiMipmapLevel ) ) &&
+			memcmp( Mipmap.data(), Thumbnail.GetData(), Mipmap.size() ) == 0, "%s: thumbnail differs from mip %u", sCase.c_str(), uiMipmapLevel ) )
+			return vlFalse;
+	}
+
+	const vlUInt64 uiDecodedSize = CVTFFile::ComputeImageSize( uiMipmapWidth, uiMipmapHeight, 1, IMAGE_FORMAT_BGRA8888 );
+	printf( "%s: mip %u %ux%u, %llu bytes read and %llu decoded in %.0f us; mip 0 %llu bytes read and %llu decoded in %.0f us\n",
+		sCase.c_str(), uiMipmapLevel, uiMipmapWidth, uiMipmapHeight, ( unsigned long long )uiSourceSize, ( unsigned long long )uiDecodedSize, dThumbnailUs,
+		( unsigned long long )File.GetDataSize( 0, 0, 0, 0 ), ( unsigned long long )Full.size(), dFullUs );
+	return Check( uiDecodedSize <= Full.size() && ( uiMipmapLevel == 0 || uiDecodedSize < Full.size() ), "%s: decodes more than mip 0", sCase.c_str() );
+}
+
+static vlBool TestMipSelection()
+{
+	vlBool bResult = vlTrue;
+	for ( const SMipSelectionCase &Case : MipSelectionCases )
+	{
+		for ( vlUInt uiSize : MipSelectionSizes )
+			bResult = TestMipSelectionCase( Case, uiSize ) && bResult;
+	}
+	return bResult;
+}
+
+#ifdef __linux__
+//
+// Files over 4 GB. Sparse files keep them cheap: only the header, the AXC table and the parts that are read hold
+// data, the rest are holes. Offsets past 4 GB must reach the right bytes through loading, reading an aux compressed
+// mip whole and an uncompressed one sampled, and the thumbnails; the aux compressed mip is too large to hold decoded
+// and scales in bands.
+//
+
+#define SPARSE_AXC_WIDTH 16384
+#define SPARSE_AXC_HEIGHT 2048
+#define SPARSE_AXC_HOLE_SIZE 0xc0000000u		//!< Claimed size of each of the two smallest mips, their streams are holes.
+#define SPARSE_SAMPLED_WIDTH 32768
+#define SPARSE_SAMPLED_HEIGHT 49152
+#define SPARSE_SAMPLED_ROWS 64					//!< Rows at the bottom that hold a pattern, the rest is a hole.
+#define SPARSE_THUMBNAIL_SIZE 256
+
+//! Removes the file when it goes out of scope.
+struct STempFile
+{
+	STempFile( const vlChar *cName ) : sPath( ( std::filesystem::temp_directory_path() / cName ).string() ), hFile( open( sPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600 ) ) {}
+	~STempFile()
+	{
+		if ( this->hFile >= 0 )
+			close( this->hFile );
+		unlink( this->sPath.c_str() );
+	}
+
+	vlBool Write( const vlVoid *lpData, size_t uiSize, vlUInt64 uiOffset ) const
+	{
+		return pwrite( this->hFile, lpData, uiSize, ( off_t )uiOffset ) == ( ssize_t )uiSize;
+	}
+
+	std::string sPath;
+	int hFile;
+};
+
+static vlByte SampledPattern( vlUInt x, vlUInt y, vlUInt uiChannel )
+{
+	return uiChannel == 3 ? 255 : ( vlByte )( ( x >> ( uiChannel * 4 ) ) + y * 7 + uiChannel );
+}
+
+//! The AXC file of a synthetic texture with the two smallest mips claiming 3 GB each, so every larger mip starts past 6 GB.
+static vlBool TestSparseAuxCompressed()
+{
+	SSyntheticVTF Desc;
+	Desc.Format = IMAGE_FORMAT_DXT1;
+	Desc.uiWidth = SPARSE_AXC_WIDTH;
+	Desc.uiHeight = SPARSE_AXC_HEIGHT;
+	Desc.bAuxCompressed = vlTrue;
+
+	std::vector<vlByte> Data;
+	if ( !Check( BuildSyntheticVTF( Desc, Data ), "sparse AXC: cannot build the file" ) )
+		return vlFalse;
+
+	IO::Readers::CMemoryReader MemoryReader( Data.data(), Data.size() );
+	CVTFFile Original;
+	if ( !Check( Original.Load( &MemoryReader, VTF_LOAD_BORROW_DATA ), "sparse AXC: cannot load the source file" ) )
+		return vlFalse;
+
+	// One frame and face, so the AXC entries and the streams are in mip order, smallest first.
+	SVTFHeader Header;
+	memset( &Header, 0, sizeof( Header ) );
+	memcpy( &Header, Data.data(), std::min<size_t>( reinterpret_cast<const SVTFFileHeader *>( Data.data() )->HeaderSize, sizeof( Header ) ) );
+	vlUInt uiEntries = 0, uiImage = 0;
+	for ( vlUInt i = 0; i < Header.ResourceCount; i++ )
+	{
+		if ( Header.Resources[i].Type == VTF_RSRC_AUX_COMPRESSION_INFO )
+			uiEntries = Header.Resources[i].Data + sizeof( vlUInt ) + sizeof( AuxCompressionInfoHeader_t );
+		else if ( Header.Resources[i].Type == VTF_LEGACY_RSRC_IMAGE )
+			uiImage = Header.Resources[i].Data;
+	}
+
+	const vlUInt uiMipCount = Original.GetMipmapCount();
+	std::vector<vlByte> Prefix( Data.begin(), Data.begin() + uiImage );
+	const vlUInt32 uiHoleSize = SPARSE_AXC_HOLE_SIZE;
+	for ( vlUInt i = 0; i < 2; i++ )
+		memcpy( Prefix.data() + uiEntries + i * sizeof( AuxCompressionInfoEntry_t ), &uiHoleSize, sizeof( uiHoleSize ) );
+
+	STempFile File( "vtftest_sparse_axc.vtf" );
+	vlUInt64 uiOffset = uiImage + 2ull * SPARSE_AXC_HOLE_SIZE;
+	vlBool bWritten = File.hFile >= 0 && File.Write( Prefix.data(), Prefix.size(), 0 );
+	for ( vlInt iMip = ( vlInt )uiMipCount - 3; iMip >= 0 && bWritten; iMip-- )
+	{
+		const vlUInt uiSize = Original.GetCompressedSize( 0, 0, iMip );
+		bWritten = File.Write( Original.GetData( 0, 0, 0, iMip ), uiSize, uiOffset );
+		uiOffset += uiSize;
+	}
+	if ( !Check( bWritten && ftruncate( File.hFile, ( off_t )uiOffset ) == 0, "sparse AXC: cannot write %s", File.sPath.c_str() ) )
+		return vlFalse;
+
+	IO::Readers::CFileReader Reader( File.sPath.c_str() );
+	CVTFFile Sparse;
+	if ( !Check( Sparse.Load( &Reader, VTF_LOAD_NO_IMAGE_DATA ), "sparse AXC: cannot load the %llu byte file", ( unsigned long long )uiOffset ) ||
+		!Check( Sparse.GetCompressedSize( 0, 0, uiMipCount - 1 ) == SPARSE_AXC_HOLE_SIZE && Sparse.GetCompressedSize( 0, 0, 0 ) == Original.GetCompressedSize( 0, 0, 0 ), "sparse AXC: wrong AXC sizes" ) )
+		return vlFalse;
+
+	// Mip 0 is the last stream in the file.
+	if ( !Check( Sparse.LoadImageData( &Reader, 0, 0, 0, 0 ) && memcmp( Sparse.GetData( 0, 0, 0, 0 ), Original.GetData( 0, 0, 0, 0 ), Original.GetCompressedSize( 0, 0, 0 ) ) == 0,
+		"sparse AXC: mip 0 past %llu bytes reads wrong", ( unsigned long long )( uiImage + 2ull * SPARSE_AXC_HOLE_SIZE ) ) )
+		return vlFalse;
+
+	// A size mip 0 has to serve, from a fresh header so the thumbnail reads the mip itself.
+	const vlUInt uiSize = SPARSE_AXC_WIDTH / 2 + 1;
+	vlUInt uiDestWidth, uiDestHeight;
+	ComputeResampleSize( SPARSE_AXC_WIDTH, SPARSE_AXC_HEIGHT, uiSize, uiDestWidth, uiDestHeight );
+	std::vector<vlByte> Decoded( ( size_t )CVTFFile::ComputeImageSize( SPARSE_AXC_WIDTH, SPARSE_AXC_HEIGHT, 1, IMAGE_FORMAT_BGRA8888 ) );
+	std::vector<vlByte> Expected( ( size_t )uiDestWidth * uiDestHeight * 4 );
+	SThumbnailOptions Options;
+	Options.bLowRes = vlFalse;
+	if ( !Check( CVTFFile::Convert( Original.GetData( 0, 0, 0, 0 ), Decoded.data(), SPARSE_AXC_WIDTH, SPARSE_AXC_HEIGHT, IMAGE_FORMAT_DXT1, IMAGE_FORMAT_BGRA8888, Original.GetCompressedSize( 0, 0, 0 ) ) &&
+		Resample( Decoded.data(), SPARSE_AXC_WIDTH, SPARSE_AXC_HEIGHT, Expected.data(), uiDestWidth, uiDestHeight, Options.Filter ), "sparse AXC: cannot decode mip 0" ) )
+		return vlFalse;
+
+	CVTFFile Thumbnailed;
+	CThumbnail Thumbnail;
+	uiLargestAlloc = 0;
+	const vlBool bCreated = Thumbnailed.Load( &Reader, VTF_LOAD_NO_IMAGE_DATA ) && Thumbnail.Create( Thumbnailed, &Reader, uiSize, Options );
+	const size_t uiLargest = uiLargestAlloc;
+	if ( !Check( bCreated, "sparse AXC: cannot create the thumbnail" ) ||
+		!Check( Thumbnail.GetWidth() == uiDestWidth && Thumbnail.GetHeight() == uiDestHeight && memcmp( Thumbnail.GetData(), Expected.data(), Expected.size() ) == 0,
+			"sparse AXC: %ux%u banded thumbnail differs from the %ux%u whole mip scaled", Thumbnail.GetWidth(), Thumbnail.GetHeight(), uiDestWidth, uiDestHeight ) ||
+		!Check( uiLargest < Decoded.size() && uiLargest <= THUMBNAIL_MAX_SOURCE_SIZE, "sparse AXC: the thumbnail allocated %llu bytes at once", ( unsigned long long )uiLargest ) )
+		return vlFalse;
+
+	printf( "sparse AXC: %llu byte file, mip 0 read and scaled in bands to %ux%u, largest allocation %llu bytes against %llu decoded\n",
+		( unsigned long long )uiOffset, uiDestWidth, uiDestHeight, ( unsigned long long )uiLargest, ( unsigned long long )Decoded.size() );
+	return vlTrue;
+}
+
+//! An uncompressed BGRA8888 file of 6 GB with a pattern in its bottom rows, all past 4 GB.
+static vlBool TestSparseSampled()
+{
+	SVTFHeader Header;
+	memset( &Header, 0, sizeof( Header ) );
+	memcpy( Header.TypeString, "VTF", 4 );
+	Header.Version[0] = 7;
+	Header.Version[1] = 5;
+	Header.Width = SPARSE_SAMPLED_WIDTH;
+	Header.Height = SPARSE_SAMPLED_HEIGHT;
+	Header.Frames = 1;
+	Header.BumpScale = 1.0f;
+	Header.ImageFormat = IMAGE_FORMAT_BGRA8888;
+	Header.MipCount = 1;
+	Header.LowResImageFormat = IMAGE_FORMAT_NONE;
+	Header.Depth = 1;
+	Header.ResourceCount = 1;
+	Header.HeaderSize = ( vlUInt )( reinterpret_cast<const vlByte *>( Header.Resources ) - reinterpret_cast<const vlByte *>( &Header ) ) + sizeof( SVTFResource );
+	Header.Resources[0].Type = VTF_LEGACY_RSRC_IMAGE;
+	Header.Resources[0].Data = Header.HeaderSize;
+
+	const vlUInt64 uiRowSize = ( vlUInt64 )SPARSE_SAMPLED_WIDTH * 4;
+	const vlUInt64 uiFileSize = Header.HeaderSize + uiRowSize * SPARSE_SAMPLED_HEIGHT;
+	const vlUInt uiFirstRow = SPARSE_SAMPLED_HEIGHT - SPARSE_SAMPLED_ROWS;
+
+	STempFile File( "vtftest_sparse_sampled.vtf" );
+	vlBool bWritten = File.hFile >= 0 && File.Write( &Header, Header.HeaderSize, 0 ) && ftruncate( File.hFile, ( off_t )uiFileSize ) == 0;
+	std::vector<vlByte> Row( ( size_t )uiRowSize );
+	for ( vlUInt y = uiFirstRow; y < SPARSE_SAMPLED_HEIGHT && bWritten; y++ )
+	{
+		for ( vlUInt x = 0; x < SPARSE_SAMPLED_WIDTH; x++ )
+		{
+			for ( vlUInt c = 0; c < 4; c++ )
+				Row[x * 4 + c] = SampledPattern( x, y, c );
+		}
+		bWritten = File.Write( Row.data(), Row.size(), Header.HeaderSize + y * uiRowSize );
+	}
+	if ( !Check( bWritten, "sparse sampled: cannot write %s", File.sPath.c_str() ) )
+		return vlFalse;
+
+	IO::Readers::CFileReader Reader( File.sPath.c_str() );
+	CVTFFile Sparse;
+	if ( !Check( Sparse.Load( &Reader, VTF_LOAD_NO_IMAGE_DATA ), "sparse sampled: cannot load the %llu byte file", ( unsigned long long )uiFileSize ) )
+		return vlFalse;
+
+	// Every eighth pixel of every eighth row, the mip is too large to read whole.
+	const vlUInt uiStep = 8;
+	vlUInt uiSampledWidth, uiSampledHeight;
+	const vlByte *lpData = 0;
+	if ( !Check( Sparse.LoadImageDataSampled( &Reader, 0, 0, 0, 0, uiStep, uiStep ) && ( lpData = Sparse.GetSampledData( uiSampledWidth, uiSampledHeight ) ) != 0 &&
+		uiSampledWidth == SPARSE_SAMPLED_WIDTH / uiStep && uiSampledHeight == SPARSE_SAMPLED_HEIGHT / uiStep, "sparse sampled: cannot read every %uth pixel", uiStep ) )
+		return vlFalse;
+
+	for ( vlUInt y = 0; y < uiSampledHeight; y++ )
+	{
+		const vlUInt uiSourceY = y * uiStep;
+		for ( vlUInt x = 0; x < uiSampledWidth; x += 97 )
+		{
+			for ( vlUInt c = 0; c < 4; c++ )
+			{
+				const vlByte uiExpected = uiSourceY >= uiFirstRow ? SampledPattern( x * uiStep, uiSourceY, c ) : 0;
+				if ( !Check( lpData[( ( size_t )y * uiSampledWidth + x ) * 4 + c] == uiExpected, "sparse sampled: sample %u, %u reads wrong", x, y ) )
+					return vlFalse;
+			}
+		}
+	}
+
+	// The thumbnail samples the image as well: its bottom row shows the pattern, the top is the transparent hole.
+	vlUInt uiDestWidth, uiDestHeight;
+	ComputeResampleSize( SPARSE_SAMPLED_WIDTH, SPARSE_SAMPLED_HEIGHT, SPARSE_THUMBNAIL_SIZE, uiDestWidth, uiDestHeight );
+	CVTFFile Thumbnailed;
+	CThumbnail Thumbnail;
+	SThumbnailOptions Options;
+	if ( !Check( Thumbnailed.Load( &Reader, VTF_LOAD_NO_IMAGE_DATA ) && Thumbnail.Create( Thumbnailed, &Reader, SPARSE_THUMBNAIL_SIZE, Options ), "sparse sampled: cannot create the thumbnail" ) ||
+		!Check( Thumbnail.GetWidth() == uiDestWidth && Thumbnail.GetHeight() == uiDestHeight, "sparse sampled: thumbnail is %ux%u", Thumbnail.GetWidth(), Thumbnail.GetHeight() ) )
+		return vlFalse;
+
+	const vlByte *lpTop = Thumbnail.GetData();
+	const vlByte *lpBottom = Thumbnail.GetData() + ( size_t )( Thumbnail.GetHeight() - 1 ) * Thumbnail.GetWidth() * 4;
+	for ( vlUInt x = 0; x < Thumbnail.GetWidth(); x++ )
+	{
+		if ( !Check( lpTop[x * 4 + 3] == 0 && lpBottom[x * 4 + 3] != 0, "sparse sampled: thumbnail column %u does not show the bottom rows", x ) )
+			return vlFalse;
+	}
+
+	printf( "sparse sampled: %llu byte file, every %uth pixel read, thumbnail %ux%u\n", ( unsigned long long )uiFileSize, uiStep, Thumbnail.GetWidth(), Thumbnail.GetHeight() );
+	return vlTrue;
+}
+
+static vlBool TestSparse4GB()
+{
+	const vlBool bAuxCompressed = TestSparseAuxCompressed();
+	return TestSparseSampled() && bAuxCompressed;
+}
+#endif
+
+//
+// Batch output. vtfthumb spreads files over its threads, and the decode of a lone file over them, yet every
+// thumbnail must come out byte for byte the same at any thread count. The tests write a small tree of synthetic
+// files and run the vtfthumb built next to vtftest on it.
+//
+
+#define BATCH_THUMBNAIL_SIZE 64
+#define BATCH_SINGLE_SIZE 512	//!< Thumbnail size of the lone file run, large enough for the decode to split into bands.
+
+struct SBatchFile
+{
+	const vlChar *cName;
+	VTFImageFormat Format;
+	vlUInt uiWidth;
+	vlUInt uiHeight;
+	vlBool bAuxCompressed;
+};
+
+static const SBatchFile BatchFiles[] =
+{
+	{ "dxt1.vtf", IMAGE_FORMAT_DXT1, 256, 256, vlFalse },
+	{ "dxt5_axc.vtf", IMAGE_FORMAT_DXT5, 512, 512, vlTrue },
+	{ "materials/bc7.vtf", IMAGE_FORMAT_BC7, 200, 300, vlFalse },
+	{ "materials/ati2n_axc.vtf", IMAGE_FORMAT_ATI2N, 256, 128, vlTrue },
+	{ "materials/hdr/bc6h.vtf", IMAGE_FORMAT_BC6H, 128, 128, vlFalse },
+	{ "materials/hdr/rgba16161616f_axc.vtf", IMAGE_FORMAT_RGBA16161616F, 96, 48, vlTrue },
+	{ "models/bgra8888.vtf", IMAGE_FORMAT_BGRA8888, 301, 199, vlFalse },
+	{ "models/rgb888_axc.vtf", IMAGE_FORMAT_RGB888, 1000, 37, vlTrue },
+	{ "models/rgb565.vtf", IMAGE_FORMAT_RGB565, 16, 16, vlFalse },
+};
+
+//! Removes the directory tree when it goes out of scope.
+struct STempDirectory
+{
+	STempDirectory( const vlChar *cName ) : Path( std::filesystem::temp_directory_path() / cName )
+	{
+		std::error_code Error;
+		std::filesystem::remove_all( this->Path, Error );
+	}
+	~STempDirectory()
+	{
+		std::error_code Error;
+		std::filesystem::remove_all( this->Path, Error );
+	}
+
+	std::filesystem::path Path;
+};
+
+static vlBool ReadWholeFile( const std::filesystem::path &Path, std::vector<vlByte> &Data )
+{
+	FILE *hFile = fopen( Path.string().c_str(), "rb" );
+	if ( hFile == 0 )
+		return vlFalse;
+
+	Data.clear();
+	vlByte Buffer[65536];
+	size_t uiRead;
+	while ( ( uiRead = fread( Buffer, 1, sizeof( Buffer ), hFile ) ) != 0 )
+		Data.insert( Data.end(), Buffer, Buffer + uiRead );
+
+	const vlBool bResult = !ferror( hFile );
+	fclose( hFile );
+	return bResult;
+}
+
+static vlBool WriteBatchFiles( const std::filesystem::path &Directory )
+{
+	vlUInt uiSeed = 1;
+	for ( const SBatchFile &File : BatchFiles )
+	{
+		SSyntheticVTF Desc;
+		Desc.Format = File.Format;
+		Desc.uiWidth = File.uiWidth;
+		Desc.uiHeight = File.uiHeight;
+		Desc.bAuxCompressed = File.bAuxCompressed;
+		Desc.uiSeed = uiSeed++;
+
+		std::vector<vlByte> Data;
+		const std::filesystem::path Path = Directory / File.cName;
+		std::error_code Error;
+		std::filesystem::create_directories( Path.parent_path(), Error );
+		FILE *hFile = Error ? 0 : fopen( Path.string().c_str(), "wb" );
+		const vlBool bWritten = hFile != 0 && BuildSyntheticVTF( Desc, Data ) && fwrite( Data.data(), 1, Data.size(), hFile ) == Data.size();
+		if ( hFile != 0 && fclose( hFile ) != 0 )
+			return Check( vlFalse, "batch: cannot write %s", Path.string().c_str() );
+		if ( !Check( bWritten, "batch: cannot write %s", Path.string().c_str() ) )
+			return vlFalse;
+	}
+	return vlTrue;
+}
+
+//! Runs vtfthumb on Input with the given options, writing to Output.
+static vlBool RunVTFThumb( const std::string &sOptions, const std::filesystem::path &Input, const std::filesystem::path &Output )
+{
+	const std::string sCommand = std::string( "\"" VTFTHUMB_PATH "\" " ) + sOptions + " \"" + Input.string() + "\" \"" + Output.string() + "\"";
+	fflush( stdout );
+	return Check( std::system( sCommand.c_str() ) == 0, "batch: %s failed", sCommand.c_str() );
+}
+
+//! Both trees must hold the same files with the same bytes, at least uiMinFiles of them.
+static vlBool CompareOutputs( const vlChar *cName, const std::filesystem::path &Expected, const std::filesystem::path &Actual, vlUInt uiMinFiles )
+{
+	std::error_code Error;
+	vlUInt uiFiles = 0, uiActualFiles = 0;
+	for ( std::filesystem::recursive_directory_iterator It( Expected, Error ); !Error && It != std::filesystem::recursive_directory_iterator(); It.increment( Error ) )
+	{
+		if ( !It->is_regular_file() )
+			continue;
+
+		const std::filesystem::path RelativePath = It->path().lexically_relative( Expected );
+		std::vector<vlByte> ExpectedData, ActualData;
+		if ( !Check( ReadWholeFile( It->path(), ExpectedData ), "%s: cannot read %s", cName, It->path().string().c_str() ) ||
+			!Check( ReadWholeFile( Actual / RelativePath, ActualData ), "%s: %s is missing", cName, RelativePath.string().c_str() ) ||
+			!Check( ActualData == ExpectedData, "%s: %s differs", cName, RelativePath.string().c_str() ) )
+			return vlFalse;
+		uiFiles++;
+	}
+
+	for ( std::filesystem::recursive_directory_iterator It( Actual, Error ); !Error && It != std::filesystem::recursive_directory_iterator(); It.increment( Error ) )
+		uiActualFiles += It->is_regular_file() ? 1 : 0;
+
+	if ( !Check( !Error, "%s: cannot list the outputs", cName ) ||
+		!Check( uiFiles >= uiMinFiles && uiActualFiles == uiFiles, "%s: %u thumbnails against %u, expected %u", cName, uiActualFiles, uiFiles, uiMinFiles ) )
+		return vlFalse;
+
+	printf( "%s: %u thumbnails identical\n", cName, uiFiles );
+	return vlTrue;
+}
+
+//! Every file at one thread against four, then the lone 512x512 file, its decode split into bands over four threads.
+static vlBool TestBatchThreads()
+{
+	STempDirectory Directory( "vtftest_batch_threads" );
+	const std::filesystem::path Input = Directory.Path / "input";
+	const std::filesystem::path Single = Input / "dxt5_axc.vtf";
+	const vlUInt uiCount = ( vlUInt )( sizeof( BatchFiles ) / sizeof( BatchFiles[0] ) );
+	const std::string sBatch = "-s " + std::to_string( BATCH_THUMBNAIL_SIZE );
+	const std::string sSingle = "-s " + std::to_string( BATCH_SINGLE_SIZE );
+	return WriteBatchFiles( Input ) &&
+		RunVTFThumb( sBatch + " -j 1", Input, Directory.Path / "j1" ) &&
+		RunVTFThumb( sBatch + " -j 4", Input, Directory.Path / "j4" ) &&
+		CompareOutputs( "batch -j 1 against -j 4", Directory.Path / "j1", Directory.Path / "j4", uiCount ) &&
+		RunVTFThumb( sSingle + " -j 1", Single, Directory.Path / "single_j1" ) &&
+		RunVTFThumb( sSingle + " -j 4", Single, Directory.Path / "single_j4" ) &&
+		CompareOutputs( "single file -j 1 against -j 4", Directory.Path / "single_j1", Directory.Path / "single_j4", 1 );
+}
+
+//! The pipeline, with several threads in every stage and queues small enough to block, against batch mode.
+static vlBool TestPipelineOutput()
+{
+	STempDirectory Directory( "vtftest_pipeline_output" );
+	const std::filesystem::path Input = Directory.Path / "input";
+	const vlUInt uiCount = ( vlUInt )( sizeof( BatchFiles ) / sizeof( BatchFiles[0] ) );
+	const std::string sSize = "-s " + std::to_string( BATCH_THUMBNAIL_SIZE );
+	return WriteBatchFiles( Input ) &&
+		RunVTFThumb( sSize + " -j 1", Input, Directory.Path / "batch" ) &&
+		RunVTFThumb( sSize + " -pipeline -j 3 -read-threads 2 -write-threads 2 -queue 2 -queue-mb 1", Input, Directory.Path / "pipeline" ) &&
+		CompareOutputs( "pipeline against batch", Directory.Path / "batch", Directory.Path / "pipeline", uiCount );
+}
+
+//
+// Test table.
+//
+
+struct STest
+{
+	const vlChar *cName;
+	vlBool ( *pfnRun )();
+};
+
+static const STest Tests[] =
+{
+	{ "mip_selection", TestMipSelection },
+	{ "batch_threads", TestBatchThreads },
+	{ "pipeline_output", TestPipelineOutput },
+#ifdef __linux__
+	{ "sparse_4gb", TestSparse4GB },
+#endif
+};
+
+int main( int argc, char **argv )
+{
+	vlUInt uiRun = 0, uiFailed = 0;
+	for ( const STest &Test : Tests )
+	{
+		if ( argc > 1 && std::none_of( argv + 1, argv + argc, [&]( const vlChar *cName ) { return strcmp( cName, Test.cName ) == 0; } ) )
+			continue;
+
+		uiRun++;
+		if ( !Test.pfnRun() )
+		{
+			fprintf( stderr, "vtftest: %s failed\n", Test.cName );
+			uiFailed++;
+		}
+	}
+
+	if ( uiRun == 0 )
+	{
+		fprintf( stderr, "usage: vtftest [test...]\n" );
+		return 2;
+	}
+
+	return uiFailed != 0 ? 1 : 0;
+}
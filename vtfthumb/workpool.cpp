@@ -0,0 +1,123 @@
+﻿#include "workpool.h"
+#include <algorithm>
+#include <thread>
+
+CWorkStealingPool::CWorkStealingPool( vlUInt uiThreads )
+{
+	if ( uiThreads == 0 )
+		uiThreads = std::thread::hardware_concurrency();
+
+	this->uiThreadCount = uiThreads != 0 ? uiThreads : 1;
+	this->pWeights = 0;
+	this->uiSteals = 0;
+
+	for ( vlUInt i = 0; i < this->uiThreadCount; i++ )
+		this->Queues.emplace_back( new SQueue() );
+}
+
+vlUInt CWorkStealingPool::GetThreadCount() const
+{
+	return this->uiThreadCount;
+}
+
+vlUInt CWorkStealingPool::GetStealCount() const
+{
+	return this->uiSteals;
+}
+
+vlVoid CWorkStealingPool::Run( const std::vector<std::uint64_t> &Weights, const std::function<vlVoid( vlUInt, vlUInt )> &Job )
+{
+	const vlUInt uiCount = ( vlUInt )Weights.size();
+	this->pWeights = &Weights;
+	this->uiSteals = 0;
+
+	std::vector<vlUInt> Order( uiCount );
+	for ( vlUInt i = 0; i < uiCount; i++ )
+		Order[i] = i;
+	std::stable_sort( Order.begin(), Order.end(), [&]( vlUInt a, vlUInt b ) { return Weights[a] > Weights[b]; } );
+
+	// Largest first to the lightest queue, which also keeps every queue sorted largest first.
+	for ( auto &Queue : this->Queues )
+	{
+		Queue->Tasks.clear();
+		Queue->uiWeight = 0;
+	}
+	for ( vlUInt uiTask : Order )
+	{
+		SQueue *pLightest = this->Queues[0].get();
+		for ( auto &Queue : this->Queues )
+		{
+			if ( Queue->uiWeight < pLightest->uiWeight )
+				pLightest = Queue.get();
+		}
+		pLightest->Tasks.push_back( uiTask );
+		// Empty files still cost a read, count them as one byte so they spread out too.
+		pLightest->uiWeight += std::max<std::uint64_t>( Weights[uiTask], 1 );
+	}
+
+	const vlUInt uiThreads = std::min<vlUInt>( this->uiThreadCount, std::max<vlUInt>( uiCount, 1 ) );
+	std::vector<std::thread> Threads;
+	Threads.reserve( uiThreads - 1 );
+	for ( vlUInt i = 1; i < uiThreads; i++ )
+		Threads.emplace_back( &CWorkStealingPool::WorkerMain, this, i, std::cref( Job ) );
+
+	this->WorkerMain( 0, Job );
+
+	for ( auto &Thread : Threads )
+		Thread.join();
+
+	this->pWeights = 0;
+}
+
+vlBool CWorkStealingPool::Pop( vlUInt uiWorker, vlUInt &uiTask )
+{
+	SQueue &Queue = *this->Queues[uiWorker];
+	std::lock_guard<std::mutex> Lock( Queue.Mutex );
+	if ( Queue.Tasks.empty() )
+		return vlFalse;
+
+	uiTask = Queue.Tasks.front();
+	Queue.Tasks.pop_front();
+	Queue.uiWeight -= std::max<std::uint64_t>( ( *this->pWeights )[uiTask], 1 );
+	return vlTrue;
+}
+
+vlBool CWorkStealingPool::Steal( vlUInt uiWorker, vlUInt &uiTask )
+{
+	// The weights are only a hint, a victim that ran dry in the meantime just means trying again.
+	for ( ;; )
+	{
+		SQueue *pVictim = 0;
+		std::uint64_t uiVictimWeight = 0;
+		for ( vlUInt i = 0; i < this->uiThreadCount; i++ )
+		{
+			const std::uint64_t uiWeight = this->Queues[i]->uiWeight;
+			if ( i != uiWorker && uiWeight > uiVictimWeight )
+			{
+				pVictim = this->Queues[i].get();
+				uiVictimWeight = uiWeight;
+			}
+		}
+
+		if ( pVictim == 0 )
+			return vlFalse;
+
+		std::lock_guard<std::mutex> Lock( pVictim->Mutex );
+		if ( pVictim->Tasks.empty() )
+			continue;
+
+		uiTask = pVictim->Tasks.back();
+		pVictim->Tasks.pop_back();
+		pVictim->uiWeight -= std::max<std::uint64_t>( ( *this->pWeights )[uiTask], 1 );
+		this->uiSteals++;
+		return vlTrue;
+	}
+}
+
+vlVoid CWorkStealingPool::WorkerMain( vlUInt uiWorker, const std::function<vlVoid( vlUInt, vlUInt )> &Job )
+{
+	// Nothing is ever queued once Run has dealt the tasks, so a worker that finds every queue empty is done.
+	vlUInt uiTask;
+	while ( this->Pop( uiWorker, uiTask ) || this->Steal( uiWorker, uiTask ) )
+		Job( uiTask, uiWorker );
+}
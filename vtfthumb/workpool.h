@@ -0,0 +1,52 @@
+﻿#pragma once
+
+#include "vtffile.h"
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+//
+// Work stealing pool for batches of independent tasks of very different cost, such as one file each.
+// Tasks are dealt to per worker queues by weight, largest first, so every queue starts with about the
+// same amount of work. Workers take their own largest task first and, once their queue runs dry, steal
+// the smallest task of the queue with the most weight left, so a giant task only ever delays its own worker.
+//
+class CWorkStealingPool
+{
+public:
+	//! uiThreads of 0 uses one thread per hardware thread. The calling thread counts as one of them.
+	CWorkStealingPool( vlUInt uiThreads = 0 );
+
+	CWorkStealingPool( const CWorkStealingPool & ) = delete;
+	CWorkStealingPool &operator=( const CWorkStealingPool & ) = delete;
+
+	vlUInt GetThreadCount() const;
+
+	//! Calls Job( uiTask, uiWorker ) for every task and returns once all of them are done. uiWorker is below GetThreadCount().
+	vlVoid Run( const std::vector<std::uint64_t> &Weights, const std::function<vlVoid( vlUInt, vlUInt )> &Job );
+
+	//! Tasks taken from another worker's queue by the last Run.
+	vlUInt GetStealCount() const;
+
+private:
+	struct SQueue
+	{
+		std::mutex Mutex;
+		std::deque<vlUInt> Tasks;					//!< Largest at the front.
+		std::atomic<std::uint64_t> uiWeight;		//!< Weight of the tasks still queued.
+	};
+
+	vlBool Pop( vlUInt uiWorker, vlUInt &uiTask );
+	vlBool Steal( vlUInt uiWorker, vlUInt &uiTask );
+	vlVoid WorkerMain( vlUInt uiWorker, const std::function<vlVoid( vlUInt, vlUInt )> &Job );
+
+private:
+	vlUInt uiThreadCount;
+	std::vector<std::unique_ptr<SQueue>> Queues;
+	const std::vector<std::uint64_t> *pWeights;
+	std::atomic<vlUInt> uiSteals;
+};